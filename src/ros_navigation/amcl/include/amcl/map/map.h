@@ -28,6 +28,7 @@
 #ifndef MAP_H
 #define MAP_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -42,22 +43,17 @@ struct _rtk_fig_t;
 #define MAP_WIFI_MAX_LEVELS 8
 
   
-// Description for a single map cell.
-typedef struct
-{
-  // Occupancy state (-1 = free, 0 = unknown, +1 = occ)
-  int occ_state;
-
-  // Distance to the nearest occupied cell
-  double occ_dist;
+// Largest quantized obstacle distance; stands for max_occ_dist (or further)
+#define MAP_DIST_MAX 255
 
-  // Wifi levels
-  //int wifi_levels[MAP_WIFI_MAX_LEVELS];
+// Number of entries past the last cell in the distance plane.  They all
+// hold MAP_DIST_MAX, so size_x * size_y can be used as an "off the map"
+// index, and 32-bit loads starting at any cell stay within the plane.
+#define MAP_DIST_PAD 4
 
-} map_cell_t;
 
-
-// Description for a map
+// Description for a map.  The cells are stored as separate planes, one
+// byte per cell each, indexed with MAP_INDEX.
 typedef struct
 {
   // Map origin; the map is a viewport onto a conceptual larger map.
@@ -69,12 +65,25 @@ typedef struct
   // Map dimensions (number of cells)
   int size_x, size_y;
   
-  // The map data, stored as a grid
-  map_cell_t *cells;
+  // Occupancy state (-1 = free, 0 = unknown, +1 = occ)
+  int8_t *occ_state;
+
+  // Distance to the nearest occupied cell, in units of occ_dist_step and
+  // clamped to MAP_DIST_MAX.  NULL until map_update_cspace() is called.
+  uint8_t *occ_dist;
+  double occ_dist_step;
+
+  // Set when occ_dist points into a memory-mapped cache file rather than
+  // to heap memory (see map_update_cspace_cached)
+  void *occ_dist_mapping;
+  size_t occ_dist_mapping_size;
 
   // Max distance at which we care about obstacles, for constructing
   // likelihood field
   double max_occ_dist;
+
+  // Transform that built occ_dist (a map_cspace_method_t)
+  int occ_dist_method;
   
 } map_t;
 
@@ -90,18 +99,77 @@ map_t *map_alloc(void);
 // Destroy a map
 void map_free(map_t *map);
 
-// Get the cell at the given point
-map_cell_t *map_get_cell(map_t *map, double ox, double oy, double oa);
+// Allocate the occupancy plane for a map of the given size; all cells
+// start out unknown.  Any previous planes are released.  Returns 0 on
+// success.
+int map_alloc_cells(map_t *map, int size_x, int size_y);
+
+// Allocate the distance plane for the given max_occ_dist, with every cell
+// (and the padding) set to MAP_DIST_MAX.  Returns 0 on success.
+int map_alloc_occ_dist(map_t *map, double max_occ_dist);
+
+// Release the distance plane, wherever it came from
+void map_free_occ_dist(map_t *map);
+
+// Make the distance plane writable: a plane mapped from the cache is
+// copied to the heap (the file is left alone).  Returns 0 on success.
+int map_detach_occ_dist(map_t *map);
+
+// Get the index of the cell at the given point, or -1 if it is off the map
+int map_get_cell_index(map_t *map, double ox, double oy, double oa);
 
 // Load an occupancy map
 int map_load_occ(map_t *map, const char *filename, double scale, int negate);
 
+// Load a binary PGM the way map_server reads it: a pixel is occupied if
+// its darkness (its brightness with negate) is above occupied_thresh,
+// free if below free_thresh, and unknown otherwise.  The map is
+// (re)allocated to the image size; the origin is left to the caller.
+// Returns 0 on success.
+int map_load_pgm(map_t *map, const char *filename, double scale, int negate,
+                 double occupied_thresh, double free_thresh);
+
 // Load a wifi signal strength map
 //int map_load_wifi(map_t *map, const char *filename, int index);
 
 // Update the cspace distances
 void map_update_cspace(map_t *map, double max_occ_dist);
 
+// Update the cspace distances with an exact Euclidean distance transform
+// (Felzenszwalb & Huttenlocher), split across thread_count threads; 0
+// uses one thread per core.  Produces the true distance to the nearest
+// occupied cell, truncated at max_occ_dist like map_update_cspace().
+void map_update_cspace_edt(map_t *map, double max_occ_dist, int thread_count);
+
+// Distance transforms available for the likelihood field
+typedef enum
+{
+  MAP_CSPACE_BRUSHFIRE,
+  MAP_CSPACE_EDT
+} map_cspace_method_t;
+
+// Update the cspace distances after the occupancy of the cells in columns
+// [x0, x1) of rows [y0, y1) changed, keeping max_occ_dist.  method must be
+// the transform that built the plane, so the result is the same as
+// rebuilding it.  With the exact transform only the cells within
+// max_occ_dist of the window are recomputed; the brushfire's distances
+// depend on the order it visits the whole map in, so with it the whole
+// plane is rebuilt.  A plane mapped from the cache is copied first.
+// Returns 0 on success, -1 if there is no distance plane.
+int map_update_cspace_window(map_t *map, int x0, int y0, int x1, int y1,
+                             map_cspace_method_t method, int thread_count);
+
+// Update the cspace distances through an on-disk cache in cache_dir.  The
+// cache file is keyed by a hash of the occupancy plane, the map geometry,
+// max_occ_dist and the method.  A valid file is mapped read-only, so
+// processes using the same map share its pages; a missing, stale or
+// corrupt one is (re)built with the given method and thread_count and
+// written atomically.  Returns 1 on a cache hit, 0 if the distances were
+// computed (whether or not they could be stored).
+int map_update_cspace_cached(map_t *map, double max_occ_dist,
+                             map_cspace_method_t method, int thread_count,
+                             const char *cache_dir);
+
 
 /**************************************************************************
  * Range functions
@@ -110,6 +178,75 @@ void map_update_cspace(map_t *map, double max_occ_dist);
 // Extract a single range reading from the map
 double map_calc_range(map_t *map, double ox, double oy, double oa, double max_range);
 
+// Precomputed map_calc_range() results, from the centre of every free
+// cell along a fixed set of bearings.  The table is a single block of
+// memory: a bitmap of the free cells, the number of free cells before
+// each 64-bit word of the bitmap, and then angle_count ranges for each
+// free cell, in cell order.
+typedef struct
+{
+  // Map size the table was built for
+  int size_x, size_y;
+
+  // Bearing k is k * 2 pi / angle_count
+  int angle_count;
+
+  // Ranges are stored in 1 or 2 bytes (bytes_per_range), in units of
+  // range_step.  The largest code stands for "no hit" (max_range); the
+  // others reach a little past max_range, as ray tracing can.
+  double max_range, range_step;
+  int bytes_per_range;
+
+  // Number of free cells
+  int free_count;
+
+  // Layout of the block
+  size_t rank_offset, range_offset, size;
+  void *memory;
+
+  // Set when memory points into a memory-mapped cache file rather than
+  // to heap memory (see map_range_table_build_cached)
+  void *mapping;
+  size_t mapping_size;
+
+} map_range_table_t;
+
+// Describe the table for the given map and settings, without building it
+// (memory is left NULL).  bytes_per_range is 1 or 2.  Returns 0 on
+// success.
+int map_range_table_init(map_range_table_t *table, map_t *map, double max_range,
+                         int angle_count, int bytes_per_range);
+
+// Build a range table, split across thread_count threads; 0 uses one
+// thread per core.  Returns NULL on failure.
+map_range_table_t *map_range_table_build(map_t *map, double max_range, int angle_count,
+                                         int bytes_per_range, int thread_count);
+
+// As map_range_table_build(), through an on-disk cache in cache_dir (see
+// map_update_cspace_cached).  *hit is set to 1 if the table came from the
+// cache.
+map_range_table_t *map_range_table_build_cached(map_t *map, double max_range,
+                                                int angle_count, int bytes_per_range,
+                                                int thread_count, const char *cache_dir,
+                                                int *hit);
+
+// A new table for a map whose occupancy changed only in the window
+// [x0, x1) x [y0, y1): rays that cannot reach the window are copied from
+// table, the others are traced again, so the result matches a rebuild at
+// the cost of the rays near the window.  table is left as it was.
+// Returns NULL on failure, or if the map's size changed.
+map_range_table_t *map_range_table_update_window(const map_range_table_t *table,
+                                                 map_t *map, int x0, int y0,
+                                                 int x1, int y1, int thread_count);
+
+// Destroy a range table
+void map_range_table_free(map_range_table_t *table);
+
+// Range reading from the table, for the nearest cell and bearing.  Cells
+// that are off the map or not free read 0, as in map_calc_range().
+double map_range_table_lookup(const map_range_table_t *table, map_t *map,
+                              double ox, double oy, double oa);
+
 
 /**************************************************************************
  * GUI/diagnostic functions
@@ -143,6 +280,16 @@ void map_draw_wifi(map_t *map, struct _rtk_fig_t *fig, int index);
 // Compute the cell index for the given map coords.
 #define MAP_INDEX(map, i, j) ((i) + (j) * map->size_x)
 
+// Occupancy state of the cell with the given index
+#define MAP_OCC_STATE(map, index) ((map)->occ_state[index])
+
+// Distance (m) from the cell with the given index to the nearest obstacle
+#define MAP_OCC_DIST(map, index) ((map)->occ_dist[index] * (map)->occ_dist_step)
+
+// Quantize a distance (m) for storage in the distance plane
+#define MAP_DIST_CODE(map, d) ((d) >= (map)->max_occ_dist ? MAP_DIST_MAX : \
+                               (uint8_t) floor((d) / (map)->occ_dist_step + 0.5))
+
 #ifdef __cplusplus
 }
 #endif
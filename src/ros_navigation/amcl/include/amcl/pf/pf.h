@@ -30,6 +30,7 @@
 
 #include "pf_vector.h"
 #include "pf_kdtree.h"
+#include "pf_random.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -55,6 +56,22 @@ typedef double (*pf_sensor_model_fn_t) (void *sensor_data,
                                         struct _pf_sample_set_t* set);
 
 
+// Schemes for picking the parents of a resampled set
+typedef enum
+{
+  // Independent draws from the weights (binary search over the CDF)
+  PF_RESAMPLE_MULTINOMIAL,
+
+  // Low-variance comb with max_samples teeth, consumed in random order so
+  // that the KLD limit can stop it anywhere
+  PF_RESAMPLE_SYSTEMATIC,
+
+  // Independent draws using Walker's alias method
+  PF_RESAMPLE_ALIAS
+
+} pf_resample_model_t;
+
+
 // Information for a single sample
 typedef struct
 {
@@ -133,6 +150,28 @@ typedef struct _pf_t
 
   double dist_threshold; //distance threshold in each axis over which the pf is considered to not be converged
   int converged; 
+
+  // Resampling scheme, and its workspace (sized for max_samples)
+  pf_resample_model_t resample_model;
+  double *resample_cdf;
+  double *resample_prob;
+  int *resample_index;
+  int *resample_work;
+
+  // Random number generator for everything the filter draws itself
+  pf_random_t rng;
+
+  // Time allowed for a sensor update and a resample together (seconds),
+  // or 0 for no limit, and running averages of what they cost per sample
+  double time_budget;
+  double sensor_cost, resample_cost;
+
+  // Outcome of the last resample: the sample count the budget allowed,
+  // and whether it stopped the set short of the KLD limit (which was
+  // then kld_samples)
+  int budget_samples;
+  int budget_limited;
+  int kld_samples;
 } pf_t;
 
 
@@ -141,6 +180,13 @@ pf_t *pf_alloc(int min_samples, int max_samples,
                double alpha_slow, double alpha_fast,
                pf_init_model_fn_t random_pose_fn, void *random_pose_data);
 
+// Create a new filter whose histograms use the given storage scheme
+// (pf_alloc() uses PF_KDTREE_TREE)
+pf_t *pf_alloc_histogram(int min_samples, int max_samples,
+                         double alpha_slow, double alpha_fast,
+                         pf_init_model_fn_t random_pose_fn, void *random_pose_data,
+                         pf_kdtree_type_t histogram_type);
+
 // Free an existing filter
 void pf_free(pf_t *pf);
 
@@ -156,9 +202,31 @@ void pf_update_action(pf_t *pf, pf_action_model_fn_t action_fn, void *action_dat
 // Update the filter with some new sensor observation
 void pf_update_sensor(pf_t *pf, pf_sensor_model_fn_t sensor_fn, void *sensor_data);
 
+// Update the filter with count observations at once.  sensor_fn applies
+// them one after the other without normalizing in between, and fills in
+// totals[k], the sum of the weights after the first k + 1 of them.  The
+// weights are normalized once, but the recovery averages move once per
+// observation, as count calls to pf_update_sensor() would move them.
+void pf_update_sensor_fused(pf_t *pf, pf_sensor_model_fn_t sensor_fn, void *sensor_data,
+                            const double *totals, int count);
+
 // Resample the distribution
 void pf_update_resample(pf_t *pf);
 
+// Select the resampling scheme (PF_RESAMPLE_MULTINOMIAL by default)
+void pf_set_resample_model(pf_t *pf, pf_resample_model_t model);
+
+// Limit the set so that a sensor update plus a resample take about
+// budget seconds, going by what they cost per sample so far; 0 (the
+// default) leaves the KLD limit alone.  When the budget binds, the set
+// stops short of the KLD limit and budget_limited is set.  Sets made by
+// pf_init() and pf_init_model() are not limited.
+void pf_set_time_budget(pf_t *pf, double budget);
+
+// Seed the filter's random number generator (pf_alloc() seeds it from
+// the clock).  The same seed and inputs give the same run.
+void pf_set_seed(pf_t *pf, uint64_t seed);
+
 // Compute the CEP statistics (mean and variance).
 void pf_get_cep_stats(pf_t *pf, pf_vector_t *mean, double *var);
 
@@ -32,6 +32,24 @@
 #include "rtk.h"
 #endif
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Storage schemes for the histogram.  Both use the same bins and give the
+// same clusters.
+typedef enum
+{
+  // Unbalanced kd tree over the bin keys
+  PF_KDTREE_TREE,
+
+  // Open-addressing hash table over the bin keys; clusters are found by
+  // union-find over neighbouring bins
+  PF_KDTREE_HASH
+
+} pf_kdtree_type_t;
+
 
 // Info for a node in the tree
 typedef struct pf_kdtree_node
@@ -61,6 +79,9 @@ typedef struct pf_kdtree_node
 // A kd tree
 typedef struct
 {
+  // Storage scheme
+  pf_kdtree_type_t type;
+
   // Cell size
   double size[3];
 
@@ -74,12 +95,24 @@ typedef struct
   // The number of leaf nodes in the tree
   int leaf_count;
 
+  // Hash table (PF_KDTREE_HASH only).  Slots hold indices into nodes, or
+  // -1; every node is a leaf.
+  int hash_mask;
+  int *hash_slots;
+
+  // Union-find forest over the nodes, used while clustering
+  int *cluster_parent;
+
 } pf_kdtree_t;
 
 
 // Create a tree
 extern pf_kdtree_t *pf_kdtree_alloc(int max_size);
 
+// Create a histogram with the given storage scheme.  For PF_KDTREE_HASH,
+// max_size is the number of bins, not of nodes.
+extern pf_kdtree_t *pf_kdtree_alloc_type(int max_size, pf_kdtree_type_t type);
+
 // Destroy a tree
 extern void pf_kdtree_free(pf_kdtree_t *self);
 
@@ -106,4 +139,8 @@ extern void pf_kdtree_draw(pf_kdtree_t *self, rtk_fig_t *fig);
 
 #endif
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
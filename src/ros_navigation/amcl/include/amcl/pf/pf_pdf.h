@@ -29,6 +29,7 @@
 #define PF_PDF_H
 
 #include "pf_vector.h"
+#include "pf_random.h"
 
 //#include <gsl/gsl_rng.h>
 //#include <gsl/gsl_randist.h>
@@ -54,8 +55,9 @@ typedef struct
   pf_matrix_t cr;
   pf_vector_t cd;
 
-  // A random number generator
-  //gsl_rng *rng;
+  // A random number generator; samples come from pf_ran_gaussian() if
+  // this is NULL
+  pf_random_t *rng;
 
 } pf_pdf_gaussian_t;
 
@@ -0,0 +1,68 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey   &  Kasper Stoy
+ *                      gerkey@usc.edu    kaspers@robotics.usc.edu
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+/**************************************************************************
+ * Desc: Seedable random number generator for the filter
+ *
+ * xoshiro256** (Blackman & Vigna), seeded through splitmix64.  Unlike
+ * drand48() the state is explicit, so every filter draws from its own
+ * stream and a fixed seed reproduces a run exactly.
+ *************************************************************************/
+
+#ifndef PF_RANDOM_H
+#define PF_RANDOM_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Generator state
+typedef struct
+{
+  uint64_t s[4];
+
+} pf_random_t;
+
+
+// Seed the generator; any seed (zero included) is fine
+void pf_random_seed(pf_random_t *rng, uint64_t seed);
+
+// Next raw 64-bit output
+uint64_t pf_random_next(pf_random_t *rng);
+
+// Uniform draw in [0, 1)
+double pf_random_uniform(pf_random_t *rng);
+
+// Draw from a zero-mean Gaussian distribution with standard deviation
+// sigma (the same as pf_ran_gaussian(), on this generator)
+double pf_random_gaussian(pf_random_t *rng, double sigma);
+
+// Fill out[0..count) with independent standard normal draws.  The
+// uniforms are generated first and then transformed in a separate,
+// branch-free pass (basic Box-Muller), which the compiler can vectorize.
+void pf_random_gaussian_fill(pf_random_t *rng, double *out, int count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,137 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Named floor maps, loaded on demand and evicted under a memory cap
+//
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef AMCL_FLOOR_SET_H
+#define AMCL_FLOOR_SET_H
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../map/map.h"
+
+namespace amcl
+{
+
+// Where to find a floor's map, in map_server's terms
+typedef struct
+{
+  // Binary PGM image
+  std::string image;
+
+  // m/pixel, and the pose of the lower left pixel (the yaw is ignored, as
+  // by amcl's map conversion)
+  double resolution;
+  double origin_x, origin_y;
+
+  // Pixel thresholds (see map_load_pgm)
+  bool negate;
+  double occupied_thresh, free_thresh;
+} amcl_floor_info_t;
+
+
+// The maps of the floors of a building.  A floor is loaded, with its
+// distance plane, the first time it is activated; with a cache directory
+// the plane is memory-mapped from the cache (see map_update_cspace_cached),
+// so revisiting a floor costs little more than reading its image.  Floors
+// other than the active one are evicted, least recently used first, to
+// keep the loaded maps under the memory limit.
+class AMCLFloorSet
+{
+  public: AMCLFloorSet();
+
+  public: ~AMCLFloorSet();
+
+  // How to build the distance planes.  An empty cache_dir computes them in
+  // memory.  Changing the distance or the transform unloads the floors
+  // other than the active one, so they are rebuilt when next activated;
+  // the active floor's plane is left to the laser, which rebuilds it when
+  // its model is set.
+  public: void SetCspace(double max_occ_dist, map_cspace_method_t method,
+                         int thread_count, const std::string& cache_dir);
+
+  // Bytes the loaded floors may use together (0, the default, for no
+  // limit).  The active floor stays loaded even if it is larger.
+  public: void SetMemoryLimit(size_t bytes);
+
+  // Add (or redefine) a floor.  Returns false if the floor is active.
+  public: bool AddFloor(const std::string& name, const amcl_floor_info_t& info);
+
+  public: bool HasFloor(const std::string& name) const;
+  public: std::vector<std::string> GetFloorNames() const;
+
+  // Make a floor the active one, loading it if need be.  Returns its map,
+  // which stays valid while the floor is active, or NULL if the floor is
+  // unknown or fails to load (the active floor is then unchanged).
+  public: map_t* Activate(const std::string& name);
+
+  // The active floor: its name ("" if none), map and free cells (for
+  // drawing uniform poses)
+  public: const std::string& GetActiveName() const {return this->active;}
+  public: map_t* GetActiveMap() const;
+  public: const std::vector<std::pair<int, int> >& GetActiveFreeCells() const;
+
+  public: bool IsLoaded(const std::string& name) const;
+
+  // Bytes used by the loaded floors
+  public: size_t GetMemoryUsed() const;
+
+  private: struct Floor
+  {
+    amcl_floor_info_t info;
+    map_t* map;
+    std::vector<std::pair<int, int> > free_cells;
+    unsigned long last_used;
+  };
+
+  // Not copyable: the floors own their maps
+  private: AMCLFloorSet(const AMCLFloorSet&);
+  private: AMCLFloorSet& operator=(const AMCLFloorSet&);
+
+  private: bool Load(Floor* floor);
+  private: void Unload(Floor* floor);
+
+  // Bytes a loaded floor uses, as its plane is now
+  private: static size_t FloorBytes(const Floor& floor);
+
+  // Unload the least recently used inactive floors until the loaded ones
+  // fit the limit
+  private: void Evict();
+
+  private: std::map<std::string, Floor> floors;
+  private: std::string active;
+  private: unsigned long clock;
+
+  private: size_t memory_limit;
+  private: double max_occ_dist;
+  private: map_cspace_method_t cspace_method;
+  private: int thread_count;
+  private: std::string cache_dir;
+};
+
+}
+
+#endif
@@ -0,0 +1,164 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Global scan matcher for relocalization: branch and bound over a
+// max-pooled likelihood pyramid (Olson, "Real-time correlative scan
+// matching"; Hess et al., "Real-time loop closure in 2D LIDAR SLAM")
+//
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef AMCL_GLOBAL_MATCHER_H
+#define AMCL_GLOBAL_MATCHER_H
+
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "../map/map.h"
+#include "../pf/pf_vector.h"
+#include "amcl_thread_pool.h"
+
+namespace amcl
+{
+
+// A pose hypothesis, with the fraction of the best possible score its
+// scan achieves (in [0, 1])
+typedef struct
+{
+  pf_vector_t pose;
+  double score;
+} amcl_match_t;
+
+
+// Finds the poses at which a scan best fits the map, over the whole map
+// and every heading.  Each cell scores how close it is to an obstacle;
+// level h of the pyramid holds, for every 2^h x 2^h block of translations,
+// an upper bound of that score, so whole blocks of poses can be ruled out
+// at once.  The top level blocks of every rotation are searched in order
+// of their bounds, so good hypotheses are found early and prune the rest.
+// The search is exact at the map resolution and at an angular step that
+// moves the furthest point by about one cell.
+class AMCLGlobalMatcher
+{
+  public: AMCLGlobalMatcher();
+
+  // Build the pyramid for the map.  Cell scores fall off with the distance
+  // to the nearest obstacle with standard deviation sigma; depth is the
+  // number of levels above the map resolution.  The search runs on
+  // thread_count threads (rotations are split among them; 0 for one per
+  // core).  The map must
+  // outlive the matcher, or the next SetMap().
+  public: void SetMap(map_t* map, double sigma, int depth, int thread_count);
+
+  public: bool HasMap() const {return this->map != NULL;}
+
+  // Hypotheses closer than this (in both position and heading) to a
+  // better one are dropped.  Defaults to 0.5 m and 0.35 rad.
+  public: void SetSeparation(double distance, double angle);
+
+  // Use at most this many scan points (default 200)
+  public: void SetMaxPoints(int max_points);
+
+  // Find up to max_hypotheses well separated poses whose score is above
+  // min_score, best first.  points are scan endpoints in the robot frame.
+  // Returns the number of hypotheses found.
+  public: int Match(const std::vector<pf_vector_t>& points, int max_hypotheses,
+                    double min_score, std::vector<amcl_match_t>* matches);
+
+  // Search nodes whose bound was computed by the last Match()
+  public: long GetNodeCount() const {return this->node_count;}
+
+  // Scan points of one rotation, as offsets in blocks of every level
+  // (point i of level h at index h * point_count + i)
+  private: struct DiscreteScan
+  {
+    double angle;
+    std::vector<int> dx, dy;
+  };
+
+  // Block (u, v) of some level, at one rotation, with its bound
+  private: struct Candidate
+  {
+    int bound;
+    int rotation;
+    int u, v;
+  };
+
+  private: static bool BetterCandidate(const Candidate& a, const Candidate& b)
+  {
+    return a.bound > b.bound;
+  }
+
+  // Rotate the scan, and bound every block of the top level
+  private: void PrepareRotation(int rotation);
+
+  // Search below one of the top level blocks (in order of their bounds)
+  private: void SearchCandidate(int index);
+
+  // Depth-first search below a block whose bound beat the threshold
+  private: void SearchBlock(const Candidate& block, int level,
+                            double* threshold, long* nodes);
+
+  // Upper bound of the score of the poses in block (u, v) of the given
+  // level (exact at level 0), or -1 if the block has no free cell
+  private: int Bound(const DiscreteScan& scan, int level, int u, int v) const;
+
+  // Offer a pose to the hypotheses; returns the score to beat from now on
+  private: double Insert(const amcl_match_t& match);
+
+  // Run fn over the tasks, on the pool if there is one
+  private: void Run(int task_count, const boost::function<void (int)>& fn);
+
+  private: map_t* map;
+  private: int depth;
+
+  // Level h (h > 0): score bound and free flag of every aligned block of
+  // 2^h x 2^h translations.  Level 0 is the cell scores, and the map's
+  // occupancy.  The scores have an extra row and column of blocks below
+  // the map, at index 0, as points may land one block off it.
+  private: std::vector<std::vector<unsigned char> > scores;
+  private: std::vector<std::vector<unsigned char> > free_blocks;
+  private: std::vector<int> level_x, level_y;
+
+  private: boost::scoped_ptr<AMCLThreadPool> pool;
+  private: double separation_distance, separation_angle;
+  private: int max_points;
+
+  // Current search
+  private: std::vector<double> point_x, point_y;
+  private: double angle_step;
+  private: int point_count;
+  private: int max_hypotheses;
+  private: double min_score;
+  private: std::vector<DiscreteScan> scans;
+  private: std::vector<std::vector<Candidate> > rotation_candidates;
+  private: std::vector<Candidate> candidates;
+  private: std::vector<amcl_match_t> best;
+  private: double threshold;
+  private: long node_count;
+  private: boost::mutex mutex;
+};
+
+}
+
+#endif
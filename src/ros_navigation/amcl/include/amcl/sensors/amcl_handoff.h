@@ -0,0 +1,84 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Lock-free hand-off of the latest value from one thread to another
+//
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef AMCL_HANDOFF_H
+#define AMCL_HANDOFF_H
+
+#include <boost/atomic.hpp>
+
+namespace amcl
+{
+
+// Passes the latest value from a single writer to a single reader without
+// either of them waiting for the other.  Each side owns one slot, and a
+// third is swapped between them atomically: the writer fills its slot
+// and swaps it in, and the reader swaps the newest one out when it wants
+// it.  Values the reader did not get to in time are skipped.
+template<typename T>
+class AMCLHandoff
+{
+  public: AMCLHandoff() : back(0), front(1), middle(2) {}
+
+  // Writer: the slot to fill.  It holds an older value (not necessarily
+  // the last one written), so every field must be set.
+  public: T& GetBack() {return this->slots[this->back];}
+
+  // Writer: hand the back slot over to the reader
+  public: void Publish()
+  {
+    this->back = this->middle.exchange(this->back | FRESH,
+                                       boost::memory_order_acq_rel) & INDEX;
+  }
+
+  // Reader: take the newest value, if one was handed over since the last
+  // call.  Returns false, keeping the front slot, otherwise.
+  public: bool Update()
+  {
+    if(!(this->middle.load(boost::memory_order_relaxed) & FRESH))
+      return false;
+    this->front = this->middle.exchange(this->front,
+                                        boost::memory_order_acq_rel) & INDEX;
+    return true;
+  }
+
+  // Reader: the value taken by the last successful Update()
+  public: const T& GetFront() const {return this->slots[this->front];}
+
+  // The middle slot's index, and whether it holds a value the reader has
+  // not seen
+  private: enum {INDEX = 3, FRESH = 4};
+
+  // Not copyable
+  private: AMCLHandoff(const AMCLHandoff&);
+  private: AMCLHandoff& operator=(const AMCLHandoff&);
+
+  private: T slots[3];
+  private: int back, front;
+  private: boost::atomic<int> middle;
+};
+
+}
+
+#endif
@@ -29,7 +29,13 @@
 #ifndef AMCL_LASER_H
 #define AMCL_LASER_H
 
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+
 #include "amcl_sensor.h"
+#include "amcl_thread_pool.h"
+#include "amcl_laser_simd.h"
 #include "../map/map.h"
 
 namespace amcl
@@ -55,6 +61,30 @@ class AMCLLaserData : public AMCLSensorData
 };
 
 
+// A contiguous range of samples scored by a single worker
+typedef struct
+{
+  // Samples [begin, end) of the set
+  int begin, end;
+
+  // Sum of the updated weights of the samples in the range
+  double total_weight;
+
+  // Per-beam count of samples that agree with the map (beam skipping)
+  int *obs_count;
+
+} laser_sample_chunk_t;
+
+
+// The scans of a fused update, and the sum of the weights after each of
+// them, in the order they are applied
+typedef struct
+{
+  std::vector<AMCLLaserData*> scans;
+  std::vector<double> totals;
+} laser_fused_scans_t;
+
+
 // Laseretric sensor model
 class AMCLLaser : public AMCLSensor
 {
@@ -90,9 +120,81 @@ class AMCLLaser : public AMCLSensor
   // filter has been updated.
   public: virtual bool UpdateSensor(pf_t *pf, AMCLSensorData *data);
 
+  // Update the filter with one scan from each of several lasers, taken at
+  // about the same time.  The lasers score each chunk of particles in
+  // turn, and the weights are normalized once for all of them, so the
+  // result is that of updating with the scans one after the other, less
+  // the normalization in between.  The recovery averages (w_slow, w_fast)
+  // still take one step per scan, with the share of the weight each scan
+  // would have had.  Returns true if the filter has been updated.
+  public: static bool UpdateSensors(pf_t *pf, const std::vector<AMCLLaserData*>& scans);
+
+  // Number of beams the last update integrated
+  public: int GetBeamsUsed() const {return this->beams_used;}
+
+  // Indices of the readings the last update scored
+  public: const std::vector<int>& GetBeams() const {return this->beam_index;}
+
   // Set the laser's pose after construction
   public: void SetLaserPose(pf_vector_t& laser_pose) 
           {this->laser_pose = laser_pose;}
+  public: const pf_vector_t& GetLaserPose() const {return this->laser_pose;}
+
+  // Score the particles on this many threads.  With one thread (the
+  // default) the models run serially on the calling thread.
+  public: void SetSensorThreads(int thread_count);
+
+  // Use the vectorized kernel for the likelihood field model.  Must be
+  // called before SetModelLikelihoodField(), which sets up the kernel.
+  public: void SetSimdKernel(bool enable);
+
+  // Build the likelihood field with the exact (parallel) distance
+  // transform instead of the brushfire.  Must be called before the
+  // likelihood field models are set.
+  public: void SetExactDistanceTransform(bool enable);
+
+  // Keep the distance field in an on-disk cache in this directory (see
+  // map_update_cspace_cached); empty disables the cache
+  public: void SetCspaceCache(const std::string& cache_dir);
+
+  // Let the beam model look ranges up in a precomputed table (see
+  // map_range_table_t) with angle_count bearings and bytes_per_range
+  // bytes per entry, instead of ray tracing.  angle_count 0 (the default)
+  // disables the table.  A non-empty cache_dir keeps the table on disk.
+  public: void SetRangeTable(int angle_count, int bytes_per_range,
+                             const std::string& cache_dir);
+
+  // Build the range table for the given max range now, rather than on
+  // the first scan.  Does nothing if the table is disabled.
+  public: void BuildRangeTable(double max_range);
+
+  // Compute the map's distance plane the way the likelihood field models
+  // do (exact transform, cache), unless it is already there for this
+  // distance and transform; for other users of the plane
+  public: void UpdateCspace(double max_occ_dist);
+
+  // The map's occupancy changed in the window [x0, x1) x [y0, y1):
+  // patch the lasers' range tables near it (see
+  // map_range_table_update_window).  Lasers that shared a table share the
+  // patched one; a table that cannot be patched is dropped, and rebuilt
+  // before the next update.
+  public: static void UpdateRangeTables(const std::vector<AMCLLaser*>& lasers,
+                                        int x0, int y0, int x1, int y1);
+
+  // Score against another map, whose distance plane (for the likelihood
+  // field models) must already be computed; used to switch floors without
+  // rebuilding the model.  The range table is rebuilt on the next scan.
+  public: void SetMap(map_t* map);
+
+  // Choose the max_beams readings to score by the geometry of each scan,
+  // instead of at a fixed stride: the readings are grouped by the
+  // direction of the surface they hit, and the groups share the beams as
+  // evenly as they can, so a few beams on a door frame or a corner are
+  // not outvoted by many on a long wall.  Max range readings are never
+  // chosen.  Selecting looks at every reading of the scan, so it costs
+  // about as much as scoring ten particles (30 of 720 readings); off by
+  // default.
+  public: void SetBeamSelection(bool enable);
 
   // Determine the probability for the given pose
   private: static double BeamModel(AMCLLaserData *data, 
@@ -105,8 +207,59 @@ class AMCLLaser : public AMCLSensor
   private: static double LikelihoodFieldModelProb(AMCLLaserData *data, 
 					     pf_sample_set_t* set);
 
+  // All the scans of UpdateSensors() together
+  private: static double FusedModel(laser_fused_scans_t *scans,
+                                    pf_sample_set_t* set);
+
+  // Chunk workers for the models above; each scores samples
+  // [chunk->begin, chunk->end) of the set
+  private: static void BeamModelChunk(AMCLLaserData *data,
+                                      pf_sample_set_t* set,
+                                      laser_sample_chunk_t* chunk);
+  private: static void LikelihoodFieldModelChunk(AMCLLaserData *data,
+                                                 pf_sample_set_t* set,
+                                                 laser_sample_chunk_t* chunk);
+  private: static void LikelihoodFieldModelProbChunk(AMCLLaserData *data,
+                                                     pf_sample_set_t* set,
+                                                     laser_sample_chunk_t* chunk);
+  private: static void BeamSkipChunk(AMCLLaserData *data,
+                                     pf_sample_set_t* set,
+                                     laser_sample_chunk_t* chunk);
+  private: static void LikelihoodFieldKernelChunk(AMCLLaserData *data,
+                                                  pf_sample_set_t* set,
+                                                  laser_sample_chunk_t* chunk);
+
+  private: typedef void (*chunk_fn_t) (AMCLLaserData *data,
+                                       pf_sample_set_t* set,
+                                       laser_sample_chunk_t* chunk);
+
+  // Set the model up for this scan and return the chunk worker that
+  // scores it, or NULL if the model has to see every sample before it can
+  // score any (beam skipping)
+  private: chunk_fn_t PrepareModel(AMCLLaserData *data, pf_sample_set_t* set);
+  private: chunk_fn_t PrepareLikelihoodField(AMCLLaserData *data, pf_sample_set_t* set);
+
+  // Split the sample set into chunk_count chunks, or one per thread if 0
+  private: void SplitSamples(pf_sample_set_t* set, int chunk_count = 0);
+
+  // Run fn over every chunk, in parallel if a pool is configured, and
+  // return the chunk weights summed in chunk order
+  private: double RunChunks(chunk_fn_t fn, AMCLLaserData *data,
+                            pf_sample_set_t* set);
+
   private: void reallocTempData(int max_samples, int max_obs);
 
+  // Fill beam_index with the readings of this scan the models score
+  private: void ChooseBeams(AMCLLaserData *data);
+  private: void StrideBeams(AMCLLaserData *data);
+  private: void SelectBeams(AMCLLaserData *data);
+
+  // Set beams_used after an update
+  private: void CountBeamsUsed();
+
+  // Precompute the likelihood of a hit for every distance code
+  private: void BuildLikelihoodTable();
+
   private: laser_model_t model_type;
 
   // Current data timestamp
@@ -121,6 +274,20 @@ class AMCLLaser : public AMCLSensor
   // Max beams to consider
   private: int max_beams;
 
+  // Beams integrated by the last update
+  private: int beams_used;
+
+  // Readings the models score for the current scan, in scan order; while
+  // selecting them, the readings of each surface direction and the scan's
+  // endpoints.  The bearings of the last scan, their sines and cosines and
+  // the boundaries between the directions are kept for the next.
+  private: bool select_beams;
+  private: std::vector<int> beam_index;
+  private: std::vector<std::vector<int> > beam_groups;
+  private: std::vector<double> select_x, select_y;
+  private: std::vector<double> select_bearing, select_cos, select_sin;
+  private: std::vector<double> select_bound_x, select_bound_y;
+
   // Beam skipping parameters (used by LikelihoodFieldModelProb model)
   private: bool do_beamskip; 
   private: double beam_skip_distance; 
@@ -134,6 +301,36 @@ class AMCLLaser : public AMCLSensor
   private: int max_obs;
   private: double **temp_obs;
 
+  // Worker pool for scoring particles; shared between copies of this laser
+  private: boost::shared_ptr<AMCLThreadPool> pool;
+
+  // Chunks of the sample set being scored, and their beam-skip counters
+  private: std::vector<laser_sample_chunk_t> chunks;
+  private: std::vector<int> chunk_obs_count;
+
+  // Beam-skip state shared by the chunks of the current update
+  private: bool beamskip_active;
+  private: bool beamskip_error;
+  private: std::vector<char> obs_mask;
+
+  // Vectorized likelihood field state: the likelihood of each distance
+  // code, the beams of the current scan and a structure-of-arrays copy of
+  // the laser poses
+  private: bool use_simd_kernel;
+  private: bool use_exact_edt;
+  private: std::string cspace_cache_dir;
+  private: std::vector<float> lf_table;
+  private: laser_lf_map_t lf_map;
+  private: std::vector<double> lf_beam_x, lf_beam_y;
+  private: std::vector<double> soa_x, soa_y, soa_cos, soa_sin, soa_p;
+
+  // Beam model range table, built for the max range of the scans.  Shared
+  // with the copies made for other lasers.
+  private: int range_table_angles;
+  private: int range_table_bytes;
+  private: std::string range_table_cache_dir;
+  private: boost::shared_ptr<map_range_table_t> range_table;
+
   // Laser model params
   //
   // Mixture params for the components of the model; must sum to 1
@@ -0,0 +1,104 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Vectorized likelihood field kernel
+//
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef AMCL_LASER_SIMD_H
+#define AMCL_LASER_SIMD_H
+
+#include <stdint.h>
+
+namespace amcl
+{
+
+// Likelihood lookup over the map grid
+typedef struct
+{
+  // Map geometry (as in map_t)
+  int size_x, size_y;
+  double origin_x, origin_y, scale;
+
+  // Quantized distance plane of the map (map_t::occ_dist).  Index
+  // size_x * size_y is used for hits that fall off the map, and the
+  // kernel may read up to 3 bytes past the cell it looks up.
+  const uint8_t *dist;
+
+  // z_hit * exp(-d^2 / (2 sigma_hit^2)) for every distance code
+  const float *table;
+
+  // Random-measurement term added to every beam
+  double z_rand_term;
+
+} laser_lf_map_t;
+
+
+// Beam endpoints in the laser frame (range * unit bearing vector)
+typedef struct
+{
+  int count;
+  const double *x, *y;
+
+} laser_lf_beams_t;
+
+
+// Structure-of-arrays view of the laser poses being scored
+typedef struct
+{
+  int count;
+
+  // Laser position and heading (as cos/sin) in the map frame
+  const double *x, *y, *cos_a, *sin_a;
+
+  // Output: 1 + sum over beams of pz^3, as in LikelihoodFieldModel
+  double *p;
+
+} laser_lf_poses_t;
+
+
+// Score every pose against every beam.  Uses AVX2 or SSE4.1 when the CPU
+// supports them and falls back to scalar code otherwise.  Beams are
+// accumulated in order, so the result does not depend on the code path
+// beyond floating point rounding.
+void laser_lf_kernel(const laser_lf_map_t *map,
+                     const laser_lf_beams_t *beams,
+                     laser_lf_poses_t *poses);
+
+// Name of the code path laser_lf_kernel() uses on this CPU
+const char *laser_lf_kernel_name();
+
+// The code paths laser_lf_kernel() picks from, so that they can be checked
+// against each other.  The vector ones return false, without scoring,
+// when the CPU lacks the instructions they need.
+void laser_lf_kernel_scalar(const laser_lf_map_t *map,
+                            const laser_lf_beams_t *beams,
+                            laser_lf_poses_t *poses);
+bool laser_lf_kernel_sse41(const laser_lf_map_t *map,
+                           const laser_lf_beams_t *beams,
+                           laser_lf_poses_t *poses);
+bool laser_lf_kernel_avx2(const laser_lf_map_t *map,
+                          const laser_lf_beams_t *beams,
+                          laser_lf_poses_t *poses);
+
+}
+
+#endif
@@ -0,0 +1,115 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Latency histograms for the stages of a filter update
+//
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef AMCL_LATENCY_H
+#define AMCL_LATENCY_H
+
+#include <string>
+#include <vector>
+
+namespace amcl
+{
+
+// Histogram of durations, with logarithmic buckets (eight per octave,
+// from 1 us to about 30 s).  Adding a sample is O(1) and never allocates;
+// percentiles are accurate to the bucket width, about 9%.
+class AMCLLatencyHistogram
+{
+  public: AMCLLatencyHistogram();
+
+  // Add a duration, in seconds
+  public: void Add(double seconds);
+
+  public: void Clear();
+
+  public: unsigned long GetCount() const {return this->count;}
+  public: double GetMean() const;
+  public: double GetMax() const {return this->max;}
+
+  // Duration that the fraction p of the samples do not exceed (the upper
+  // edge of its bucket, but never more than the largest sample)
+  public: double GetPercentile(double p) const;
+
+  private: std::vector<unsigned long> buckets;
+  private: unsigned long count;
+  private: double sum;
+  private: double max;
+};
+
+
+// Named stages, each with a histogram of the current window (cleared
+// whenever the owner reports it) and one for the whole run
+class AMCLLatency
+{
+  public: AMCLLatency();
+
+  // Add a stage; returns its index
+  public: int AddStage(const std::string& name);
+
+  public: int GetStageCount() const {return (int)this->names.size();}
+  public: const std::string& GetStageName(int stage) const {return this->names[stage];}
+
+  // Record a duration, in seconds, for a stage
+  public: void Record(int stage, double seconds);
+
+  public: const AMCLLatencyHistogram& GetWindow(int stage) const {return this->window[stage];}
+  public: const AMCLLatencyHistogram& GetTotal(int stage) const {return this->total[stage];}
+
+  // Start a new window
+  public: void ClearWindow();
+
+  // Table of count, mean, p50, p95, p99 and max for every stage, in ms
+  public: std::string Format(bool whole_run) const;
+
+  // Monotonic clock, in seconds
+  public: static double Now();
+
+  private: std::vector<std::string> names;
+  private: std::vector<AMCLLatencyHistogram> window;
+  private: std::vector<AMCLLatencyHistogram> total;
+};
+
+
+// Splits the time between construction and destruction into stages.
+// Each Lap() records the time since the previous lap; the destructor
+// records the whole span into the stage given to the constructor (if it
+// is not negative), so early returns are covered too.
+class AMCLLatencyTimer
+{
+  public: AMCLLatencyTimer(AMCLLatency* latency, int total_stage);
+  public: ~AMCLLatencyTimer();
+
+  // Record the time since the previous lap (or construction) for stage,
+  // and return it, in seconds
+  public: double Lap(int stage);
+
+  private: AMCLLatency* latency;
+  private: int total_stage;
+  private: double start, last;
+};
+
+}
+
+#endif
@@ -29,6 +29,8 @@
 #ifndef AMCL_ODOM_H
 #define AMCL_ODOM_H
 
+#include <vector>
+
 #include "amcl_sensor.h"
 #include "../pf/pf_pdf.h"
 
@@ -90,6 +92,10 @@ class AMCLOdom : public AMCLSensor
 
   // Drift parameters
   private: double alpha1, alpha2, alpha3, alpha4, alpha5;
+
+  // Standard normal draws for one update: three blocks of sample_count,
+  // one per noise term
+  private: std::vector<double> noise;
 };
 
 
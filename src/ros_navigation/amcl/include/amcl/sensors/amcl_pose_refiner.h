@@ -0,0 +1,100 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Scan-to-map refinement of a pose estimate: Gauss-Newton over the
+// likelihood field's distance plane
+//
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef AMCL_POSE_REFINER_H
+#define AMCL_POSE_REFINER_H
+
+#include <vector>
+
+#include "../map/map.h"
+#include "../pf/pf_vector.h"
+
+namespace amcl
+{
+
+// Moves a pose so that the scan endpoints sit as close to the map's
+// obstacles as they can.  The distance to the nearest obstacle is read
+// from the map's distance plane (the one the likelihood field models use)
+// with bilinear interpolation, which also gives its gradient, and the sum
+// of the (Huber weighted) squared distances is minimized with damped
+// Gauss-Newton steps.  Points further than max_occ_dist from any obstacle
+// carry no gradient and so do not pull the pose.
+class AMCLPoseRefiner
+{
+  public: AMCLPoseRefiner();
+
+  // Refine against this map; its distance plane must be computed (see
+  // map_update_cspace) before Refine() is called
+  public: void SetMap(map_t* map) {this->map = map;}
+
+  // Distances beyond huber_delta (m) count linearly rather than
+  // quadratically.  Defaults to 0.1 m.
+  public: void SetHuberDelta(double huber_delta);
+
+  // Stop after this many iterations (default 10)
+  public: void SetMaxIterations(int max_iterations);
+
+  // Refuse to move the pose further than this, in distance and heading;
+  // larger corrections mean the match went wrong.  Defaults to 0.5 m and
+  // 0.3 rad.
+  public: void SetMaxCorrection(double distance, double angle);
+
+  // Refine pose, given scan endpoints in the robot frame.  Returns true
+  // and updates pose if the scan fits the map better at the new pose;
+  // pose is left alone otherwise.
+  public: bool Refine(const std::vector<pf_vector_t>& points, pf_vector_t* pose);
+
+  // About the last Refine(): iterations run, points within reach of an
+  // obstacle, and the mean distance to the map before and after
+  public: int GetIterations() const {return this->iterations;}
+  public: int GetPointsUsed() const {return this->points_used;}
+  public: double GetInitialError() const {return this->initial_error;}
+  public: double GetFinalError() const {return this->final_error;}
+
+  // Cost of the scan at pose, with its gradient and the Gauss-Newton
+  // approximation of its Hessian
+  private: double Evaluate(const std::vector<pf_vector_t>& points,
+                           const pf_vector_t& pose, double grad[3],
+                           double hessian[3][3], int* used, double* error) const;
+
+  // Interpolated distance (m) to the nearest obstacle at world point
+  // (x, y), and its gradient.  Returns false off the map.
+  private: bool Distance(double x, double y, double* d,
+                         double* dx, double* dy) const;
+
+  private: map_t* map;
+  private: double huber_delta;
+  private: int max_iterations;
+  private: double max_distance, max_angle;
+
+  private: int iterations;
+  private: int points_used;
+  private: double initial_error, final_error;
+};
+
+}
+
+#endif
@@ -0,0 +1,77 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Fixed-size worker pool used to score particles in parallel
+//
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef AMCL_THREAD_POOL_H
+#define AMCL_THREAD_POOL_H
+
+#include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace amcl
+{
+
+// A pool of persistent worker threads.  Run() hands out task indices
+// [0, task_count) to the workers and to the calling thread, and returns
+// once every task has finished.  Only one Run() may be active at a time.
+class AMCLThreadPool
+{
+  // Create a pool that runs tasks on thread_count threads, including
+  // the thread that calls Run()
+  public: AMCLThreadPool(int thread_count);
+
+  public: ~AMCLThreadPool();
+
+  // Number of threads that execute tasks (workers plus the caller)
+  public: int GetThreadCount() const {return this->thread_count;}
+
+  // Execute fn(i) for every i in [0, task_count) and block until done
+  public: void Run(int task_count, const boost::function<void (int)>& fn);
+
+  private: void WorkerLoop();
+
+  // Pull tasks off the current job until none are left
+  private: void DrainTasks();
+
+  private: int thread_count;
+  private: boost::thread_group workers;
+
+  private: boost::mutex mutex;
+  private: boost::condition_variable job_cond;
+  private: boost::condition_variable done_cond;
+
+  // Current job, protected by mutex
+  private: const boost::function<void (int)>* job_fn;
+  private: int job_task_count;
+  private: int job_next_task;
+  private: int job_pending;
+  private: unsigned long job_generation;
+  private: bool shutdown;
+};
+
+}
+
+#endif
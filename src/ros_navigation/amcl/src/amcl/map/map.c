@@ -30,6 +30,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <sys/mman.h>
 
 #include "amcl/map/map.h"
 
@@ -51,7 +52,13 @@ map_t *map_alloc(void)
   map->scale = 0;
   
   // Allocate storage for main map
-  map->cells = (map_cell_t*) NULL;
+  map->occ_state = NULL;
+  map->occ_dist = NULL;
+  map->occ_dist_step = 0;
+  map->occ_dist_mapping = NULL;
+  map->occ_dist_mapping_size = 0;
+  map->max_occ_dist = 0;
+  map->occ_dist_method = 0;
   
   return map;
 }
@@ -60,25 +67,94 @@ map_t *map_alloc(void)
 // Destroy a map
 void map_free(map_t *map)
 {
-  free(map->cells);
+  free(map->occ_state);
+  map_free_occ_dist(map);
   free(map);
   return;
 }
 
 
+// Allocate the occupancy plane
+int map_alloc_cells(map_t *map, int size_x, int size_y)
+{
+  free(map->occ_state);
+  map_free_occ_dist(map);
+
+  map->size_x = size_x;
+  map->size_y = size_y;
+  map->occ_state = (int8_t*) calloc((size_t) size_x * size_y, sizeof(map->occ_state[0]));
+  if (map->occ_state == NULL)
+    return -1;
+  
+  return 0;
+}
+
+
+// Allocate the distance plane
+int map_alloc_occ_dist(map_t *map, double max_occ_dist)
+{
+  size_t n = (size_t) map->size_x * map->size_y + MAP_DIST_PAD;
+
+  map_free_occ_dist(map);
+  map->max_occ_dist = max_occ_dist;
+  map->occ_dist_step = max_occ_dist / MAP_DIST_MAX;
+  map->occ_dist = (uint8_t*) malloc(n * sizeof(map->occ_dist[0]));
+  if (map->occ_dist == NULL)
+    return -1;
+  memset(map->occ_dist, MAP_DIST_MAX, n * sizeof(map->occ_dist[0]));
+
+  return 0;
+}
+
+
+// Release the distance plane
+void map_free_occ_dist(map_t *map)
+{
+  if (map->occ_dist_mapping)
+    munmap(map->occ_dist_mapping, map->occ_dist_mapping_size);
+  else
+    free(map->occ_dist);
+
+  map->occ_dist = NULL;
+  map->occ_dist_mapping = NULL;
+  map->occ_dist_mapping_size = 0;
+}
+
+
+// Copy a mapped distance plane to the heap
+int map_detach_occ_dist(map_t *map)
+{
+  size_t n = (size_t) map->size_x * map->size_y + MAP_DIST_PAD;
+  uint8_t *copy;
+
+  if (map->occ_dist_mapping == NULL)
+    return 0;
+
+  copy = (uint8_t*) malloc(n * sizeof(map->occ_dist[0]));
+  if (copy == NULL)
+    return -1;
+  memcpy(copy, map->occ_dist, n * sizeof(map->occ_dist[0]));
+
+  munmap(map->occ_dist_mapping, map->occ_dist_mapping_size);
+  map->occ_dist = copy;
+  map->occ_dist_mapping = NULL;
+  map->occ_dist_mapping_size = 0;
+
+  return 0;
+}
+
+
 // Get the cell at the given point
-map_cell_t *map_get_cell(map_t *map, double ox, double oy, double oa)
+int map_get_cell_index(map_t *map, double ox, double oy, double oa)
 {
   int i, j;
-  map_cell_t *cell;
 
   i = MAP_GXWX(map, ox);
   j = MAP_GYWY(map, oy);
   
   if (!MAP_VALID(map, i, j))
-    return NULL;
+    return -1;
 
-  cell = map->cells + MAP_INDEX(map, i, j);
-  return cell;
+  return MAP_INDEX(map, i, j);
 }
 
@@ -0,0 +1,355 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey   &  Kasper Stoy
+ *                      gerkey@usc.edu    kaspers@robotics.usc.edu
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+/**************************************************************************
+ * Desc: On-disk cache for the cspace distance plane and range tables
+ *
+ * A cache file is a fixed header followed by the payload (the distance
+ * plane including its padding, or the range table block), exactly as it
+ * is laid out in memory, so a valid file can be mapped and used in place.
+**************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "amcl/map/map.h"
+
+#define MAP_CACHE_DIST_MAGIC "AMCLDST"
+#define MAP_CACHE_RANGE_MAGIC "AMCLRNG"
+#define MAP_CACHE_VERSION 2
+
+// File header; 88 bytes, so the payload that follows is 8-byte aligned
+typedef struct
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  int32_t size_x, size_y;
+  double scale;
+
+  // What the payload is computed with; depends on the magic
+  double params[4];
+
+  // Hash of everything the payload is computed from
+  uint64_t key;
+
+  // Hash of the payload itself
+  uint64_t checksum;
+
+  // Size of the payload in bytes
+  uint64_t payload_size;
+
+} map_cache_header_t;
+
+// The header is written to disk as is: fail to compile if its layout
+// changes, rather than read back files of the old one
+typedef char map_cache_header_size_check[sizeof(map_cache_header_t) == 88 ? 1 : -1];
+
+
+// 64-bit FNV-1a
+static uint64_t map_cache_hash(uint64_t hash, const void *data, size_t size)
+{
+  const uint8_t *p = (const uint8_t*) data;
+  size_t i;
+
+  for (i = 0; i < size; i++)
+  {
+    hash ^= p[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+
+// Fill in the header describing the payload we want for this map
+static void map_cache_describe(map_t *map, const char *magic, const double params[4],
+                               size_t payload_size, map_cache_header_t *hdr)
+{
+  uint64_t key = 14695981039346656037ULL;
+
+  memset(hdr, 0, sizeof(*hdr));
+  memcpy(hdr->magic, magic, sizeof(hdr->magic));
+  hdr->version = MAP_CACHE_VERSION;
+  hdr->size_x = map->size_x;
+  hdr->size_y = map->size_y;
+  hdr->scale = map->scale;
+  memcpy(hdr->params, params, sizeof(hdr->params));
+  hdr->payload_size = payload_size;
+
+  // The key covers the header fields above and the occupancy plane
+  key = map_cache_hash(key, hdr, offsetof(map_cache_header_t, key));
+  key = map_cache_hash(key, map->occ_state, (size_t) map->size_x * map->size_y);
+  hdr->key = key;
+}
+
+
+// Path of the cache file for the given header
+static void map_cache_path(char *path, size_t size, const char *cache_dir,
+                           const char *suffix, const map_cache_header_t *hdr)
+{
+  snprintf(path, size, "%s/amcl_%016llx.%s", cache_dir,
+           (unsigned long long) hdr->key, suffix);
+}
+
+
+// Map a cache file if it matches the expected header and its checksum.
+// Returns the mapping (header included), or NULL.
+static void *map_cache_load(const char *path, const map_cache_header_t *expect)
+{
+  int fd;
+  struct stat st;
+  size_t size;
+  void *base;
+  const map_cache_header_t *hdr;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  size = sizeof(map_cache_header_t) + expect->payload_size;
+  if (fstat(fd, &st) != 0 || (size_t) st.st_size != size)
+  {
+    fprintf(stderr, "ignoring cache file %s: unexpected size\n", path);
+    close(fd);
+    return NULL;
+  }
+
+  // A private read-only mapping is backed by the page cache, so every
+  // process that maps the file shares the same physical pages
+  base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED)
+  {
+    fprintf(stderr, "%s: %s\n", strerror(errno), path);
+    return NULL;
+  }
+
+  hdr = (const map_cache_header_t*) base;
+  if (memcmp(hdr, expect, offsetof(map_cache_header_t, checksum)) != 0 ||
+      hdr->payload_size != expect->payload_size)
+  {
+    fprintf(stderr, "ignoring stale cache file %s\n", path);
+    munmap(base, size);
+    return NULL;
+  }
+  if (map_cache_hash(14695981039346656037ULL, hdr + 1, hdr->payload_size) != hdr->checksum)
+  {
+    fprintf(stderr, "ignoring corrupt cache file %s\n", path);
+    munmap(base, size);
+    return NULL;
+  }
+
+  return base;
+}
+
+
+// Write everything in buf, retrying on short writes
+static int map_cache_write(int fd, const void *buf, size_t size)
+{
+  const char *p = (const char*) buf;
+
+  while (size > 0)
+  {
+    ssize_t n = write(fd, p, size);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    p += n;
+    size -= n;
+  }
+  return 0;
+}
+
+
+// Store a payload.  The file is written under a temporary name and
+// renamed into place, so readers never see a partial file.  Returns 0 on
+// success.
+static int map_cache_store(const char *cache_dir, const char *path,
+                           map_cache_header_t *hdr, const void *payload)
+{
+  char tmp_path[4096 + 32];
+  int fd;
+
+  if (mkdir(cache_dir, 0755) != 0 && errno != EEXIST)
+  {
+    fprintf(stderr, "%s: %s\n", strerror(errno), cache_dir);
+    return -1;
+  }
+
+  hdr->checksum = map_cache_hash(14695981039346656037ULL, payload, hdr->payload_size);
+
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%d", path, (int) getpid());
+  fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+  {
+    fprintf(stderr, "%s: %s\n", strerror(errno), tmp_path);
+    return -1;
+  }
+
+  if (map_cache_write(fd, hdr, sizeof(*hdr)) != 0 ||
+      map_cache_write(fd, payload, hdr->payload_size) != 0 ||
+      fsync(fd) != 0)
+  {
+    fprintf(stderr, "%s: %s\n", strerror(errno), tmp_path);
+    close(fd);
+    unlink(tmp_path);
+    return -1;
+  }
+  close(fd);
+
+  if (rename(tmp_path, path) != 0)
+  {
+    fprintf(stderr, "%s: %s\n", strerror(errno), path);
+    unlink(tmp_path);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+// Use a mapped cache file as the distance plane
+static void map_cache_use_occ_dist(map_t *map, void *base)
+{
+  const map_cache_header_t *hdr = (const map_cache_header_t*) base;
+
+  map_free_occ_dist(map);
+  map->max_occ_dist = hdr->params[1];
+  map->occ_dist_method = (int) hdr->params[0];
+  map->occ_dist_step = map->max_occ_dist / MAP_DIST_MAX;
+  map->occ_dist = (uint8_t*) (hdr + 1);
+  map->occ_dist_mapping = base;
+  map->occ_dist_mapping_size = sizeof(*hdr) + hdr->payload_size;
+}
+
+
+// Update the cspace distances through the cache
+int map_update_cspace_cached(map_t *map, double max_occ_dist,
+                             map_cspace_method_t method, int thread_count,
+                             const char *cache_dir)
+{
+  map_cache_header_t hdr;
+  double params[4] = {0, 0, 0, 0};
+  char path[4096];
+  void *base;
+
+  params[0] = method;
+  params[1] = max_occ_dist;
+  map_cache_describe(map, MAP_CACHE_DIST_MAGIC, params,
+                     (size_t) map->size_x * map->size_y + MAP_DIST_PAD, &hdr);
+  map_cache_path(path, sizeof(path), cache_dir, "dist", &hdr);
+
+  base = map_cache_load(path, &hdr);
+  if (base != NULL)
+  {
+    map_cache_use_occ_dist(map, base);
+    return 1;
+  }
+
+  if (method == MAP_CSPACE_EDT)
+    map_update_cspace_edt(map, max_occ_dist, thread_count);
+  else
+    map_update_cspace(map, max_occ_dist);
+  if (map->occ_dist == NULL)
+    return 0;
+
+  // Switch to the mapped copy, so this process shares it as well
+  if (map_cache_store(cache_dir, path, &hdr, map->occ_dist) == 0)
+  {
+    base = map_cache_load(path, &hdr);
+    if (base != NULL)
+      map_cache_use_occ_dist(map, base);
+  }
+
+  return 0;
+}
+
+
+// Use a mapped cache file as the block of a range table
+static void map_cache_use_range_table(map_range_table_t *table, void *base)
+{
+  const map_cache_header_t *hdr = (const map_cache_header_t*) base;
+
+  if (table->mapping)
+    munmap(table->mapping, table->mapping_size);
+  else
+    free(table->memory);
+
+  table->memory = (void*) (hdr + 1);
+  table->mapping = base;
+  table->mapping_size = sizeof(*hdr) + hdr->payload_size;
+}
+
+
+// Build a range table through the cache
+map_range_table_t *map_range_table_build_cached(map_t *map, double max_range,
+                                                int angle_count, int bytes_per_range,
+                                                int thread_count, const char *cache_dir,
+                                                int *hit)
+{
+  map_cache_header_t hdr;
+  map_range_table_t expect, *table;
+  double params[4] = {0, 0, 0, 0};
+  char path[4096];
+  void *base;
+
+  *hit = 0;
+  if (map_range_table_init(&expect, map, max_range, angle_count, bytes_per_range) != 0)
+    return NULL;
+
+  params[0] = angle_count;
+  params[1] = max_range;
+  params[2] = bytes_per_range;
+  map_cache_describe(map, MAP_CACHE_RANGE_MAGIC, params, expect.size, &hdr);
+  map_cache_path(path, sizeof(path), cache_dir, "range", &hdr);
+
+  base = map_cache_load(path, &hdr);
+  if (base != NULL)
+  {
+    table = malloc(sizeof(map_range_table_t));
+    *table = expect;
+    map_cache_use_range_table(table, base);
+    *hit = 1;
+    return table;
+  }
+
+  table = map_range_table_build(map, max_range, angle_count, bytes_per_range, thread_count);
+  if (table == NULL)
+    return NULL;
+
+  if (map_cache_store(cache_dir, path, &hdr, table->memory) == 0)
+  {
+    base = map_cache_load(path, &hdr);
+    if (base != NULL)
+      map_cache_use_range_table(table, base);
+  }
+
+  return table;
+}
@@ -20,15 +20,20 @@
  */
 
 #include <queue>
+#include <vector>
+#include <limits>
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
 #include "amcl/map/map.h"
 
 class CellData
 {
   public:
-    map_t* map_;
+    // Distance (in cells) to the source obstacle
+    double distance_;
     unsigned int i_, j_;
     unsigned int src_i_, src_j_;
 };
@@ -68,7 +73,7 @@ class CachedDistanceMap
 
 bool operator<(const CellData& a, const CellData& b)
 {
-  return a.map_->cells[MAP_INDEX(a.map_, a.i_, a.j_)].occ_dist > a.map_->cells[MAP_INDEX(b.map_, b.i_, b.j_)].occ_dist;
+  return a.distance_ > b.distance_;
 }
 
 CachedDistanceMap*
@@ -90,7 +95,7 @@ void enqueue(map_t* map, int i, int j,
 	     int src_i, int src_j,
 	     std::priority_queue<CellData>& Q,
 	     CachedDistanceMap* cdm,
-	     unsigned char* marked)
+	     std::vector<bool>& marked)
 {
   if(marked[MAP_INDEX(map, i, j)])
     return;
@@ -102,10 +107,10 @@ void enqueue(map_t* map, int i, int j,
   if(distance > cdm->cell_radius_)
     return;
 
-  map->cells[MAP_INDEX(map, i, j)].occ_dist = distance * map->scale;
+  map->occ_dist[MAP_INDEX(map, i, j)] = MAP_DIST_CODE(map, distance * map->scale);
 
   CellData cell;
-  cell.map_ = map;
+  cell.distance_ = distance;
   cell.i_ = i;
   cell.j_ = j;
   cell.src_i_ = src_i;
@@ -113,39 +118,38 @@ void enqueue(map_t* map, int i, int j,
 
   Q.push(cell);
 
-  marked[MAP_INDEX(map, i, j)] = 1;
+  marked[MAP_INDEX(map, i, j)] = true;
 }
 
 // Update the cspace distance values
 void map_update_cspace(map_t *map, double max_occ_dist)
 {
-  unsigned char* marked;
+  // One bit per cell, to keep the peak footprint close to the map itself
+  std::vector<bool> marked(map->size_x*map->size_y, false);
   std::priority_queue<CellData> Q;
 
-  marked = new unsigned char[map->size_x*map->size_y];
-  memset(marked, 0, sizeof(unsigned char) * map->size_x*map->size_y);
-
-  map->max_occ_dist = max_occ_dist;
+  // Every cell starts out at max_occ_dist
+  if(map_alloc_occ_dist(map, max_occ_dist) != 0)
+    return;
+  map->occ_dist_method = MAP_CSPACE_BRUSHFIRE;
 
   CachedDistanceMap* cdm = get_distance_map(map->scale, map->max_occ_dist);
 
   // Enqueue all the obstacle cells
   CellData cell;
-  cell.map_ = map;
+  cell.distance_ = 0.0;
   for(int i=0; i<map->size_x; i++)
   {
     cell.src_i_ = cell.i_ = i;
     for(int j=0; j<map->size_y; j++)
     {
-      if(map->cells[MAP_INDEX(map, i, j)].occ_state == +1)
+      if(MAP_OCC_STATE(map, MAP_INDEX(map, i, j)) == +1)
       {
-	map->cells[MAP_INDEX(map, i, j)].occ_dist = 0.0;
+	map->occ_dist[MAP_INDEX(map, i, j)] = 0;
 	cell.src_j_ = cell.j_ = j;
-	marked[MAP_INDEX(map, i, j)] = 1;
+	marked[MAP_INDEX(map, i, j)] = true;
 	Q.push(cell);
       }
-      else
-	map->cells[MAP_INDEX(map, i, j)].occ_dist = max_occ_dist;
     }
   }
 
@@ -171,63 +175,210 @@ void map_update_cspace(map_t *map, double max_occ_dist)
 
     Q.pop();
   }
-
-  delete[] marked;
 }
 
-#if 0
-// TODO: replace this with a more efficient implementation.  Not crucial,
-// because we only do it once, at startup.
-void map_update_cspace(map_t *map, double max_occ_dist)
+// Marks "no obstacle within range" in the distance transform
+static const int EDT_NONE = std::numeric_limits<int>::max();
+
+// Exact distance transform for the cells in columns [col_begin, col_end)
+// of rows [row_begin, row_end).  Only obstacles within radius of those
+// cells are looked at.  The vertical pass is done incrementally: for
+// every column we track the nearest obstacle at or above the current row
+// and the next one below it, so each band only needs a few rows of state.
+// The horizontal pass takes the lower envelope of the parabolas
+// (x - q)^2 + dy(q)^2.
+static void edt_window(map_t* map, int radius, int col_begin, int col_end,
+                       int row_begin, int row_end)
 {
-  int i, j;
-  int ni, nj;
-  int s;
-  double d;
-  map_cell_t *cell, *ncell;
+  const int size_y = map->size_y;
+
+  // Obstacles in columns further than this cannot affect the window
+  const int x0 = std::max(0, col_begin - radius);
+  const int x1 = std::min(map->size_x, col_end + radius);
+  const int width = x1 - x0;
+
+  // Obstacles further than this below the band cannot affect it
+  const int scan_limit = std::min(size_y, row_end + radius + 1);
 
-  map->max_occ_dist = max_occ_dist;
-  s = (int) ceil(map->max_occ_dist / map->scale);
+  std::vector<int> last_above(width, EDT_NONE);
+  std::vector<int> next_below(width, EDT_NONE);
+  std::vector<int> f(width);
+  std::vector<int> v(width);
+  std::vector<double> z(width + 1);
 
-  // Reset the distance values
-  for (j = 0; j < map->size_y; j++)
+  for(int i = 0; i < width; i++)
   {
-    for (i = 0; i < map->size_x; i++)
+    for(int j = row_begin - 1; j >= 0 && j >= row_begin - radius; j--)
     {
-      cell = map->cells + MAP_INDEX(map, i, j);
-      cell->occ_dist = map->max_occ_dist;
+      if(MAP_OCC_STATE(map, MAP_INDEX(map, x0 + i, j)) == +1)
+      {
+        last_above[i] = j;
+        break;
+      }
+    }
+    for(int j = row_begin; j < scan_limit; j++)
+    {
+      if(MAP_OCC_STATE(map, MAP_INDEX(map, x0 + i, j)) == +1)
+      {
+        next_below[i] = j;
+        break;
+      }
     }
   }
 
-  // Find all the occupied cells and update their neighbours
-  for (j = 0; j < map->size_y; j++)
+  for(int j = row_begin; j < row_end; j++)
   {
-    for (i = 0; i < map->size_x; i++)
+    // Vertical distances for this row
+    int finite = 0;
+    for(int i = 0; i < width; i++)
     {
-      cell = map->cells + MAP_INDEX(map, i, j);
-      if (cell->occ_state != +1)
-        continue;
-          
-      cell->occ_dist = 0;
-
-      // Update adjacent cells
-      for (nj = -s; nj <= +s; nj++)
+      if(next_below[i] == j)
       {
-        for (ni = -s; ni <= +s; ni++)
+        last_above[i] = j;
+        next_below[i] = EDT_NONE;
+        for(int k = j + 1; k < scan_limit; k++)
         {
-          if (!MAP_VALID(map, i + ni, j + nj))
-            continue;
+          if(MAP_OCC_STATE(map, MAP_INDEX(map, x0 + i, k)) == +1)
+          {
+            next_below[i] = k;
+            break;
+          }
+        }
+      }
 
-          ncell = map->cells + MAP_INDEX(map, i + ni, j + nj);
-          d = map->scale * sqrt(ni * ni + nj * nj);
+      int dy = EDT_NONE;
+      if(last_above[i] != EDT_NONE)
+        dy = j - last_above[i];
+      if(next_below[i] != EDT_NONE && next_below[i] - j < dy)
+        dy = next_below[i] - j;
 
-          if (d < ncell->occ_dist)
-            ncell->occ_dist = d;
-        }
+      if(dy > radius)
+        f[i] = EDT_NONE;
+      else
+      {
+        f[i] = dy * dy;
+        finite++;
+      }
+    }
+
+    uint8_t* row = map->occ_dist + MAP_INDEX(map, 0, j);
+    if(finite == 0)
+    {
+      memset(row + col_begin, MAP_DIST_MAX, col_end - col_begin);
+      continue;
+    }
+
+    // Lower envelope of the parabolas rooted at the finite entries
+    int k = -1;
+    for(int q = 0; q < width; q++)
+    {
+      if(f[q] == EDT_NONE)
+        continue;
+      if(k < 0)
+      {
+        k = 0;
+        v[0] = q;
+        z[0] = -std::numeric_limits<double>::infinity();
+        z[1] = std::numeric_limits<double>::infinity();
+        continue;
+      }
+      double s;
+      for(;;)
+      {
+        int p = v[k];
+        s = ((f[q] + (double)q * q) - (f[p] + (double)p * p)) / (2.0 * (q - p));
+        if(s > z[k])
+          break;
+        k--;
       }
+      k++;
+      v[k] = q;
+      z[k] = s;
+      z[k + 1] = std::numeric_limits<double>::infinity();
+    }
+
+    k = 0;
+    for(int i = col_begin - x0; i < col_end - x0; i++)
+    {
+      while(z[k + 1] < i)
+        k++;
+      int dx = i - v[k];
+      int d2 = dx * dx + f[v[k]];
+      if(d2 > radius * radius)
+        row[x0 + i] = MAP_DIST_MAX;
+      else
+        row[x0 + i] = MAP_DIST_CODE(map, sqrt((double)d2) * map->scale);
     }
   }
-  
-  return;
 }
-#endif
+
+// Run the transform over a window, in bands of rows; each thread works
+// on its own
+static void edt_bands(map_t* map, int radius, int col_begin, int col_end,
+                      int row_begin, int row_end, int thread_count)
+{
+  int rows = row_end - row_begin;
+  if(thread_count <= 0)
+    thread_count = boost::thread::hardware_concurrency();
+  if(thread_count > rows)
+    thread_count = rows;
+  if(thread_count <= 1)
+  {
+    edt_window(map, radius, col_begin, col_end, row_begin, row_end);
+    return;
+  }
+
+  boost::thread_group threads;
+  for(int t = 0; t < thread_count; t++)
+  {
+    int begin = row_begin + (int)((long)rows * t / thread_count);
+    int end = row_begin + (int)((long)rows * (t + 1) / thread_count);
+    threads.create_thread(boost::bind(&edt_window, map, radius, col_begin, col_end,
+                                      begin, end));
+  }
+  threads.join_all();
+}
+
+// Update the cspace distance values with an exact distance transform
+void map_update_cspace_edt(map_t *map, double max_occ_dist, int thread_count)
+{
+  if(map_alloc_occ_dist(map, max_occ_dist) != 0)
+    return;
+  map->occ_dist_method = MAP_CSPACE_EDT;
+
+  // Same truncation as the brushfire's cell radius
+  int radius = (int)(max_occ_dist / map->scale);
+
+  edt_bands(map, radius, 0, map->size_x, 0, map->size_y, thread_count);
+}
+
+// Update the cspace distance values around a window whose occupancy
+// changed
+int map_update_cspace_window(map_t *map, int x0, int y0, int x1, int y1,
+                             map_cspace_method_t method, int thread_count)
+{
+  if(map->occ_dist == NULL)
+    return -1;
+
+  // Which source the brushfire reaches a cell from first depends on the
+  // order of the ties in its queue, i.e. on every obstacle of the map
+  if(method == MAP_CSPACE_BRUSHFIRE)
+  {
+    map_update_cspace(map, map->max_occ_dist);
+    return map->occ_dist != NULL ? 0 : -1;
+  }
+
+  // Cells further than the radius from the window keep their distances
+  int radius = (int)(map->max_occ_dist / map->scale);
+  x0 = std::max(0, x0 - radius);
+  y0 = std::max(0, y0 - radius);
+  x1 = std::min(map->size_x, x1 + radius);
+  y1 = std::min(map->size_y, y1 + radius);
+  if(x0 >= x1 || y0 >= y1)
+    return 0;
+
+  if(map_detach_occ_dist(map) != 0)
+    return -1;
+  edt_bands(map, radius, x0, x1, y0, y1, thread_count);
+  return 0;
+}
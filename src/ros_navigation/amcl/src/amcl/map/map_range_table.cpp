@@ -0,0 +1,375 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey   &  Kasper Stoy
+ *                      gerkey@usc.edu    kaspers@robotics.usc.edu
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+/**************************************************************************
+ * Desc: Precomputed range tables
+**************************************************************************/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include "amcl/map/map.h"
+
+// Largest code for the given storage size
+static unsigned int range_code_max(int bytes_per_range)
+{
+  return (bytes_per_range == 1) ? 0xff : 0xffff;
+}
+
+// Describe the table for the given map and settings
+int map_range_table_init(map_range_table_t *table, map_t *map, double max_range,
+                         int angle_count, int bytes_per_range)
+{
+  if(angle_count <= 0 || max_range <= 0 ||
+     (bytes_per_range != 1 && bytes_per_range != 2))
+  {
+    fprintf(stderr, "invalid range table settings\n");
+    return -1;
+  }
+
+  memset(table, 0, sizeof(*table));
+  table->size_x = map->size_x;
+  table->size_y = map->size_y;
+  table->angle_count = angle_count;
+  table->max_range = max_range;
+  table->bytes_per_range = bytes_per_range;
+  // A hit on the last cell of a ray can be up to a diagonal further
+  // than max_range
+  table->range_step = (max_range + 2 * map->scale) / (range_code_max(bytes_per_range) - 1);
+
+  size_t cell_count = (size_t)map->size_x * map->size_y;
+  for(size_t i = 0; i < cell_count; i++)
+    if(map->occ_state[i] == -1)
+      table->free_count++;
+
+  size_t words = (cell_count + 63) / 64;
+  table->rank_offset = words * sizeof(uint64_t);
+  table->range_offset = table->rank_offset + ((words * sizeof(uint32_t) + 7) & ~(size_t)7);
+  table->size = table->range_offset +
+    (size_t)table->free_count * angle_count * bytes_per_range;
+
+  return 0;
+}
+
+// Code for a ray traced range
+static unsigned int range_code(const map_range_table_t *table, double r)
+{
+  unsigned int code_max = range_code_max(table->bytes_per_range);
+  if(r == table->max_range)
+    return code_max;
+  unsigned int code = (unsigned int) floor(r / table->range_step + 0.5);
+  return (code > code_max - 1) ? code_max - 1 : code;
+}
+
+static unsigned int load_code(const map_range_table_t *table, const uint8_t *ranges,
+                              size_t at)
+{
+  if(table->bytes_per_range == 1)
+    return ranges[at];
+  return ((const uint16_t*) ranges)[at];
+}
+
+static void store_code(const map_range_table_t *table, uint8_t *ranges, size_t at,
+                       unsigned int code)
+{
+  if(table->bytes_per_range == 1)
+    ranges[at] = (uint8_t) code;
+  else
+    ((uint16_t*) ranges)[at] = (uint16_t) code;
+}
+
+// Rank of the cell among the free cells, if it is free in the table
+static bool range_table_rank(const map_range_table_t *table, size_t cell, size_t *n)
+{
+  const uint64_t *bits = (const uint64_t*) table->memory;
+  const uint32_t *rank = (const uint32_t*) ((const char*) table->memory + table->rank_offset);
+  uint64_t word = bits[cell / 64];
+  uint64_t below = 1ULL << (cell % 64);
+  if(!(word & below))
+    return false;
+  *n = rank[cell / 64] + __builtin_popcountll(word & (below - 1));
+  return true;
+}
+
+// What map_range_table_update_window() keeps from the old table: rays
+// that stay clear of the window, a box in cells around it, are copied
+typedef struct
+{
+  const map_range_table_t *old;
+  double box_x0, box_y0, box_x1, box_y1;
+  // Cells further than this from the box, in cells, reach it on no bearing
+  double reach;
+  std::vector<double> cos_a, sin_a;
+} range_table_patch_t;
+
+// Whether the ray from (x, y) along (dx, dy), for length cells, meets
+// the patch's box
+static bool ray_meets_box(const range_table_patch_t *patch, double x, double y,
+                          double dx, double dy, double length)
+{
+  double t0 = 0.0, t1 = length;
+  double p[2] = {x, y}, d[2] = {dx, dy};
+  double lo[2] = {patch->box_x0, patch->box_y0}, hi[2] = {patch->box_x1, patch->box_y1};
+  for(int a = 0; a < 2; a++)
+  {
+    if(fabs(d[a]) < 1e-12)
+    {
+      if(p[a] < lo[a] || p[a] > hi[a])
+        return false;
+      continue;
+    }
+    double ta = (lo[a] - p[a]) / d[a], tb = (hi[a] - p[a]) / d[a];
+    if(ta > tb)
+      std::swap(ta, tb);
+    t0 = std::max(t0, ta);
+    t1 = std::min(t1, tb);
+    if(t0 > t1)
+      return false;
+  }
+  return true;
+}
+
+// Fill in the ranges for every free cell in rows row, row + row_step, ...
+// With a patch, ranges that the window cannot have changed come from the
+// old table instead of being traced again
+static void range_table_rows(map_range_table_t *table, map_t *map,
+                             int row, int row_step, const range_table_patch_t *patch)
+{
+  const uint64_t *bits = (const uint64_t*) table->memory;
+  const uint32_t *rank = (const uint32_t*) ((char*) table->memory + table->rank_offset);
+  uint8_t *ranges = (uint8_t*) table->memory + table->range_offset;
+  const uint8_t *old_ranges = NULL;
+  if(patch)
+    old_ranges = (const uint8_t*) patch->old->memory + patch->old->range_offset;
+  const int angle_count = table->angle_count;
+  const size_t cell_bytes = (size_t) angle_count * table->bytes_per_range;
+
+  for(int j = row; j < map->size_y; j += row_step)
+  {
+    // Rank of the first free cell in the row
+    size_t first = MAP_INDEX(map, 0, j);
+    size_t n = rank[first / 64] +
+      __builtin_popcountll(bits[first / 64] & ((1ULL << (first % 64)) - 1));
+
+    for(int i = 0; i < map->size_x; i++)
+    {
+      size_t cell = MAP_INDEX(map, i, j);
+      if(MAP_OCC_STATE(map, cell) != -1)
+        continue;
+
+      double ox = MAP_WXGX(map, i);
+      double oy = MAP_WYGY(map, j);
+
+      // Free before, outside the box: copy the rays that miss it
+      size_t m;
+      bool inside = patch && i >= patch->box_x0 && i <= patch->box_x1 &&
+        j >= patch->box_y0 && j <= patch->box_y1;
+      if(patch && !inside && range_table_rank(patch->old, cell, &m))
+      {
+        const uint8_t *from = old_ranges + m * cell_bytes;
+        if(i < patch->box_x0 - patch->reach || i > patch->box_x1 + patch->reach ||
+           j < patch->box_y0 - patch->reach || j > patch->box_y1 + patch->reach)
+        {
+          memcpy(ranges + n * cell_bytes, from, cell_bytes);
+          n++;
+          continue;
+        }
+        for(int k = 0; k < angle_count; k++)
+        {
+          unsigned int code = load_code(table, from, k);
+          double r = (code == range_code_max(table->bytes_per_range)) ?
+            table->max_range : code * table->range_step;
+          // The ray stops at its hit, give or take a code and the cells
+          // the line rounds to
+          double length = (r + table->range_step) / map->scale + 2;
+          if(!ray_meets_box(patch, i, j, patch->cos_a[k], patch->sin_a[k], length))
+            store_code(table, ranges, n * angle_count + k, code);
+          else
+            store_code(table, ranges, n * angle_count + k,
+                       range_code(table, map_calc_range(map, ox, oy,
+                                                        k * 2 * M_PI / angle_count,
+                                                        table->max_range)));
+        }
+        n++;
+        continue;
+      }
+
+      for(int k = 0; k < angle_count; k++)
+      {
+        double r = map_calc_range(map, ox, oy, k * 2 * M_PI / angle_count,
+                                  table->max_range);
+        store_code(table, ranges, n * angle_count + k, range_code(table, r));
+      }
+      n++;
+    }
+  }
+}
+
+// Allocate a table for the map, with its free cell bitmap and ranks
+static map_range_table_t *range_table_alloc(map_t *map, double max_range, int angle_count,
+                                            int bytes_per_range)
+{
+  map_range_table_t *table = (map_range_table_t*) malloc(sizeof(map_range_table_t));
+  if(table == NULL)
+    return NULL;
+  if(map_range_table_init(table, map, max_range, angle_count, bytes_per_range) != 0)
+  {
+    free(table);
+    return NULL;
+  }
+
+  table->memory = malloc(table->size);
+  if(table->memory == NULL)
+  {
+    fprintf(stderr, "not enough memory for a %lu byte range table\n",
+            (unsigned long) table->size);
+    free(table);
+    return NULL;
+  }
+
+  // Free cell bitmap and the rank of each word
+  uint64_t *bits = (uint64_t*) table->memory;
+  uint32_t *rank = (uint32_t*) ((char*) table->memory + table->rank_offset);
+  size_t cell_count = (size_t)map->size_x * map->size_y;
+  size_t words = (cell_count + 63) / 64;
+  memset(bits, 0, words * sizeof(uint64_t));
+  // Zero the padding after the ranks too, so that equal tables compare
+  // (and cache) equal
+  memset(rank + words, 0,
+         table->range_offset - table->rank_offset - words * sizeof(uint32_t));
+  for(size_t i = 0; i < cell_count; i++)
+    if(map->occ_state[i] == -1)
+      bits[i / 64] |= 1ULL << (i % 64);
+  uint32_t n = 0;
+  for(size_t w = 0; w < words; w++)
+  {
+    rank[w] = n;
+    n += __builtin_popcountll(bits[w]);
+  }
+  return table;
+}
+
+// Fill in the ranges of a table, on thread_count threads
+static void range_table_fill(map_range_table_t *table, map_t *map, int thread_count,
+                             const range_table_patch_t *patch)
+{
+  if(thread_count <= 0)
+    thread_count = boost::thread::hardware_concurrency();
+  if(thread_count > map->size_y)
+    thread_count = map->size_y;
+  if(thread_count <= 1)
+  {
+    range_table_rows(table, map, 0, 1, patch);
+    return;
+  }
+
+  // Rows are independent; interleave them so that every thread gets a
+  // similar share of the free space
+  boost::thread_group threads;
+  for(int t = 0; t < thread_count; t++)
+    threads.create_thread(boost::bind(&range_table_rows, table, map, t, thread_count,
+                                      patch));
+  threads.join_all();
+}
+
+// Build a range table
+map_range_table_t *map_range_table_build(map_t *map, double max_range, int angle_count,
+                                         int bytes_per_range, int thread_count)
+{
+  map_range_table_t *table = range_table_alloc(map, max_range, angle_count,
+                                               bytes_per_range);
+  if(table == NULL)
+    return NULL;
+  range_table_fill(table, map, thread_count, NULL);
+  return table;
+}
+
+// Rebuild a range table around a window whose occupancy changed
+map_range_table_t *map_range_table_update_window(const map_range_table_t *table,
+                                                 map_t *map, int x0, int y0,
+                                                 int x1, int y1, int thread_count)
+{
+  if(table->size_x != map->size_x || table->size_y != map->size_y)
+    return NULL;
+  map_range_table_t *updated = range_table_alloc(map, table->max_range,
+                                                 table->angle_count,
+                                                 table->bytes_per_range);
+  if(updated == NULL)
+    return NULL;
+
+  // A ray visits cells up to a cell off its line
+  range_table_patch_t patch;
+  patch.old = table;
+  patch.box_x0 = x0 - 2;
+  patch.box_y0 = y0 - 2;
+  patch.box_x1 = x1 + 1;
+  patch.box_y1 = y1 + 1;
+  patch.reach = (table->max_range + table->range_step) / map->scale + 2;
+  for(int k = 0; k < table->angle_count; k++)
+  {
+    patch.cos_a.push_back(cos(k * 2 * M_PI / table->angle_count));
+    patch.sin_a.push_back(sin(k * 2 * M_PI / table->angle_count));
+  }
+  range_table_fill(updated, map, thread_count, &patch);
+  return updated;
+}
+
+// Destroy a range table
+void map_range_table_free(map_range_table_t *table)
+{
+  if(table == NULL)
+    return;
+  if(table->mapping)
+    munmap(table->mapping, table->mapping_size);
+  else
+    free(table->memory);
+  free(table);
+}
+
+// Range reading from the table
+double map_range_table_lookup(const map_range_table_t *table, map_t *map,
+                              double ox, double oy, double oa)
+{
+  int i = MAP_GXWX(map, ox);
+  int j = MAP_GYWY(map, oy);
+  if(!MAP_VALID(map, i, j))
+    return 0.0;
+
+  size_t n;
+  if(!range_table_rank(table, MAP_INDEX(map, i, j), &n))
+    return 0.0;
+
+  // Nearest bearing, wrapped into [0, angle_count)
+  int k = (int) floor(oa * table->angle_count / (2 * M_PI) + 0.5) % table->angle_count;
+  if(k < 0)
+    k += table->angle_count;
+
+  const uint8_t *ranges = (const uint8_t*) table->memory + table->range_offset;
+  unsigned int code = load_code(table, ranges, n * table->angle_count + k);
+  if(code == range_code_max(table->bytes_per_range))
+    return table->max_range;
+  return code * table->range_step;
+}
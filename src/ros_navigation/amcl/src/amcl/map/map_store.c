@@ -43,7 +43,6 @@ int map_load_occ(map_t *map, const char *filename, double scale, int negate)
   int i, j;
   int ch, occ;
   int width, height, depth;
-  map_cell_t *cell;
 
   // Open file
   file = fopen(filename, "r");
@@ -75,12 +74,14 @@ int map_load_occ(map_t *map, const char *filename, double scale, int negate)
   }
 
   // Allocate space in the map
-  if (map->cells == NULL)
+  if (map->occ_state == NULL)
   {
     map->scale = scale;
-    map->size_x = width;
-    map->size_y = height;
-    map->cells = calloc(width * height, sizeof(map->cells[0]));
+    if (map_alloc_cells(map, width, height) != 0)
+    {
+      fclose(file);
+      return -1;
+    }
   }
   else
   {
@@ -122,8 +123,7 @@ int map_load_occ(map_t *map, const char *filename, double scale, int negate)
 
       if (!MAP_VALID(map, i, j))
         continue;
-      cell = map->cells + MAP_INDEX(map, i, j);
-      cell->occ_state = occ;
+      MAP_OCC_STATE(map, MAP_INDEX(map, i, j)) = occ;
     }
   }
   
@@ -133,6 +133,103 @@ int map_load_occ(map_t *map, const char *filename, double scale, int negate)
 }
 
 
+////////////////////////////////////////////////////////////////////////////
+// Load an occupancy grid with map_server's thresholds
+int map_load_pgm(map_t *map, const char *filename, double scale, int negate,
+                 double occupied_thresh, double free_thresh)
+{
+  FILE *file;
+  char magic[3];
+  int i, j, ch;
+  int width, height, depth;
+  int header[3];
+  unsigned char *row;
+  int8_t lookup[256];
+
+  file = fopen(filename, "rb");
+  if (file == NULL)
+  {
+    fprintf(stderr, "%s: %s\n", strerror(errno), filename);
+    return -1;
+  }
+
+  if ((fscanf(file, "%2s", magic) != 1) || (strcmp(magic, "P5") != 0))
+  {
+    fprintf(stderr, "%s: incorrect image format; must be PGM/binary\n", filename);
+    fclose(file);
+    return -1;
+  }
+
+  // Width, height and depth, each of which may follow comments
+  for (i = 0; i < 3; i++)
+  {
+    while ((ch = fgetc(file)) == '#' || ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r')
+      if (ch == '#')
+        while ((ch = fgetc(file)) != '\n' && ch != EOF);
+    ungetc(ch, file);
+    if (fscanf(file, "%d", &header[i]) != 1)
+    {
+      fprintf(stderr, "%s: failed to read image dimensions\n", filename);
+      fclose(file);
+      return -1;
+    }
+  }
+  width = header[0];
+  height = header[1];
+  depth = header[2];
+  fgetc(file);
+  if (width <= 0 || height <= 0 || depth <= 0 || depth > 255)
+  {
+    fprintf(stderr, "%s: unsupported image size or depth\n", filename);
+    fclose(file);
+    return -1;
+  }
+
+  // Occupancy of every pixel value
+  for (i = 0; i < 256; i++)
+  {
+    double p = negate ? (double) i / depth : (double) (depth - i) / depth;
+    if (p > occupied_thresh)
+      lookup[i] = +1;
+    else if (p < free_thresh)
+      lookup[i] = -1;
+    else
+      lookup[i] = 0;
+  }
+
+  map->scale = scale;
+  if (map_alloc_cells(map, width, height) != 0)
+  {
+    fclose(file);
+    return -1;
+  }
+
+  // The image starts with the top row
+  row = malloc(width);
+  if (row == NULL)
+  {
+    fclose(file);
+    return -1;
+  }
+  for (j = height - 1; j >= 0; j--)
+  {
+    if (fread(row, 1, width, file) != (size_t) width)
+    {
+      fprintf(stderr, "%s: image is truncated\n", filename);
+      free(row);
+      fclose(file);
+      return -1;
+    }
+    for (i = 0; i < width; i++)
+      map->occ_state[MAP_INDEX(map, i, j)] = lookup[row[i]];
+  }
+
+  free(row);
+  fclose(file);
+  return 0;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////
 // Load a wifi signal strength map
 /*
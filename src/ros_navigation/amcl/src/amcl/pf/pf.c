@@ -39,22 +39,72 @@
 // with samples in them.
 static int pf_resample_limit(pf_t *pf, int k);
 
+// Weight of a new measurement in the per-sample cost averages
+#define PF_COST_ALPHA 0.2
+
+// Monotonic clock, in seconds
+static double pf_clock(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Fold a measured cost per sample into a running average
+static void pf_update_cost(double *cost, double seconds, int samples)
+{
+  if (samples <= 0)
+    return;
+  if (*cost == 0.0)
+    *cost = seconds / samples;
+  else
+    *cost += PF_COST_ALPHA * (seconds / samples - *cost);
+}
+
+// Fold the average weight of an observation into the running averages
+// that decide on recovery (Prob Rob p258)
+static void pf_update_averages(pf_t *pf, double w_avg)
+{
+  if(pf->w_slow == 0.0)
+    pf->w_slow = w_avg;
+  else
+    pf->w_slow += pf->alpha_slow * (w_avg - pf->w_slow);
+  if(pf->w_fast == 0.0)
+    pf->w_fast = w_avg;
+  else
+    pf->w_fast += pf->alpha_fast * (w_avg - pf->w_fast);
+}
+
 
 
 // Create a new filter
 pf_t *pf_alloc(int min_samples, int max_samples,
                double alpha_slow, double alpha_fast,
                pf_init_model_fn_t random_pose_fn, void *random_pose_data)
+{
+  return pf_alloc_histogram(min_samples, max_samples, alpha_slow, alpha_fast,
+                            random_pose_fn, random_pose_data, PF_KDTREE_TREE);
+}
+
+
+// Create a new filter with the given histogram storage
+pf_t *pf_alloc_histogram(int min_samples, int max_samples,
+                         double alpha_slow, double alpha_fast,
+                         pf_init_model_fn_t random_pose_fn, void *random_pose_data,
+                         pf_kdtree_type_t histogram_type)
 {
   int i, j;
   pf_t *pf;
   pf_sample_set_t *set;
   pf_sample_t *sample;
   
+  // Random pose generators may still use drand48()
   srand48(time(NULL));
 
   pf = calloc(1, sizeof(pf_t));
 
+  pf_random_seed(&pf->rng, (uint64_t) time(NULL));
+
   pf->random_pose_fn = random_pose_fn;
   pf->random_pose_data = random_pose_data;
 
@@ -87,8 +137,12 @@ pf_t *pf_alloc(int min_samples, int max_samples,
       sample->weight = 1.0 / max_samples;
     }
 
-    // HACK: is 3 times max_samples enough?
-    set->kdtree = pf_kdtree_alloc(3 * max_samples);
+    // HACK: is 3 times max_samples enough?  (The hash table only holds
+    // leaves, so max_samples bins will do there.)
+    if (histogram_type == PF_KDTREE_HASH)
+      set->kdtree = pf_kdtree_alloc_type(max_samples, PF_KDTREE_HASH);
+    else
+      set->kdtree = pf_kdtree_alloc(3 * max_samples);
 
     set->cluster_count = 0;
     set->cluster_max_count = max_samples;
@@ -104,6 +158,15 @@ pf_t *pf_alloc(int min_samples, int max_samples,
   pf->alpha_slow = alpha_slow;
   pf->alpha_fast = alpha_fast;
 
+  pf->resample_model = PF_RESAMPLE_MULTINOMIAL;
+  pf->resample_cdf = calloc(max_samples + 1, sizeof(double));
+  pf->resample_prob = calloc(max_samples, sizeof(double));
+  pf->resample_index = calloc(max_samples, sizeof(int));
+  pf->resample_work = calloc(max_samples, sizeof(int));
+
+  pf->time_budget = 0.0;
+  pf->budget_samples = max_samples;
+
   //set converged to 0
   pf_init_converged(pf);
 
@@ -121,6 +184,10 @@ void pf_free(pf_t *pf)
     pf_kdtree_free(pf->sets[i].kdtree);
     free(pf->sets[i].samples);
   }
+  free(pf->resample_cdf);
+  free(pf->resample_prob);
+  free(pf->resample_index);
+  free(pf->resample_work);
   free(pf);
   
   return;
@@ -142,6 +209,7 @@ void pf_init(pf_t *pf, pf_vector_t mean, pf_matrix_t cov)
   set->sample_count = pf->max_samples;
 
   pdf = pf_pdf_gaussian_alloc(mean, cov);
+  pdf->rng = &pf->rng;
     
   // Compute the new sample poses
   for (i = 0; i < set->sample_count; i++)
@@ -264,12 +332,14 @@ void pf_update_sensor(pf_t *pf, pf_sensor_model_fn_t sensor_fn, void *sensor_dat
   int i;
   pf_sample_set_t *set;
   pf_sample_t *sample;
-  double total;
+  double total, start;
 
   set = pf->sets + pf->current_set;
 
   // Compute the sample weights
+  start = pf_clock();
   total = (*sensor_fn) (sensor_data, set);
+  pf_update_cost(&pf->sensor_cost, pf_clock() - start, set->sample_count);
   
   if (total > 0.0)
   {
@@ -281,16 +351,9 @@ void pf_update_sensor(pf_t *pf, pf_sensor_model_fn_t sensor_fn, void *sensor_dat
       w_avg += sample->weight;
       sample->weight /= total;
     }
-    // Update running averages of likelihood of samples (Prob Rob p258)
+    // Update running averages of likelihood of samples
     w_avg /= set->sample_count;
-    if(pf->w_slow == 0.0)
-      pf->w_slow = w_avg;
-    else
-      pf->w_slow += pf->alpha_slow * (w_avg - pf->w_slow);
-    if(pf->w_fast == 0.0)
-      pf->w_fast = w_avg;
-    else
-      pf->w_fast += pf->alpha_fast * (w_avg - pf->w_fast);
+    pf_update_averages(pf, w_avg);
     //printf("w_avg: %e slow: %e fast: %e\n", 
            //w_avg, pf->w_slow, pf->w_fast);
   }
@@ -308,31 +371,237 @@ void pf_update_sensor(pf_t *pf, pf_sensor_model_fn_t sensor_fn, void *sensor_dat
 }
 
 
+// Update the filter with several sensor observations at once
+void pf_update_sensor_fused(pf_t *pf, pf_sensor_model_fn_t sensor_fn, void *sensor_data,
+                            const double *totals, int count)
+{
+  int i, k;
+  pf_sample_set_t *set;
+  pf_sample_t *sample;
+  double total, start, prev;
+
+  set = pf->sets + pf->current_set;
+
+  // Compute the sample weights
+  start = pf_clock();
+  total = (*sensor_fn) (sensor_data, set);
+  pf_update_cost(&pf->sensor_cost, pf_clock() - start, set->sample_count);
+
+  if (total > 0.0)
+  {
+    for (i = 0; i < set->sample_count; i++)
+    {
+      sample = set->samples + i;
+      sample->weight /= total;
+    }
+
+    // Had the weights been normalized after each observation, the next
+    // would have averaged totals[k] / totals[k - 1] / sample_count
+    prev = 1.0;
+    for (k = 0; k < count && totals[k] > 0.0; k++)
+    {
+      pf_update_averages(pf, totals[k] / prev / set->sample_count);
+      prev = totals[k];
+    }
+  }
+  else
+  {
+    // Handle zero total
+    for (i = 0; i < set->sample_count; i++)
+    {
+      sample = set->samples + i;
+      sample->weight = 1.0 / set->sample_count;
+    }
+  }
+
+  return;
+}
+
+
+// Seed the random number generator
+void pf_set_seed(pf_t *pf, uint64_t seed)
+{
+  pf_random_seed(&pf->rng, seed);
+}
+
+
+// Select the resampling scheme
+void pf_set_time_budget(pf_t *pf, double budget)
+{
+  pf->time_budget = (budget > 0.0) ? budget : 0.0;
+}
+
+
+void pf_set_resample_model(pf_t *pf, pf_resample_model_t model)
+{
+  pf->resample_model = model;
+}
+
+
+// Build the tables the resampling scheme draws from.  All of them take
+// O(n) time, where n is the size of set.
+static void pf_resample_prepare(pf_t *pf, pf_sample_set_t *set)
+{
+  int i, n, m;
+  double *c;
+
+  n = set->sample_count;
+
+  // Cumulative probability table, used by all schemes
+  c = pf->resample_cdf;
+  c[0] = 0.0;
+  for(i=0;i<n;i++)
+    c[i+1] = c[i]+set->samples[i].weight;
+
+  if(pf->resample_model == PF_RESAMPLE_SYSTEMATIC)
+  {
+    // Low-variance resampler, taken from Probabilistic Robotics, p110,
+    // with one tooth for each sample we could possibly need
+    double step, u;
+    int k, last;
+
+    // Teeth past the total weight (by rounding) go to the last sample
+    // that has any weight
+    last = n - 1;
+    while(last > 0 && !(set->samples[last].weight > 0))
+      last--;
+
+    m = pf->max_samples;
+    step = c[n] / m;
+    u = pf_random_uniform(&pf->rng) * step;
+    i = 0;
+    for(k = 0; k < m; k++, u += step)
+    {
+      while(i < last && c[i+1] <= u)
+        i++;
+      pf->resample_index[k] = i;
+    }
+  }
+  else if(pf->resample_model == PF_RESAMPLE_ALIAS)
+  {
+    // Vose's construction of the alias table; small entries are stacked
+    // from the front of the work array and large ones from the back
+    double *prob = pf->resample_prob;
+    int *alias = pf->resample_index;
+    int *work = pf->resample_work;
+    int small = 0, large = n;
+
+    for(i=0;i<n;i++)
+    {
+      prob[i] = set->samples[i].weight * n / c[n];
+      alias[i] = i;
+      if(prob[i] < 1.0)
+        work[small++] = i;
+      else
+        work[--large] = i;
+    }
+    while(small > 0 && large < n)
+    {
+      int s = work[--small];
+      int l = work[large++];
+      alias[s] = l;
+      prob[l] = (prob[l] + prob[s]) - 1.0;
+      if(prob[l] < 1.0)
+        work[small++] = l;
+      else
+        work[--large] = l;
+    }
+    // Whatever is left is 1 up to rounding
+    while(small > 0)
+      prob[work[--small]] = 1.0;
+    while(large < n)
+      prob[work[large++]] = 1.0;
+  }
+}
+
+
+// Pick the parent for the k-th resampled (non-random) sample
+static int pf_resample_draw(pf_t *pf, pf_sample_set_t *set, int k)
+{
+  int i, n;
+
+  n = set->sample_count;
+
+  if(pf->resample_model == PF_RESAMPLE_SYSTEMATIC)
+  {
+    // Incremental Fisher-Yates shuffle of the comb: every prefix is a
+    // uniformly random subset of the teeth
+    int m = pf->max_samples;
+    int j;
+    if(k >= m)
+      return pf->resample_index[(int)(pf_random_uniform(&pf->rng) * m)];
+    j = k + (int)(pf_random_uniform(&pf->rng) * (m - k));
+    i = pf->resample_index[j];
+    pf->resample_index[j] = pf->resample_index[k];
+    pf->resample_index[k] = i;
+    return i;
+  }
+  else if(pf->resample_model == PF_RESAMPLE_ALIAS)
+  {
+    double u = pf_random_uniform(&pf->rng) * n;
+    i = (int) u;
+    if(i >= n)
+      i = n - 1;
+    if(u - i < pf->resample_prob[i])
+      return i;
+    return pf->resample_index[i];
+  }
+  else
+  {
+    // Find the i with c[i] <= r < c[i+1]; the same sample the original
+    // linear search picked
+    double *c = pf->resample_cdf;
+    double r = pf_random_uniform(&pf->rng);
+    int lo = 0, hi = n;
+    while(hi - lo > 1)
+    {
+      int mid = (lo + hi) / 2;
+      if(c[mid] <= r)
+        lo = mid;
+      else
+        hi = mid;
+    }
+    i = lo;
+
+    // r can land beyond the total weight by rounding; take the last
+    // sample that has any weight
+    while(i > 0 && !(set->samples[i].weight > 0))
+      i--;
+    return i;
+  }
+}
+
+
 // Resample the distribution
 void pf_update_resample(pf_t *pf)
 {
-  int i;
-  double total;
+  int i, k, limit;
+  double total, start, cost;
   pf_sample_set_t *set_a, *set_b;
   pf_sample_t *sample_a, *sample_b;
 
-  //double r,c,U;
-  //int m;
-  //double count_inv;
-  double* c;
-
   double w_diff;
 
+  start = pf_clock();
+
+  // Samples the time budget allows, at the cost measured so far
+  pf->budget_samples = pf->max_samples;
+  pf->budget_limited = 0;
+  pf->kld_samples = 0;
+  cost = pf->sensor_cost + pf->resample_cost;
+  if (pf->time_budget > 0.0 && cost > 0.0 && pf->time_budget / cost < pf->max_samples)
+  {
+    pf->budget_samples = (int) (pf->time_budget / cost);
+    if (pf->budget_samples < pf->min_samples)
+      pf->budget_samples = pf->min_samples;
+  }
+
   set_a = pf->sets + pf->current_set;
   set_b = pf->sets + (pf->current_set + 1) % 2;
 
-  // Build up cumulative probability table for resampling.
-  // TODO: Replace this with a more efficient procedure
-  // (e.g., http://www.network-theory.co.uk/docs/gslref/GeneralDiscreteDistributions.html)
-  c = (double*)malloc(sizeof(double)*(set_a->sample_count+1));
-  c[0] = 0.0;
-  for(i=0;i<set_a->sample_count;i++)
-    c[i+1] = c[i]+set_a->samples[i].weight;
+  // Build up the tables for picking parents.  These live in the filter,
+  // so nothing is allocated here.
+  pf_resample_prepare(pf, set_a);
 
   // Create the kd tree for adaptive sampling
   pf_kdtree_clear(set_b->kdtree);
@@ -346,56 +615,16 @@ void pf_update_resample(pf_t *pf)
     w_diff = 0.0;
   //printf("w_diff: %9.6f\n", w_diff);
 
-  // Can't (easily) combine low-variance sampler with KLD adaptive
-  // sampling, so we'll take the more traditional route.
-  /*
-  // Low-variance resampler, taken from Probabilistic Robotics, p110
-  count_inv = 1.0/set_a->sample_count;
-  r = drand48() * count_inv;
-  c = set_a->samples[0].weight;
-  i = 0;
-  m = 0;
-  */
+  k = 0;
   while(set_b->sample_count < pf->max_samples)
   {
     sample_b = set_b->samples + set_b->sample_count++;
 
-    if(drand48() < w_diff)
+    if(pf_random_uniform(&pf->rng) < w_diff)
       sample_b->pose = (pf->random_pose_fn)(pf->random_pose_data);
     else
     {
-      // Can't (easily) combine low-variance sampler with KLD adaptive
-      // sampling, so we'll take the more traditional route.
-      /*
-      // Low-variance resampler, taken from Probabilistic Robotics, p110
-      U = r + m * count_inv;
-      while(U>c)
-      {
-        i++;
-        // Handle wrap-around by resetting counters and picking a new random
-        // number
-        if(i >= set_a->sample_count)
-        {
-          r = drand48() * count_inv;
-          c = set_a->samples[0].weight;
-          i = 0;
-          m = 0;
-          U = r + m * count_inv;
-          continue;
-        }
-        c += set_a->samples[i].weight;
-      }
-      m++;
-      */
-
-      // Naive discrete event sampler
-      double r;
-      r = drand48();
-      for(i=0;i<set_a->sample_count;i++)
-      {
-        if((c[i] <= r) && (r < c[i+1]))
-          break;
-      }
+      i = pf_resample_draw(pf, set_a, k++);
       assert(i<set_a->sample_count);
 
       sample_a = set_a->samples + i;
@@ -412,9 +641,17 @@ void pf_update_resample(pf_t *pf)
     // Add sample to histogram
     pf_kdtree_insert(set_b->kdtree, sample_b->pose, sample_b->weight);
 
-    // See if we have enough samples yet
-    if (set_b->sample_count > pf_resample_limit(pf, set_b->kdtree->leaf_count))
+    // See if we have enough samples yet, or as many as we can afford
+    limit = pf_resample_limit(pf, set_b->kdtree->leaf_count);
+    if (set_b->sample_count > limit)
       break;
+    if (set_b->sample_count >= pf->budget_samples &&
+        pf->budget_samples < pf->max_samples)
+    {
+      pf->budget_limited = 1;
+      pf->kld_samples = limit;
+      break;
+    }
   }
   
   // Reset averages, to avoid spiraling off into complete randomness.
@@ -438,7 +675,8 @@ void pf_update_resample(pf_t *pf)
 
   pf_update_converged(pf);
 
-  free(c);
+  pf_update_cost(&pf->resample_cost, pf_clock() - start, set_b->sample_count);
+
   return;
 }
 
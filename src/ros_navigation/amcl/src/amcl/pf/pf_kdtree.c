@@ -48,6 +48,20 @@ static pf_kdtree_node_t *pf_kdtree_find_node(pf_kdtree_t *self, pf_kdtree_node_t
 // Recursively label nodes in this cluster
 static void pf_kdtree_cluster_node(pf_kdtree_t *self, pf_kdtree_node_t *node, int depth);
 
+// Compute the bin key for a pose
+static void pf_kdtree_key(pf_kdtree_t *self, pf_vector_t pose, int key[]);
+
+// Slot in the hash table for the given key
+static unsigned int pf_kdtree_hash(pf_kdtree_t *self, int key[]);
+
+// Hash table insertion and search
+static void pf_kdtree_hash_insert(pf_kdtree_t *self, int key[], double value);
+static pf_kdtree_node_t *pf_kdtree_hash_find(pf_kdtree_t *self, int key[]);
+
+// Union-find root of a bin, and labelling of the bins in the hash table
+static int pf_kdtree_cluster_find(pf_kdtree_t *self, int i);
+static void pf_kdtree_hash_cluster(pf_kdtree_t *self);
+
 // Recursive node printing
 //static void pf_kdtree_print_node(pf_kdtree_t *self, pf_kdtree_node_t *node);
 
@@ -65,10 +79,21 @@ static void pf_kdtree_draw_node(pf_kdtree_t *self, pf_kdtree_node_t *node, rtk_f
 // Create a tree
 pf_kdtree_t *pf_kdtree_alloc(int max_size)
 {
+  return pf_kdtree_alloc_type(max_size, PF_KDTREE_TREE);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Create a histogram with the given storage scheme
+pf_kdtree_t *pf_kdtree_alloc_type(int max_size, pf_kdtree_type_t type)
+{
+  int i, slot_count;
   pf_kdtree_t *self;
 
   self = calloc(1, sizeof(pf_kdtree_t));
 
+  self->type = type;
+
   self->size[0] = 0.50;
   self->size[1] = 0.50;
   self->size[2] = (10 * M_PI / 180);
@@ -81,6 +106,19 @@ pf_kdtree_t *pf_kdtree_alloc(int max_size)
 
   self->leaf_count = 0;
 
+  if (self->type == PF_KDTREE_HASH)
+  {
+    // Keep the load factor at or below 1/2
+    slot_count = 1;
+    while (slot_count < 2 * max_size)
+      slot_count *= 2;
+    self->hash_mask = slot_count - 1;
+    self->hash_slots = malloc(slot_count * sizeof(int));
+    for (i = 0; i < slot_count; i++)
+      self->hash_slots[i] = -1;
+    self->cluster_parent = calloc(max_size, sizeof(int));
+  }
+
   return self;
 }
 
@@ -89,6 +127,8 @@ pf_kdtree_t *pf_kdtree_alloc(int max_size)
 // Destroy a tree
 void pf_kdtree_free(pf_kdtree_t *self)
 {
+  free(self->hash_slots);
+  free(self->cluster_parent);
   free(self->nodes);
   free(self);
   return;
@@ -99,6 +139,22 @@ void pf_kdtree_free(pf_kdtree_t *self)
 // Clear all entries from the tree
 void pf_kdtree_clear(pf_kdtree_t *self)
 {
+  int i;
+  unsigned int slot;
+
+  // Empty the slots in the reverse order they were filled: the probe
+  // sequence of each key then only crosses slots that are still taken
+  if (self->type == PF_KDTREE_HASH)
+  {
+    for (i = self->node_count - 1; i >= 0; i--)
+    {
+      slot = pf_kdtree_hash(self, self->nodes[i].key);
+      while (self->hash_slots[slot] != i)
+        slot = (slot + 1) & self->hash_mask;
+      self->hash_slots[slot] = -1;
+    }
+  }
+
   self->root = NULL;
   self->leaf_count = 0;
   self->node_count = 0;
@@ -113,9 +169,13 @@ void pf_kdtree_insert(pf_kdtree_t *self, pf_vector_t pose, double value)
 {
   int key[3];
 
-  key[0] = floor(pose.v[0] / self->size[0]);
-  key[1] = floor(pose.v[1] / self->size[1]);
-  key[2] = floor(pose.v[2] / self->size[2]);
+  pf_kdtree_key(self, pose, key);
+
+  if (self->type == PF_KDTREE_HASH)
+  {
+    pf_kdtree_hash_insert(self, key, value);
+    return;
+  }
 
   self->root = pf_kdtree_insert_node(self, NULL, self->root, key, value);
 
@@ -152,11 +212,12 @@ double pf_kdtree_get_prob(pf_kdtree_t *self, pf_vector_t pose)
   int key[3];
   pf_kdtree_node_t *node;
 
-  key[0] = floor(pose.v[0] / self->size[0]);
-  key[1] = floor(pose.v[1] / self->size[1]);
-  key[2] = floor(pose.v[2] / self->size[2]);
+  pf_kdtree_key(self, pose, key);
 
-  node = pf_kdtree_find_node(self, self->root, key);
+  if (self->type == PF_KDTREE_HASH)
+    node = pf_kdtree_hash_find(self, key);
+  else
+    node = pf_kdtree_find_node(self, self->root, key);
   if (node == NULL)
     return 0.0;
   return node->value;
@@ -170,11 +231,12 @@ int pf_kdtree_get_cluster(pf_kdtree_t *self, pf_vector_t pose)
   int key[3];
   pf_kdtree_node_t *node;
 
-  key[0] = floor(pose.v[0] / self->size[0]);
-  key[1] = floor(pose.v[1] / self->size[1]);
-  key[2] = floor(pose.v[2] / self->size[2]);
+  pf_kdtree_key(self, pose, key);
 
-  node = pf_kdtree_find_node(self, self->root, key);
+  if (self->type == PF_KDTREE_HASH)
+    node = pf_kdtree_hash_find(self, key);
+  else
+    node = pf_kdtree_find_node(self, self->root, key);
   if (node == NULL)
     return -1;
   return node->cluster;
@@ -361,6 +423,12 @@ void pf_kdtree_cluster(pf_kdtree_t *self)
   int queue_count, cluster_count;
   pf_kdtree_node_t **queue, *node;
 
+  if (self->type == PF_KDTREE_HASH)
+  {
+    pf_kdtree_hash_cluster(self);
+    return;
+  }
+
   queue_count = 0;
   queue = calloc(self->node_count, sizeof(queue[0]));
 
@@ -440,12 +508,178 @@ void pf_kdtree_cluster_node(pf_kdtree_t *self, pf_kdtree_node_t *node, int depth
 
 
 
+////////////////////////////////////////////////////////////////////////////////
+// Compute the bin key for a pose
+void pf_kdtree_key(pf_kdtree_t *self, pf_vector_t pose, int key[])
+{
+  key[0] = floor(pose.v[0] / self->size[0]);
+  key[1] = floor(pose.v[1] / self->size[1]);
+  key[2] = floor(pose.v[2] / self->size[2]);
+  return;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Slot in the hash table for the given key
+unsigned int pf_kdtree_hash(pf_kdtree_t *self, int key[])
+{
+  unsigned int h;
+
+  // Spatial hash (Teschner et al. 2003), with a final mix so that the
+  // low bits depend on all of the key
+  h = ((unsigned int) key[0] * 73856093u) ^
+      ((unsigned int) key[1] * 19349663u) ^
+      ((unsigned int) key[2] * 83492791u);
+  h ^= h >> 16;
+  h *= 0x45d9f3bu;
+  h ^= h >> 16;
+
+  return h & self->hash_mask;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Add to the bin for this key, creating it if need be
+void pf_kdtree_hash_insert(pf_kdtree_t *self, int key[], double value)
+{
+  int i;
+  unsigned int slot;
+  pf_kdtree_node_t *node;
+
+  slot = pf_kdtree_hash(self, key);
+  while ((i = self->hash_slots[slot]) >= 0)
+  {
+    node = self->nodes + i;
+    if (pf_kdtree_equal(self, key, node->key))
+    {
+      node->value += value;
+      return;
+    }
+    slot = (slot + 1) & self->hash_mask;
+  }
+
+  assert(self->node_count < self->node_max_count);
+  i = self->node_count++;
+  node = self->nodes + i;
+  memset(node, 0, sizeof(pf_kdtree_node_t));
+  node->leaf = 1;
+  node->key[0] = key[0];
+  node->key[1] = key[1];
+  node->key[2] = key[2];
+  node->value = value;
+  self->hash_slots[slot] = i;
+  self->leaf_count += 1;
+
+  return;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Find the bin for this key
+pf_kdtree_node_t *pf_kdtree_hash_find(pf_kdtree_t *self, int key[])
+{
+  int i;
+  unsigned int slot;
+
+  slot = pf_kdtree_hash(self, key);
+  while ((i = self->hash_slots[slot]) >= 0)
+  {
+    if (pf_kdtree_equal(self, key, self->nodes[i].key))
+      return self->nodes + i;
+    slot = (slot + 1) & self->hash_mask;
+  }
+  return NULL;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Root of the union-find set containing bin i, halving the path on the way
+int pf_kdtree_cluster_find(pf_kdtree_t *self, int i)
+{
+  int *parent = self->cluster_parent;
+
+  while (parent[i] != i)
+  {
+    parent[i] = parent[parent[i]];
+    i = parent[i];
+  }
+  return i;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Label the bins in the hash table.  Bins are joined with every occupied
+// neighbour (the same 26-neighbourhood as the tree uses), so the clusters
+// are the same connected components.  Each set is rooted at its oldest
+// bin, which makes the labels follow the order the bins were created in.
+void pf_kdtree_hash_cluster(pf_kdtree_t *self)
+{
+  int i, j, n;
+  int a, b;
+  int nkey[3];
+  int cluster_count;
+  pf_kdtree_node_t *node, *nnode;
+
+  for (i = 0; i < self->node_count; i++)
+    self->cluster_parent[i] = i;
+
+  for (i = 0; i < self->node_count; i++)
+  {
+    node = self->nodes + i;
+
+    // Union is symmetric, so only the 13 neighbours that come after this
+    // bin (in key order) need looking at
+    for (n = 3 * 3 * 3 / 2 + 1; n < 3 * 3 * 3; n++)
+    {
+      nkey[0] = node->key[0] + (n / 9) - 1;
+      nkey[1] = node->key[1] + ((n % 9) / 3) - 1;
+      nkey[2] = node->key[2] + ((n % 9) % 3) - 1;
+
+      nnode = pf_kdtree_hash_find(self, nkey);
+      if (nnode == NULL)
+        continue;
+
+      j = nnode - self->nodes;
+      a = pf_kdtree_cluster_find(self, i);
+      b = pf_kdtree_cluster_find(self, j);
+      if (a < b)
+        self->cluster_parent[b] = a;
+      else if (b < a)
+        self->cluster_parent[a] = b;
+    }
+  }
+
+  // Roots come before the rest of their set
+  cluster_count = 0;
+  for (i = 0; i < self->node_count; i++)
+  {
+    a = pf_kdtree_cluster_find(self, i);
+    if (a == i)
+      self->nodes[i].cluster = cluster_count++;
+    else
+      self->nodes[i].cluster = self->nodes[a].cluster;
+  }
+
+  return;
+}
+
+
+
 #ifdef INCLUDE_RTKGUI
 
 ////////////////////////////////////////////////////////////////////////////////
 // Draw the tree
 void pf_kdtree_draw(pf_kdtree_t *self, rtk_fig_t *fig)
 {
+  int i;
+
+  if (self->type == PF_KDTREE_HASH)
+  {
+    for (i = 0; i < self->node_count; i++)
+      pf_kdtree_draw_node(self, self->nodes + i, fig);
+    return;
+  }
+
   if (self->root != NULL)
     pf_kdtree_draw_node(self, self->root, fig);
   return;
@@ -111,8 +111,10 @@ pf_vector_t pf_pdf_gaussian_sample(pf_pdf_gaussian_t *pdf)
   // Generate a random vector
   for (i = 0; i < 3; i++)
   {
-    //r.v[i] = gsl_ran_gaussian(pdf->rng, pdf->cd.v[i]);
-    r.v[i] = pf_ran_gaussian(pdf->cd.v[i]);
+    if (pdf->rng)
+      r.v[i] = pf_random_gaussian(pdf->rng, pdf->cd.v[i]);
+    else
+      r.v[i] = pf_ran_gaussian(pdf->cd.v[i]);
   }
 
   for (i = 0; i < 3; i++)
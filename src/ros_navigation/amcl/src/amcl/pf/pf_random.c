@@ -0,0 +1,125 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey   &  Kasper Stoy
+ *                      gerkey@usc.edu    kaspers@robotics.usc.edu
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+/**************************************************************************
+ * Desc: Seedable random number generator for the filter
+ *************************************************************************/
+
+#include <math.h>
+
+#include "amcl/pf/pf_random.h"
+
+
+static uint64_t pf_random_rotl(uint64_t x, int k)
+{
+  return (x << k) | (x >> (64 - k));
+}
+
+
+// Seed the generator.  splitmix64 spreads the seed over the whole
+// state, so it is never all zero.
+void pf_random_seed(pf_random_t *rng, uint64_t seed)
+{
+  int i;
+  uint64_t z;
+
+  for (i = 0; i < 4; i++)
+  {
+    seed += 0x9e3779b97f4a7c15ULL;
+    z = seed;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    rng->s[i] = z ^ (z >> 31);
+  }
+}
+
+
+// Next raw output (xoshiro256**)
+uint64_t pf_random_next(pf_random_t *rng)
+{
+  uint64_t *s = rng->s;
+  uint64_t result = pf_random_rotl(s[1] * 5, 7) * 9;
+  uint64_t t = s[1] << 17;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = pf_random_rotl(s[3], 45);
+
+  return result;
+}
+
+
+// Uniform draw in [0, 1), from the top 53 bits
+double pf_random_uniform(pf_random_t *rng)
+{
+  return (pf_random_next(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+// Zero-mean Gaussian draw; the polar Box-Muller of pf_ran_gaussian()
+double pf_random_gaussian(pf_random_t *rng, double sigma)
+{
+  double x1, x2, w;
+
+  do
+  {
+    x1 = 2.0 * pf_random_uniform(rng) - 1.0;
+    x2 = 2.0 * pf_random_uniform(rng) - 1.0;
+    w = x1*x1 + x2*x2;
+  } while (w > 1.0 || w == 0.0);
+
+  return sigma * x2 * sqrt(-2.0 * log(w) / w);
+}
+
+
+// Standard normal draws in bulk
+void pf_random_gaussian_fill(pf_random_t *rng, double *out, int count)
+{
+  int i, pairs;
+  double tail[2];
+
+  // Uniform pairs: the first in (0, 1] so that its log is finite, the
+  // second in [0, 1)
+  pairs = count / 2;
+  for (i = 0; i < pairs; i++)
+  {
+    out[2*i] = 1.0 - pf_random_uniform(rng);
+    out[2*i+1] = pf_random_uniform(rng);
+  }
+
+  // Box-Muller on every pair; no rejection, so the loop has no branches
+  for (i = 0; i < pairs; i++)
+  {
+    double r = sqrt(-2.0 * log(out[2*i]));
+    double t = 2.0 * M_PI * out[2*i+1];
+    out[2*i] = r * cos(t);
+    out[2*i+1] = r * sin(t);
+  }
+
+  if (count % 2)
+  {
+    tail[0] = 1.0 - pf_random_uniform(rng);
+    tail[1] = pf_random_uniform(rng);
+    out[count-1] = sqrt(-2.0 * log(tail[0])) * cos(2.0 * M_PI * tail[1]);
+  }
+}
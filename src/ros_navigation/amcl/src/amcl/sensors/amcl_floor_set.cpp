@@ -0,0 +1,244 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Named floor maps, loaded on demand and evicted under a memory cap
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+
+#include "amcl/sensors/amcl_floor_set.h"
+
+using namespace amcl;
+
+////////////////////////////////////////////////////////////////////////////////
+// Default constructor
+AMCLFloorSet::AMCLFloorSet() :
+  clock(0), memory_limit(0), max_occ_dist(2.0),
+  cspace_method(MAP_CSPACE_BRUSHFIRE), thread_count(0)
+{
+}
+
+AMCLFloorSet::~AMCLFloorSet()
+{
+  for(std::map<std::string, Floor>::iterator it = this->floors.begin();
+      it != this->floors.end(); ++it)
+    this->Unload(&it->second);
+}
+
+void
+AMCLFloorSet::SetCspace(double max_occ_dist, map_cspace_method_t method,
+                        int thread_count, const std::string& cache_dir)
+{
+  if(max_occ_dist != this->max_occ_dist || method != this->cspace_method)
+  {
+    for(std::map<std::string, Floor>::iterator it = this->floors.begin();
+        it != this->floors.end(); ++it)
+      if(it->first != this->active)
+        this->Unload(&it->second);
+  }
+
+  this->max_occ_dist = max_occ_dist;
+  this->cspace_method = method;
+  this->thread_count = thread_count;
+  this->cache_dir = cache_dir;
+}
+
+void
+AMCLFloorSet::SetMemoryLimit(size_t bytes)
+{
+  this->memory_limit = bytes;
+  this->Evict();
+}
+
+bool
+AMCLFloorSet::AddFloor(const std::string& name, const amcl_floor_info_t& info)
+{
+  if(name == this->active)
+    return false;
+
+  Floor& floor = this->floors[name];
+  if(floor.map != NULL)
+    this->Unload(&floor);
+  floor.info = info;
+  floor.map = NULL;
+  floor.last_used = 0;
+  return true;
+}
+
+bool
+AMCLFloorSet::HasFloor(const std::string& name) const
+{
+  return this->floors.count(name) > 0;
+}
+
+std::vector<std::string>
+AMCLFloorSet::GetFloorNames() const
+{
+  std::vector<std::string> names;
+  for(std::map<std::string, Floor>::const_iterator it = this->floors.begin();
+      it != this->floors.end(); ++it)
+    names.push_back(it->first);
+  return names;
+}
+
+bool
+AMCLFloorSet::IsLoaded(const std::string& name) const
+{
+  std::map<std::string, Floor>::const_iterator it = this->floors.find(name);
+  return it != this->floors.end() && it->second.map != NULL;
+}
+
+map_t*
+AMCLFloorSet::GetActiveMap() const
+{
+  std::map<std::string, Floor>::const_iterator it = this->floors.find(this->active);
+  return (it != this->floors.end()) ? it->second.map : NULL;
+}
+
+const std::vector<std::pair<int, int> >&
+AMCLFloorSet::GetActiveFreeCells() const
+{
+  static const std::vector<std::pair<int, int> > none;
+  std::map<std::string, Floor>::const_iterator it = this->floors.find(this->active);
+  return (it != this->floors.end()) ? it->second.free_cells : none;
+}
+
+size_t
+AMCLFloorSet::GetMemoryUsed() const
+{
+  size_t bytes = 0;
+  for(std::map<std::string, Floor>::const_iterator it = this->floors.begin();
+      it != this->floors.end(); ++it)
+    bytes += FloorBytes(it->second);
+  return bytes;
+}
+
+// Pages of a mapped plane are shared and can be dropped by the kernel, but
+// they still count against the limit
+size_t
+AMCLFloorSet::FloorBytes(const Floor& floor)
+{
+  const map_t* map = floor.map;
+  if(map == NULL)
+    return 0;
+  size_t cells = (size_t)map->size_x * map->size_y;
+  size_t plane = 0;
+  if(map->occ_dist_mapping != NULL)
+    plane = map->occ_dist_mapping_size;
+  else if(map->occ_dist != NULL)
+    plane = cells + MAP_DIST_PAD;
+  return cells * sizeof(map->occ_state[0]) + plane +
+         floor.free_cells.capacity() * sizeof(floor.free_cells[0]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Switch floors
+map_t*
+AMCLFloorSet::Activate(const std::string& name)
+{
+  std::map<std::string, Floor>::iterator it = this->floors.find(name);
+  if(it == this->floors.end())
+    return NULL;
+
+  Floor& floor = it->second;
+  if(floor.map == NULL && !this->Load(&floor))
+    return NULL;
+
+  floor.last_used = ++this->clock;
+  this->active = name;
+  this->Evict();
+  return floor.map;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Read the image and build (or map) the distance plane
+bool
+AMCLFloorSet::Load(Floor* floor)
+{
+  const amcl_floor_info_t& info = floor->info;
+  map_t* map = map_alloc();
+  if(map_load_pgm(map, info.image.c_str(), info.resolution, info.negate ? 1 : 0,
+                  info.occupied_thresh, info.free_thresh) != 0)
+  {
+    map_free(map);
+    return false;
+  }
+
+  // Like the node's conversion of map messages, the origin is the centre
+  map->origin_x = info.origin_x + (map->size_x / 2) * map->scale;
+  map->origin_y = info.origin_y + (map->size_y / 2) * map->scale;
+
+  if(!this->cache_dir.empty())
+    map_update_cspace_cached(map, this->max_occ_dist, this->cspace_method,
+                             this->thread_count, this->cache_dir.c_str());
+  else if(this->cspace_method == MAP_CSPACE_EDT)
+    map_update_cspace_edt(map, this->max_occ_dist, this->thread_count);
+  else
+    map_update_cspace(map, this->max_occ_dist);
+  if(map->occ_dist == NULL)
+  {
+    fprintf(stderr, "Failed to build the distance plane of %s\n", info.image.c_str());
+    map_free(map);
+    return false;
+  }
+
+  floor->free_cells.clear();
+  for(int i = 0; i < map->size_x; i++)
+    for(int j = 0; j < map->size_y; j++)
+      if(map->occ_state[MAP_INDEX(map, i, j)] == -1)
+        floor->free_cells.push_back(std::make_pair(i, j));
+
+  floor->map = map;
+  return true;
+}
+
+void
+AMCLFloorSet::Unload(Floor* floor)
+{
+  if(floor->map != NULL)
+    map_free(floor->map);
+  floor->map = NULL;
+  std::vector<std::pair<int, int> >().swap(floor->free_cells);
+}
+
+void
+AMCLFloorSet::Evict()
+{
+  if(this->memory_limit == 0)
+    return;
+
+  while(this->GetMemoryUsed() > this->memory_limit)
+  {
+    Floor* oldest = NULL;
+    for(std::map<std::string, Floor>::iterator it = this->floors.begin();
+        it != this->floors.end(); ++it)
+    {
+      if(it->second.map == NULL || it->first == this->active)
+        continue;
+      if(oldest == NULL || it->second.last_used < oldest->last_used)
+        oldest = &it->second;
+    }
+    if(oldest == NULL)
+      break;
+    this->Unload(oldest);
+  }
+}
@@ -0,0 +1,414 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Global scan matcher for relocalization
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+#include <algorithm>
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "amcl/sensors/amcl_global_matcher.h"
+
+using namespace amcl;
+
+static bool better_match(const amcl_match_t& a, const amcl_match_t& b)
+{
+  return a.score > b.score;
+}
+
+// Floor of a / 2^shift, for negative a as well
+static int floor_shift(int a, int shift)
+{
+  int d = 1 << shift;
+  return (a >= 0) ? a / d : -((-a + d - 1) / d);
+}
+
+static double normalize_angle(double a)
+{
+  return atan2(sin(a), cos(a));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Default constructor
+AMCLGlobalMatcher::AMCLGlobalMatcher() :
+  map(NULL), depth(0), separation_distance(0.5), separation_angle(0.35),
+  max_points(200), angle_step(0), point_count(0), max_hypotheses(0),
+  min_score(0), node_count(0)
+{
+}
+
+void
+AMCLGlobalMatcher::SetSeparation(double distance, double angle)
+{
+  this->separation_distance = distance;
+  this->separation_angle = angle;
+}
+
+void
+AMCLGlobalMatcher::SetMaxPoints(int max_points)
+{
+  this->max_points = std::max(max_points, 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Build the pyramid
+void
+AMCLGlobalMatcher::SetMap(map_t* map, double sigma, int depth, int thread_count)
+{
+  this->map = map;
+  this->depth = std::max(depth, 0);
+  if(thread_count < 1)
+    thread_count = std::max(1, (int)boost::thread::hardware_concurrency());
+  if(thread_count > 1)
+    this->pool.reset(new AMCLThreadPool(thread_count));
+  else
+    this->pool.reset();
+
+  // Distances on a scratch copy of the map, so the likelihood field the
+  // laser uses is left alone
+  map_t scratch = *map;
+  scratch.occ_dist = NULL;
+  scratch.occ_dist_mapping = NULL;
+  scratch.occ_dist_mapping_size = 0;
+  map_update_cspace_edt(&scratch, 3 * sigma, thread_count);
+
+  unsigned char table[MAP_DIST_MAX + 1];
+  for(int c = 0; c <= MAP_DIST_MAX; c++)
+  {
+    double d = c * scratch.occ_dist_step;
+    table[c] = (c == MAP_DIST_MAX) ? 0 :
+      (unsigned char)floor(255 * exp(-d * d / (2 * sigma * sigma)) + 0.5);
+  }
+
+  int cell_count = map->size_x * map->size_y;
+  this->scores.assign(this->depth + 1, std::vector<unsigned char>());
+  this->free_blocks.assign(this->depth + 1, std::vector<unsigned char>());
+  this->level_x.assign(this->depth + 1, 0);
+  this->level_y.assign(this->depth + 1, 0);
+  this->scores[0].assign((map->size_x + 1) * (map->size_y + 1), 0);
+  for(int j = 0; j < map->size_y; j++)
+    for(int i = 0; i < map->size_x; i++)
+      this->scores[0][(i + 1) + (j + 1) * (map->size_x + 1)] =
+        table[scratch.occ_dist[MAP_INDEX(map, i, j)]];
+  this->level_x[0] = map->size_x;
+  this->level_y[0] = map->size_y;
+
+  // Maxima over aligned blocks, halving the size at every level
+  std::vector<unsigned char> aligned(cell_count), aligned_free(cell_count);
+  for(int i = 0; i < cell_count; i++)
+  {
+    aligned[i] = table[scratch.occ_dist[i]];
+    aligned_free[i] = (map->occ_state[i] == -1);
+  }
+  map_free_occ_dist(&scratch);
+
+  for(int h = 1; h <= this->depth; h++)
+  {
+    int px = this->level_x[h-1], py = this->level_y[h-1];
+    int sx = (px + 1) / 2, sy = (py + 1) / 2;
+    std::vector<unsigned char> next(sx * sy, 0), next_free(sx * sy, 0);
+    for(int j = 0; j < py; j++)
+      for(int i = 0; i < px; i++)
+      {
+        int k = (i / 2) + (j / 2) * sx;
+        next[k] = std::max(next[k], aligned[i + j * px]);
+        next_free[k] |= aligned_free[i + j * px];
+      }
+    aligned.swap(next);
+    aligned_free.swap(next_free);
+    this->level_x[h] = sx;
+    this->level_y[h] = sy;
+    this->free_blocks[h] = aligned_free;
+
+    // A block of translations moves a point over up to two aligned
+    // blocks in each direction; the padding row and column hold the
+    // blocks just below the map
+    std::vector<unsigned char>& level = this->scores[h];
+    level.assign((sx + 1) * (sy + 1), 0);
+    for(int j = -1; j < sy; j++)
+      for(int i = -1; i < sx; i++)
+      {
+        unsigned char m = 0;
+        for(int b = 0; b < 2; b++)
+          for(int a = 0; a < 2; a++)
+            if(i + a >= 0 && i + a < sx && j + b >= 0 && j + b < sy)
+              m = std::max(m, aligned[(i + a) + (j + b) * sx]);
+        level[(i + 1) + (j + 1) * (sx + 1)] = m;
+      }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Bound of the scores of a block of translations
+int
+AMCLGlobalMatcher::Bound(const DiscreteScan& scan, int level, int u, int v) const
+{
+  int sx = this->level_x[level], sy = this->level_y[level];
+  if(u < 0 || u >= sx || v < 0 || v >= sy)
+    return -1;
+  if(level == 0 ? MAP_OCC_STATE(this->map, MAP_INDEX(this->map, u, v)) != -1
+                : !this->free_blocks[level][u + v * sx])
+    return -1;
+
+  // Points at most one block off the map still count, through the padding
+  const unsigned char* grid = &this->scores[level][0];
+  const int* dx = &scan.dx[level * this->point_count];
+  const int* dy = &scan.dy[level * this->point_count];
+  int stride = sx + 1;
+  int sum = 0;
+  for(int i = 0; i < this->point_count; i++)
+  {
+    int x = u + dx[i] + 1;
+    int y = v + dy[i] + 1;
+    if(x >= 0 && x <= sx && y >= 0 && y <= sy)
+      sum += grid[x + y * stride];
+  }
+  return sum;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Add a hypothesis, keeping the best well separated ones
+double
+AMCLGlobalMatcher::Insert(const amcl_match_t& match)
+{
+  boost::mutex::scoped_lock lock(this->mutex);
+
+  bool merged = false;
+  for(size_t i = 0; i < this->best.size(); i++)
+  {
+    const amcl_match_t& other = this->best[i];
+    double d = hypot(match.pose.v[0] - other.pose.v[0], match.pose.v[1] - other.pose.v[1]);
+    double a = fabs(normalize_angle(match.pose.v[2] - other.pose.v[2]));
+    if(d < this->separation_distance && a < this->separation_angle)
+    {
+      if(match.score > other.score)
+        this->best[i] = match;
+      merged = true;
+      break;
+    }
+  }
+  if(!merged)
+    this->best.push_back(match);
+  std::sort(this->best.begin(), this->best.end(), better_match);
+  if((int)this->best.size() > this->max_hypotheses)
+    this->best.resize(this->max_hypotheses);
+
+  if((int)this->best.size() == this->max_hypotheses)
+    this->threshold = std::max(this->min_score, this->best.back().score);
+  return this->threshold;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Search below a block whose bound beat the threshold
+void
+AMCLGlobalMatcher::SearchBlock(const Candidate& block, int level,
+                               double* threshold, long* nodes)
+{
+  const DiscreteScan& scan = this->scans[block.rotation];
+  double full = 255.0 * this->point_count;
+
+  if(level == 0)
+  {
+    amcl_match_t match;
+    match.pose.v[0] = MAP_WXGX(this->map, block.u);
+    match.pose.v[1] = MAP_WYGY(this->map, block.v);
+    match.pose.v[2] = scan.angle;
+    match.score = block.bound / full;
+    *threshold = this->Insert(match);
+    return;
+  }
+
+  // The children that may beat the threshold, best first; there are at
+  // most four, so they are insertion sorted as they come
+  Candidate children[4];
+  int count = 0;
+  for(int b = 0; b < 2; b++)
+    for(int a = 0; a < 2; a++)
+    {
+      Candidate c;
+      c.rotation = block.rotation;
+      c.u = 2 * block.u + a;
+      c.v = 2 * block.v + b;
+      c.bound = this->Bound(scan, level - 1, c.u, c.v);
+      (*nodes)++;
+      if(c.bound < 0 || c.bound / full <= *threshold)
+        continue;
+      int k = count++;
+      for(; k > 0 && BetterCandidate(c, children[k - 1]); k--)
+        children[k] = children[k - 1];
+      children[k] = c;
+    }
+
+  for(int k = 0; k < count; k++)
+  {
+    if(children[k].bound / full <= *threshold)
+      break;
+    this->SearchBlock(children[k], level - 1, threshold, nodes);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Rotate the scan, and bound the top level blocks for that rotation
+void
+AMCLGlobalMatcher::PrepareRotation(int rotation)
+{
+  DiscreteScan& scan = this->scans[rotation];
+  scan.angle = normalize_angle(-M_PI + rotation * this->angle_step);
+  double cs = cos(scan.angle), sn = sin(scan.angle);
+  int n = this->point_count;
+  scan.dx.resize((this->depth + 1) * n);
+  scan.dy.resize((this->depth + 1) * n);
+  for(int i = 0; i < n; i++)
+  {
+    double x = this->point_x[i] * cs - this->point_y[i] * sn;
+    double y = this->point_x[i] * sn + this->point_y[i] * cs;
+    int dx = (int)floor(x / this->map->scale + 0.5);
+    int dy = (int)floor(y / this->map->scale + 0.5);
+    for(int h = 0; h <= this->depth; h++)
+    {
+      scan.dx[h * n + i] = floor_shift(dx, h);
+      scan.dy[h * n + i] = floor_shift(dy, h);
+    }
+  }
+
+  double full = 255.0 * n;
+  int top = this->depth;
+  std::vector<Candidate>& found = this->rotation_candidates[rotation];
+  found.clear();
+  for(int v = 0; v < this->level_y[top]; v++)
+    for(int u = 0; u < this->level_x[top]; u++)
+    {
+      Candidate c;
+      c.rotation = rotation;
+      c.u = u;
+      c.v = v;
+      c.bound = this->Bound(scan, top, u, v);
+      if(c.bound >= 0 && c.bound / full > this->min_score)
+        found.push_back(c);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Search below a top level block
+void
+AMCLGlobalMatcher::SearchCandidate(int index)
+{
+  const Candidate& block = this->candidates[index];
+  double threshold;
+  {
+    boost::mutex::scoped_lock lock(this->mutex);
+    threshold = this->threshold;
+  }
+
+  // The rest are no better
+  if(block.bound / (255.0 * this->point_count) <= threshold)
+    return;
+
+  long nodes = 0;
+  this->SearchBlock(block, this->depth, &threshold, &nodes);
+
+  boost::mutex::scoped_lock lock(this->mutex);
+  this->node_count += nodes;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Search the whole map
+int
+AMCLGlobalMatcher::Match(const std::vector<pf_vector_t>& points, int max_hypotheses,
+                         double min_score, std::vector<amcl_match_t>* matches)
+{
+  matches->clear();
+  this->best.clear();
+  this->node_count = 0;
+  if(this->map == NULL || max_hypotheses < 1)
+    return 0;
+
+  // Drop points closer than a cell to the previous one, then thin evenly
+  // down to max_points
+  std::vector<pf_vector_t> kept;
+  for(size_t i = 0; i < points.size(); i++)
+  {
+    const pf_vector_t& p = points[i];
+    if(p.v[0] != p.v[0] || p.v[1] != p.v[1])
+      continue;
+    if(!kept.empty() &&
+       hypot(p.v[0] - kept.back().v[0], p.v[1] - kept.back().v[1]) < this->map->scale)
+      continue;
+    kept.push_back(p);
+  }
+  if(kept.empty())
+    return 0;
+
+  int n = std::min((int)kept.size(), this->max_points);
+  this->point_x.resize(n);
+  this->point_y.resize(n);
+  double reach = this->map->scale;
+  for(int i = 0; i < n; i++)
+  {
+    const pf_vector_t& p = kept[(size_t)i * kept.size() / n];
+    this->point_x[i] = p.v[0];
+    this->point_y[i] = p.v[1];
+    reach = std::max(reach, hypot(p.v[0], p.v[1]));
+  }
+  this->point_count = n;
+
+  // Turning by the angular step moves the furthest point by about a cell
+  double step = acos(1 - this->map->scale * this->map->scale / (2 * reach * reach));
+  int rotations = (int)ceil(2 * M_PI / step);
+  this->angle_step = 2 * M_PI / rotations;
+
+  this->max_hypotheses = max_hypotheses;
+  this->min_score = min_score;
+  this->threshold = min_score;
+
+  // Top level of every rotation, then the blocks best first across all
+  // of them
+  this->scans.resize(rotations);
+  this->rotation_candidates.resize(rotations);
+  this->Run(rotations, boost::bind(&AMCLGlobalMatcher::PrepareRotation, this, _1));
+
+  this->candidates.clear();
+  for(int r = 0; r < rotations; r++)
+    this->candidates.insert(this->candidates.end(), this->rotation_candidates[r].begin(),
+                            this->rotation_candidates[r].end());
+  std::sort(this->candidates.begin(), this->candidates.end(), BetterCandidate);
+  this->node_count = (long)rotations * this->level_x[this->depth] * this->level_y[this->depth];
+
+  this->Run((int)this->candidates.size(),
+            boost::bind(&AMCLGlobalMatcher::SearchCandidate, this, _1));
+
+  *matches = this->best;
+  return (int)matches->size();
+}
+
+void
+AMCLGlobalMatcher::Run(int task_count, const boost::function<void (int)>& fn)
+{
+  if(this->pool)
+    this->pool->Run(task_count, fn);
+  else
+    for(int i = 0; i < task_count; i++)
+      fn(i);
+}
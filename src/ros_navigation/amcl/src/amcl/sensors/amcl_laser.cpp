@@ -32,20 +32,58 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
+#include <algorithm>
 
 #include "amcl/sensors/amcl_laser.h"
 
 using namespace amcl;
 
+namespace
+{
+// Adapts a chunk worker to the pool's task interface
+struct ChunkTask
+{
+  void (*fn) (AMCLLaserData *data, pf_sample_set_t* set, laser_sample_chunk_t* chunk);
+  AMCLLaserData *data;
+  pf_sample_set_t *set;
+  laser_sample_chunk_t *chunks;
+
+  void operator()(int k) const
+  {
+    (*fn)(data, set, chunks + k);
+  }
+};
+
+// Scores a chunk for each laser in turn, while its samples are in cache
+struct FusedChunkTask
+{
+  const std::vector<ChunkTask> *lasers;
+
+  void operator()(int k) const
+  {
+    for(size_t l = 0; l < lasers->size(); l++)
+      (*lasers)[l](k);
+  }
+};
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Default constructor
 AMCLLaser::AMCLLaser(size_t max_beams, map_t* map) : AMCLSensor(), 
+						     select_beams(false),
 						     max_samples(0), max_obs(0), 
-						     temp_obs(NULL)
+						     temp_obs(NULL),
+						     beamskip_active(false),
+						     beamskip_error(false),
+						     use_simd_kernel(false),
+						     use_exact_edt(false),
+						     range_table_angles(0),
+						     range_table_bytes(2)
 {
   this->time = 0.0;
 
   this->max_beams = max_beams;
+  this->beams_used = 0;
   this->map = map;
 
   return;
@@ -61,6 +99,150 @@ AMCLLaser::~AMCLLaser()
   }
 }
 
+void
+AMCLLaser::SetSensorThreads(int thread_count)
+{
+  if(thread_count > 1)
+    this->pool.reset(new AMCLThreadPool(thread_count));
+  else
+    this->pool.reset();
+}
+
+void
+AMCLLaser::SetBeamSelection(bool enable)
+{
+  this->select_beams = enable;
+}
+
+void
+AMCLLaser::SetSimdKernel(bool enable)
+{
+  this->use_simd_kernel = enable;
+  if(enable)
+    fprintf(stderr, "Using %s likelihood field kernel\n", laser_lf_kernel_name());
+}
+
+void
+AMCLLaser::SetExactDistanceTransform(bool enable)
+{
+  this->use_exact_edt = enable;
+}
+
+void
+AMCLLaser::SetCspaceCache(const std::string& cache_dir)
+{
+  this->cspace_cache_dir = cache_dir;
+}
+
+void
+AMCLLaser::SetRangeTable(int angle_count, int bytes_per_range,
+                         const std::string& cache_dir)
+{
+  this->range_table_angles = angle_count;
+  this->range_table_bytes = bytes_per_range;
+  this->range_table_cache_dir = cache_dir;
+  this->range_table.reset();
+}
+
+void
+AMCLLaser::BuildRangeTable(double max_range)
+{
+  if(this->range_table_angles <= 0)
+    return;
+  // Scans carry their max range as a float
+  if(this->range_table && fabs(this->range_table->max_range - max_range) <= 1e-6 * max_range)
+    return;
+
+  // Like the distance transforms, this runs once per map on every core
+  int hit = 0;
+  map_range_table_t *table;
+  if(!this->range_table_cache_dir.empty())
+    table = map_range_table_build_cached(this->map, max_range,
+                                         this->range_table_angles,
+                                         this->range_table_bytes, 0,
+                                         this->range_table_cache_dir.c_str(), &hit);
+  else
+    table = map_range_table_build(this->map, max_range,
+                                  this->range_table_angles,
+                                  this->range_table_bytes, 0);
+  if(table)
+    this->range_table.reset(table, map_range_table_free);
+  else
+    this->range_table.reset();
+
+  if(!this->range_table)
+  {
+    // Fall back to ray tracing, and don't retry on every scan
+    fprintf(stderr, "Range table unavailable; ray tracing instead\n");
+    this->range_table_angles = 0;
+  }
+  else if(hit)
+    fprintf(stderr, "Loaded range table from %s\n", this->range_table_cache_dir.c_str());
+}
+
+void
+AMCLLaser::UpdateRangeTables(const std::vector<AMCLLaser*>& lasers,
+                             int x0, int y0, int x1, int y1)
+{
+  // Each table once, however many lasers share it
+  typedef boost::shared_ptr<map_range_table_t> table_ptr;
+  std::vector<std::pair<table_ptr, table_ptr> > patched;
+  for(size_t l = 0; l < lasers.size(); l++)
+  {
+    AMCLLaser* self = lasers[l];
+    if(!self->range_table)
+      continue;
+    // A laser listed twice already has the patched table
+    size_t p = 0;
+    while(p < patched.size() && patched[p].first != self->range_table &&
+          patched[p].second != self->range_table)
+      p++;
+    if(p == patched.size())
+    {
+      // Like the build, on every core
+      map_range_table_t* table = map_range_table_update_window(
+        self->range_table.get(), self->map, x0, y0, x1, y1, 0);
+      table_ptr updated;
+      if(table)
+        updated.reset(table, map_range_table_free);
+      patched.push_back(std::make_pair(self->range_table, updated));
+    }
+    self->range_table = patched[p].second;
+  }
+}
+
+void
+AMCLLaser::SetMap(map_t* map)
+{
+  this->map = map;
+  this->range_table.reset();
+  if(!this->lf_table.empty())
+    this->BuildLikelihoodTable();
+}
+
+void
+AMCLLaser::UpdateCspace(double max_occ_dist)
+{
+  // Floor maps come with their plane, and a reconfigure that keeps the
+  // distance and the transform keeps it too
+  map_cspace_method_t method = this->use_exact_edt ? MAP_CSPACE_EDT : MAP_CSPACE_BRUSHFIRE;
+  if(this->map->occ_dist != NULL && this->map->max_occ_dist == max_occ_dist &&
+     this->map->occ_dist_method == method)
+    return;
+
+  // This runs once per map, so use every core for the exact transform
+  if(!this->cspace_cache_dir.empty())
+  {
+    if(map_update_cspace_cached(this->map, max_occ_dist, method, 0,
+                                this->cspace_cache_dir.c_str()))
+      fprintf(stderr, "Loaded likelihood field from %s\n", this->cspace_cache_dir.c_str());
+  }
+  else if(this->use_exact_edt)
+    map_update_cspace_edt(this->map, max_occ_dist, 0);
+  else
+    map_update_cspace(this->map, max_occ_dist);
+}
+
 void 
 AMCLLaser::SetModelBeam(double z_hit,
                         double z_short,
@@ -91,7 +273,10 @@ AMCLLaser::SetModelLikelihoodField(double z_hit,
   this->z_rand = z_rand;
   this->sigma_hit = sigma_hit;
 
-  map_update_cspace(this->map, max_occ_dist);
+  this->UpdateCspace(max_occ_dist);
+
+  if(this->use_simd_kernel)
+    this->BuildLikelihoodTable();
 }
 
 void 
@@ -112,7 +297,7 @@ AMCLLaser::SetModelLikelihoodFieldProb(double z_hit,
   this->beam_skip_distance = beam_skip_distance;
   this->beam_skip_threshold = beam_skip_threshold;
   this->beam_skip_error_threshold = beam_skip_error_threshold;
-  map_update_cspace(this->map, max_occ_dist);
+  this->UpdateCspace(max_occ_dist);
 }
 
 
@@ -123,6 +308,10 @@ bool AMCLLaser::UpdateSensor(pf_t *pf, AMCLSensorData *data)
   if (this->max_beams < 2)
     return false;
 
+  // Pick the readings to score, once for every particle
+  AMCLLaserData *ldata = (AMCLLaserData*) data;
+  this->ChooseBeams(ldata);
+
   // Apply the laser sensor model
   if(this->model_type == LASER_MODEL_BEAM)
     pf_update_sensor(pf, (pf_sensor_model_fn_t) BeamModel, data);
@@ -133,16 +322,371 @@ bool AMCLLaser::UpdateSensor(pf_t *pf, AMCLSensorData *data)
   else
     pf_update_sensor(pf, (pf_sensor_model_fn_t) BeamModel, data);
 
+  this->CountBeamsUsed();
+
   return true;
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+// Apply the sensor models of several lasers in one pass
+bool AMCLLaser::UpdateSensors(pf_t *pf, const std::vector<AMCLLaserData*>& scans)
+{
+  laser_fused_scans_t fused;
+  for(size_t l = 0; l < scans.size(); l++)
+  {
+    AMCLLaser *self = (AMCLLaser*) scans[l]->sensor;
+    if(self->max_beams < 2)
+      continue;
+    self->ChooseBeams(scans[l]);
+    fused.scans.push_back(scans[l]);
+  }
+  if(fused.scans.empty())
+    return false;
+
+  // The recovery averages see each scan's share of the weight, as they
+  // would updating with the scans one by one
+  fused.totals.assign(fused.scans.size(), 0.0);
+  pf_update_sensor_fused(pf, (pf_sensor_model_fn_t) FusedModel, &fused,
+                         &fused.totals[0], fused.totals.size());
+
+  for(size_t l = 0; l < fused.scans.size(); l++)
+    ((AMCLLaser*) fused.scans[l]->sensor)->CountBeamsUsed();
+
+  return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Count the beams the model scored, less the ones beam skipping left out
+void AMCLLaser::CountBeamsUsed()
+{
+  this->beams_used = this->beam_index.size();
+  if(this->model_type == LASER_MODEL_LIKELIHOOD_FIELD_PROB &&
+     this->beamskip_active && !this->beamskip_error)
+  {
+    int used = 0;
+    for(int i = 0; i < this->beams_used && i < (int)this->obs_mask.size(); i++)
+      used += this->obs_mask[i] ? 1 : 0;
+    this->beams_used = used;
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pick the readings of this scan to score
+void AMCLLaser::ChooseBeams(AMCLLaserData *data)
+{
+  if(this->select_beams)
+    this->SelectBeams(data);
+  else
+    this->StrideBeams(data);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Every step-th reading.  The probabilistic model keeps to max_beams; the
+// others have always strided a little finer.
+void AMCLLaser::StrideBeams(AMCLLaserData *data)
+{
+  int step;
+  if(this->model_type == LASER_MODEL_LIKELIHOOD_FIELD_PROB)
+    step = ceil(data->range_count / static_cast<double>(this->max_beams));
+  else
+    step = (data->range_count - 1) / (this->max_beams - 1);
+  if(step < 1)
+    step = 1;
+
+  this->beam_index.clear();
+  for(int i = 0; i < data->range_count; i += step)
+    this->beam_index.push_back(i);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Normal space sampling (Rusinkiewicz and Levoy, "Efficient variants of the
+// ICP algorithm").  Each valid reading is filed under the direction of the
+// surface it hits, from the endpoints of its neighbours; the directions
+// share the beams out evenly, and take theirs evenly spaced along the
+// scan.  Readings whose neighbours are missing or on another surface come
+// last, as they say least about the pose.
+
+// Surface directions are told apart to 180 / SELECT_DIRECTIONS degrees
+static const int SELECT_DIRECTIONS = 12;
+
+void AMCLLaser::SelectBeams(AMCLLaserData *data)
+{
+  int n = data->range_count;
+  this->beam_groups.resize(SELECT_DIRECTIONS + 1);
+  for(size_t g = 0; g < this->beam_groups.size(); g++)
+    this->beam_groups[g].clear();
+
+  // The bearings of a laser rarely change, so their sines and cosines are
+  // kept from scan to scan, along with the boundaries of the directions
+  bool same_geometry = ((int)this->select_bearing.size() == n);
+  for(int i = 0; i < n && same_geometry; i++)
+    same_geometry = (this->select_bearing[i] == data->ranges[i][1]);
+  if(!same_geometry)
+  {
+    this->select_bearing.resize(n);
+    this->select_cos.resize(n);
+    this->select_sin.resize(n);
+    for(int i = 0; i < n; i++)
+    {
+      this->select_bearing[i] = data->ranges[i][1];
+      this->select_cos[i] = cos(data->ranges[i][1]);
+      this->select_sin[i] = sin(data->ranges[i][1]);
+    }
+    this->select_bound_x.resize(SELECT_DIRECTIONS - 1);
+    this->select_bound_y.resize(SELECT_DIRECTIONS - 1);
+    for(int g = 1; g < SELECT_DIRECTIONS; g++)
+    {
+      this->select_bound_x[g - 1] = cos(g * M_PI / SELECT_DIRECTIONS);
+      this->select_bound_y[g - 1] = sin(g * M_PI / SELECT_DIRECTIONS);
+    }
+  }
+
+  // Endpoints of the valid readings in the laser frame
+  this->select_x.resize(n);
+  this->select_y.resize(n);
+  for(int i = 0; i < n; i++)
+  {
+    double r = data->ranges[i][0];
+    if(r < data->range_max)
+    {
+      this->select_x[i] = r * this->select_cos[i];
+      this->select_y[i] = r * this->select_sin[i];
+    }
+  }
+
+  for(int i = 0; i < n; i++)
+  {
+    double r = data->ranges[i][0];
+    if(!(r < data->range_max))
+      continue;
+
+    // Neighbours on the same surface: closer in range than a surface at a
+    // grazing angle would put them
+    int a = i, b = i;
+    for(int k = i - 1; k <= i + 1; k += 2)
+    {
+      if(k < 0 || k >= n || !(data->ranges[k][0] < data->range_max))
+        continue;
+      double gap = r * fabs(data->ranges[k][1] - data->ranges[i][1]);
+      if(fabs(data->ranges[k][0] - r) < 0.05 + 5 * gap)
+      {
+        if(k < i)
+          a = k;
+        else
+          b = k;
+      }
+    }
+
+    // The direction of the surface, folded onto [0, 180] degrees, is past
+    // every boundary it is counterclockwise of
+    int group = SELECT_DIRECTIONS;
+    if(a != b)
+    {
+      double dx = this->select_x[b] - this->select_x[a];
+      double dy = this->select_y[b] - this->select_y[a];
+      if(dy < 0)
+      {
+        dx = -dx;
+        dy = -dy;
+      }
+      group = 0;
+      while(group < SELECT_DIRECTIONS - 1 &&
+            this->select_bound_x[group] * dy - this->select_bound_y[group] * dx >= 0)
+        group++;
+    }
+    this->beam_groups[group].push_back(i);
+  }
+
+  // Share the beams among the directions (water filling), then give what
+  // is left to the readings without one
+  std::vector<int> quota(SELECT_DIRECTIONS + 1, 0);
+  int remaining = this->max_beams;
+  for(;;)
+  {
+    int open = 0;
+    for(int g = 0; g < SELECT_DIRECTIONS; g++)
+      if(quota[g] < (int)this->beam_groups[g].size())
+        open++;
+    if(open == 0 || remaining == 0)
+      break;
+    int share = std::max(remaining / open, 1);
+    for(int g = 0; g < SELECT_DIRECTIONS && remaining > 0; g++)
+    {
+      int give = std::min(share, (int)this->beam_groups[g].size() - quota[g]);
+      give = std::min(give, remaining);
+      quota[g] += give;
+      remaining -= give;
+    }
+  }
+  quota[SELECT_DIRECTIONS] = std::min(remaining,
+                                      (int)this->beam_groups[SELECT_DIRECTIONS].size());
+
+  this->beam_index.clear();
+  for(int g = 0; g <= SELECT_DIRECTIONS; g++)
+  {
+    const std::vector<int>& group = this->beam_groups[g];
+    for(int k = 0; k < quota[g]; k++)
+      this->beam_index.push_back(group[(int)((k + 0.5) * group.size() / quota[g])]);
+  }
+  std::sort(this->beam_index.begin(), this->beam_index.end());
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Split the sample set into contiguous chunks, one per thread unless
+// chunk_count says otherwise.  The boundaries only depend on the sample
+// count and the chunk count, so the reduction in RunChunks() is
+// deterministic, and lasers given the same count split alike.
+void AMCLLaser::SplitSamples(pf_sample_set_t* set, int chunk_count)
+{
+  if(chunk_count <= 0)
+    chunk_count = this->pool ? this->pool->GetThreadCount() : 1;
+  if(chunk_count > set->sample_count)
+    chunk_count = set->sample_count;
+  if(chunk_count < 1)
+    chunk_count = 1;
+
+  this->chunks.resize(chunk_count);
+  this->chunk_obs_count.assign(chunk_count * this->max_beams, 0);
+  for(int k = 0; k < chunk_count; k++)
+  {
+    laser_sample_chunk_t& chunk = this->chunks[k];
+    chunk.begin = (int)((long)set->sample_count * k / chunk_count);
+    chunk.end = (int)((long)set->sample_count * (k + 1) / chunk_count);
+    chunk.total_weight = 0.0;
+    chunk.obs_count = &this->chunk_obs_count[k * this->max_beams];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Score every chunk and reduce the weights in chunk order
+double AMCLLaser::RunChunks(chunk_fn_t fn, AMCLLaserData *data, pf_sample_set_t* set)
+{
+  this->SplitSamples(set);
+
+  ChunkTask task;
+  task.fn = fn;
+  task.data = data;
+  task.set = set;
+  task.chunks = &this->chunks[0];
+
+  if(this->pool && this->chunks.size() > 1)
+    this->pool->Run(this->chunks.size(), task);
+  else
+    task(0);
+
+  double total_weight = 0.0;
+  for(size_t k = 0; k < this->chunks.size(); k++)
+    total_weight += this->chunks[k].total_weight;
+  return total_weight;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Score every chunk against each scan, and reduce the weights after each
+// one
+double AMCLLaser::FusedModel(laser_fused_scans_t *scans, pf_sample_set_t* set)
+{
+  double total_weight = 0.0;
+  int applied = 0;
+  std::vector<AMCLLaserData*> fused;
+  std::vector<chunk_fn_t> fns;
+  for(size_t l = 0; l < scans->scans.size(); l++)
+  {
+    AMCLLaserData *data = scans->scans[l];
+    AMCLLaser *self = (AMCLLaser*) data->sensor;
+    chunk_fn_t fn = self->PrepareModel(data, set);
+    if(fn != NULL)
+    {
+      fused.push_back(data);
+      fns.push_back(fn);
+    }
+    else
+    {
+      // Beam skipping takes two passes of its own; the weights multiply,
+      // so it can go first
+      total_weight = LikelihoodFieldModelProb(data, set);
+      scans->totals[applied++] = total_weight;
+    }
+  }
+  if(fused.empty())
+    return total_weight;
+
+  // Every laser splits the set like the first, whose pool scores it
+  AMCLLaser *lead = (AMCLLaser*) fused[0]->sensor;
+  lead->SplitSamples(set);
+  int chunk_count = lead->chunks.size();
+
+  std::vector<ChunkTask> lasers(fused.size());
+  for(size_t l = 0; l < fused.size(); l++)
+  {
+    AMCLLaser *self = (AMCLLaser*) fused[l]->sensor;
+    if(self != lead)
+      self->SplitSamples(set, chunk_count);
+    lasers[l].fn = fns[l];
+    lasers[l].data = fused[l];
+    lasers[l].set = set;
+    lasers[l].chunks = &self->chunks[0];
+  }
+
+  FusedChunkTask task;
+  task.lasers = &lasers;
+  if(lead->pool && chunk_count > 1)
+    lead->pool->Run(chunk_count, task);
+  else
+    task(0);
+
+  // Each laser's chunks hold the weights as they were after its scan
+  for(size_t l = 0; l < fused.size(); l++)
+  {
+    AMCLLaser *self = (AMCLLaser*) fused[l]->sensor;
+    total_weight = 0.0;
+    for(int k = 0; k < chunk_count; k++)
+      total_weight += self->chunks[k].total_weight;
+    scans->totals[applied++] = total_weight;
+  }
+  return total_weight;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Set the model up for the current scan
+AMCLLaser::chunk_fn_t AMCLLaser::PrepareModel(AMCLLaserData *data, pf_sample_set_t* set)
+{
+  if(this->model_type == LASER_MODEL_LIKELIHOOD_FIELD)
+    return this->PrepareLikelihoodField(data, set);
+
+  if(this->model_type == LASER_MODEL_LIKELIHOOD_FIELD_PROB)
+  {
+    // Beam skipping needs the agreement of every sample first
+    if(this->do_beamskip && set->converged)
+      return NULL;
+    this->beamskip_active = false;
+    return LikelihoodFieldModelProbChunk;
+  }
+
+  this->BuildRangeTable(data->range_max);
+  return BeamModelChunk;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Determine the probability for the given pose
 double AMCLLaser::BeamModel(AMCLLaserData *data, pf_sample_set_t* set)
+{
+  AMCLLaser *self = (AMCLLaser*) data->sensor;
+  self->BuildRangeTable(data->range_max);
+  return self->RunChunks(BeamModelChunk, data, set);
+}
+
+void AMCLLaser::BeamModelChunk(AMCLLaserData *data, pf_sample_set_t* set,
+                               laser_sample_chunk_t* chunk)
 {
   AMCLLaser *self;
-  int i, j, step;
+  int i, j, b;
   double z, pz;
   double p;
   double map_range;
@@ -152,11 +696,12 @@ double AMCLLaser::BeamModel(AMCLLaserData *data, pf_sample_set_t* set)
   pf_vector_t pose;
 
   self = (AMCLLaser*) data->sensor;
+  int beam_count = self->beam_index.size();
 
   total_weight = 0.0;
 
   // Compute the sample weights
-  for (j = 0; j < set->sample_count; j++)
+  for (j = chunk->begin; j < chunk->end; j++)
   {
     sample = set->samples + j;
     pose = sample->pose;
@@ -166,15 +711,20 @@ double AMCLLaser::BeamModel(AMCLLaserData *data, pf_sample_set_t* set)
 
     p = 1.0;
 
-    step = (data->range_count - 1) / (self->max_beams - 1);
-    for (i = 0; i < data->range_count; i += step)
+    for (b = 0; b < beam_count; b++)
     {
+      i = self->beam_index[b];
       obs_range = data->ranges[i][0];
       obs_bearing = data->ranges[i][1];
 
       // Compute the range according to the map
-      map_range = map_calc_range(self->map, pose.v[0], pose.v[1],
-                                 pose.v[2] + obs_bearing, data->range_max);
+      if(self->range_table)
+        map_range = map_range_table_lookup(self->range_table.get(), self->map,
+                                           pose.v[0], pose.v[1],
+                                           pose.v[2] + obs_bearing);
+      else
+        map_range = map_calc_range(self->map, pose.v[0], pose.v[1],
+                                   pose.v[2] + obs_bearing, data->range_max);
       pz = 0.0;
 
       // Part 1: good, but noisy, hit
@@ -207,13 +757,110 @@ double AMCLLaser::BeamModel(AMCLLaserData *data, pf_sample_set_t* set)
     total_weight += sample->weight;
   }
 
-  return(total_weight);
+  chunk->total_weight = total_weight;
 }
 
 double AMCLLaser::LikelihoodFieldModel(AMCLLaserData *data, pf_sample_set_t* set)
+{
+  AMCLLaser *self = (AMCLLaser*) data->sensor;
+  return self->RunChunks(self->PrepareLikelihoodField(data, set), data, set);
+}
+
+AMCLLaser::chunk_fn_t AMCLLaser::PrepareLikelihoodField(AMCLLaserData *data,
+                                                        pf_sample_set_t* set)
+{
+  if(this->lf_table.empty())
+    return LikelihoodFieldModelChunk;
+
+  // Keep the beams the scalar model would use, as endpoints in the laser
+  // frame, so each particle only needs one sin/cos
+  this->lf_beam_x.clear();
+  this->lf_beam_y.clear();
+  for (size_t b = 0; b < this->beam_index.size(); b++)
+  {
+    int i = this->beam_index[b];
+    double obs_range = data->ranges[i][0];
+    double obs_bearing = data->ranges[i][1];
+
+    // This model ignores max range readings and NaNs
+    if(obs_range >= data->range_max || obs_range != obs_range)
+      continue;
+
+    this->lf_beam_x.push_back(obs_range * cos(obs_bearing));
+    this->lf_beam_y.push_back(obs_range * sin(obs_bearing));
+  }
+
+  this->lf_map.dist = this->map->occ_dist;
+  this->lf_map.table = &this->lf_table[0];
+  this->lf_map.z_rand_term = this->z_rand / data->range_max;
+
+  this->soa_x.resize(set->sample_count);
+  this->soa_y.resize(set->sample_count);
+  this->soa_cos.resize(set->sample_count);
+  this->soa_sin.resize(set->sample_count);
+  this->soa_p.resize(set->sample_count);
+
+  return LikelihoodFieldKernelChunk;
+}
+
+void AMCLLaser::LikelihoodFieldKernelChunk(AMCLLaserData *data, pf_sample_set_t* set,
+                                           laser_sample_chunk_t* chunk)
+{
+  AMCLLaser *self = (AMCLLaser*) data->sensor;
+  int j;
+
+  if(chunk->begin == chunk->end)
+  {
+    chunk->total_weight = 0.0;
+    return;
+  }
+
+  // Laser pose of each particle; this is pf_vector_coord_add() with the
+  // rotation shared between the position and the heading
+  double laser_c = cos(self->laser_pose.v[2]);
+  double laser_s = sin(self->laser_pose.v[2]);
+  for (j = chunk->begin; j < chunk->end; j++)
+  {
+    pf_vector_t pose = set->samples[j].pose;
+    double c = cos(pose.v[2]);
+    double s = sin(pose.v[2]);
+    self->soa_x[j] = pose.v[0] + self->laser_pose.v[0] * c - self->laser_pose.v[1] * s;
+    self->soa_y[j] = pose.v[1] + self->laser_pose.v[0] * s + self->laser_pose.v[1] * c;
+    self->soa_cos[j] = c * laser_c - s * laser_s;
+    self->soa_sin[j] = s * laser_c + c * laser_s;
+  }
+
+  laser_lf_beams_t beams;
+  beams.count = self->lf_beam_x.size();
+  beams.x = beams.count ? &self->lf_beam_x[0] : NULL;
+  beams.y = beams.count ? &self->lf_beam_y[0] : NULL;
+
+  laser_lf_poses_t poses;
+  poses.count = chunk->end - chunk->begin;
+  poses.x = &self->soa_x[chunk->begin];
+  poses.y = &self->soa_y[chunk->begin];
+  poses.cos_a = &self->soa_cos[chunk->begin];
+  poses.sin_a = &self->soa_sin[chunk->begin];
+  poses.p = &self->soa_p[chunk->begin];
+
+  laser_lf_kernel(&self->lf_map, &beams, &poses);
+
+  double total_weight = 0.0;
+  for (j = chunk->begin; j < chunk->end; j++)
+  {
+    pf_sample_t *sample = set->samples + j;
+    sample->weight *= self->soa_p[j];
+    total_weight += sample->weight;
+  }
+
+  chunk->total_weight = total_weight;
+}
+
+void AMCLLaser::LikelihoodFieldModelChunk(AMCLLaserData *data, pf_sample_set_t* set,
+                                          laser_sample_chunk_t* chunk)
 {
   AMCLLaser *self;
-  int i, j, step;
+  int i, j, b;
   double z, pz;
   double p;
   double obs_range, obs_bearing;
@@ -227,7 +874,7 @@ double AMCLLaser::LikelihoodFieldModel(AMCLLaserData *data, pf_sample_set_t* set
   total_weight = 0.0;
 
   // Compute the sample weights
-  for (j = 0; j < set->sample_count; j++)
+  for (j = chunk->begin; j < chunk->end; j++)
   {
     sample = set->samples + j;
     pose = sample->pose;
@@ -241,14 +888,9 @@ double AMCLLaser::LikelihoodFieldModel(AMCLLaserData *data, pf_sample_set_t* set
     double z_hit_denom = 2 * self->sigma_hit * self->sigma_hit;
     double z_rand_mult = 1.0/data->range_max;
 
-    step = (data->range_count - 1) / (self->max_beams - 1);
-
-    // Step size must be at least 1
-    if(step < 1)
-      step = 1;
-
-    for (i = 0; i < data->range_count; i += step)
+    for (b = 0; b < (int)self->beam_index.size(); b++)
     {
+      i = self->beam_index[b];
       obs_range = data->ranges[i][0];
       obs_bearing = data->ranges[i][1];
 
@@ -276,7 +918,7 @@ double AMCLLaser::LikelihoodFieldModel(AMCLLaserData *data, pf_sample_set_t* set
       if(!MAP_VALID(self->map, mi, mj))
         z = self->map->max_occ_dist;
       else
-        z = self->map->cells[MAP_INDEX(self->map,mi,mj)].occ_dist;
+        z = MAP_OCC_DIST(self->map, MAP_INDEX(self->map,mi,mj));
       // Gaussian model
       // NOTE: this should have a normalization of 1/(sqrt(2pi)*sigma)
       pz += self->z_hit * exp(-(z * z) / z_hit_denom);
@@ -297,58 +939,30 @@ double AMCLLaser::LikelihoodFieldModel(AMCLLaserData *data, pf_sample_set_t* set
     total_weight += sample->weight;
   }
 
-  return(total_weight);
+  chunk->total_weight = total_weight;
 }
 
 double AMCLLaser::LikelihoodFieldModelProb(AMCLLaserData *data, pf_sample_set_t* set)
 {
   AMCLLaser *self;
-  int i, j, step;
-  double z, pz;
-  double log_p;
-  double obs_range, obs_bearing;
+  int beam_ind;
   double total_weight;
-  pf_sample_t *sample;
-  pf_vector_t pose;
-  pf_vector_t hit;
 
   self = (AMCLLaser*) data->sensor;
 
-  total_weight = 0.0;
-
-  step = ceil((data->range_count) / static_cast<double>(self->max_beams)); 
-  
-  // Step size must be at least 1
-  if(step < 1)
-    step = 1;
-
-  // Pre-compute a couple of things
-  double z_hit_denom = 2 * self->sigma_hit * self->sigma_hit;
-  double z_rand_mult = 1.0/data->range_max;
-
-  double max_dist_prob = exp(-(self->map->max_occ_dist * self->map->max_occ_dist) / z_hit_denom);
-
   //Beam skipping - ignores beams for which a majoirty of particles do not agree with the map
   //prevents correct particles from getting down weighted because of unexpected obstacles 
   //such as humans 
 
   bool do_beamskip = self->do_beamskip;
-  double beam_skip_distance = self->beam_skip_distance;
   double beam_skip_threshold = self->beam_skip_threshold;
   
   //we only do beam skipping if the filter has converged 
   if(do_beamskip && !set->converged){
     do_beamskip = false;
   }
+  self->beamskip_active = do_beamskip;
 
-  //we need a count the no of particles for which the beam agreed with the map 
-  int *obs_count = new int[self->max_beams]();
-
-  //we also need a mask of which observations to integrate (to decide which beams to integrate to all particles) 
-  bool *obs_mask = new bool[self->max_beams]();
-  
-  int beam_ind = 0;
-  
   //realloc indicates if we need to reallocate the temp data structure needed to do beamskipping 
   bool realloc = false; 
 
@@ -367,8 +981,81 @@ double AMCLLaser::LikelihoodFieldModelProb(AMCLLaserData *data, pf_sample_set_t*
     }
   }
 
-  // Compute the sample weights
-  for (j = 0; j < set->sample_count; j++)
+  // Compute the sample weights (or, when beam skipping, the per-beam
+  // probabilities and agreement counts)
+  total_weight = self->RunChunks(LikelihoodFieldModelProbChunk, data, set);
+
+  if(!do_beamskip)
+    return(total_weight);
+
+  //we need a count the no of particles for which the beam agreed with the map 
+  //(summed over the chunks in order)
+  int beam_count = self->beam_index.size();
+  std::vector<int> obs_count(beam_count, 0);
+  for(size_t k = 0; k < self->chunks.size(); k++)
+    for(beam_ind = 0; beam_ind < beam_count; beam_ind++)
+      obs_count[beam_ind] += self->chunks[k].obs_count[beam_ind];
+
+  //we also need a mask of which observations to integrate (to decide which beams to integrate to all particles) 
+  self->obs_mask.assign(beam_count, false);
+
+  int skipped_beam_count = 0; 
+  for (beam_ind = 0; beam_ind < beam_count; beam_ind++){
+    if((obs_count[beam_ind] / static_cast<double>(set->sample_count)) > beam_skip_threshold){
+      self->obs_mask[beam_ind] = true;
+    }
+    else{
+      self->obs_mask[beam_ind] = false;
+      skipped_beam_count++; 
+    }
+  }
+
+  //we check if there is at least a critical number of beams that agreed with the map 
+  //otherwise it probably indicates that the filter converged to a wrong solution
+  //if that's the case we integrate all the beams and hope the filter might converge to 
+  //the right solution
+  self->beamskip_error = false; 
+
+  if(skipped_beam_count >= (beam_ind * self->beam_skip_error_threshold)){
+    fprintf(stderr, "Over %f%% of the observations were not in the map - pf may have converged to wrong pose - integrating all observations\n", (100 * self->beam_skip_error_threshold));
+    self->beamskip_error = true; 
+  }
+
+  return self->RunChunks(BeamSkipChunk, data, set);
+}
+
+void AMCLLaser::LikelihoodFieldModelProbChunk(AMCLLaserData *data, pf_sample_set_t* set,
+                                              laser_sample_chunk_t* chunk)
+{
+  AMCLLaser *self;
+  int i, j;
+  double z, pz;
+  double log_p;
+  double obs_range, obs_bearing;
+  double total_weight;
+  pf_sample_t *sample;
+  pf_vector_t pose;
+  pf_vector_t hit;
+
+  self = (AMCLLaser*) data->sensor;
+
+  total_weight = 0.0;
+  int beam_count = self->beam_index.size();
+
+  // Pre-compute a couple of things
+  double z_hit_denom = 2 * self->sigma_hit * self->sigma_hit;
+  double z_rand_mult = 1.0/data->range_max;
+
+  double max_dist_prob = exp(-(self->map->max_occ_dist * self->map->max_occ_dist) / z_hit_denom);
+
+  bool do_beamskip = self->beamskip_active;
+  double beam_skip_distance = self->beam_skip_distance;
+
+  int *obs_count = chunk->obs_count;
+
+  int beam_ind = 0;
+  
+  for (j = chunk->begin; j < chunk->end; j++)
   {
     sample = set->samples + j;
     pose = sample->pose;
@@ -380,8 +1067,9 @@ double AMCLLaser::LikelihoodFieldModelProb(AMCLLaserData *data, pf_sample_set_t*
     
     beam_ind = 0;
     
-    for (i = 0; i < data->range_count; i += step, beam_ind++)
+    for (beam_ind = 0; beam_ind < beam_count; beam_ind++)
     {
+      i = self->beam_index[beam_ind];
       obs_range = data->ranges[i][0];
       obs_bearing = data->ranges[i][1];
 
@@ -413,7 +1101,7 @@ double AMCLLaser::LikelihoodFieldModelProb(AMCLLaserData *data, pf_sample_set_t*
 	pz += self->z_hit * max_dist_prob;
       }
       else{
-	z = self->map->cells[MAP_INDEX(self->map,mi,mj)].occ_dist;
+	z = MAP_OCC_DIST(self->map, MAP_INDEX(self->map,mi,mj));
 	if(z < beam_skip_distance){
 	  obs_count[beam_ind] += 1;
 	}
@@ -443,52 +1131,64 @@ double AMCLLaser::LikelihoodFieldModelProb(AMCLLaserData *data, pf_sample_set_t*
       total_weight += sample->weight;
     }
   }
-  
-  if(do_beamskip){
-    int skipped_beam_count = 0; 
-    for (beam_ind = 0; beam_ind < self->max_beams; beam_ind++){
-      if((obs_count[beam_ind] / static_cast<double>(set->sample_count)) > beam_skip_threshold){
-	obs_mask[beam_ind] = true;
-      }
-      else{
-	obs_mask[beam_ind] = false;
-	skipped_beam_count++; 
-      }
-    }
 
-    //we check if there is at least a critical number of beams that agreed with the map 
-    //otherwise it probably indicates that the filter converged to a wrong solution
-    //if that's the case we integrate all the beams and hope the filter might converge to 
-    //the right solution
-    bool error = false; 
+  chunk->total_weight = total_weight;
+}
 
-    if(skipped_beam_count >= (beam_ind * self->beam_skip_error_threshold)){
-      fprintf(stderr, "Over %f%% of the observations were not in the map - pf may have converged to wrong pose - integrating all observations\n", (100 * self->beam_skip_error_threshold));
-      error = true; 
-    }
+void AMCLLaser::BeamSkipChunk(AMCLLaserData *data, pf_sample_set_t* set,
+                              laser_sample_chunk_t* chunk)
+{
+  AMCLLaser *self;
+  int j, beam_ind;
+  double log_p;
+  double total_weight;
+  pf_sample_t *sample;
 
-    for (j = 0; j < set->sample_count; j++)
-      {
-	sample = set->samples + j;
-	pose = sample->pose;
+  self = (AMCLLaser*) data->sensor;
+
+  total_weight = 0.0;
+
+  for (j = chunk->begin; j < chunk->end; j++)
+    {
+      sample = set->samples + j;
 
-	log_p = 0;
+      log_p = 0;
 
-	for (beam_ind = 0; beam_ind < self->max_beams; beam_ind++){
-	  if(error || obs_mask[beam_ind]){
-	    log_p += log(self->temp_obs[j][beam_ind]);
-	  }
+      for (beam_ind = 0; beam_ind < (int)self->beam_index.size(); beam_ind++){
+	if(self->beamskip_error || self->obs_mask[beam_ind]){
+	  log_p += log(self->temp_obs[j][beam_ind]);
 	}
-	
-	sample->weight *= exp(log_p);
-	
-	total_weight += sample->weight;
-      }      
+      }
+      
+      sample->weight *= exp(log_p);
+      
+      total_weight += sample->weight;
+    }
+
+  chunk->total_weight = total_weight;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Precompute z_hit * exp(-d^2 / 2 sigma^2) for every distance code
+void AMCLLaser::BuildLikelihoodTable()
+{
+  double z_hit_denom = 2 * this->sigma_hit * this->sigma_hit;
+
+  this->lf_table.resize(MAP_DIST_MAX + 1);
+  for(int i = 0; i <= MAP_DIST_MAX; i++)
+  {
+    double z = i * this->map->occ_dist_step;
+    this->lf_table[i] = this->z_hit * exp(-(z * z) / z_hit_denom);
   }
 
-  delete [] obs_count; 
-  delete [] obs_mask;
-  return(total_weight);
+  this->lf_map.size_x = this->map->size_x;
+  this->lf_map.size_y = this->map->size_y;
+  this->lf_map.origin_x = this->map->origin_x;
+  this->lf_map.origin_y = this->map->origin_y;
+  this->lf_map.scale = this->map->scale;
+  this->lf_map.dist = NULL;
+  this->lf_map.table = NULL;
+  this->lf_map.z_rand_term = 0.0;
 }
 
 void AMCLLaser::reallocTempData(int new_max_samples, int new_max_obs){
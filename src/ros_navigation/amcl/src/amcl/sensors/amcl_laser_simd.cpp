@@ -0,0 +1,303 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Vectorized likelihood field kernel
+//
+// The kernel works on blocks of poses: for each block it walks the beams
+// in order, computes the hit cells for all poses of the block at once,
+// gathers their distance codes and looks the likelihoods up in a table.
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+
+#include "amcl/sensors/amcl_laser_simd.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define AMCL_LASER_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+using namespace amcl;
+
+namespace
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Table index of the cell containing (x, y); mirrors MAP_GXWX/MAP_GYWY
+inline int lf_cell_index(const laser_lf_map_t *map, double x, double y)
+{
+  double gx = floor((x - map->origin_x) / map->scale + 0.5) + map->size_x / 2;
+  double gy = floor((y - map->origin_y) / map->scale + 0.5) + map->size_y / 2;
+  if(!(gx >= 0 && gx < map->size_x && gy >= 0 && gy < map->size_y))
+    return map->size_x * map->size_y;
+  return (int)gx + (int)gy * map->size_x;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Reference implementation, also used for the tail of each vector loop
+void lf_kernel_scalar(const laser_lf_map_t *map, const laser_lf_beams_t *beams,
+                      laser_lf_poses_t *poses, int begin)
+{
+  for(int j = begin; j < poses->count; j++)
+  {
+    double x = poses->x[j], y = poses->y[j];
+    double c = poses->cos_a[j], s = poses->sin_a[j];
+    double p = 1.0;
+    for(int i = 0; i < beams->count; i++)
+    {
+      double hx = x + c * beams->x[i] - s * beams->y[i];
+      double hy = y + s * beams->x[i] + c * beams->y[i];
+      double pz = map->table[map->dist[lf_cell_index(map, hx, hy)]] + map->z_rand_term;
+      p += pz * pz * pz;
+    }
+    poses->p[j] = p;
+  }
+}
+
+#ifdef AMCL_LASER_SIMD_X86
+
+////////////////////////////////////////////////////////////////////////////////
+// Four poses per iteration, using the hardware gather
+__attribute__((target("avx2")))
+void lf_kernel_avx2(const laser_lf_map_t *map, const laser_lf_beams_t *beams,
+                    laser_lf_poses_t *poses)
+{
+  const __m256d origin_x = _mm256_set1_pd(map->origin_x);
+  const __m256d origin_y = _mm256_set1_pd(map->origin_y);
+  const __m256d scale = _mm256_set1_pd(map->scale);
+  const __m256d half = _mm256_set1_pd(0.5);
+  const __m256d zero = _mm256_setzero_pd();
+  const __m256d size_x = _mm256_set1_pd(map->size_x);
+  const __m256d size_y = _mm256_set1_pd(map->size_y);
+  const __m256d offset_x = _mm256_set1_pd(map->size_x / 2);
+  const __m256d offset_y = _mm256_set1_pd(map->size_y / 2);
+  const __m256d off_map = _mm256_set1_pd((double)map->size_x * map->size_y);
+  const __m256d z_rand_term = _mm256_set1_pd(map->z_rand_term);
+  const __m128i code_mask = _mm_set1_epi32(0xff);
+
+  int j = 0;
+  for(; j + 4 <= poses->count; j += 4)
+  {
+    __m256d x = _mm256_loadu_pd(poses->x + j);
+    __m256d y = _mm256_loadu_pd(poses->y + j);
+    __m256d c = _mm256_loadu_pd(poses->cos_a + j);
+    __m256d s = _mm256_loadu_pd(poses->sin_a + j);
+    __m256d p = _mm256_set1_pd(1.0);
+
+    for(int i = 0; i < beams->count; i++)
+    {
+      __m256d bx = _mm256_set1_pd(beams->x[i]);
+      __m256d by = _mm256_set1_pd(beams->y[i]);
+      __m256d hx = _mm256_sub_pd(_mm256_add_pd(x, _mm256_mul_pd(c, bx)),
+                                 _mm256_mul_pd(s, by));
+      __m256d hy = _mm256_add_pd(_mm256_add_pd(y, _mm256_mul_pd(s, bx)),
+                                 _mm256_mul_pd(c, by));
+
+      __m256d gx = _mm256_floor_pd(_mm256_add_pd(
+          _mm256_div_pd(_mm256_sub_pd(hx, origin_x), scale), half));
+      __m256d gy = _mm256_floor_pd(_mm256_add_pd(
+          _mm256_div_pd(_mm256_sub_pd(hy, origin_y), scale), half));
+      gx = _mm256_add_pd(gx, offset_x);
+      gy = _mm256_add_pd(gy, offset_y);
+
+      // Ordered compares are false for NaN, which sends it off the map
+      __m256d valid = _mm256_and_pd(
+          _mm256_and_pd(_mm256_cmp_pd(gx, zero, _CMP_GE_OQ),
+                        _mm256_cmp_pd(gx, size_x, _CMP_LT_OQ)),
+          _mm256_and_pd(_mm256_cmp_pd(gy, zero, _CMP_GE_OQ),
+                        _mm256_cmp_pd(gy, size_y, _CMP_LT_OQ)));
+      __m256d index = _mm256_add_pd(gx, _mm256_mul_pd(gy, size_x));
+      index = _mm256_blendv_pd(off_map, index, valid);
+
+      // There is no byte gather; load 32 bits at each cell and keep the
+      // low byte (the plane is padded for this)
+      __m128i cell = _mm256_cvttpd_epi32(index);
+      __m128i code = _mm_and_si128(
+          _mm_i32gather_epi32((const int*) map->dist, cell, 1), code_mask);
+      __m256d pz = _mm256_cvtps_pd(_mm_i32gather_ps(map->table, code, 4));
+      pz = _mm256_add_pd(pz, z_rand_term);
+      p = _mm256_add_pd(p, _mm256_mul_pd(_mm256_mul_pd(pz, pz), pz));
+    }
+
+    _mm256_storeu_pd(poses->p + j, p);
+  }
+
+  lf_kernel_scalar(map, beams, poses, j);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Two poses per iteration; no gather instruction, so the table is read
+// one lane at a time
+__attribute__((target("sse4.1")))
+void lf_kernel_sse(const laser_lf_map_t *map, const laser_lf_beams_t *beams,
+                   laser_lf_poses_t *poses)
+{
+  const __m128d origin_x = _mm_set1_pd(map->origin_x);
+  const __m128d origin_y = _mm_set1_pd(map->origin_y);
+  const __m128d scale = _mm_set1_pd(map->scale);
+  const __m128d half = _mm_set1_pd(0.5);
+  const __m128d zero = _mm_setzero_pd();
+  const __m128d size_x = _mm_set1_pd(map->size_x);
+  const __m128d size_y = _mm_set1_pd(map->size_y);
+  const __m128d offset_x = _mm_set1_pd(map->size_x / 2);
+  const __m128d offset_y = _mm_set1_pd(map->size_y / 2);
+  const __m128d off_map = _mm_set1_pd((double)map->size_x * map->size_y);
+  const __m128d z_rand_term = _mm_set1_pd(map->z_rand_term);
+
+  int j = 0;
+  for(; j + 2 <= poses->count; j += 2)
+  {
+    __m128d x = _mm_loadu_pd(poses->x + j);
+    __m128d y = _mm_loadu_pd(poses->y + j);
+    __m128d c = _mm_loadu_pd(poses->cos_a + j);
+    __m128d s = _mm_loadu_pd(poses->sin_a + j);
+    __m128d p = _mm_set1_pd(1.0);
+
+    for(int i = 0; i < beams->count; i++)
+    {
+      __m128d bx = _mm_set1_pd(beams->x[i]);
+      __m128d by = _mm_set1_pd(beams->y[i]);
+      __m128d hx = _mm_sub_pd(_mm_add_pd(x, _mm_mul_pd(c, bx)),
+                              _mm_mul_pd(s, by));
+      __m128d hy = _mm_add_pd(_mm_add_pd(y, _mm_mul_pd(s, bx)),
+                              _mm_mul_pd(c, by));
+
+      __m128d gx = _mm_floor_pd(_mm_add_pd(
+          _mm_div_pd(_mm_sub_pd(hx, origin_x), scale), half));
+      __m128d gy = _mm_floor_pd(_mm_add_pd(
+          _mm_div_pd(_mm_sub_pd(hy, origin_y), scale), half));
+      gx = _mm_add_pd(gx, offset_x);
+      gy = _mm_add_pd(gy, offset_y);
+
+      __m128d valid = _mm_and_pd(
+          _mm_and_pd(_mm_cmpge_pd(gx, zero), _mm_cmplt_pd(gx, size_x)),
+          _mm_and_pd(_mm_cmpge_pd(gy, zero), _mm_cmplt_pd(gy, size_y)));
+      __m128d index = _mm_add_pd(gx, _mm_mul_pd(gy, size_x));
+      index = _mm_blendv_pd(off_map, index, valid);
+
+      __m128i cell = _mm_cvttpd_epi32(index);
+      __m128d pz = _mm_set_pd(map->table[map->dist[_mm_extract_epi32(cell, 1)]],
+                              map->table[map->dist[_mm_cvtsi128_si32(cell)]]);
+      pz = _mm_add_pd(pz, z_rand_term);
+      p = _mm_add_pd(p, _mm_mul_pd(_mm_mul_pd(pz, pz), pz));
+    }
+
+    _mm_storeu_pd(poses->p + j, p);
+  }
+
+  lf_kernel_scalar(map, beams, poses, j);
+}
+
+#endif
+
+void lf_kernel_generic(const laser_lf_map_t *map, const laser_lf_beams_t *beams,
+                       laser_lf_poses_t *poses)
+{
+  lf_kernel_scalar(map, beams, poses, 0);
+}
+
+typedef void (*lf_kernel_fn_t) (const laser_lf_map_t *map,
+                                const laser_lf_beams_t *beams,
+                                laser_lf_poses_t *poses);
+
+////////////////////////////////////////////////////////////////////////////////
+// Pick the widest code path the CPU supports
+void lf_kernel_select(lf_kernel_fn_t *fn, const char **name)
+{
+#ifdef AMCL_LASER_SIMD_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2"))
+  {
+    *name = "avx2";
+    *fn = lf_kernel_avx2;
+    return;
+  }
+  if(__builtin_cpu_supports("sse4.1"))
+  {
+    *name = "sse4.1";
+    *fn = lf_kernel_sse;
+    return;
+  }
+#endif
+  *name = "scalar";
+  *fn = lf_kernel_generic;
+}
+
+// Selected on first use; AMCLLaser does that from the configuring thread
+// through laser_lf_kernel_name() before any scoring starts
+lf_kernel_fn_t lf_kernel_fn = NULL;
+const char *lf_kernel_fn_name = NULL;
+
+}
+
+void amcl::laser_lf_kernel(const laser_lf_map_t *map,
+                           const laser_lf_beams_t *beams,
+                           laser_lf_poses_t *poses)
+{
+  if(lf_kernel_fn == NULL)
+    lf_kernel_select(&lf_kernel_fn, &lf_kernel_fn_name);
+  (*lf_kernel_fn)(map, beams, poses);
+}
+
+const char *amcl::laser_lf_kernel_name()
+{
+  if(lf_kernel_fn == NULL)
+    lf_kernel_select(&lf_kernel_fn, &lf_kernel_fn_name);
+  return lf_kernel_fn_name;
+}
+
+void amcl::laser_lf_kernel_scalar(const laser_lf_map_t *map,
+                                  const laser_lf_beams_t *beams,
+                                  laser_lf_poses_t *poses)
+{
+  lf_kernel_scalar(map, beams, poses, 0);
+}
+
+bool amcl::laser_lf_kernel_sse41(const laser_lf_map_t *map,
+                                 const laser_lf_beams_t *beams,
+                                 laser_lf_poses_t *poses)
+{
+#ifdef AMCL_LASER_SIMD_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("sse4.1"))
+  {
+    lf_kernel_sse(map, beams, poses);
+    return true;
+  }
+#endif
+  return false;
+}
+
+bool amcl::laser_lf_kernel_avx2(const laser_lf_map_t *map,
+                                const laser_lf_beams_t *beams,
+                                laser_lf_poses_t *poses)
+{
+#ifdef AMCL_LASER_SIMD_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2"))
+  {
+    lf_kernel_avx2(map, beams, poses);
+    return true;
+  }
+#endif
+  return false;
+}
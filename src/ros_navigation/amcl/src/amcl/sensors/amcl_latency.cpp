@@ -0,0 +1,180 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Latency histograms for the stages of a filter update
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+#include <algorithm>
+
+#include "amcl/sensors/amcl_latency.h"
+
+using namespace amcl;
+
+// Bucket 0 holds everything under 1 us, bucket i > 0 the durations up to
+// 2^(i/8) us, and the last bucket everything beyond
+static const int BUCKETS_PER_OCTAVE = 8;
+static const int BUCKET_COUNT = 2 + 25 * BUCKETS_PER_OCTAVE;
+
+static int bucket_index(double seconds)
+{
+  double us = seconds * 1e6;
+  if(!(us > 1.0))
+    return 0;
+  int i = 1 + (int)floor(log2(us) * BUCKETS_PER_OCTAVE);
+  return (i < BUCKET_COUNT) ? i : BUCKET_COUNT - 1;
+}
+
+static double bucket_upper(int i)
+{
+  return 1e-6 * exp2((double)i / BUCKETS_PER_OCTAVE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Histogram
+AMCLLatencyHistogram::AMCLLatencyHistogram() :
+  buckets(BUCKET_COUNT, 0)
+{
+  this->Clear();
+}
+
+void AMCLLatencyHistogram::Add(double seconds)
+{
+  if(seconds < 0)
+    seconds = 0;
+  this->buckets[bucket_index(seconds)]++;
+  this->count++;
+  this->sum += seconds;
+  if(seconds > this->max)
+    this->max = seconds;
+}
+
+void AMCLLatencyHistogram::Clear()
+{
+  std::fill(this->buckets.begin(), this->buckets.end(), 0);
+  this->count = 0;
+  this->sum = 0.0;
+  this->max = 0.0;
+}
+
+double AMCLLatencyHistogram::GetMean() const
+{
+  return this->count ? this->sum / this->count : 0.0;
+}
+
+double AMCLLatencyHistogram::GetPercentile(double p) const
+{
+  if(this->count == 0)
+    return 0.0;
+
+  // Rank of the sample we want, counting from 1
+  unsigned long rank = (unsigned long)ceil(p * this->count);
+  if(rank < 1)
+    rank = 1;
+
+  unsigned long seen = 0;
+  for(int i = 0; i < BUCKET_COUNT; i++)
+  {
+    seen += this->buckets[i];
+    if(seen >= rank)
+      return (i < BUCKET_COUNT - 1) ? std::min(bucket_upper(i), this->max) : this->max;
+  }
+  return this->max;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Stages
+AMCLLatency::AMCLLatency()
+{
+}
+
+int AMCLLatency::AddStage(const std::string& name)
+{
+  this->names.push_back(name);
+  this->window.push_back(AMCLLatencyHistogram());
+  this->total.push_back(AMCLLatencyHistogram());
+  return (int)this->names.size() - 1;
+}
+
+void AMCLLatency::Record(int stage, double seconds)
+{
+  this->window[stage].Add(seconds);
+  this->total[stage].Add(seconds);
+}
+
+void AMCLLatency::ClearWindow()
+{
+  for(size_t i = 0; i < this->window.size(); i++)
+    this->window[i].Clear();
+}
+
+std::string AMCLLatency::Format(bool whole_run) const
+{
+  std::string text;
+  char line[256];
+
+  snprintf(line, sizeof(line), "%-12s %8s %9s %9s %9s %9s %9s\n",
+           "stage (ms)", "count", "mean", "p50", "p95", "p99", "max");
+  text += line;
+  for(size_t i = 0; i < this->names.size(); i++)
+  {
+    const AMCLLatencyHistogram& h = whole_run ? this->total[i] : this->window[i];
+    snprintf(line, sizeof(line), "%-12s %8lu %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+             this->names[i].c_str(), h.GetCount(), h.GetMean() * 1e3,
+             h.GetPercentile(0.5) * 1e3, h.GetPercentile(0.95) * 1e3,
+             h.GetPercentile(0.99) * 1e3, h.GetMax() * 1e3);
+    text += line;
+  }
+  return text;
+}
+
+double AMCLLatency::Now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Stage timer
+AMCLLatencyTimer::AMCLLatencyTimer(AMCLLatency* latency, int total_stage) :
+  latency(latency), total_stage(total_stage)
+{
+  this->start = this->last = AMCLLatency::Now();
+}
+
+AMCLLatencyTimer::~AMCLLatencyTimer()
+{
+  if(this->total_stage >= 0)
+    this->latency->Record(this->total_stage, AMCLLatency::Now() - this->start);
+}
+
+double AMCLLatencyTimer::Lap(int stage)
+{
+  double now = AMCLLatency::Now();
+  double elapsed = now - this->last;
+  this->latency->Record(stage, elapsed);
+  this->last = now;
+  return elapsed;
+}
@@ -0,0 +1,257 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Scan-to-map refinement of a pose estimate
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#include "amcl/sensors/amcl_pose_refiner.h"
+
+using namespace amcl;
+
+// Fewest points within reach of an obstacle worth refining with
+static const int MIN_POINTS = 10;
+
+// Steps smaller than this (m, or rad) end the iterations
+static const double MIN_STEP = 1e-4;
+
+static double normalize_angle(double a)
+{
+  return atan2(sin(a), cos(a));
+}
+
+// Solve the symmetric 3x3 system a x = b; returns false if it is singular
+static bool solve3(double a[3][3], const double b[3], double x[3])
+{
+  double c00 = a[1][1] * a[2][2] - a[1][2] * a[2][1];
+  double c01 = a[1][2] * a[2][0] - a[1][0] * a[2][2];
+  double c02 = a[1][0] * a[2][1] - a[1][1] * a[2][0];
+  double det = a[0][0] * c00 + a[0][1] * c01 + a[0][2] * c02;
+  if(!(fabs(det) > 1e-12))
+    return false;
+
+  double inv[3][3];
+  inv[0][0] = c00;
+  inv[0][1] = a[0][2] * a[2][1] - a[0][1] * a[2][2];
+  inv[0][2] = a[0][1] * a[1][2] - a[0][2] * a[1][1];
+  inv[1][0] = c01;
+  inv[1][1] = a[0][0] * a[2][2] - a[0][2] * a[2][0];
+  inv[1][2] = a[0][2] * a[1][0] - a[0][0] * a[1][2];
+  inv[2][0] = c02;
+  inv[2][1] = a[0][1] * a[2][0] - a[0][0] * a[2][1];
+  inv[2][2] = a[0][0] * a[1][1] - a[0][1] * a[1][0];
+  for(int i = 0; i < 3; i++)
+    x[i] = (inv[i][0] * b[0] + inv[i][1] * b[1] + inv[i][2] * b[2]) / det;
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Default constructor
+AMCLPoseRefiner::AMCLPoseRefiner() :
+  map(NULL), huber_delta(0.1), max_iterations(10), max_distance(0.5),
+  max_angle(0.3), iterations(0), points_used(0), initial_error(0),
+  final_error(0)
+{
+}
+
+void
+AMCLPoseRefiner::SetHuberDelta(double huber_delta)
+{
+  this->huber_delta = huber_delta;
+}
+
+void
+AMCLPoseRefiner::SetMaxIterations(int max_iterations)
+{
+  this->max_iterations = std::max(max_iterations, 1);
+}
+
+void
+AMCLPoseRefiner::SetMaxCorrection(double distance, double angle)
+{
+  this->max_distance = distance;
+  this->max_angle = angle;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Distance plane lookup.  Cell (i, j) holds the distance at its centre, so
+// the four cells around (x, y) are interpolated bilinearly.
+bool
+AMCLPoseRefiner::Distance(double x, double y, double* d, double* dx, double* dy) const
+{
+  double u = (x - this->map->origin_x) / this->map->scale + this->map->size_x / 2;
+  double v = (y - this->map->origin_y) / this->map->scale + this->map->size_y / 2;
+  int i = (int)floor(u), j = (int)floor(v);
+  if(i < 0 || j < 0 || i + 1 >= this->map->size_x || j + 1 >= this->map->size_y)
+    return false;
+
+  double a = u - i, b = v - j;
+  const uint8_t* c = this->map->occ_dist + MAP_INDEX(this->map, i, j);
+  double d00 = c[0], d10 = c[1];
+  double d01 = c[this->map->size_x], d11 = c[this->map->size_x + 1];
+
+  double step = this->map->occ_dist_step;
+  *d = step * ((1 - b) * ((1 - a) * d00 + a * d10) + b * ((1 - a) * d01 + a * d11));
+  *dx = step / this->map->scale * ((1 - b) * (d10 - d00) + b * (d11 - d01));
+  *dy = step / this->map->scale * ((1 - a) * (d01 - d00) + a * (d11 - d10));
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Huber cost of the scan at pose, with its gradient and (weighted) J^T J
+double
+AMCLPoseRefiner::Evaluate(const std::vector<pf_vector_t>& points,
+                          const pf_vector_t& pose, double grad[3],
+                          double hessian[3][3], int* used, double* error) const
+{
+  double cs = cos(pose.v[2]), sn = sin(pose.v[2]);
+  double delta = this->huber_delta;
+  double reach = this->map->max_occ_dist;
+  double cost = 0.0, sum = 0.0;
+  int on_map = 0;
+
+  memset(grad, 0, 3 * sizeof(double));
+  memset(hessian, 0, 9 * sizeof(double));
+  *used = 0;
+
+  for(size_t k = 0; k < points.size(); k++)
+  {
+    const pf_vector_t& p = points[k];
+    double rx = cs * p.v[0] - sn * p.v[1];
+    double ry = sn * p.v[0] + cs * p.v[1];
+    double d, ddx, ddy;
+    if(!this->Distance(pose.v[0] + rx, pose.v[1] + ry, &d, &ddx, &ddy))
+      continue;
+    on_map++;
+    sum += d;
+
+    // Points out of reach of every obstacle cost the same wherever they go
+    if(d < delta)
+      cost += 0.5 * d * d;
+    else
+      cost += delta * (d - 0.5 * delta);
+    if(d >= reach)
+      continue;
+    (*used)++;
+
+    // Jacobian of d with respect to (x, y, theta), and the IRLS weight
+    // that turns the Huber cost into weighted least squares
+    double j[3] = {ddx, ddy, -ddx * ry + ddy * rx};
+    double w = (d <= delta) ? 1.0 : delta / d;
+    for(int r = 0; r < 3; r++)
+    {
+      grad[r] += w * d * j[r];
+      for(int s = 0; s < 3; s++)
+        hessian[r][s] += w * j[r] * j[s];
+    }
+  }
+
+  *error = on_map ? sum / on_map : 0.0;
+  return cost;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Levenberg-Marquardt damped Gauss-Newton: a step that raises the cost is
+// retried with more damping, which shortens it and turns it towards the
+// gradient
+bool
+AMCLPoseRefiner::Refine(const std::vector<pf_vector_t>& points, pf_vector_t* pose)
+{
+  this->iterations = 0;
+  this->points_used = 0;
+  this->initial_error = this->final_error = 0.0;
+  if(this->map == NULL || this->map->occ_dist == NULL)
+    return false;
+
+  pf_vector_t current = *pose;
+  double grad[3], hessian[3][3];
+  int used;
+  double error;
+  double cost = this->Evaluate(points, current, grad, hessian, &used, &error);
+  double start_cost = cost;
+  this->initial_error = this->final_error = error;
+  this->points_used = used;
+  if(used < MIN_POINTS)
+    return false;
+
+  double lambda = 1e-3;
+  for(int it = 0; it < this->max_iterations; it++)
+  {
+    this->iterations = it + 1;
+    bool improved = false;
+    double step[3];
+    for(int attempt = 0; attempt < 5 && !improved; attempt++)
+    {
+      double damped[3][3];
+      double rhs[3];
+      memcpy(damped, hessian, sizeof(damped));
+      for(int r = 0; r < 3; r++)
+      {
+        damped[r][r] += lambda * hessian[r][r] + 1e-9;
+        rhs[r] = -grad[r];
+      }
+      if(!solve3(damped, rhs, step))
+        break;
+
+      pf_vector_t next = current;
+      next.v[0] += step[0];
+      next.v[1] += step[1];
+      next.v[2] = normalize_angle(next.v[2] + step[2]);
+
+      double next_grad[3], next_hessian[3][3];
+      int next_used;
+      double next_error;
+      double next_cost = this->Evaluate(points, next, next_grad, next_hessian,
+                                        &next_used, &next_error);
+      if(next_cost < cost)
+      {
+        current = next;
+        cost = next_cost;
+        memcpy(grad, next_grad, sizeof(grad));
+        memcpy(hessian, next_hessian, sizeof(hessian));
+        this->final_error = next_error;
+        this->points_used = next_used;
+        lambda = std::max(lambda * 0.1, 1e-6);
+        improved = true;
+      }
+      else
+        lambda *= 10;
+    }
+    if(!improved || (hypot(step[0], step[1]) < MIN_STEP && fabs(step[2]) < MIN_STEP))
+      break;
+  }
+
+  // A correction this large means the scan locked onto the wrong walls
+  if(!(cost < start_cost) ||
+     hypot(current.v[0] - pose->v[0], current.v[1] - pose->v[1]) > this->max_distance ||
+     fabs(normalize_angle(current.v[2] - pose->v[2])) > this->max_angle)
+  {
+    this->final_error = this->initial_error;
+    return false;
+  }
+
+  *pose = current;
+  return true;
+}
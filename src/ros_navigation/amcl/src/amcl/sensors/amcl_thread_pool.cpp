@@ -0,0 +1,132 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Fixed-size worker pool used to score particles in parallel
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include <boost/bind.hpp>
+
+#include "amcl/sensors/amcl_thread_pool.h"
+
+using namespace amcl;
+
+////////////////////////////////////////////////////////////////////////////////
+// Start the worker threads
+AMCLThreadPool::AMCLThreadPool(int thread_count) :
+  job_fn(NULL), job_task_count(0), job_next_task(0), job_pending(0),
+  job_generation(0), shutdown(false)
+{
+  if(thread_count < 1)
+    thread_count = 1;
+  this->thread_count = thread_count;
+
+  // The calling thread does its share of the work, so we only need
+  // thread_count - 1 helpers
+  for(int i = 1; i < thread_count; i++)
+    this->workers.create_thread(boost::bind(&AMCLThreadPool::WorkerLoop, this));
+}
+
+AMCLThreadPool::~AMCLThreadPool()
+{
+  {
+    boost::mutex::scoped_lock lock(this->mutex);
+    this->shutdown = true;
+  }
+  this->job_cond.notify_all();
+  this->workers.join_all();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Run a job to completion
+void AMCLThreadPool::Run(int task_count, const boost::function<void (int)>& fn)
+{
+  if(task_count <= 0)
+    return;
+
+  // Nothing to hand out; avoid waking the workers
+  if(task_count == 1 || this->thread_count == 1)
+  {
+    for(int i = 0; i < task_count; i++)
+      fn(i);
+    return;
+  }
+
+  {
+    boost::mutex::scoped_lock lock(this->mutex);
+    this->job_fn = &fn;
+    this->job_task_count = task_count;
+    this->job_next_task = 0;
+    this->job_pending = task_count;
+    this->job_generation++;
+  }
+  this->job_cond.notify_all();
+
+  this->DrainTasks();
+
+  boost::mutex::scoped_lock lock(this->mutex);
+  while(this->job_pending > 0)
+    this->done_cond.wait(lock);
+  this->job_fn = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Execute tasks from the current job until it has been handed out entirely
+void AMCLThreadPool::DrainTasks()
+{
+  for(;;)
+  {
+    int task;
+    const boost::function<void (int)>* fn;
+    {
+      boost::mutex::scoped_lock lock(this->mutex);
+      if(this->job_fn == NULL || this->job_next_task >= this->job_task_count)
+        return;
+      task = this->job_next_task++;
+      fn = this->job_fn;
+    }
+
+    (*fn)(task);
+
+    boost::mutex::scoped_lock lock(this->mutex);
+    if(--this->job_pending == 0)
+      this->done_cond.notify_all();
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Worker thread main loop
+void AMCLThreadPool::WorkerLoop()
+{
+  unsigned long seen_generation = 0;
+  for(;;)
+  {
+    {
+      boost::mutex::scoped_lock lock(this->mutex);
+      while(!this->shutdown && this->job_generation == seen_generation)
+        this->job_cond.wait(lock);
+      if(this->shutdown)
+        return;
+      seen_generation = this->job_generation;
+    }
+    this->DrainTasks();
+  }
+}
@@ -0,0 +1,1052 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Filter throughput without ROS.  Drives a robot along a scripted
+// path through a map image, ray casts its scans, and times the action,
+// sensor and resample updates for each laser model and particle count.
+// The path, the scans and the filters are all fixed by --seed, so two
+// runs with the same options score the same particles.  --components
+// times parts of the filter and the map work around it on their own.
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "amcl/map/map.h"
+#include "amcl/pf/pf.h"
+#include "amcl/pf/pf_kdtree.h"
+#include "amcl/pf/pf_pdf.h"
+#include "amcl/pf/pf_random.h"
+#include "amcl/sensors/amcl_floor_set.h"
+#include "amcl/sensors/amcl_global_matcher.h"
+#include "amcl/sensors/amcl_laser.h"
+#include "amcl/sensors/amcl_latency.h"
+#include "amcl/sensors/amcl_odom.h"
+
+using namespace amcl;
+
+static const char* usage =
+  "usage: amcl_benchmark [options] MAP.pgm\n"
+  "  --resolution M     map resolution, in m per pixel (0.05)\n"
+  "  --particles N,...  particle counts (500,2000,5000)\n"
+  "  --models NAME,...  beam, likelihood_field, likelihood_field_prob (all)\n"
+  "  --steps N          updates per run (100)\n"
+  "  --beams N          laser_max_beams (60)\n"
+  "  --threads N        sensor_threads (1)\n"
+  "  --seed N           seed for the scan noise and the filter (1)\n"
+  "  --min-rate R       exit with 1 if a run manages fewer scans/sec\n"
+  "  --components NAME,... time parts of the filter on their own instead\n"
+  "                     of whole updates: all, cspace, resample, kdtree,\n"
+  "                     range_table, odom, global_matcher, beam_selection,\n"
+  "                     floor_set, fused_update\n";
+
+// Laser and path settings
+static const int SCAN_RANGES = 720;
+static const double SCAN_MAX_RANGE = 12.0;
+static const double SCAN_NOISE = 0.02;
+static const double STEP_DISTANCE = 0.25;
+static const double MIN_CLEARANCE = 0.5;
+static const double TURN_STEP = M_PI / 12;
+static const int TURN_EVERY = 20;
+
+struct benchmark_options_t
+{
+  std::string map_file;
+  double resolution;
+  std::vector<int> particles;
+  std::vector<std::string> models;
+  int steps;
+  int beams;
+  int threads;
+  int seed;
+  double min_rate;
+  std::vector<std::string> components;
+};
+
+static std::vector<std::string> split(const char* list)
+{
+  std::vector<std::string> items;
+  std::string s(list);
+  size_t start = 0;
+  while(start <= s.size())
+  {
+    size_t end = s.find(',', start);
+    if(end == std::string::npos)
+      end = s.size();
+    if(end > start)
+      items.push_back(s.substr(start, end - start));
+    start = end + 1;
+  }
+  return items;
+}
+
+static bool parse_options(int argc, char** argv, benchmark_options_t* options)
+{
+  options->resolution = 0.05;
+  options->particles.push_back(500);
+  options->particles.push_back(2000);
+  options->particles.push_back(5000);
+  options->models.push_back("beam");
+  options->models.push_back("likelihood_field");
+  options->models.push_back("likelihood_field_prob");
+  options->steps = 100;
+  options->beams = 60;
+  options->threads = 1;
+  options->seed = 1;
+  options->min_rate = 0.0;
+
+  for(int i = 1; i < argc; i++)
+  {
+    const char* arg = argv[i];
+    const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+    if(arg[0] != '-')
+    {
+      options->map_file = arg;
+      continue;
+    }
+    if(value == NULL)
+      return false;
+    i++;
+    if(!strcmp(arg, "--resolution"))
+      options->resolution = atof(value);
+    else if(!strcmp(arg, "--particles"))
+    {
+      std::vector<std::string> counts = split(value);
+      options->particles.clear();
+      for(size_t k = 0; k < counts.size(); k++)
+        options->particles.push_back(atoi(counts[k].c_str()));
+    }
+    else if(!strcmp(arg, "--models"))
+      options->models = split(value);
+    else if(!strcmp(arg, "--steps"))
+      options->steps = atoi(value);
+    else if(!strcmp(arg, "--beams"))
+      options->beams = atoi(value);
+    else if(!strcmp(arg, "--threads"))
+      options->threads = atoi(value);
+    else if(!strcmp(arg, "--seed"))
+      options->seed = atoi(value);
+    else if(!strcmp(arg, "--min-rate"))
+      options->min_rate = atof(value);
+    else if(!strcmp(arg, "--components"))
+      options->components = split(value);
+    else
+      return false;
+  }
+
+  for(size_t k = 0; k < options->particles.size(); k++)
+    if(options->particles[k] < 1)
+      return false;
+  return !options->map_file.empty() && options->resolution > 0 &&
+         options->steps > 0 && options->beams >= 2 && options->threads >= 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// The path: a scripted drive through the free space.  It starts at the
+// most open cell facing +x and goes STEP_DISTANCE per update, making a
+// quarter turn to the left every TURN_EVERY steps.  Where a step would come
+// closer than MIN_CLEARANCE to anything it tries TURN_STEP either side of
+// the heading, then twice that and so on, so it never needs a random draw;
+// turning right round always finds the cell it came from.
+
+static double clearance(map_t* map, double x, double y)
+{
+  int i = MAP_GXWX(map, x), j = MAP_GYWY(map, y);
+  if(!MAP_VALID(map, i, j) || map->occ_state[MAP_INDEX(map, i, j)] != -1)
+    return 0.0;
+  return MAP_OCC_DIST(map, MAP_INDEX(map, i, j));
+}
+
+static bool make_path(map_t* map, const std::vector<std::pair<int, int> >& free_cells,
+                      int steps, std::vector<pf_vector_t>* path)
+{
+  // Start at the first of the most open cells
+  pf_vector_t pose = pf_vector_zero();
+  double best = 0.0;
+  for(size_t k = 0; k < free_cells.size(); k++)
+  {
+    double x = MAP_WXGX(map, free_cells[k].first);
+    double y = MAP_WYGY(map, free_cells[k].second);
+    double c = clearance(map, x, y);
+    if(c > best)
+    {
+      best = c;
+      pose.v[0] = x;
+      pose.v[1] = y;
+    }
+  }
+  if(best < MIN_CLEARANCE)
+    return false;
+
+  path->clear();
+  path->push_back(pose);
+  int turns = (int)(M_PI / TURN_STEP);
+  while((int)path->size() <= steps)
+  {
+    double heading = pose.v[2];
+    if(path->size() % TURN_EVERY == 0)
+      heading += M_PI / 2;
+
+    pf_vector_t next = pose;
+    int t;
+    for(t = 0; t <= 2 * turns; t++)
+    {
+      // 0, +1, -1, +2, -2, ... steps from the heading
+      int offset = (t + 1) / 2 * ((t % 2) ? 1 : -1);
+      next.v[2] = heading + offset * TURN_STEP;
+      next.v[2] = atan2(sin(next.v[2]), cos(next.v[2]));
+      next.v[0] = pose.v[0] + STEP_DISTANCE * cos(next.v[2]);
+      next.v[1] = pose.v[1] + STEP_DISTANCE * sin(next.v[2]);
+      if(clearance(map, next.v[0], next.v[1]) >= MIN_CLEARANCE)
+        break;
+    }
+    if(t > 2 * turns)
+      return false;
+    path->push_back(next);
+    pose = next;
+  }
+  return true;
+}
+
+static double scan_bearing(int b)
+{
+  return -M_PI + b * 2 * M_PI / SCAN_RANGES;
+}
+
+// The ranges seen from each pose of the path; made once, before any filter
+// reseeds drand48(), so every run gets the same noise
+static void make_scans(map_t* map, const std::vector<pf_vector_t>& path,
+                       std::vector<std::vector<double> >* scans)
+{
+  scans->resize(path.size());
+  for(size_t k = 0; k < path.size(); k++)
+  {
+    std::vector<double>& ranges = (*scans)[k];
+    ranges.resize(SCAN_RANGES);
+    for(int b = 0; b < SCAN_RANGES; b++)
+    {
+      double r = map_calc_range(map, path[k].v[0], path[k].v[1],
+                                path[k].v[2] + scan_bearing(b), SCAN_MAX_RANGE);
+      if(r < SCAN_MAX_RANGE)
+        r = std::min(SCAN_MAX_RANGE, std::max(0.0, r + pf_ran_gaussian(SCAN_NOISE)));
+      ranges[b] = r;
+    }
+  }
+}
+
+static void fill_scan(const std::vector<double>& ranges, AMCLLaserData* data)
+{
+  data->range_count = SCAN_RANGES;
+  data->range_max = SCAN_MAX_RANGE;
+  data->ranges = new double[SCAN_RANGES][2];
+  for(int b = 0; b < SCAN_RANGES; b++)
+  {
+    data->ranges[b][0] = ranges[b];
+    data->ranges[b][1] = scan_bearing(b);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Uniform poses over the free space, for the filter's recovery
+
+struct free_space_t
+{
+  map_t* map;
+  const std::vector<std::pair<int, int> >* cells;
+};
+
+static pf_vector_t uniform_pose(void* arg)
+{
+  free_space_t* space = (free_space_t*) arg;
+  const std::pair<int, int>& cell = (*space->cells)[lrand48() % space->cells->size()];
+  pf_vector_t p;
+  p.v[0] = MAP_WXGX(space->map, cell.first);
+  p.v[1] = MAP_WYGY(space->map, cell.second);
+  p.v[2] = drand48() * 2 * M_PI - M_PI;
+  return p;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// One run: a model and a particle count along the whole path
+
+enum {STAGE_ACTION, STAGE_SENSOR, STAGE_RESAMPLE, STAGE_UPDATE};
+
+struct benchmark_result_t
+{
+  std::string model;
+  int particles;
+  double rate;
+  double error;
+};
+
+static bool set_model(AMCLLaser* laser, const std::string& model)
+{
+  if(model == "beam")
+    laser->SetModelBeam(0.5, 0.05, 0.05, 0.5, 0.2, 0.1, 0.0);
+  else if(model == "likelihood_field")
+    laser->SetModelLikelihoodField(0.95, 0.05, 0.2, 2.0);
+  else if(model == "likelihood_field_prob")
+    laser->SetModelLikelihoodFieldProb(0.95, 0.05, 0.2, 2.0, false, 0.5, 0.3, 0.9);
+  else
+    return false;
+  return true;
+}
+
+static benchmark_result_t run(map_t* map, free_space_t* space,
+                              const std::vector<pf_vector_t>& path,
+                              const std::vector<std::vector<double> >& scans,
+                              const benchmark_options_t& options,
+                              const std::string& model, int particles)
+{
+  benchmark_result_t result;
+  result.model = model;
+  result.particles = particles;
+
+  AMCLOdom odom;
+  odom.SetModel(ODOM_MODEL_DIFF, 0.2, 0.2, 0.2, 0.2);
+  AMCLLaser laser(options.beams, map);
+  pf_vector_t laser_pose = pf_vector_zero();
+  laser.SetLaserPose(laser_pose);
+  laser.SetSensorThreads(options.threads);
+  set_model(&laser, model);
+
+  // A fixed particle count, so the runs do the same work whatever the
+  // filter makes of the scans
+  pf_t* pf = pf_alloc(particles, particles, 0.001, 0.1, uniform_pose, space);
+  pf_set_seed(pf, options.seed);
+  // pf_alloc() seeds drand48() from the clock; uniform_pose() draws from it
+  srand48(options.seed);
+  pf_matrix_t cov = pf_matrix_zero();
+  cov.m[0][0] = cov.m[1][1] = 0.25 * 0.25;
+  cov.m[2][2] = 0.1 * 0.1;
+  pf_init(pf, path[0], cov);
+
+  AMCLLatency latency;
+  latency.AddStage("action");
+  latency.AddStage("sensor");
+  latency.AddStage("resample");
+  latency.AddStage("update");
+
+  double error = 0.0;
+  for(size_t k = 1; k < path.size(); k++)
+  {
+    // Scans are copied outside the timed span
+    AMCLLaserData ldata;
+    ldata.sensor = &laser;
+    fill_scan(scans[k], &ldata);
+
+    AMCLOdomData odata;
+    odata.sensor = &odom;
+    odata.pose = path[k];
+    odata.delta = pf_vector_sub(path[k], path[k - 1]);
+    odata.delta.v[2] = atan2(sin(odata.delta.v[2]), cos(odata.delta.v[2]));
+
+    {
+      AMCLLatencyTimer timer(&latency, STAGE_UPDATE);
+      odom.UpdateAction(pf, &odata);
+      timer.Lap(STAGE_ACTION);
+      laser.UpdateSensor(pf, &ldata);
+      timer.Lap(STAGE_SENSOR);
+      pf_update_resample(pf);
+      timer.Lap(STAGE_RESAMPLE);
+    }
+
+    pf_sample_set_t* set = pf->sets + pf->current_set;
+    error += hypot(set->mean.v[0] - path[k].v[0], set->mean.v[1] - path[k].v[1]);
+  }
+
+  const AMCLLatencyHistogram& update = latency.GetTotal(STAGE_UPDATE);
+  result.rate = 1.0 / update.GetMean();
+  result.error = error / (path.size() - 1);
+
+  printf("\n%s, %d particles: %.1f scans/sec, mean error %.3f m\n%s", model.c_str(),
+         particles, result.rate, result.error, latency.Format(true).c_str());
+  fflush(stdout);
+
+  pf_free(pf);
+  return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Component timings.  Each prints one or more lines starting with its
+// name; they run on the map as loaded, with the path and scans above.
+
+struct benchmark_scene_t
+{
+  map_t* map;
+  // occ_state before unknown cells were made walls
+  std::vector<int8_t> loaded_state;
+  std::vector<pf_vector_t> path;
+  std::vector<std::vector<double> > scans;
+};
+
+// Both distance transforms over the whole map, and the exact one over a
+// 2 m square edit in the middle.  Leaves the map's plane as it was.
+static void time_cspace(benchmark_scene_t* scene, const benchmark_options_t&)
+{
+  map_t* map = scene->map;
+  double t0 = AMCLLatency::Now();
+  map_update_cspace(map, 2.0);
+  double t1 = AMCLLatency::Now();
+  map_update_cspace_edt(map, 2.0, 1);
+  double t2 = AMCLLatency::Now();
+  map_update_cspace_edt(map, 2.0, 0);
+  double t3 = AMCLLatency::Now();
+
+  int cx = map->size_x / 2, cy = map->size_y / 2, half = (int)(1.0 / map->scale);
+  double t4 = AMCLLatency::Now();
+  map_update_cspace_window(map, cx - half, cy - half, cx + half, cy + half,
+                           MAP_CSPACE_EDT, 1);
+  double t5 = AMCLLatency::Now();
+
+  printf("cspace: brushfire %.3f s, edt %.3f s (1 thread), %.3f s (all cores), "
+         "2 m window %.3f ms\n", t1 - t0, t2 - t1, t3 - t2, (t5 - t4) * 1e3);
+}
+
+// Resampling a full set, every sample in a kd-tree cell of its own, at
+// each --particles count.  "linear" is the parent search the filter used
+// before, on its own; the others are whole pf_update_resample() calls,
+// kd-tree and cluster statistics included.
+static double linear_search_time(const std::vector<double>& weights)
+{
+  double t0 = AMCLLatency::Now();
+  std::vector<double> c(weights.size() + 1, 0.0);
+  for(size_t i = 0; i < weights.size(); i++)
+    c[i+1] = c[i] + weights[i];
+  long sum = 0;
+  for(size_t k = 0; k < weights.size(); k++)
+  {
+    double r = drand48() * c[weights.size()];
+    size_t i;
+    for(i = 0; i < weights.size(); i++)
+      if((c[i] <= r) && (r < c[i+1]))
+        break;
+    sum += i;
+  }
+  double t1 = AMCLLatency::Now();
+  return (sum >= 0) ? t1 - t0 : 0.0;
+}
+
+static void time_resample(benchmark_scene_t*, const benchmark_options_t& options)
+{
+  const pf_resample_model_t models[] =
+    {PF_RESAMPLE_MULTINOMIAL, PF_RESAMPLE_SYSTEMATIC, PF_RESAMPLE_ALIAS};
+  const char* model_names[] = {"multinomial", "systematic", "alias"};
+
+  srand48(options.seed);
+  for(size_t n = 0; n < options.particles.size(); n++)
+  {
+    int count = options.particles[n];
+    std::vector<double> weights(count);
+    double total = 0.0;
+    for(int i = 0; i < count; i++)
+      total += weights[i] = exp(-10.0 * drand48());
+
+    printf("resample: %d samples", count);
+    // The old search is quadratic
+    if(count <= 20000)
+      printf(", linear %.2f ms", linear_search_time(weights) * 1e3);
+    for(int m = 0; m < 3; m++)
+    {
+      pf_t* pf = pf_alloc(1, count, 0.0, 0.0, NULL, NULL);
+      pf_set_seed(pf, options.seed);
+      pf_set_resample_model(pf, models[m]);
+      pf->pop_err = 1e-3;
+      pf_sample_set_t* set = pf->sets + pf->current_set;
+      set->sample_count = count;
+      for(int i = 0; i < count; i++)
+      {
+        set->samples[i].pose = pf_vector_zero();
+        set->samples[i].pose.v[0] = i;
+        set->samples[i].weight = weights[i] / total;
+      }
+
+      double t0 = AMCLLatency::Now();
+      pf_update_resample(pf);
+      double t1 = AMCLLatency::Now();
+      printf(", %s %.2f ms", model_names[m], (t1 - t0) * 1e3);
+      pf_free(pf);
+    }
+    printf("\n");
+  }
+}
+
+// Filling and clustering the histogram, and one cluster lookup per pose
+// as pf_cluster_stats() does them, with the kd-tree and with the hash
+// table at each --particles count.  The poses are a cloud around the
+// path, as after the filter has spread out along it, with a tenth of them
+// scattered over the whole map.
+static double histogram_time(pf_kdtree_t* tree, const std::vector<pf_vector_t>& poses)
+{
+  double t0 = AMCLLatency::Now();
+  pf_kdtree_clear(tree);
+  for(size_t i = 0; i < poses.size(); i++)
+    pf_kdtree_insert(tree, poses[i], 1.0 / poses.size());
+  pf_kdtree_cluster(tree);
+  int sum = 0;
+  for(size_t i = 0; i < poses.size(); i++)
+    sum += pf_kdtree_get_cluster(tree, poses[i]);
+  double t1 = AMCLLatency::Now();
+  return (sum >= 0) ? t1 - t0 : 0.0;
+}
+
+static void time_kdtree(benchmark_scene_t* scene, const benchmark_options_t& options)
+{
+  map_t* map = scene->map;
+  srand48(options.seed);
+  for(size_t n = 0; n < options.particles.size(); n++)
+  {
+    int count = options.particles[n];
+    std::vector<pf_vector_t> poses(count);
+    for(int i = 0; i < count; i++)
+    {
+      pf_vector_t p = pf_vector_zero();
+      if(i % 10 == 0)
+      {
+        p.v[0] = MAP_WXGX(map, 0) + drand48() * map->size_x * map->scale;
+        p.v[1] = MAP_WYGY(map, 0) + drand48() * map->size_y * map->scale;
+        p.v[2] = drand48() * 2 * M_PI - M_PI;
+      }
+      else
+      {
+        const pf_vector_t& at = scene->path[lrand48() % scene->path.size()];
+        p.v[0] = at.v[0] + pf_ran_gaussian(0.5);
+        p.v[1] = at.v[1] + pf_ran_gaussian(0.5);
+        p.v[2] = at.v[2] + pf_ran_gaussian(0.3);
+      }
+      poses[i] = p;
+    }
+
+    pf_kdtree_t* tree = pf_kdtree_alloc(3 * count);
+    pf_kdtree_t* hash = pf_kdtree_alloc_type(count, PF_KDTREE_HASH);
+
+    // Second run of each, with warm buffers
+    histogram_time(tree, poses);
+    double tree_time = histogram_time(tree, poses);
+    histogram_time(hash, poses);
+    double hash_time = histogram_time(hash, poses);
+    printf("kdtree: %d samples in %d bins, kdtree %.2f ms, hash %.2f ms\n", count,
+           tree->leaf_count, tree_time * 1e3, hash_time * 1e3);
+
+    pf_kdtree_free(tree);
+    pf_kdtree_free(hash);
+  }
+}
+
+// Building the beam model's range table for the map, then ray tracing
+// against looking up --beams ranges for each particle, at each
+// --particles count, and patching the table for a map update.  The
+// particles are spread around the path.
+static const int RANGE_TABLE_ANGLES = 180;
+static const size_t RANGE_TABLE_MAX_SIZE = (size_t) 1 << 30;
+
+static void time_range_table(benchmark_scene_t* scene, const benchmark_options_t& options)
+{
+  map_t* map = scene->map;
+  map_range_table_t layout;
+  if(map_range_table_init(&layout, map, SCAN_MAX_RANGE, RANGE_TABLE_ANGLES, 2) != 0 ||
+     layout.size > RANGE_TABLE_MAX_SIZE)
+  {
+    printf("range_table: %d bearings would not fit in %.0f MB; skipped\n",
+           RANGE_TABLE_ANGLES, RANGE_TABLE_MAX_SIZE / 1e6);
+    return;
+  }
+
+  double t0 = AMCLLatency::Now();
+  map_range_table_t* table = map_range_table_build(map, SCAN_MAX_RANGE, RANGE_TABLE_ANGLES,
+                                                   2, options.threads);
+  double t1 = AMCLLatency::Now();
+  if(table == NULL)
+  {
+    printf("range_table: build failed\n");
+    return;
+  }
+  printf("range_table: %d bearings, build %.2f s on %d threads (%.1f MB)\n",
+         RANGE_TABLE_ANGLES, t1 - t0, options.threads, table->size / 1e6);
+
+  srand48(options.seed);
+  for(size_t n = 0; n < options.particles.size(); n++)
+  {
+    int count = options.particles[n];
+    std::vector<pf_vector_t> poses(count);
+    for(int i = 0; i < count; i++)
+    {
+      const pf_vector_t& at = scene->path[lrand48() % scene->path.size()];
+      poses[i].v[0] = at.v[0] + pf_ran_gaussian(0.5);
+      poses[i].v[1] = at.v[1] + pf_ran_gaussian(0.5);
+      poses[i].v[2] = at.v[2] + pf_ran_gaussian(0.3);
+    }
+
+    double traced = 0, looked_up = 0;
+    double t2 = AMCLLatency::Now();
+    for(int i = 0; i < count; i++)
+      for(int b = 0; b < options.beams; b++)
+        traced += map_calc_range(map, poses[i].v[0], poses[i].v[1],
+                                 poses[i].v[2] + b * 2 * M_PI / options.beams,
+                                 SCAN_MAX_RANGE);
+    double t3 = AMCLLatency::Now();
+    for(int i = 0; i < count; i++)
+      for(int b = 0; b < options.beams; b++)
+        looked_up += map_range_table_lookup(table, map, poses[i].v[0], poses[i].v[1],
+                                            poses[i].v[2] + b * 2 * M_PI / options.beams);
+    double t4 = AMCLLatency::Now();
+
+    printf("range_table: %d particles x %d beams, ray tracing %.2f ms, lookup %.2f ms, "
+           "mean range %.3f m traced, %.3f m looked up\n", count, options.beams,
+           (t3 - t2) * 1e3, (t4 - t3) * 1e3, traced / (count * options.beams),
+           looked_up / (count * options.beams));
+  }
+
+  // A 2 m square edit in the middle, as a map update patches it (the map
+  // itself is left as it is)
+  int cx = map->size_x / 2, cy = map->size_y / 2, half = (int)(1.0 / map->scale);
+  double t5 = AMCLLatency::Now();
+  map_range_table_t* updated = map_range_table_update_window(table, map, cx - half,
+                                                             cy - half, cx + half,
+                                                             cy + half, options.threads);
+  double t6 = AMCLLatency::Now();
+  if(updated != NULL)
+    printf("range_table: 2 m window update %.2f s on %d threads\n", t6 - t5,
+           options.threads);
+  map_range_table_free(updated);
+
+  map_range_table_free(table);
+}
+
+// The motion models' noise, drawn one at a time from drand48() and in
+// bulk from the filter's generator, and whole diff and omni action
+// updates along the first step of the path, at each --particles count
+static void time_odom(benchmark_scene_t* scene, const benchmark_options_t& options)
+{
+  AMCLOdomData data;
+  data.sensor = NULL;
+  data.pose = scene->path[1];
+  data.delta = pf_vector_sub(scene->path[1], scene->path[0]);
+  data.delta.v[2] = atan2(sin(data.delta.v[2]), cos(data.delta.v[2]));
+
+  srand48(options.seed);
+  for(size_t n = 0; n < options.particles.size(); n++)
+  {
+    int count = options.particles[n];
+    std::vector<double> x(3 * count);
+
+    double t0 = AMCLLatency::Now();
+    for(int i = 0; i < 3 * count; i++)
+      x[i] = pf_ran_gaussian(1.0);
+    double t1 = AMCLLatency::Now();
+    pf_random_t rng;
+    pf_random_seed(&rng, options.seed);
+    pf_random_gaussian_fill(&rng, &x[0], 3 * count);
+    double t2 = AMCLLatency::Now();
+
+    pf_t* pf = pf_alloc(count, count, 0.0, 0.0, NULL, NULL);
+    pf_set_seed(pf, options.seed);
+    pf_matrix_t cov = pf_matrix_zero();
+    cov.m[0][0] = cov.m[1][1] = 0.25 * 0.25;
+    cov.m[2][2] = 0.1 * 0.1;
+    pf_init(pf, scene->path[0], cov);
+
+    AMCLOdom diff, omni;
+    diff.SetModel(ODOM_MODEL_DIFF_CORRECTED, 0.2, 0.2, 0.2, 0.2, 0.2);
+    omni.SetModel(ODOM_MODEL_OMNI_CORRECTED, 0.2, 0.2, 0.2, 0.2, 0.2);
+    // Second run of each, with warm buffers
+    diff.UpdateAction(pf, &data);
+    double t3 = AMCLLatency::Now();
+    diff.UpdateAction(pf, &data);
+    double t4 = AMCLLatency::Now();
+    omni.UpdateAction(pf, &data);
+    double t5 = AMCLLatency::Now();
+    omni.UpdateAction(pf, &data);
+    double t6 = AMCLLatency::Now();
+
+    printf("odom: %d samples, drand48 noise %.2f ms, bulk noise %.2f ms, "
+           "diff update %.2f ms, omni update %.2f ms\n", count, (t1 - t0) * 1e3,
+           (t2 - t1) * 1e3, (t4 - t3) * 1e3, (t6 - t5) * 1e3);
+    pf_free(pf);
+  }
+}
+
+// Building the global matcher's pyramid for the map, and matching the
+// scans from the start, the middle and the end of the path against it.
+// The matcher gets the map as loaded: with unknown space made into walls,
+// free specks inside it would fit any scan.  Beams that end in unknown
+// space are left out, as a real scanner would not see them.
+static void time_global_matcher(benchmark_scene_t* scene, const benchmark_options_t& options)
+{
+  map_t* map = scene->map;
+  std::vector<int8_t> walled(map->occ_state, map->occ_state + map->size_x * map->size_y);
+  std::copy(scene->loaded_state.begin(), scene->loaded_state.end(), map->occ_state);
+
+  double t0 = AMCLLatency::Now();
+  AMCLGlobalMatcher matcher;
+  matcher.SetMap(map, 0.1, 7, options.threads);
+  double t1 = AMCLLatency::Now();
+  printf("global_matcher: pyramid %.3f s on %d threads\n", t1 - t0, options.threads);
+
+  size_t last = scene->path.size() - 1;
+  size_t steps[] = {0, last / 2, last};
+  for(int k = 0; k < 3; k++)
+  {
+    const pf_vector_t& pose = scene->path[steps[k]];
+    const std::vector<double>& ranges = scene->scans[steps[k]];
+    std::vector<pf_vector_t> points;
+    for(int b = 0; b < SCAN_RANGES; b++)
+    {
+      if(ranges[b] >= SCAN_MAX_RANGE)
+        continue;
+      double a = pose.v[2] + scan_bearing(b);
+      int i = MAP_GXWX(map, pose.v[0] + ranges[b] * cos(a));
+      int j = MAP_GYWY(map, pose.v[1] + ranges[b] * sin(a));
+      if(!MAP_VALID(map, i, j) || map->occ_state[MAP_INDEX(map, i, j)] == 0)
+        continue;
+      pf_vector_t p = pf_vector_zero();
+      p.v[0] = ranges[b] * cos(scan_bearing(b));
+      p.v[1] = ranges[b] * sin(scan_bearing(b));
+      points.push_back(p);
+    }
+
+    std::vector<amcl_match_t> matches;
+    double t2 = AMCLLatency::Now();
+    int found = matcher.Match(points, 8, 0.5, &matches);
+    double t3 = AMCLLatency::Now();
+
+    double error = (found > 0) ? hypot(pose.v[0] - matches[0].pose.v[0],
+                                       pose.v[1] - matches[0].pose.v[1]) : -1;
+    printf("global_matcher: step %d, match %.3f s, %ld nodes, %d hypotheses, "
+           "best %.3f at %.3f m\n", (int) steps[k], t3 - t2, matcher.GetNodeCount(),
+           found, found > 0 ? matches[0].score : 0.0, error);
+  }
+
+  std::copy(walled.begin(), walled.end(), map->occ_state);
+}
+
+// The likelihood field update with strided and with selected beams, for
+// one particle, where selecting dominates, and at each --particles count
+static void time_beam_selection(benchmark_scene_t* scene, const benchmark_options_t& options)
+{
+  const pf_vector_t& pose = scene->path[scene->path.size() / 2];
+  AMCLLaserData data;
+  fill_scan(scene->scans[scene->path.size() / 2], &data);
+
+  std::vector<int> counts(1, 1);
+  counts.insert(counts.end(), options.particles.begin(), options.particles.end());
+  for(size_t n = 0; n < counts.size(); n++)
+  {
+    pf_t* pf = pf_alloc(counts[n], counts[n], 0.0, 0.0, NULL, NULL);
+    pf_set_seed(pf, options.seed);
+    pf_matrix_t cov = pf_matrix_zero();
+    cov.m[0][0] = cov.m[1][1] = 0.25 * 0.25;
+    cov.m[2][2] = 0.1 * 0.1;
+    pf_init(pf, pose, cov);
+
+    double seconds[2];
+    for(int s = 0; s < 2; s++)
+    {
+      AMCLLaser laser(options.beams, scene->map);
+      pf_vector_t origin = pf_vector_zero();
+      laser.SetLaserPose(origin);
+      laser.SetModelLikelihoodField(0.95, 0.05, 0.2, 2.0);
+      laser.SetBeamSelection(s == 1);
+      data.sensor = &laser;
+      const int repeats = std::max(1, 20000 / counts[n]);
+      double t0 = AMCLLatency::Now();
+      for(int k = 0; k < repeats; k++)
+        laser.UpdateSensor(pf, &data);
+      seconds[s] = (AMCLLatency::Now() - t0) / repeats;
+    }
+    printf("beam_selection: %d samples, %d of %d beams, strided %.1f us, selected %.1f us\n",
+           counts[n], options.beams, SCAN_RANGES, seconds[0] * 1e6, seconds[1] * 1e6);
+    pf_free(pf);
+  }
+}
+
+// Switching between two floors with the map's image, through a plane
+// cache in a scratch directory: the first load, which also fills the
+// cache, a load from the cache, a switch back to a loaded floor, and a
+// load from the cache after the memory limit evicted the floor
+static void time_floor_set(benchmark_scene_t*, const benchmark_options_t& options)
+{
+  char cache_dir[] = "/tmp/amcl_benchmark.XXXXXX";
+  if(mkdtemp(cache_dir) == NULL)
+  {
+    printf("floor_set: no scratch directory for the cache, skipped\n");
+    return;
+  }
+
+  amcl_floor_info_t info;
+  info.image = options.map_file;
+  info.resolution = options.resolution;
+  info.origin_x = info.origin_y = 0.0;
+  info.negate = false;
+  info.occupied_thresh = 0.65;
+  info.free_thresh = 0.196;
+  {
+    AMCLFloorSet floors;
+    floors.SetCspace(2.0, MAP_CSPACE_EDT, options.threads, cache_dir);
+    floors.AddFloor("upper", info);
+    floors.AddFloor("lower", info);
+
+    double t0 = AMCLLatency::Now();
+    map_t* map = floors.Activate("upper");
+    double t1 = AMCLLatency::Now();
+    size_t floor_bytes = floors.GetMemoryUsed();
+    map_t* lower = floors.Activate("lower");
+    double t2 = AMCLLatency::Now();
+    floors.Activate("upper");
+    double t3 = AMCLLatency::Now();
+    floors.SetMemoryLimit(floor_bytes);
+    double t4 = AMCLLatency::Now();
+    lower = floors.Activate("lower");
+    double t5 = AMCLLatency::Now();
+
+    if(map == NULL || lower == NULL)
+      printf("floor_set: failed to load %s\n", options.map_file.c_str());
+    else
+      printf("floor_set: %.1f MB per floor, first load %.1f ms, cached %.1f ms, "
+             "loaded %.3f ms, evicted and cached %.1f ms\n", floor_bytes / 1048576.0,
+             (t1 - t0) * 1e3, (t2 - t1) * 1e3, (t3 - t2) * 1e3, (t5 - t4) * 1e3);
+  }
+
+  std::string cleanup = std::string("rm -rf ") + cache_dir;
+  if(system(cleanup.c_str()) != 0)
+    fprintf(stderr, "Failed to remove %s\n", cache_dir);
+}
+
+// Front, rear and side lasers on the middle pose of the path, each with a
+// 361 reading scan over its front half, updated one after the other and
+// fused (AMCLLaser::UpdateSensors), for each --models model (the
+// likelihood field also with the kernel) at each --particles count
+static void time_fused_update(benchmark_scene_t* scene, const benchmark_options_t& options)
+{
+  const pf_vector_t& pose = scene->path[scene->path.size() / 2];
+  const double mounts[3][3] = {{0.3, 0.0, 0.0}, {-0.3, 0.0, M_PI}, {0.0, 0.2, M_PI / 2}};
+  const int beams = 361;
+
+  std::vector<std::string> models;
+  for(size_t m = 0; m < options.models.size(); m++)
+  {
+    models.push_back(options.models[m]);
+    if(options.models[m] == "likelihood_field")
+      models.push_back("likelihood_field (kernel)");
+  }
+  for(size_t m = 0; m < models.size(); m++)
+    for(size_t n = 0; n < options.particles.size(); n++)
+    {
+      AMCLLaser front(options.beams, scene->map), rear(options.beams, scene->map),
+                side(options.beams, scene->map);
+      AMCLLaser* lasers[3] = {&front, &rear, &side};
+      AMCLLaserData data[3];
+      std::vector<AMCLLaserData*> scans;
+      for(int l = 0; l < 3; l++)
+      {
+        pf_vector_t mount = pf_vector_zero();
+        for(int i = 0; i < 3; i++)
+          mount.v[i] = mounts[l][i];
+        lasers[l]->SetLaserPose(mount);
+        lasers[l]->SetSimdKernel(models[m] == "likelihood_field (kernel)");
+        set_model(lasers[l], models[m] == "likelihood_field (kernel)" ?
+                  "likelihood_field" : models[m]);
+
+        pf_vector_t at = pf_vector_coord_add(mount, pose);
+        data[l].sensor = lasers[l];
+        data[l].range_count = beams;
+        data[l].range_max = SCAN_MAX_RANGE;
+        data[l].ranges = new double[beams][2];
+        for(int b = 0; b < beams; b++)
+        {
+          double bearing = -M_PI / 2 + b * M_PI / (beams - 1);
+          data[l].ranges[b][0] = map_calc_range(scene->map, at.v[0], at.v[1],
+                                                at.v[2] + bearing, SCAN_MAX_RANGE);
+          data[l].ranges[b][1] = bearing;
+        }
+        scans.push_back(&data[l]);
+      }
+
+      int count = options.particles[n];
+      pf_t* pf = pf_alloc(count, count, 0.0, 0.0, NULL, NULL);
+      pf_set_seed(pf, options.seed);
+      pf_matrix_t cov = pf_matrix_zero();
+      cov.m[0][0] = cov.m[1][1] = 0.5 * 0.5;
+      cov.m[2][2] = 0.3 * 0.3;
+      pf_init(pf, pose, cov);
+
+      const int repeats = models[m] == "beam" ? 2 : 20;
+      double t0 = AMCLLatency::Now();
+      for(int k = 0; k < repeats; k++)
+        for(int l = 0; l < 3; l++)
+          lasers[l]->UpdateSensor(pf, &data[l]);
+      double t1 = AMCLLatency::Now();
+      for(int k = 0; k < repeats; k++)
+        AMCLLaser::UpdateSensors(pf, scans);
+      double t2 = AMCLLatency::Now();
+      printf("fused_update: %s, %d samples, 3 lasers: %.3f ms one by one, %.3f ms fused\n",
+             models[m].c_str(), count, (t1 - t0) * 1e3 / repeats, (t2 - t1) * 1e3 / repeats);
+      pf_free(pf);
+    }
+}
+
+typedef void (*component_fn_t) (benchmark_scene_t* scene,
+                                const benchmark_options_t& options);
+
+static const struct
+{
+  const char* name;
+  component_fn_t fn;
+} components[] =
+{
+  {"cspace", time_cspace},
+  {"resample", time_resample},
+  {"kdtree", time_kdtree},
+  {"range_table", time_range_table},
+  {"odom", time_odom},
+  {"global_matcher", time_global_matcher},
+  {"beam_selection", time_beam_selection},
+  {"floor_set", time_floor_set},
+  {"fused_update", time_fused_update},
+};
+static const int component_count = sizeof(components) / sizeof(components[0]);
+
+static int find_component(const std::string& name)
+{
+  for(int c = 0; c < component_count; c++)
+    if(name == components[c].name)
+      return c;
+  return -1;
+}
+
+int main(int argc, char** argv)
+{
+  benchmark_options_t options;
+  if(!parse_options(argc, argv, &options))
+  {
+    fprintf(stderr, "%s", usage);
+    return 2;
+  }
+  for(size_t m = 0; m < options.models.size(); m++)
+  {
+    if(options.models[m] != "beam" && options.models[m] != "likelihood_field" &&
+       options.models[m] != "likelihood_field_prob")
+    {
+      fprintf(stderr, "Unknown model %s\n%s", options.models[m].c_str(), usage);
+      return 2;
+    }
+  }
+  if(options.components.size() == 1 && options.components[0] == "all")
+  {
+    options.components.clear();
+    for(int c = 0; c < component_count; c++)
+      options.components.push_back(components[c].name);
+  }
+  for(size_t c = 0; c < options.components.size(); c++)
+  {
+    if(find_component(options.components[c]) < 0)
+    {
+      fprintf(stderr, "Unknown component %s\n%s", options.components[c].c_str(), usage);
+      return 2;
+    }
+  }
+
+  // Lay the map out like the node does a map message with its origin at
+  // the lower left corner
+  map_t* map = map_alloc();
+  if(map_load_pgm(map, options.map_file.c_str(), options.resolution, 0, 0.65, 0.196) != 0)
+  {
+    fprintf(stderr, "Failed to load %s\n", options.map_file.c_str());
+    map_free(map);
+    return 2;
+  }
+  map->origin_x = (map->size_x / 2) * map->scale;
+  map->origin_y = (map->size_y / 2) * map->scale;
+
+  // The scans are ray cast like the beam model's, which stops at unknown
+  // cells; make them walls for the likelihood field models too
+  benchmark_scene_t scene;
+  scene.map = map;
+  scene.loaded_state.assign(map->occ_state, map->occ_state + map->size_x * map->size_y);
+  for(int i = 0; i < map->size_x * map->size_y; i++)
+    if(map->occ_state[i] == 0)
+      map->occ_state[i] = +1;
+
+  double t0 = AMCLLatency::Now();
+  map_update_cspace_edt(map, 2.0, 0);
+  printf("Map %s: %d x %d cells, distance field in %.0f ms\n", options.map_file.c_str(),
+         map->size_x, map->size_y, (AMCLLatency::Now() - t0) * 1e3);
+
+  std::vector<std::pair<int, int> > free_cells;
+  for(int i = 0; i < map->size_x; i++)
+    for(int j = 0; j < map->size_y; j++)
+      if(map->occ_state[MAP_INDEX(map, i, j)] == -1)
+        free_cells.push_back(std::make_pair(i, j));
+  free_space_t space;
+  space.map = map;
+  space.cells = &free_cells;
+
+  srand48(options.seed);
+  std::vector<pf_vector_t> path;
+  if(free_cells.empty() || !make_path(map, free_cells, options.steps, &path))
+  {
+    fprintf(stderr, "No room for a path in %s\n", options.map_file.c_str());
+    map_free(map);
+    return 2;
+  }
+  std::vector<std::vector<double> > scans;
+  make_scans(map, path, &scans);
+
+  if(!options.components.empty())
+  {
+    scene.path = path;
+    scene.scans = scans;
+    for(size_t c = 0; c < options.components.size(); c++)
+    {
+      (*components[find_component(options.components[c])].fn)(&scene, options);
+      fflush(stdout);
+    }
+    map_free(map);
+    return 0;
+  }
+
+  std::vector<benchmark_result_t> results;
+  for(size_t m = 0; m < options.models.size(); m++)
+    for(size_t n = 0; n < options.particles.size(); n++)
+      results.push_back(run(map, &space, path, scans, options, options.models[m],
+                            options.particles[n]));
+
+  // One line per run, for scripts to compare
+  int status = 0;
+  printf("\n%-22s %9s %12s %10s\n", "model", "particles", "scans/sec", "error (m)");
+  for(size_t r = 0; r < results.size(); r++)
+  {
+    bool slow = results[r].rate < options.min_rate;
+    printf("%-22s %9d %12.1f %10.3f%s\n", results[r].model.c_str(), results[r].particles,
+           results[r].rate, results[r].error, slow ? "  below --min-rate" : "");
+    if(slow)
+      status = 1;
+  }
+
+  map_free(map);
+  return status;
+}
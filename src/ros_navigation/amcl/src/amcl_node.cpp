@@ -26,7 +26,10 @@
 #include <cmath>
 
 #include <boost/bind.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
 // Signal handling
 #include <signal.h>
@@ -35,6 +38,11 @@
 #include "amcl/pf/pf.h"
 #include "amcl/sensors/amcl_odom.h"
 #include "amcl/sensors/amcl_laser.h"
+#include "amcl/sensors/amcl_latency.h"
+#include "amcl/sensors/amcl_global_matcher.h"
+#include "amcl/sensors/amcl_pose_refiner.h"
+#include "amcl/sensors/amcl_floor_set.h"
+#include "amcl/sensors/amcl_handoff.h"
 
 #include "ros/assert.h"
 
@@ -48,7 +56,10 @@
 #include "geometry_msgs/Pose.h"
 #include "nav_msgs/GetMap.h"
 #include "nav_msgs/SetMap.h"
+#include "map_msgs/OccupancyGridUpdate.h"
 #include "std_srvs/Empty.h"
+#include "amcl/SetFloor.h"
+#include "diagnostic_msgs/DiagnosticArray.h"
 
 // For transform support
 #include "tf/transform_broadcaster.h"
@@ -84,6 +95,43 @@ typedef struct
 
 } amcl_hyp_t;
 
+// The filter's latest output, with what the publisher thread needs to
+// publish it
+typedef struct
+{
+  // Particle cloud (decimated) and pose, numbered so that each is
+  // published once
+  unsigned long cloud_seq;
+  boost::shared_ptr<const std::vector<pf_vector_t> > cloud;
+  unsigned long pose_seq;
+  geometry_msgs::PoseWithCovarianceStamped pose;
+
+  // map->odom, and the latest odometric pose (to save the map pose)
+  bool tf_valid;
+  tf::Transform map_to_odom;
+  tf::Pose odom_pose;
+
+  // Settings as of the update, which may be reconfigured
+  std::string global_frame_id, odom_frame_id;
+  bool tf_broadcast;
+  ros::Duration transform_tolerance;
+  ros::Duration save_pose_period;
+} amcl_estimate_t;
+
+// Scan match hypotheses to draw initial particles around
+typedef struct
+{
+  std::vector<amcl_match_t> matches;
+
+  // Cumulative weights of the matches, ending at 1
+  std::vector<double> cdf;
+
+  // Spread of the particles around a match
+  double sigma_xy, sigma_theta;
+
+  pf_random_t* rng;
+} amcl_match_seed_t;
+
 static double
 normalize(double z)
 {
@@ -123,6 +171,9 @@ class AmclNode
     void savePoseToServer();
 
   private:
+    void savePoseToServer(const tf::Pose& map_pose,
+                          const geometry_msgs::PoseWithCovarianceStamped& estimate);
+
     tf::TransformBroadcaster*   tfb_;  //publish tf
 
     // Use a child class to get access to tf2::Buffer class inside of tf_
@@ -141,6 +192,9 @@ class AmclNode
     // Pose-generating function used to uniformly distribute particles over
     // the map
     static pf_vector_t uniformPoseGenerator(void* arg);
+    // Pose-generating function that draws particles around the hypotheses
+    // of the global matcher (arg is an amcl_match_seed_t)
+    static pf_vector_t matchedPoseGenerator(void* arg);
 #if NEW_UNIFORM_SAMPLING
     static std::vector<std::pair<int,int> > free_space_indices;
 #endif
@@ -151,14 +205,27 @@ class AmclNode
                                     std_srvs::Empty::Response& res);
     bool setMapCallback(nav_msgs::SetMap::Request& req,
                         nav_msgs::SetMap::Response& res);
+    bool setFloorCallback(amcl::SetFloor::Request& req,
+                          amcl::SetFloor::Response& res);
 
     void laserReceived(const sensor_msgs::LaserScanConstPtr& laser_scan);
     void initialPoseReceived(const geometry_msgs::PoseWithCovarianceStampedConstPtr& msg);
     void handleInitialPoseMessage(const geometry_msgs::PoseWithCovarianceStamped& msg);
     void mapReceived(const nav_msgs::OccupancyGridConstPtr& msg);
+    void mapUpdateReceived(const map_msgs::OccupancyGridUpdateConstPtr& msg);
 
     void handleMapMessage(const nav_msgs::OccupancyGrid& msg);
+    void allocMapDependentMemory();
     void freeMapDependentMemory();
+    bool loadFloors();
+    bool getLaserAngles(const sensor_msgs::LaserScan& laser_scan,
+                        double& angle_min, double& angle_increment);
+    bool fillLaserData(const sensor_msgs::LaserScan& laser_scan, int laser_index,
+                       AMCLLaserData& ldata);
+    bool holdFusedScan(const sensor_msgs::LaserScanConstPtr& laser_scan, int laser_index);
+    bool getScanPoints(const sensor_msgs::LaserScan& laser_scan, int laser_index,
+                       std::vector<pf_vector_t>& points);
+    bool initFromScanMatch();
     map_t* convertMap( const nav_msgs::OccupancyGrid& map_msg );
     void updatePoseFromServer();
     void applyInitialPose();
@@ -197,6 +264,12 @@ class AmclNode
     std::vector< bool > lasers_update_;
     std::map< std::string, int > frame_to_laser_;
 
+    // Fused updates: the scan of each laser held for the next update, and
+    // how far apart in time the scans of one update may be
+    bool laser_fused_update_;
+    double laser_fused_tolerance_;
+    std::vector< sensor_msgs::LaserScanConstPtr > fused_scans_;
+
     // Particle filter
     pf_t *pf_;
     double pf_err_, pf_z_;
@@ -205,6 +278,10 @@ class AmclNode
     double d_thresh_, a_thresh_;
     int resample_interval_;
     int resample_count_;
+    pf_resample_model_t resample_model_;
+    pf_kdtree_type_t histogram_type_;
+    int random_seed_;
+    double update_time_budget_;
     double laser_min_range_;
     double laser_max_range_;
 
@@ -214,6 +291,27 @@ class AmclNode
     AMCLOdom* odom_;
     AMCLLaser* laser_;
 
+    // Global relocalization by scan matching, and the latest scan to
+    // match (from lasers_[last_scan_laser_])
+    bool global_matcher_enabled_;
+    int global_matcher_depth_;
+    int global_matcher_hypotheses_;
+    double global_matcher_min_score_;
+    AMCLGlobalMatcher* global_matcher_;
+    bool global_matcher_stale_;
+    sensor_msgs::LaserScanConstPtr last_scan_;
+    int last_scan_laser_;
+
+    // Scan-to-map refinement of the published pose
+    bool refine_pose_;
+    int refine_max_iterations_;
+    double refine_max_distance_, refine_max_angle_;
+    AMCLPoseRefiner* pose_refiner_;
+
+    // Maps of the floors of the building, if any; map_ is then the active
+    // floor's, and belongs to floors_
+    AMCLFloorSet* floors_;
+
     ros::Duration cloud_pub_interval;
     ros::Time last_cloud_pub_time;
 
@@ -239,8 +337,10 @@ class AmclNode
     ros::ServiceServer global_loc_srv_;
     ros::ServiceServer nomotion_update_srv_; //to let amcl update samples without requiring motion
     ros::ServiceServer set_map_srv_;
+    ros::ServiceServer set_floor_srv_;
     ros::Subscriber initial_pose_sub_old_;
     ros::Subscriber map_sub_;
+    ros::Subscriber map_update_sub_;
 
     amcl_hyp_t* initial_pose_hyp_;
     bool first_map_received_;
@@ -252,6 +352,14 @@ class AmclNode
     ros::Timer check_laser_timer_;
 
     int max_beams_, min_particles_, max_particles_;
+    int sensor_threads_;
+    bool laser_simd_kernel_;
+    bool laser_beam_selection_;
+    bool laser_exact_edt_;
+    std::string laser_likelihood_cache_dir_;
+    double laser_range_table_resolution_;
+    bool laser_range_table_compress_;
+    std::string laser_range_table_cache_dir_;
     double alpha1_, alpha2_, alpha3_, alpha4_, alpha5_;
     double alpha_slow_, alpha_fast_;
     double z_hit_, z_short_, z_max_, z_rand_, sigma_hit_, lambda_short_;
@@ -270,6 +378,37 @@ class AmclNode
     ros::Time last_laser_received_ts_;
     ros::Duration laser_check_interval_;
     void checkLaserReceived(const ros::TimerEvent& event);
+
+    // Timed stages of laserReceived(), in the order they run
+    enum
+    {
+      LATENCY_LOCK, LATENCY_TF, LATENCY_ACTION, LATENCY_SCAN, LATENCY_SENSOR,
+      LATENCY_RESAMPLE, LATENCY_CLOUD, LATENCY_HYPOTHESES, LATENCY_REFINE,
+      LATENCY_PUBLISH, LATENCY_TOTAL
+    };
+    AMCLLatency latency_;
+    // Filter state over the current diagnostics window, and at the last
+    // update
+    int latency_updates_, latency_resamples_, latency_budget_limited_;
+    int latency_refined_;
+    int last_particles_, last_beams_;
+    bool last_resampled_;
+    double diagnostics_period_;
+    ros::Publisher diagnostics_pub_;
+    ros::Timer diagnostics_timer_;
+    void publishDiagnostics(const ros::TimerEvent& event);
+
+    // Publication from a thread of its own: laserReceived() keeps the
+    // latest output in estimate_ and hands copies over, and the thread
+    // publishes them and rebroadcasts map->odom at tf_publish_rate_
+    double tf_publish_rate_;
+    int particlecloud_max_poses_;
+    amcl_estimate_t estimate_;
+    AMCLHandoff<amcl_estimate_t> estimate_handoff_;
+    boost::thread* publisher_thread_;
+    boost::atomic<bool> publisher_stop_;
+    void handOffEstimate();
+    void publishLoop();
 };
 
 std::vector<std::pair<int,int> > AmclNode::free_space_indices;
@@ -322,10 +461,24 @@ AmclNode::AmclNode() :
         resample_count_(0),
         odom_(NULL),
         laser_(NULL),
+        global_matcher_(NULL),
+        global_matcher_stale_(false),
+        last_scan_laser_(-1),
+        pose_refiner_(NULL),
+        floors_(NULL),
 	      private_nh_("~"),
         initial_pose_hyp_(NULL),
         first_map_received_(false),
-        first_reconfigure_call_(true)
+        first_reconfigure_call_(true),
+        latency_updates_(0),
+        latency_resamples_(0),
+        latency_budget_limited_(0),
+        latency_refined_(0),
+        last_particles_(0),
+        last_beams_(0),
+        last_resampled_(false),
+        publisher_thread_(NULL),
+        publisher_stop_(false)
 {
   boost::recursive_mutex::scoped_lock l(configuration_mutex_);
 
@@ -342,6 +495,22 @@ AmclNode::AmclNode() :
   private_nh_.param("laser_min_range", laser_min_range_, -1.0);
   private_nh_.param("laser_max_range", laser_max_range_, -1.0);
   private_nh_.param("laser_max_beams", max_beams_, 30);
+  // Choose the laser_max_beams beams by the geometry of each scan rather
+  // than at a fixed stride; about half as many beams are then needed, but
+  // choosing them costs about as much as scoring ten particles per scan
+  private_nh_.param("laser_beam_selection", laser_beam_selection_, false);
+  // With several lasers, update the filter once with a scan from each
+  // rather than once per scan: one odometry step, one normalization and
+  // one count towards resample_interval for all of them
+  private_nh_.param("laser_fused_update", laser_fused_update_, false);
+  private_nh_.param("laser_fused_tolerance", laser_fused_tolerance_, 0.05);
+  private_nh_.param("sensor_threads", sensor_threads_, 1);
+  if(sensor_threads_ < 1)
+  {
+    ROS_WARN("sensor_threads must be at least 1; using a single thread");
+    sensor_threads_ = 1;
+  }
+  private_nh_.param("laser_simd_kernel", laser_simd_kernel_, false);
   private_nh_.param("min_particles", min_particles_, 100);
   private_nh_.param("max_particles", max_particles_, 5000);
   private_nh_.param("kld_err", pf_err_, 0.01);
@@ -387,6 +556,31 @@ AmclNode::AmclNode() :
     laser_model_type_ = LASER_MODEL_LIKELIHOOD_FIELD;
   }
 
+  std::string tmp_transform;
+  private_nh_.param("laser_distance_transform", tmp_transform, std::string("brushfire"));
+  if(tmp_transform == "brushfire")
+    laser_exact_edt_ = false;
+  else if(tmp_transform == "edt")
+    laser_exact_edt_ = true;
+  else
+  {
+    ROS_WARN("Unknown laser distance transform \"%s\"; defaulting to brushfire",
+             tmp_transform.c_str());
+    laser_exact_edt_ = false;
+  }
+  // The brushfire can only be rebuilt for the whole map, which would stall
+  // the filter on every map update
+  if(use_map_topic_ && !first_map_only_ && !laser_exact_edt_)
+  {
+    ROS_INFO("Using the exact distance transform, as map updates patch the likelihood field");
+    laser_exact_edt_ = true;
+  }
+
+  private_nh_.param("laser_likelihood_cache_dir", laser_likelihood_cache_dir_, std::string(""));
+  private_nh_.param("laser_range_table_resolution", laser_range_table_resolution_, 0.0);
+  private_nh_.param("laser_range_table_compress", laser_range_table_compress_, false);
+  private_nh_.param("laser_range_table_cache_dir", laser_range_table_cache_dir_, std::string(""));
+
   private_nh_.param("odom_model_type", tmp_model_type, std::string("diff"));
   if(tmp_model_type == "diff")
     odom_model_type_ = ODOM_MODEL_DIFF;
@@ -409,11 +603,65 @@ AmclNode::AmclNode() :
   private_nh_.param("base_frame_id", base_frame_id_, std::string("base_link"));
   private_nh_.param("global_frame_id", global_frame_id_, std::string("map"));
   private_nh_.param("resample_interval", resample_interval_, 2);
+  std::string tmp_resample;
+  private_nh_.param("resample_model", tmp_resample, std::string("multinomial"));
+  if(tmp_resample == "multinomial")
+    resample_model_ = PF_RESAMPLE_MULTINOMIAL;
+  else if(tmp_resample == "systematic")
+    resample_model_ = PF_RESAMPLE_SYSTEMATIC;
+  else if(tmp_resample == "alias")
+    resample_model_ = PF_RESAMPLE_ALIAS;
+  else
+  {
+    ROS_WARN("Unknown resample model \"%s\"; defaulting to multinomial",
+             tmp_resample.c_str());
+    resample_model_ = PF_RESAMPLE_MULTINOMIAL;
+  }
+  std::string tmp_histogram;
+  private_nh_.param("histogram_type", tmp_histogram, std::string("kdtree"));
+  if(tmp_histogram == "kdtree")
+    histogram_type_ = PF_KDTREE_TREE;
+  else if(tmp_histogram == "hash")
+    histogram_type_ = PF_KDTREE_HASH;
+  else
+  {
+    ROS_WARN("Unknown histogram type \"%s\"; defaulting to kdtree",
+             tmp_histogram.c_str());
+    histogram_type_ = PF_KDTREE_TREE;
+  }
+  // Period of the latency report on /diagnostics; 0 disables it
+  private_nh_.param("diagnostics_period", diagnostics_period_, 1.0);
+  // A non-negative seed makes runs reproducible; otherwise the filter
+  // seeds from the clock
+  private_nh_.param("random_seed", random_seed_, -1);
+  // Seconds a sensor update and resample may take together; the particle
+  // count is capped to fit, below the KLD limit if need be.  0 disables.
+  private_nh_.param("update_time_budget", update_time_budget_, 0.0);
+  // Seed global localization from a search of the latest scan over the
+  // map, instead of spreading the particles uniformly
+  private_nh_.param("global_localization_matcher", global_matcher_enabled_, false);
+  private_nh_.param("global_matcher_depth", global_matcher_depth_, 7);
+  private_nh_.param("global_matcher_hypotheses", global_matcher_hypotheses_, 8);
+  private_nh_.param("global_matcher_min_score", global_matcher_min_score_, 0.5);
+  // Align the latest scan with the map around the best cluster's mean, and
+  // publish that pose instead; the filter then needs fewer particles for
+  // the same accuracy.  Corrections larger than the limits are ignored.
+  private_nh_.param("refine_pose", refine_pose_, false);
+  private_nh_.param("refine_max_iterations", refine_max_iterations_, 10);
+  private_nh_.param("refine_max_distance", refine_max_distance_, 0.5);
+  private_nh_.param("refine_max_angle", refine_max_angle_, 0.3);
   double tmp_tol;
   private_nh_.param("transform_tolerance", tmp_tol, 0.1);
   private_nh_.param("recovery_alpha_slow", alpha_slow_, 0.001);
   private_nh_.param("recovery_alpha_fast", alpha_fast_, 0.1);
   private_nh_.param("tf_broadcast", tf_broadcast_, true);  //config 是否发布tf message
+  // Publish the pose, the particle cloud and map->odom from a thread of
+  // their own, rebroadcasting the transform at this rate (Hz), so a slow
+  // filter update does not hold them up.  0 publishes them from the scan
+  // callback, and only sends the transform on scans.
+  private_nh_.param("tf_publish_rate", tf_publish_rate_, 0.0);
+  // Most particles the publisher thread puts in a cloud; 0 sends them all
+  private_nh_.param("particlecloud_max_poses", particlecloud_max_poses_, 0);
 
   transform_tolerance_.fromSec(tmp_tol);
 
@@ -436,6 +684,7 @@ AmclNode::AmclNode() :
                                          this);
   nomotion_update_srv_= nh_.advertiseService("request_nomotion_update", &AmclNode::nomotionUpdateCallback, this);
   set_map_srv_= nh_.advertiseService("set_map", &AmclNode::setMapCallback, this);
+  set_floor_srv_= nh_.advertiseService("set_floor", &AmclNode::setFloorCallback, this);
 
   // 订阅laserScan话题
   laser_scan_sub_ = new message_filters::Subscriber<sensor_msgs::LaserScan>(nh_, scan_topic_, 100);
@@ -451,8 +700,12 @@ AmclNode::AmclNode() :
   initial_pose_sub_ = nh_.subscribe("initialpose", 2, &AmclNode::initialPoseReceived, this);
 
   // 订阅 map 话题
-  if(use_map_topic_) {
+  if(loadFloors()) {
+    ROS_INFO("Localizing on floor \"%s\"", floors_->GetActiveName().c_str());
+  }
+  else if(use_map_topic_) {
     map_sub_ = nh_.subscribe("map", 1, &AmclNode::mapReceived, this);
+    map_update_sub_ = nh_.subscribe("map_updates", 10, &AmclNode::mapUpdateReceived, this);
     ROS_INFO("Subscribed to map topic.");
   } 
   else {
@@ -468,6 +721,33 @@ AmclNode::AmclNode() :
   laser_check_interval_ = ros::Duration(15.0);
   check_laser_timer_ = nh_.createTimer(laser_check_interval_, 
                                        boost::bind(&AmclNode::checkLaserReceived, this, _1));
+
+  // Stage timers, registered in the order of the enum
+  latency_.AddStage("lock");
+  latency_.AddStage("tf");
+  latency_.AddStage("action");
+  latency_.AddStage("scan");
+  latency_.AddStage("sensor");
+  latency_.AddStage("resample");
+  latency_.AddStage("cloud");
+  latency_.AddStage("hypotheses");
+  latency_.AddStage("refine");
+  latency_.AddStage("publish");
+  latency_.AddStage("total");
+  if(diagnostics_period_ > 0.0)
+  {
+    diagnostics_pub_ = nh_.advertise<diagnostic_msgs::DiagnosticArray>("diagnostics", 1);
+    diagnostics_timer_ = nh_.createTimer(ros::Duration(diagnostics_period_),
+                                         boost::bind(&AmclNode::publishDiagnostics, this, _1));
+  }
+
+  if(tf_publish_rate_ > 0.0)
+  {
+    estimate_.cloud_seq = 0;
+    estimate_.pose_seq = 0;
+    estimate_.tf_valid = false;
+    publisher_thread_ = new boost::thread(boost::bind(&AmclNode::publishLoop, this));
+  }
 }
 
 void AmclNode::reconfigureCB(AMCLConfig &config, uint32_t level)
@@ -516,6 +796,11 @@ void AmclNode::reconfigureCB(AMCLConfig &config, uint32_t level)
   sigma_hit_ = config.laser_sigma_hit;
   lambda_short_ = config.laser_lambda_short;
   laser_likelihood_max_dist_ = config.laser_likelihood_max_dist;
+  // Floors loaded from now on are built the way the laser builds its field
+  if(floors_ != NULL)
+    floors_->SetCspace(laser_likelihood_max_dist_,
+                       laser_exact_edt_ ? MAP_CSPACE_EDT : MAP_CSPACE_BRUSHFIRE,
+                       0, laser_likelihood_cache_dir_);
 
   if(config.laser_model_type == "beam")
     laser_model_type_ = LASER_MODEL_BEAM;
@@ -549,14 +834,22 @@ void AmclNode::reconfigureCB(AMCLConfig &config, uint32_t level)
   beam_skip_distance_ = config.beam_skip_distance; 
   beam_skip_threshold_ = config.beam_skip_threshold; 
 
-  pf_ = pf_alloc(min_particles_, max_particles_,
-                 alpha_slow_, alpha_fast_,
-                 (pf_init_model_fn_t)AmclNode::uniformPoseGenerator,
-                 (void *)map_);
+  pf_ = pf_alloc_histogram(min_particles_, max_particles_,
+                           alpha_slow_, alpha_fast_,
+                           (pf_init_model_fn_t)AmclNode::uniformPoseGenerator,
+                           (void *)map_, histogram_type_);
   pf_err_ = config.kld_err; 
   pf_z_ = config.kld_z; 
   pf_->pop_err = pf_err_;
   pf_->pop_z = pf_z_;
+  pf_set_resample_model(pf_, resample_model_);
+  pf_set_time_budget(pf_, update_time_budget_);
+  if(random_seed_ >= 0)
+  {
+    // The uniform pose generator still draws from drand48()
+    pf_set_seed(pf_, random_seed_);
+    srand48(random_seed_);
+  }
 
   // Initialize the filter
   pf_vector_t pf_init_pose_mean = pf_vector_zero();
@@ -580,9 +873,27 @@ void AmclNode::reconfigureCB(AMCLConfig &config, uint32_t level)
   delete laser_;
   laser_ = new AMCLLaser(max_beams_, map_);
   ROS_ASSERT(laser_);
+  laser_->SetSensorThreads(sensor_threads_);
+  laser_->SetSimdKernel(laser_simd_kernel_);
+  laser_->SetBeamSelection(laser_beam_selection_);
+  laser_->SetExactDistanceTransform(laser_exact_edt_);
+  laser_->SetCspaceCache(laser_likelihood_cache_dir_);
+  if(laser_range_table_resolution_ > 0.0)
+    laser_->SetRangeTable((int)ceil(2 * M_PI / laser_range_table_resolution_),
+                          laser_range_table_compress_ ? 1 : 2,
+                          laser_range_table_cache_dir_);
   if(laser_model_type_ == LASER_MODEL_BEAM)
+  {
     laser_->SetModelBeam(z_hit_, z_short_, z_max_, z_rand_,
                          sigma_hit_, lambda_short_, 0.0);
+    // Without a fixed max range the table waits for the first scan
+    if(laser_range_table_resolution_ > 0.0 && laser_max_range_ > 0.0)
+    {
+      ROS_INFO("Initializing range table; this can take some time on large maps...");
+      laser_->BuildRangeTable(laser_max_range_);
+      ROS_INFO("Done initializing range table.");
+    }
+  }
   else if(laser_model_type_ == LASER_MODEL_LIKELIHOOD_FIELD_PROB){
     ROS_INFO("Initializing likelihood field model; this can take some time on large maps...");
     laser_->SetModelLikelihoodFieldProb(z_hit_, z_rand_, sigma_hit_,
@@ -598,6 +909,20 @@ void AmclNode::reconfigureCB(AMCLConfig &config, uint32_t level)
     ROS_INFO("Done initializing likelihood field model.");
   }
 
+  // The refiner's plane follows laser_likelihood_max_dist, and its
+  // Huber delta sigma_hit
+  if(pose_refiner_ != NULL)
+  {
+    laser_->UpdateCspace(laser_likelihood_max_dist_);
+    pose_refiner_->SetMap(map_);
+    pose_refiner_->SetHuberDelta(sigma_hit_);
+    pose_refiner_->SetMaxIterations(refine_max_iterations_);
+    pose_refiner_->SetMaxCorrection(refine_max_distance_, refine_max_angle_);
+  }
+
+  // The matcher's scores follow sigma_hit; rebuilt when it is next needed
+  global_matcher_stale_ = true;
+
   odom_frame_id_ = config.odom_frame_id;
   base_frame_id_ = config.base_frame_id;
   global_frame_id_ = config.global_frame_id;
@@ -708,6 +1033,12 @@ void AmclNode::savePoseToServer()
   // the latest map pose to store.  We'll take the covariance from
   // last_published_pose.
   tf::Pose map_pose = latest_tf_.inverse() * latest_odom_pose_;
+  savePoseToServer(map_pose, last_published_pose);
+}
+
+void AmclNode::savePoseToServer(const tf::Pose& map_pose,
+                                const geometry_msgs::PoseWithCovarianceStamped& estimate)
+{
   double yaw,pitch,roll;
   map_pose.getBasis().getEulerYPR(yaw, pitch, roll);
 
@@ -717,11 +1048,11 @@ void AmclNode::savePoseToServer()
   private_nh_.setParam("initial_pose_y", map_pose.getOrigin().y());
   private_nh_.setParam("initial_pose_a", yaw);
   private_nh_.setParam("initial_cov_xx", 
-                                  last_published_pose.pose.covariance[6*0+0]);
+                                  estimate.pose.covariance[6*0+0]);
   private_nh_.setParam("initial_cov_yy", 
-                                  last_published_pose.pose.covariance[6*1+1]);
+                                  estimate.pose.covariance[6*1+1]);
   private_nh_.setParam("initial_cov_aa", 
-                                  last_published_pose.pose.covariance[6*5+5]);
+                                  estimate.pose.covariance[6*5+5]);
 }
 
 void AmclNode::updatePoseFromServer()
@@ -778,6 +1109,88 @@ AmclNode::checkLaserReceived(const ros::TimerEvent& event)
   }
 }
 
+void
+AmclNode::publishDiagnostics(const ros::TimerEvent& event)
+{
+  boost::recursive_mutex::scoped_lock dl(configuration_mutex_);
+
+  diagnostic_msgs::DiagnosticStatus status;
+  status.name = ros::this_node::getName() + ": Scan latency";
+  status.hardware_id = "none";
+  status.level = diagnostic_msgs::DiagnosticStatus::OK;
+  status.message = "Latency since the last report, in ms";
+
+  // One entry per stage with its percentiles over the window
+  char value[128];
+  for(int i = 0; i < latency_.GetStageCount(); i++)
+  {
+    const AMCLLatencyHistogram& h = latency_.GetWindow(i);
+    diagnostic_msgs::KeyValue kv;
+    kv.key = latency_.GetStageName(i);
+    snprintf(value, sizeof(value), "n %lu p50 %.3f p95 %.3f p99 %.3f max %.3f",
+             h.GetCount(), h.GetPercentile(0.5) * 1e3, h.GetPercentile(0.95) * 1e3,
+             h.GetPercentile(0.99) * 1e3, h.GetMax() * 1e3);
+    kv.value = value;
+    status.values.push_back(kv);
+  }
+
+  // Filter state to go with it
+  diagnostic_msgs::KeyValue kv;
+  kv.key = "updates";
+  snprintf(value, sizeof(value), "%d", latency_updates_);
+  kv.value = value;
+  status.values.push_back(kv);
+  kv.key = "resamples";
+  snprintf(value, sizeof(value), "%d", latency_resamples_);
+  kv.value = value;
+  status.values.push_back(kv);
+  kv.key = "particles";
+  snprintf(value, sizeof(value), "%d", last_particles_);
+  kv.value = value;
+  status.values.push_back(kv);
+  kv.key = "beams";
+  snprintf(value, sizeof(value), "%d", last_beams_);
+  kv.value = value;
+  status.values.push_back(kv);
+  kv.key = "last resampled";
+  kv.value = last_resampled_ ? "true" : "false";
+  status.values.push_back(kv);
+  if(refine_pose_)
+  {
+    kv.key = "refined poses";
+    snprintf(value, sizeof(value), "%d", latency_refined_);
+    kv.value = value;
+    status.values.push_back(kv);
+  }
+  if(update_time_budget_ > 0.0)
+  {
+    kv.key = "budget particles";
+    snprintf(value, sizeof(value), "%d", pf_ ? pf_->budget_samples : 0);
+    kv.value = value;
+    status.values.push_back(kv);
+    kv.key = "budget limited resamples";
+    snprintf(value, sizeof(value), "%d", latency_budget_limited_);
+    kv.value = value;
+    status.values.push_back(kv);
+    if(latency_budget_limited_ > 0)
+    {
+      status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+      status.message += "; time budget held the particle count below the KLD bound";
+    }
+  }
+
+  diagnostic_msgs::DiagnosticArray msg;
+  msg.header.stamp = ros::Time::now();
+  msg.status.push_back(status);
+  diagnostics_pub_.publish(msg);
+
+  latency_.ClearWindow();
+  latency_updates_ = 0;
+  latency_resamples_ = 0;
+  latency_budget_limited_ = 0;
+  latency_refined_ = 0;
+}
+
 void
 AmclNode::requestMap()
 {
@@ -796,6 +1209,112 @@ AmclNode::requestMap()
   handleMapMessage( resp.map );
 }
 
+// A number from the parameter server, which may have been written as an
+// integer
+static double
+xmlRpcNumber(XmlRpc::XmlRpcValue& value)
+{
+  if(value.getType() == XmlRpc::XmlRpcValue::TypeInt)
+    return static_cast<int>(value);
+  return static_cast<double>(value);
+}
+
+// Read the floors of a building from ~floors, a struct of floor names to
+// their maps ({image, resolution, origin, negate, occupied_thresh,
+// free_thresh}, as in map_server's map files), and localize on
+// ~initial_floor; the set_floor service then switches floors.  Inactive
+// floors stay loaded until they exceed ~floor_memory_limit_mb (0 keeps
+// them all).  Returns false if there are no floors, or if the initial one
+// fails to load.
+bool
+AmclNode::loadFloors()
+{
+  XmlRpc::XmlRpcValue floors;
+  if(!private_nh_.getParam("floors", floors))
+    return false;
+  if(floors.getType() != XmlRpc::XmlRpcValue::TypeStruct || floors.size() == 0)
+  {
+    ROS_ERROR("~floors must map floor names to their maps; ignoring it");
+    return false;
+  }
+
+  boost::recursive_mutex::scoped_lock ml(configuration_mutex_);
+  floors_ = new AMCLFloorSet();
+  // Built like the likelihood field, so the laser can use them as they are
+  floors_->SetCspace(laser_likelihood_max_dist_,
+                     laser_exact_edt_ ? MAP_CSPACE_EDT : MAP_CSPACE_BRUSHFIRE,
+                     0, laser_likelihood_cache_dir_);
+  double memory_limit_mb;
+  private_nh_.param("floor_memory_limit_mb", memory_limit_mb, 0.0);
+  floors_->SetMemoryLimit((size_t)(memory_limit_mb * 1024 * 1024));
+
+  for(XmlRpc::XmlRpcValue::iterator it = floors.begin(); it != floors.end(); ++it)
+  {
+    XmlRpc::XmlRpcValue& floor = it->second;
+    amcl_floor_info_t info;
+    info.origin_x = info.origin_y = 0.0;
+    info.negate = false;
+    info.occupied_thresh = 0.65;
+    info.free_thresh = 0.196;
+    try
+    {
+      if(floor.getType() != XmlRpc::XmlRpcValue::TypeStruct ||
+         !floor.hasMember("image") || !floor.hasMember("resolution"))
+      {
+        ROS_ERROR("Floor \"%s\" needs an image and a resolution; skipping it",
+                  it->first.c_str());
+        continue;
+      }
+      info.image = static_cast<std::string>(floor["image"]);
+      info.resolution = xmlRpcNumber(floor["resolution"]);
+      if(floor.hasMember("origin"))
+      {
+        info.origin_x = xmlRpcNumber(floor["origin"][0]);
+        info.origin_y = xmlRpcNumber(floor["origin"][1]);
+      }
+      if(floor.hasMember("negate"))
+      {
+        if(floor["negate"].getType() == XmlRpc::XmlRpcValue::TypeBool)
+          info.negate = static_cast<bool>(floor["negate"]);
+        else
+          info.negate = static_cast<int>(floor["negate"]) != 0;
+      }
+      if(floor.hasMember("occupied_thresh"))
+        info.occupied_thresh = xmlRpcNumber(floor["occupied_thresh"]);
+      if(floor.hasMember("free_thresh"))
+        info.free_thresh = xmlRpcNumber(floor["free_thresh"]);
+    }
+    catch(XmlRpc::XmlRpcException& e)
+    {
+      ROS_ERROR("Malformed floor \"%s\" (%s); skipping it",
+                it->first.c_str(), e.getMessage().c_str());
+      continue;
+    }
+    floors_->AddFloor(it->first, info);
+  }
+
+  std::vector<std::string> names = floors_->GetFloorNames();
+  std::string initial_floor;
+  private_nh_.param("initial_floor", initial_floor,
+                    names.empty() ? std::string("") : names[0]);
+  ros::WallTime start = ros::WallTime::now();
+  map_ = floors_->Activate(initial_floor);
+  if(map_ == NULL)
+  {
+    ROS_ERROR("Failed to load floor \"%s\"; falling back to the map server",
+              initial_floor.c_str());
+    delete floors_;
+    floors_ = NULL;
+    return false;
+  }
+  ROS_INFO("Loaded floor \"%s\" (%d X %d @ %.3f m/pix) in %.3f s",
+           initial_floor.c_str(), map_->size_x, map_->size_y, map_->scale,
+           (ros::WallTime::now() - start).toSec());
+
+  allocMapDependentMemory();
+  return true;
+}
+
 void
 AmclNode::mapReceived(const nav_msgs::OccupancyGridConstPtr& msg)
 {
@@ -808,6 +1327,85 @@ AmclNode::mapReceived(const nav_msgs::OccupancyGridConstPtr& msg)
   first_map_received_ = true;
 }
 
+// Patch the map in place, keeping the filter as it is
+void
+AmclNode::mapUpdateReceived(const map_msgs::OccupancyGridUpdateConstPtr& msg)
+{
+  if( first_map_only_ && first_map_received_ ) {
+    return;
+  }
+  boost::recursive_mutex::scoped_lock l(configuration_mutex_);
+  if( map_ == NULL ) {
+    return;
+  }
+  if(msg->data.size() < (size_t)msg->width * msg->height)
+  {
+    ROS_WARN("Ignoring map update with %d cells for a %dx%d window",
+             (int)msg->data.size(), msg->width, msg->height);
+    return;
+  }
+
+  // Part of the window that lies on the map
+  int x0 = std::max(msg->x, 0);
+  int y0 = std::max(msg->y, 0);
+  int x1 = std::min(msg->x + (int)msg->width, map_->size_x);
+  int y1 = std::min(msg->y + (int)msg->height, map_->size_y);
+  if(x0 >= x1 || y0 >= y1)
+    return;
+
+  // Same conversion as convertMap()
+  for(int j = y0; j < y1; j++)
+    for(int i = x0; i < x1; i++)
+    {
+      int8_t value = msg->data[(j - msg->y) * msg->width + (i - msg->x)];
+      if(value == 0)
+        MAP_OCC_STATE(map_, MAP_INDEX(map_, i, j)) = -1;
+      else if(value == 100)
+        MAP_OCC_STATE(map_, MAP_INDEX(map_, i, j)) = +1;
+      else
+        MAP_OCC_STATE(map_, MAP_INDEX(map_, i, j)) = 0;
+    }
+
+  // The likelihood field models look up the distances, which only change
+  // near the window; every laser shares the map.  They are patched with
+  // the transform that built them, so they match a rebuild; with a map
+  // topic that is the exact one, which patches only the cells near the
+  // window (see the laser_distance_transform parameter).
+  if(map_->occ_dist != NULL)
+    map_update_cspace_window(map_, x0, y0, x1, y1,
+                             laser_exact_edt_ ? MAP_CSPACE_EDT : MAP_CSPACE_BRUSHFIRE, 0);
+  // Likewise the beam model's range tables, now rather than on the next
+  // scan
+  std::vector<AMCLLaser*> all_lasers(1, laser_);
+  all_lasers.insert(all_lasers.end(), lasers_.begin(), lasers_.end());
+  AMCLLaser::UpdateRangeTables(all_lasers, x0, y0, x1, y1);
+
+#if NEW_UNIFORM_SAMPLING
+  // The free cells stay in (i, j) order: those outside the window, merged
+  // with the window's
+  std::vector<std::pair<int,int> > outside, inside;
+  outside.reserve(free_space_indices.size());
+  for(size_t k = 0; k < free_space_indices.size(); k++)
+  {
+    const std::pair<int,int>& c = free_space_indices[k];
+    if(c.first < x0 || c.first >= x1 || c.second < y0 || c.second >= y1)
+      outside.push_back(c);
+  }
+  for(int i = x0; i < x1; i++)
+    for(int j = y0; j < y1; j++)
+      if(MAP_OCC_STATE(map_, MAP_INDEX(map_,i,j)) == -1)
+        inside.push_back(std::make_pair(i,j));
+  free_space_indices.resize(outside.size() + inside.size());
+  std::merge(outside.begin(), outside.end(), inside.begin(), inside.end(),
+             free_space_indices.begin());
+#endif
+
+  // Rebuilt when it is next needed
+  global_matcher_stale_ = true;
+
+  ROS_DEBUG("Applied a %dx%d map update at (%d, %d)", x1 - x0, y1 - y0, x0, y0);
+}
+
 void
 AmclNode::handleMapMessage(const nav_msgs::OccupancyGrid& msg)
 {
@@ -829,24 +1427,41 @@ AmclNode::handleMapMessage(const nav_msgs::OccupancyGrid& msg)
   lasers_.clear();
   lasers_update_.clear();
   frame_to_laser_.clear();
+  fused_scans_.clear();
+  last_scan_.reset();
+  last_scan_laser_ = -1;
 
   map_ = convertMap(msg);
+  allocMapDependentMemory();
+}
 
+// Set up the filter and the sensor models for map_
+void
+AmclNode::allocMapDependentMemory()
+{
 #if NEW_UNIFORM_SAMPLING
   // Index of free space
   free_space_indices.resize(0);
   for(int i = 0; i < map_->size_x; i++)
     for(int j = 0; j < map_->size_y; j++)
-      if(map_->cells[MAP_INDEX(map_,i,j)].occ_state == -1)
+      if(MAP_OCC_STATE(map_, MAP_INDEX(map_,i,j)) == -1)
         free_space_indices.push_back(std::make_pair(i,j));
 #endif
   // Create the particle filter
-  pf_ = pf_alloc(min_particles_, max_particles_,
-                 alpha_slow_, alpha_fast_,
-                 (pf_init_model_fn_t)AmclNode::uniformPoseGenerator,
-                 (void *)map_);
+  pf_ = pf_alloc_histogram(min_particles_, max_particles_,
+                           alpha_slow_, alpha_fast_,
+                           (pf_init_model_fn_t)AmclNode::uniformPoseGenerator,
+                           (void *)map_, histogram_type_);
   pf_->pop_err = pf_err_;
   pf_->pop_z = pf_z_;
+  pf_set_resample_model(pf_, resample_model_);
+  pf_set_time_budget(pf_, update_time_budget_);
+  if(random_seed_ >= 0)
+  {
+    // The uniform pose generator still draws from drand48()
+    pf_set_seed(pf_, random_seed_);
+    srand48(random_seed_);
+  }
 
   // Initialize the filter
   updatePoseFromServer();
@@ -871,9 +1486,27 @@ AmclNode::handleMapMessage(const nav_msgs::OccupancyGrid& msg)
   delete laser_;
   laser_ = new AMCLLaser(max_beams_, map_);
   ROS_ASSERT(laser_);
+  laser_->SetSensorThreads(sensor_threads_);
+  laser_->SetSimdKernel(laser_simd_kernel_);
+  laser_->SetBeamSelection(laser_beam_selection_);
+  laser_->SetExactDistanceTransform(laser_exact_edt_);
+  laser_->SetCspaceCache(laser_likelihood_cache_dir_);
+  if(laser_range_table_resolution_ > 0.0)
+    laser_->SetRangeTable((int)ceil(2 * M_PI / laser_range_table_resolution_),
+                          laser_range_table_compress_ ? 1 : 2,
+                          laser_range_table_cache_dir_);
   if(laser_model_type_ == LASER_MODEL_BEAM)
+  {
     laser_->SetModelBeam(z_hit_, z_short_, z_max_, z_rand_,
                          sigma_hit_, lambda_short_, 0.0);
+    // Without a fixed max range the table waits for the first scan
+    if(laser_range_table_resolution_ > 0.0 && laser_max_range_ > 0.0)
+    {
+      ROS_INFO("Initializing range table; this can take some time on large maps...");
+      laser_->BuildRangeTable(laser_max_range_);
+      ROS_INFO("Done initializing range table.");
+    }
+  }
   else if(laser_model_type_ == LASER_MODEL_LIKELIHOOD_FIELD_PROB){
     ROS_INFO("Initializing likelihood field model; this can take some time on large maps...");
     laser_->SetModelLikelihoodFieldProb(z_hit_, z_rand_, sigma_hit_,
@@ -890,6 +1523,27 @@ AmclNode::handleMapMessage(const nav_msgs::OccupancyGrid& msg)
     ROS_INFO("Done initializing likelihood field model.");
   }
 
+  if(global_matcher_enabled_)
+  {
+    ROS_INFO("Initializing global matcher; this can take some time on large maps...");
+    global_matcher_ = new AMCLGlobalMatcher();
+    global_matcher_->SetMap(map_, sigma_hit_, global_matcher_depth_, sensor_threads_);
+    global_matcher_stale_ = false;
+    ROS_INFO("Done initializing global matcher.");
+  }
+
+  if(refine_pose_)
+  {
+    // The beam model does not need the distance plane, but the refiner
+    // does; build it as the likelihood field would (transform, cache)
+    laser_->UpdateCspace(laser_likelihood_max_dist_);
+    pose_refiner_ = new AMCLPoseRefiner();
+    pose_refiner_->SetMap(map_);
+    pose_refiner_->SetHuberDelta(sigma_hit_);
+    pose_refiner_->SetMaxIterations(refine_max_iterations_);
+    pose_refiner_->SetMaxCorrection(refine_max_distance_, refine_max_angle_);
+  }
+
   // In case the initial pose message arrived before the first map,
   // try to apply the initial pose now that the map has arrived.
   applyInitialPose();
@@ -899,10 +1553,10 @@ AmclNode::handleMapMessage(const nav_msgs::OccupancyGrid& msg)
 void
 AmclNode::freeMapDependentMemory()
 {
-  if( map_ != NULL ) {
+  if( map_ != NULL && floors_ == NULL ) {
     map_free( map_ );
-    map_ = NULL;
   }
+  map_ = NULL;
   if( pf_ != NULL ) {
     pf_free( pf_ );
     pf_ = NULL;
@@ -911,6 +1565,10 @@ AmclNode::freeMapDependentMemory()
   odom_ = NULL;
   delete laser_;
   laser_ = NULL;
+  delete global_matcher_;
+  global_matcher_ = NULL;
+  delete pose_refiner_;
+  pose_refiner_ = NULL;
 }
 
 /**
@@ -923,22 +1581,20 @@ AmclNode::convertMap( const nav_msgs::OccupancyGrid& map_msg )
   map_t* map = map_alloc();
   ROS_ASSERT(map);
 
-  map->size_x = map_msg.info.width;
-  map->size_y = map_msg.info.height;
+  // Convert to player format
+  int ret = map_alloc_cells(map, map_msg.info.width, map_msg.info.height);
+  ROS_ASSERT(ret == 0);
   map->scale = map_msg.info.resolution;
   map->origin_x = map_msg.info.origin.position.x + (map->size_x / 2) * map->scale;
   map->origin_y = map_msg.info.origin.position.y + (map->size_y / 2) * map->scale;
-  // Convert to player format
-  map->cells = (map_cell_t*)malloc(sizeof(map_cell_t)*map->size_x*map->size_y);
-  ROS_ASSERT(map->cells);
   for(int i=0;i<map->size_x * map->size_y;i++)
   {
     if(map_msg.data[i] == 0)
-      map->cells[i].occ_state = -1;
+      MAP_OCC_STATE(map, i) = -1;
     else if(map_msg.data[i] == 100)
-      map->cells[i].occ_state = +1;
+      MAP_OCC_STATE(map, i) = +1;
     else
-      map->cells[i].occ_state = 0;
+      MAP_OCC_STATE(map, i) = 0;
   }
 
   return map;
@@ -946,8 +1602,20 @@ AmclNode::convertMap( const nav_msgs::OccupancyGrid& map_msg )
 
 AmclNode::~AmclNode()
 {
+  if(publisher_thread_ != NULL)
+  {
+    publisher_stop_ = true;
+    publisher_thread_->join();
+    delete publisher_thread_;
+  }
+
+  // Dump the latency over the whole run
+  if(latency_.GetTotal(LATENCY_TOTAL).GetCount() > 0)
+    ROS_INFO("Scan processing latency:\n%s", latency_.Format(true).c_str());
+
   delete dsrv_;
   freeMapDependentMemory();
+  delete floors_;
   delete laser_scan_filter_;
   delete laser_scan_sub_;
   delete tfb_;
@@ -1012,13 +1680,80 @@ AmclNode::uniformPoseGenerator(void* arg)
     int i,j;
     i = MAP_GXWX(map, p.v[0]);
     j = MAP_GYWY(map, p.v[1]);
-    if(MAP_VALID(map,i,j) && (map->cells[MAP_INDEX(map,i,j)].occ_state == -1))
+    if(MAP_VALID(map,i,j) && (MAP_OCC_STATE(map, MAP_INDEX(map,i,j)) == -1))
       break;
   }
 #endif
   return p;
 }
 
+pf_vector_t
+AmclNode::matchedPoseGenerator(void* arg)
+{
+  amcl_match_seed_t* seed = (amcl_match_seed_t*)arg;
+
+  // Pick a match with probability proportional to its score
+  double r = pf_random_uniform(seed->rng);
+  size_t i = std::lower_bound(seed->cdf.begin(), seed->cdf.end(), r) - seed->cdf.begin();
+  if(i >= seed->matches.size())
+    i = seed->matches.size() - 1;
+
+  pf_vector_t p = seed->matches[i].pose;
+  p.v[0] += pf_random_gaussian(seed->rng, seed->sigma_xy);
+  p.v[1] += pf_random_gaussian(seed->rng, seed->sigma_xy);
+  p.v[2] = normalize(p.v[2] + pf_random_gaussian(seed->rng, seed->sigma_theta));
+  return p;
+}
+
+// Search the latest scan over the whole map, and put the particles
+// around the best matches
+bool
+AmclNode::initFromScanMatch()
+{
+  if(global_matcher_ == NULL || !last_scan_)
+    return false;
+
+  // Catch up with map updates
+  if(global_matcher_stale_)
+  {
+    global_matcher_->SetMap(map_, sigma_hit_, global_matcher_depth_, sensor_threads_);
+    global_matcher_stale_ = false;
+  }
+
+  std::vector<pf_vector_t> points;
+  if(!getScanPoints(*last_scan_, last_scan_laser_, points))
+    return false;
+
+  amcl_match_seed_t seed;
+  double start = AMCLLatency::Now();
+  int found = global_matcher_->Match(points, global_matcher_hypotheses_,
+                                     global_matcher_min_score_, &seed.matches);
+  ROS_INFO("Global matcher found %d hypotheses in %.3f s (%d points, %ld nodes)",
+           found, AMCLLatency::Now() - start, (int)points.size(),
+           global_matcher_->GetNodeCount());
+  if(found == 0)
+    return false;
+
+  double total = 0.0;
+  for(int i = 0; i < found; i++)
+  {
+    ROS_DEBUG("Hypothesis %d: %.3f %.3f %.3f, score %.3f", i,
+              seed.matches[i].pose.v[0], seed.matches[i].pose.v[1],
+              seed.matches[i].pose.v[2], seed.matches[i].score);
+    total += seed.matches[i].score;
+    seed.cdf.push_back(total);
+  }
+  for(int i = 0; i < found; i++)
+    seed.cdf[i] /= total;
+
+  // The search is exact to a cell; leave some room around it
+  seed.sigma_xy = 2 * map_->scale;
+  seed.sigma_theta = 0.05;
+  seed.rng = &pf_->rng;
+  pf_init_model(pf_, (pf_init_model_fn_t)AmclNode::matchedPoseGenerator, (void *)&seed);
+  return true;
+}
+
 bool
 AmclNode::globalLocalizationCallback(std_srvs::Empty::Request& req,
                                      std_srvs::Empty::Response& res)
@@ -1027,9 +1762,16 @@ AmclNode::globalLocalizationCallback(std_srvs::Empty::Request& req,
     return true;
   }
   boost::recursive_mutex::scoped_lock gl(configuration_mutex_);
-  ROS_INFO("Initializing with uniform distribution");
-  pf_init_model(pf_, (pf_init_model_fn_t)AmclNode::uniformPoseGenerator,
-                (void *)map_);
+  if(initFromScanMatch())
+    ROS_INFO("Initialized around the global matcher's hypotheses");
+  else
+  {
+    if(global_matcher_enabled_)
+      ROS_WARN("Global matcher found no hypothesis; falling back to a uniform distribution");
+    ROS_INFO("Initializing with uniform distribution");
+    pf_init_model(pf_, (pf_init_model_fn_t)AmclNode::uniformPoseGenerator,
+                  (void *)map_);
+  }
   ROS_INFO("Global initialisation done!");
   pf_init_ = false;
   return true;
@@ -1049,12 +1791,205 @@ bool
 AmclNode::setMapCallback(nav_msgs::SetMap::Request& req,
                          nav_msgs::SetMap::Response& res)
 {
+  if(floors_ != NULL)
+  {
+    ROS_WARN("Ignoring set_map while localizing on floors; use set_floor");
+    res.success = false;
+    return true;
+  }
   handleMapMessage(req.map);
   handleInitialPoseMessage(req.initial_pose);
   res.success = true;
   return true;
 }
 
+// Switch floors, keeping the filter and sensor models but for the map
+bool
+AmclNode::setFloorCallback(amcl::SetFloor::Request& req,
+                           amcl::SetFloor::Response& res)
+{
+  boost::recursive_mutex::scoped_lock sfl(configuration_mutex_);
+  res.success = false;
+  if(floors_ == NULL)
+  {
+    res.message = "no floors are configured";
+    return true;
+  }
+  if(!floors_->HasFloor(req.floor))
+  {
+    res.message = "unknown floor \"" + req.floor + "\"";
+    return true;
+  }
+  // As handleInitialPoseMessage() would, but before leaving the old floor
+  if(req.initial_pose.header.frame_id != "" &&
+     tf_->resolve(req.initial_pose.header.frame_id) != tf_->resolve(global_frame_id_))
+  {
+    res.message = "initial pose must be in the global frame, \"" + global_frame_id_ + "\"";
+    return true;
+  }
+
+  ros::WallTime start = ros::WallTime::now();
+  map_t* map = floors_->Activate(req.floor);
+  if(map == NULL)
+  {
+    res.message = "failed to load floor \"" + req.floor + "\"";
+    return true;
+  }
+
+  // The previous floor's map may have been evicted: nothing may keep it
+  map_ = map;
+  laser_->SetMap(map_);
+  for(unsigned int i = 0; i < lasers_.size(); i++)
+    lasers_[i]->SetMap(map_);
+  pf_->random_pose_data = (void *)map_;
+#if NEW_UNIFORM_SAMPLING
+  free_space_indices = floors_->GetActiveFreeCells();
+#endif
+  if(pose_refiner_ != NULL)
+    pose_refiner_->SetMap(map_);
+  // Rebuilt when it is next needed
+  global_matcher_stale_ = true;
+
+  handleInitialPoseMessage(req.initial_pose);
+  ROS_INFO("Switched to floor \"%s\" in %.1f ms", req.floor.c_str(),
+           (ros::WallTime::now() - start).toSec() * 1000.0);
+  res.success = true;
+  return true;
+}
+
+
+// Bearing of the first beam, and between beams, in the base frame
+bool
+AmclNode::getLaserAngles(const sensor_msgs::LaserScan& laser_scan,
+                         double& angle_min, double& angle_increment)
+{
+  // To account for lasers that are mounted upside-down, we determine the
+  // min, max, and increment angles of the laser in the base frame.
+  //
+  // Construct min and max angles of laser, in the base_link frame.
+  tf::Quaternion q;
+  q.setRPY(0.0, 0.0, laser_scan.angle_min);
+  tf::Stamped<tf::Quaternion> min_q(q, laser_scan.header.stamp,
+                                    laser_scan.header.frame_id);
+  q.setRPY(0.0, 0.0, laser_scan.angle_min + laser_scan.angle_increment);
+  tf::Stamped<tf::Quaternion> inc_q(q, laser_scan.header.stamp,
+                                    laser_scan.header.frame_id);
+  try
+  {
+    tf_->transformQuaternion(base_frame_id_, min_q, min_q);
+    tf_->transformQuaternion(base_frame_id_, inc_q, inc_q);
+  }
+  catch(tf::TransformException& e)
+  {
+    ROS_WARN("Unable to transform min/max laser angles into base frame: %s",
+             e.what());
+    return false;
+  }
+
+  angle_min = tf::getYaw(min_q);
+  angle_increment = tf::getYaw(inc_q) - angle_min;
+
+  // wrapping angle to [-pi .. pi]
+  angle_increment = fmod(angle_increment + 5*M_PI, 2*M_PI) - M_PI;
+  return true;
+}
+
+// Endpoints of the valid readings of a scan, in the base frame
+bool
+AmclNode::getScanPoints(const sensor_msgs::LaserScan& laser_scan, int laser_index,
+                        std::vector<pf_vector_t>& points)
+{
+  double angle_min, angle_increment;
+  if(!getLaserAngles(laser_scan, angle_min, angle_increment))
+    return false;
+
+  double range_max = laser_scan.range_max;
+  if(laser_max_range_ > 0.0)
+    range_max = std::min(range_max, laser_max_range_);
+  double range_min = laser_scan.range_min;
+  if(laser_min_range_ > 0.0)
+    range_min = std::max(range_min, laser_min_range_);
+
+  pf_vector_t laser_pose = lasers_[laser_index]->GetLaserPose();
+  points.clear();
+  for(size_t i = 0; i < laser_scan.ranges.size(); i++)
+  {
+    double r = laser_scan.ranges[i];
+    if(!(r > range_min && r < range_max))
+      continue;
+    double bearing = angle_min + i * angle_increment;
+    pf_vector_t p = pf_vector_zero();
+    p.v[0] = laser_pose.v[0] + r * cos(bearing);
+    p.v[1] = laser_pose.v[1] + r * sin(bearing);
+    points.push_back(p);
+  }
+  return true;
+}
+
+// Convert a scan from lasers_[laser_index] for the sensor model
+bool
+AmclNode::fillLaserData(const sensor_msgs::LaserScan& laser_scan, int laser_index,
+                        AMCLLaserData& ldata)
+{
+  ldata.sensor = lasers_[laser_index];
+  ldata.range_count = laser_scan.ranges.size();
+
+  double angle_min, angle_increment;
+  if(!getLaserAngles(laser_scan, angle_min, angle_increment))
+    return false;
+
+  ROS_DEBUG("Laser %d angles in base frame: min: %.3f inc: %.3f", laser_index, angle_min, angle_increment);
+
+  // Apply range min/max thresholds, if the user supplied them
+  if(laser_max_range_ > 0.0)
+    ldata.range_max = std::min(laser_scan.range_max, (float)laser_max_range_);
+  else
+    ldata.range_max = laser_scan.range_max;
+  double range_min;
+  if(laser_min_range_ > 0.0)
+    range_min = std::max(laser_scan.range_min, (float)laser_min_range_);
+  else
+    range_min = laser_scan.range_min;
+  // The AMCLLaserData destructor will free this memory
+  ldata.ranges = new double[ldata.range_count][2];
+  ROS_ASSERT(ldata.ranges);
+  for(int i=0;i<ldata.range_count;i++)
+  {
+    // amcl doesn't (yet) have a concept of min range.  So we'll map short
+    // readings to max range.
+    if(laser_scan.ranges[i] <= range_min)
+      ldata.ranges[i][0] = ldata.range_max;
+    else
+      ldata.ranges[i][0] = laser_scan.ranges[i];
+    // Compute bearing
+    ldata.ranges[i][1] = angle_min +
+            (i * angle_increment);
+  }
+  return true;
+}
+
+// Hold the scan for the next fused update, dropping held scans too old to
+// go with it.  Returns true once every laser has a scan held, or when this
+// laser already had one (a laser that stopped publishing doesn't hold the
+// others up for longer than a period of this one).
+bool
+AmclNode::holdFusedScan(const sensor_msgs::LaserScanConstPtr& laser_scan, int laser_index)
+{
+  fused_scans_.resize(lasers_.size());
+  bool period_over = fused_scans_[laser_index].get() != NULL;
+  fused_scans_[laser_index] = laser_scan;
+
+  bool complete = true;
+  for(size_t i = 0; i < fused_scans_.size(); i++)
+  {
+    if(fused_scans_[i] &&
+       (laser_scan->header.stamp - fused_scans_[i]->header.stamp).toSec() > laser_fused_tolerance_)
+      fused_scans_[i].reset();
+    if(!fused_scans_[i])
+      complete = false;
+  }
+  return complete || period_over;
+}
 
 //接收到Lasers数据的处理
 void
@@ -1064,7 +1999,11 @@ AmclNode::laserReceived(const sensor_msgs::LaserScanConstPtr& laser_scan)
   if( map_ == NULL ) {
     return;
   }
+  // Times each stage below, and the whole callback when it goes out of
+  // scope
+  AMCLLatencyTimer timer(&latency_, LATENCY_TOTAL);
   boost::recursive_mutex::scoped_lock lr(configuration_mutex_);
+  timer.Lap(LATENCY_LOCK);
   int laser_index = -1;
 
   // Do we have the base->base_laser Tx yet?
@@ -1110,6 +2049,13 @@ AmclNode::laserReceived(const sensor_msgs::LaserScanConstPtr& laser_scan)
     laser_index = frame_to_laser_[laser_scan->header.frame_id];
   }
 
+  // Kept for the global matcher
+  if(global_matcher_ != NULL)
+  {
+    last_scan_ = laser_scan;
+    last_scan_laser_ = laser_index;
+  }
+
   // Where was the robot when this scan was taken?
   pf_vector_t pose;
   if(!getOdomPose(latest_odom_pose_, pose.v[0], pose.v[1], pose.v[2],
@@ -1118,6 +2064,7 @@ AmclNode::laserReceived(const sensor_msgs::LaserScanConstPtr& laser_scan)
     ROS_ERROR("Couldn't determine robot's pose associated with laser scan");
     return;
   }
+  timer.Lap(LATENCY_TF);
 
 
   pf_vector_t delta = pf_vector_zero();
@@ -1143,6 +2090,12 @@ AmclNode::laserReceived(const sensor_msgs::LaserScanConstPtr& laser_scan)
         lasers_update_[i] = true;
   }
 
+  // Fused updates wait for a scan from every laser, and then update as of
+  // this one, the newest
+  if(laser_fused_update_ && lasers_update_[laser_index] &&
+     !holdFusedScan(laser_scan, laser_index))
+    return;
+
   bool force_publication = false;
   if(!pf_init_)
   {
@@ -1175,6 +2128,7 @@ AmclNode::laserReceived(const sensor_msgs::LaserScanConstPtr& laser_scan)
 
     // Use the action data to update the filter
     odom_->UpdateAction(pf_, (AMCLSensorData*)&odata);
+    timer.Lap(LATENCY_ACTION);
 
     // Pose at last filter update
     //this->pf_odom_pose = pose;
@@ -1184,86 +2138,94 @@ AmclNode::laserReceived(const sensor_msgs::LaserScanConstPtr& laser_scan)
   // If the robot has moved, update the filter
   if(lasers_update_[laser_index])
   {
-    AMCLLaserData ldata;
-    ldata.sensor = lasers_[laser_index];
-    ldata.range_count = laser_scan->ranges.size();
-
-    // To account for lasers that are mounted upside-down, we determine the
-    // min, max, and increment angles of the laser in the base frame.
-    //
-    // Construct min and max angles of laser, in the base_link frame.
-    tf::Quaternion q;
-    q.setRPY(0.0, 0.0, laser_scan->angle_min);
-    tf::Stamped<tf::Quaternion> min_q(q, laser_scan->header.stamp,
-                                      laser_scan->header.frame_id);
-    q.setRPY(0.0, 0.0, laser_scan->angle_min + laser_scan->angle_increment);
-    tf::Stamped<tf::Quaternion> inc_q(q, laser_scan->header.stamp,
-                                      laser_scan->header.frame_id);
-    try
-    {
-      tf_->transformQuaternion(base_frame_id_, min_q, min_q);
-      tf_->transformQuaternion(base_frame_id_, inc_q, inc_q);
-    }
-    catch(tf::TransformException& e)
+    double sensor_time;
+    int beams = 0;
+    if(laser_fused_update_)
     {
-      ROS_WARN("Unable to transform min/max laser angles into base frame: %s",
-               e.what());
-      return;
-    }
-
-    double angle_min = tf::getYaw(min_q);
-    double angle_increment = tf::getYaw(inc_q) - angle_min;
-
-    // wrapping angle to [-pi .. pi]
-    angle_increment = fmod(angle_increment + 5*M_PI, 2*M_PI) - M_PI;
+      // One pass over the particles with the held scans of all lasers
+      boost::scoped_array<AMCLLaserData> ldata(new AMCLLaserData[fused_scans_.size()]);
+      std::vector<AMCLLaserData*> scans;
+      std::vector<int> scan_lasers;
+      for(size_t i = 0; i < fused_scans_.size(); i++)
+      {
+        if(!fused_scans_[i] || !fillLaserData(*fused_scans_[i], i, ldata[i]))
+          continue;
+        scans.push_back(&ldata[i]);
+        scan_lasers.push_back(i);
+      }
+      fused_scans_.clear();
+      timer.Lap(LATENCY_SCAN);
 
-    ROS_DEBUG("Laser %d angles in base frame: min: %.3f inc: %.3f", laser_index, angle_min, angle_increment);
+      AMCLLaser::UpdateSensors(pf_, scans);
+      sensor_time = timer.Lap(LATENCY_SENSOR);
 
-    // Apply range min/max thresholds, if the user supplied them
-    if(laser_max_range_ > 0.0)
-      ldata.range_max = std::min(laser_scan->range_max, (float)laser_max_range_);
-    else
-      ldata.range_max = laser_scan->range_max;
-    double range_min;
-    if(laser_min_range_ > 0.0)
-      range_min = std::max(laser_scan->range_min, (float)laser_min_range_);
+      for(size_t i = 0; i < scan_lasers.size(); i++)
+        beams += lasers_[scan_lasers[i]]->GetBeamsUsed();
+      for(unsigned int i=0; i < lasers_update_.size(); i++)
+        lasers_update_[i] = false;
+    }
     else
-      range_min = laser_scan->range_min;
-    // The AMCLLaserData destructor will free this memory
-    ldata.ranges = new double[ldata.range_count][2];
-    ROS_ASSERT(ldata.ranges);
-    for(int i=0;i<ldata.range_count;i++)
     {
-      // amcl doesn't (yet) have a concept of min range.  So we'll map short
-      // readings to max range.
-      if(laser_scan->ranges[i] <= range_min)
-        ldata.ranges[i][0] = ldata.range_max;
-      else
-        ldata.ranges[i][0] = laser_scan->ranges[i];
-      // Compute bearing
-      ldata.ranges[i][1] = angle_min +
-              (i * angle_increment);
-    }
+      AMCLLaserData ldata;
+      if(!fillLaserData(*laser_scan, laser_index, ldata))
+        return;
+      timer.Lap(LATENCY_SCAN);
 
-    lasers_[laser_index]->UpdateSensor(pf_, (AMCLSensorData*)&ldata);
+      lasers_[laser_index]->UpdateSensor(pf_, (AMCLSensorData*)&ldata);
+      sensor_time = timer.Lap(LATENCY_SENSOR);
 
-    lasers_update_[laser_index] = false;
+      beams = lasers_[laser_index]->GetBeamsUsed();
+      lasers_update_[laser_index] = false;
+    }
 
     pf_odom_pose_ = pose;
 
     // Resample the particles
+    double resample_time = 0.0;
     if(!(++resample_count_ % resample_interval_))
     {
       pf_update_resample(pf_);
       resampled = true;
+      resample_time = timer.Lap(LATENCY_RESAMPLE);
+      if(pf_->budget_limited)
+      {
+        latency_budget_limited_++;
+        ROS_WARN_THROTTLE(10.0, "Update time budget limits the filter to %d particles; "
+                          "the KLD bound asks for %d", pf_->budget_samples,
+                          pf_->kld_samples);
+      }
     }
 
     pf_sample_set_t* set = pf_->sets + pf_->current_set;
     ROS_DEBUG("Num samples: %d\n", set->sample_count);
 
+    // Filter state for the latency report
+    latency_updates_++;
+    latency_resamples_ += resampled ? 1 : 0;
+    last_particles_ = set->sample_count;
+    last_beams_ = beams;
+    last_resampled_ = resampled;
+    ROS_DEBUG_NAMED("latency", "Update: %d particles, %d beams, sensor %.3f ms, "
+                    "resampled %d (%.3f ms)", last_particles_, last_beams_,
+                    sensor_time * 1e3, (int)resampled, resample_time * 1e3);
+
     // Publish the resulting cloud
     // TODO: set maximum rate for publishing
-    if (!m_force_update) {
+    if (!m_force_update && publisher_thread_ != NULL) {
+      // Every stride-th particle; the publisher thread builds the message
+      int stride = 1;
+      if(particlecloud_max_poses_ > 0)
+        stride = std::max(1, (set->sample_count + particlecloud_max_poses_ - 1) /
+                             particlecloud_max_poses_);
+      std::vector<pf_vector_t>* cloud = new std::vector<pf_vector_t>();
+      cloud->reserve(set->sample_count / stride + 1);
+      for(int i = 0; i < set->sample_count; i += stride)
+        cloud->push_back(set->samples[i].pose);
+      estimate_.cloud.reset(cloud);
+      estimate_.cloud_seq++;
+      handOffEstimate();
+    }
+    else if (!m_force_update) {
       geometry_msgs::PoseArray cloud_msg;
       cloud_msg.header.stamp = ros::Time::now();
       cloud_msg.header.frame_id = global_frame_id_;
@@ -1277,6 +2239,7 @@ AmclNode::laserReceived(const sensor_msgs::LaserScanConstPtr& laser_scan)
       }
       particlecloud_pub_.publish(cloud_msg);
     }
+    timer.Lap(LATENCY_CLOUD);
   }
 
   if(resampled || force_publication)
@@ -1308,6 +2271,26 @@ AmclNode::laserReceived(const sensor_msgs::LaserScanConstPtr& laser_scan)
         max_weight_hyp = hyp_count;
       }
     }
+    timer.Lap(LATENCY_HYPOTHESES);
+
+    // Align the scan with the map around the best cluster, and publish
+    // the result in place of the cluster's mean
+    std::vector<pf_vector_t> points;
+    if(max_weight > 0.0 && pose_refiner_ != NULL &&
+       getScanPoints(*laser_scan, laser_index, points))
+    {
+      pf_vector_t refined = hyps[max_weight_hyp].pf_pose_mean;
+      if(pose_refiner_->Refine(points, &refined))
+      {
+        ROS_DEBUG("Refined pose: %.3f %.3f %.3f in %d iterations, mean distance "
+                  "%.3f -> %.3f m", refined.v[0], refined.v[1], refined.v[2],
+                  pose_refiner_->GetIterations(), pose_refiner_->GetInitialError(),
+                  pose_refiner_->GetFinalError());
+        hyps[max_weight_hyp].pf_pose_mean = refined;
+        latency_refined_++;
+      }
+    }
+    timer.Lap(LATENCY_REFINE);
 
     if(max_weight > 0.0)
     {
@@ -1358,7 +2341,13 @@ AmclNode::laserReceived(const sensor_msgs::LaserScanConstPtr& laser_scan)
          }
        */
 
-      pose_pub_.publish(p);
+      if(publisher_thread_ != NULL)
+      {
+        estimate_.pose = p;
+        estimate_.pose_seq++;
+      }
+      else
+        pose_pub_.publish(p);
       last_published_pose = p;
 
       ROS_DEBUG("New pose: %6.3f %6.3f %6.3f",
@@ -1384,6 +2373,8 @@ AmclNode::laserReceived(const sensor_msgs::LaserScanConstPtr& laser_scan)
       catch(tf::TransformException)
       {
         ROS_DEBUG("Failed to subtract base to odom transform");
+        if(publisher_thread_ != NULL)
+          handOffEstimate();
         return;
       }
 
@@ -1391,7 +2382,16 @@ AmclNode::laserReceived(const sensor_msgs::LaserScanConstPtr& laser_scan)
                                  tf::Point(odom_to_map.getOrigin()));
       latest_tf_valid_ = true;
 
-      if (tf_broadcast_ == true) // allowed publish tf message
+      if(publisher_thread_ != NULL)
+      {
+        // Sent from the publisher thread
+        estimate_.tf_valid = true;
+        estimate_.map_to_odom = latest_tf_.inverse();
+        estimate_.odom_pose = latest_odom_pose_;
+        handOffEstimate();
+        sent_first_transform_ = sent_first_transform_ || tf_broadcast_;
+      }
+      else if (tf_broadcast_ == true) // allowed publish tf message
       {
         // We want to send a transform that is good up until a
         // tolerance time so that odom can be used
@@ -1409,6 +2409,12 @@ AmclNode::laserReceived(const sensor_msgs::LaserScanConstPtr& laser_scan)
       ROS_ERROR("No pose!");
     }
   }
+  else if(latest_tf_valid_ && publisher_thread_ != NULL)
+  {
+    // The publisher thread rebroadcasts the transform and saves the pose
+    estimate_.odom_pose = latest_odom_pose_;
+    handOffEstimate();
+  }
   else if(latest_tf_valid_)
   {
     if (tf_broadcast_ == true)
@@ -1432,7 +2438,79 @@ AmclNode::laserReceived(const sensor_msgs::LaserScanConstPtr& laser_scan)
       save_pose_last_time = now;
     }
   }
+  timer.Lap(LATENCY_PUBLISH);
+}
 
+// Hand a copy of estimate_ to the publisher thread
+void
+AmclNode::handOffEstimate()
+{
+  estimate_.global_frame_id = global_frame_id_;
+  estimate_.odom_frame_id = odom_frame_id_;
+  estimate_.tf_broadcast = tf_broadcast_;
+  estimate_.transform_tolerance = transform_tolerance_;
+  estimate_.save_pose_period = save_pose_period;
+  estimate_handoff_.GetBack() = estimate_;
+  estimate_handoff_.Publish();
+}
+
+// Publish what the filter hands over, and rebroadcast map->odom with the
+// latest estimate at tf_publish_rate_.  Runs without the configuration
+// lock: everything it uses comes with the estimate.
+void
+AmclNode::publishLoop()
+{
+  ros::WallRate rate(tf_publish_rate_);
+  bool have_estimate = false;
+  unsigned long cloud_seq = 0, pose_seq = 0;
+  ros::Time save_pose_time = ros::Time::now();
+  while(ros::ok() && !publisher_stop_)
+  {
+    if(estimate_handoff_.Update())
+      have_estimate = true;
+    if(have_estimate)
+    {
+      const amcl_estimate_t& estimate = estimate_handoff_.GetFront();
+      if(estimate.cloud_seq != cloud_seq && estimate.cloud)
+      {
+        const std::vector<pf_vector_t>& cloud = *estimate.cloud;
+        geometry_msgs::PoseArray cloud_msg;
+        cloud_msg.header.stamp = ros::Time::now();
+        cloud_msg.header.frame_id = estimate.global_frame_id;
+        cloud_msg.poses.resize(cloud.size());
+        for(size_t i = 0; i < cloud.size(); i++)
+          tf::poseTFToMsg(tf::Pose(tf::createQuaternionFromYaw(cloud[i].v[2]),
+                                   tf::Vector3(cloud[i].v[0], cloud[i].v[1], 0)),
+                          cloud_msg.poses[i]);
+        particlecloud_pub_.publish(cloud_msg);
+        cloud_seq = estimate.cloud_seq;
+      }
+      if(estimate.pose_seq != pose_seq)
+      {
+        pose_pub_.publish(estimate.pose);
+        pose_seq = estimate.pose_seq;
+      }
+
+      if(estimate.tf_valid)
+      {
+        // Good until a tolerance past now, so odom can be used meanwhile
+        ros::Time now = ros::Time::now();
+        if(estimate.tf_broadcast)
+          tfb_->sendTransform(tf::StampedTransform(estimate.map_to_odom,
+                                                   now + estimate.transform_tolerance,
+                                                   estimate.global_frame_id,
+                                                   estimate.odom_frame_id));
+
+        if((estimate.save_pose_period.toSec() > 0.0) &&
+           (now - save_pose_time) >= estimate.save_pose_period)
+        {
+          savePoseToServer(estimate.map_to_odom * estimate.odom_pose, estimate.pose);
+          save_pose_time = now;
+        }
+      }
+    }
+    rate.sleep();
+  }
 }
 
 double
@@ -0,0 +1,93 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Helpers shared by the amcl unit tests.  Timings belong in
+// amcl_benchmark, not here.
+//
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef AMCL_TEST_UTIL_H
+#define AMCL_TEST_UTIL_H
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <string>
+
+#include "amcl/map/map.h"
+#include "amcl/sensors/amcl_laser.h"
+
+// Wall clock, in seconds
+inline double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// Scratch directory, removed with its contents at the end of a test
+class TempDir
+{
+  public: TempDir()
+  {
+    char dir_template[] = "/tmp/amcl_test.XXXXXX";
+    if(mkdtemp(dir_template) != NULL)
+      this->path = dir_template;
+  }
+  public: ~TempDir()
+  {
+    std::string cleanup = "rm -rf " + this->path;
+    if(!this->path.empty() && system(cleanup.c_str()) != 0)
+      fprintf(stderr, "failed to remove %s\n", this->path.c_str());
+  }
+  public: std::string path;
+};
+
+// Set the cells of a rectangle, inclusive, that lie on the map
+inline void fill(map_t* map, int x0, int y0, int x1, int y1, int state)
+{
+  for(int j = y0; j <= y1; j++)
+    for(int i = x0; i <= x1; i++)
+      if(MAP_VALID(map, i, j))
+        map->occ_state[MAP_INDEX(map, i, j)] = state;
+}
+
+// Ray cast a scan over the front half, -pi/2 to pi/2, from a laser mounted
+// on a robot at pose
+inline void scan_data(map_t* map, amcl::AMCLLaser* laser, pf_vector_t pose, int beams,
+                      double max_range, amcl::AMCLLaserData* data)
+{
+  pf_vector_t at = pf_vector_coord_add(laser->GetLaserPose(), pose);
+  data->sensor = laser;
+  data->range_count = beams;
+  data->range_max = max_range;
+  data->ranges = new double[beams][2];
+  for(int b = 0; b < beams; b++)
+  {
+    double bearing = -M_PI / 2 + b * M_PI / (beams - 1);
+    data->ranges[b][0] = map_calc_range(map, at.v[0], at.v[1], at.v[2] + bearing,
+                                        max_range);
+    data->ranges[b][1] = bearing;
+  }
+}
+
+#endif
@@ -0,0 +1,189 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Runs amcl_benchmark for a few steps on a small room, and its
+// component timings, so the tool keeps building and running, and checks
+// that a seed repeats its results
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "amcl_test_util.h"
+
+// The benchmark's path, set by the build
+#ifndef AMCL_BENCHMARK
+#define AMCL_BENCHMARK "amcl_benchmark"
+#endif
+
+// A 6 x 4 m room with a wall part way across and a box, so that the scans
+// tell the two halves apart
+static std::string write_room(const std::string& dir)
+{
+  const int width = 120, height = 80;
+  std::vector<unsigned char> pixels(width * height, 254);
+  for(int v = 0; v < height; v++)
+    for(int u = 0; u < width; u++)
+    {
+      bool border = u < 2 || v < 2 || u >= width - 2 || v >= height - 2;
+      bool wall = u >= 60 && u < 62 && v < 45;
+      bool box = u >= 85 && u < 95 && v >= 50 && v < 58;
+      if(border || wall || box)
+        pixels[v * width + u] = 0;
+    }
+
+  std::string path = dir + "/room.pgm";
+  FILE* file = fopen(path.c_str(), "wb");
+  if(file == NULL)
+    return "";
+  fprintf(file, "P5\n# CREATOR: benchmark_smoke_test\n%d %d\n255\n", width, height);
+  fwrite(&pixels[0], 1, pixels.size(), file);
+  fclose(file);
+  return path;
+}
+
+struct benchmark_row_t
+{
+  std::string model;
+  int particles;
+  double rate;
+  double error;
+};
+
+// Run the benchmark; returns its exit status, the rows of its summary
+// and, if lines is given, everything it printed
+static int run_benchmark(const std::string& args, std::vector<benchmark_row_t>* rows,
+                         std::vector<std::string>* lines = NULL)
+{
+  std::string command = std::string(AMCL_BENCHMARK) + " " + args + " 2>&1";
+  FILE* pipe = popen(command.c_str(), "r");
+  if(pipe == NULL)
+    return -1;
+
+  rows->clear();
+  if(lines)
+    lines->clear();
+  bool summary = false;
+  char line[1024];
+  while(fgets(line, sizeof(line), pipe) != NULL)
+  {
+    if(lines)
+      lines->push_back(line);
+    if(!strncmp(line, "model ", 6))
+    {
+      summary = true;
+      continue;
+    }
+    char model[64];
+    benchmark_row_t row;
+    if(summary && sscanf(line, "%63s %d %lf %lf", model, &row.particles, &row.rate,
+                         &row.error) == 4)
+    {
+      row.model = model;
+      rows->push_back(row);
+    }
+  }
+  int status = pclose(pipe);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+TEST(Benchmark, Smoke)
+{
+  TempDir dir;
+  ASSERT_FALSE(dir.path.empty());
+  std::string map = write_room(dir.path);
+  ASSERT_FALSE(map.empty());
+
+  std::string args = "--particles 100,300 --steps 30 --beams 30 --seed 7 " + map;
+  std::vector<benchmark_row_t> first, second;
+  ASSERT_EQ(0, run_benchmark(args, &first));
+  ASSERT_EQ(6u, first.size());
+  const char* models[] = {"beam", "likelihood_field", "likelihood_field_prob"};
+  for(size_t r = 0; r < first.size(); r++)
+  {
+    EXPECT_EQ(models[r / 2], first[r].model);
+    EXPECT_EQ(r % 2 ? 300 : 100, first[r].particles);
+    EXPECT_GT(first[r].rate, 0.0);
+    // Started on the true pose, the filter should stay with it
+    EXPECT_LT(first[r].error, 0.5) << first[r].model << ", " << first[r].particles;
+  }
+
+  // The same seed drives the same path past the same particles
+  ASSERT_EQ(0, run_benchmark(args, &second));
+  ASSERT_EQ(first.size(), second.size());
+  for(size_t r = 0; r < first.size(); r++)
+    EXPECT_EQ(first[r].error, second[r].error) << first[r].model << ", " << first[r].particles;
+
+  // An unattainable rate fails the run
+  std::vector<benchmark_row_t> slow;
+  EXPECT_EQ(1, run_benchmark("--particles 100 --models beam --steps 5 --min-rate 1e12 " +
+                             map, &slow));
+  EXPECT_EQ(1u, slow.size());
+
+  // Bad options and missing maps are usage errors
+  std::vector<benchmark_row_t> none;
+  EXPECT_EQ(2, run_benchmark("--models nothing " + map, &none));
+  EXPECT_EQ(2, run_benchmark(dir.path + "/missing.pgm", &none));
+  EXPECT_EQ(2, run_benchmark("--components nothing " + map, &none));
+  EXPECT_TRUE(none.empty());
+}
+
+// Every component timing runs, and reports under its name
+TEST(Benchmark, Components)
+{
+  TempDir dir;
+  ASSERT_FALSE(dir.path.empty());
+  std::string map = write_room(dir.path);
+  ASSERT_FALSE(map.empty());
+
+  std::vector<benchmark_row_t> rows;
+  std::vector<std::string> lines;
+  ASSERT_EQ(0, run_benchmark("--steps 20 --particles 100,300 --components all " + map,
+                             &rows, &lines));
+  EXPECT_TRUE(rows.empty());
+
+  const char* names[] = {"cspace", "resample", "kdtree", "range_table",
+                         "odom", "global_matcher", "beam_selection", "floor_set",
+                         "fused_update"};
+  for(size_t n = 0; n < sizeof(names) / sizeof(names[0]); n++)
+  {
+    std::string prefix = std::string(names[n]) + ": ";
+    size_t found = 0;
+    for(size_t l = 0; l < lines.size(); l++)
+      if(!lines[l].compare(0, prefix.size(), prefix))
+        found++;
+    EXPECT_GT(found, 0u) << names[n];
+  }
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
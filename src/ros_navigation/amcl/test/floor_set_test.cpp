@@ -0,0 +1,346 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Checks the PGM loader and the floor set: lazy loading, the cached
+// distance planes and eviction under the memory limit
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "amcl/map/map.h"
+#include "amcl/sensors/amcl_floor_set.h"
+#include "amcl/sensors/amcl_laser.h"
+
+#include "amcl_test_util.h"
+
+using namespace amcl;
+
+// Write a binary PGM, top row first
+static void write_pgm(const std::string& path, int width, int height,
+                      const std::vector<unsigned char>& pixels)
+{
+  FILE* file = fopen(path.c_str(), "wb");
+  ASSERT_TRUE(file != NULL);
+  fprintf(file, "P5\n# CREATOR: floor_set_test\n%d %d\n255\n", width, height);
+  fwrite(&pixels[0], 1, pixels.size(), file);
+  fclose(file);
+}
+
+// A free room with walls around it, and a pillar at (width / 3, height / 3)
+static std::string write_room(const std::string& dir, const std::string& name,
+                              int width, int height)
+{
+  std::vector<unsigned char> pixels(width * height, 254);
+  for(int v = 0; v < height; v++)
+    for(int u = 0; u < width; u++)
+      if(u == 0 || v == 0 || u == width - 1 || v == height - 1)
+        pixels[v * width + u] = 0;
+  pixels[(height / 3) * width + width / 3] = 0;
+
+  std::string path = dir + "/" + name + ".pgm";
+  write_pgm(path, width, height, pixels);
+  return path;
+}
+
+static amcl_floor_info_t floor_info(const std::string& image)
+{
+  amcl_floor_info_t info;
+  info.image = image;
+  info.resolution = 0.05;
+  info.origin_x = -1.0;
+  info.origin_y = -2.0;
+  info.negate = false;
+  info.occupied_thresh = 0.65;
+  info.free_thresh = 0.196;
+  return info;
+}
+
+TEST(FloorSet, LoadPgm)
+{
+  TempDir dir;
+  ASSERT_FALSE(dir.path.empty());
+
+  // Top row: black, dark grey, mid grey; bottom row: light grey, white, 205
+  std::vector<unsigned char> pixels;
+  pixels.push_back(0);
+  pixels.push_back(50);
+  pixels.push_back(128);
+  pixels.push_back(220);
+  pixels.push_back(255);
+  pixels.push_back(205);
+  std::string path = dir.path + "/tiny.pgm";
+  write_pgm(path, 3, 2, pixels);
+
+  map_t* map = map_alloc();
+  ASSERT_EQ(0, map_load_pgm(map, path.c_str(), 0.1, 0, 0.65, 0.196));
+  EXPECT_EQ(3, map->size_x);
+  EXPECT_EQ(2, map->size_y);
+  EXPECT_DOUBLE_EQ(0.1, map->scale);
+  // The image's top row is the map's last
+  EXPECT_EQ(+1, map->occ_state[MAP_INDEX(map, 0, 1)]);
+  EXPECT_EQ(+1, map->occ_state[MAP_INDEX(map, 1, 1)]);
+  EXPECT_EQ(0, map->occ_state[MAP_INDEX(map, 2, 1)]);
+  EXPECT_EQ(-1, map->occ_state[MAP_INDEX(map, 0, 0)]);
+  EXPECT_EQ(-1, map->occ_state[MAP_INDEX(map, 1, 0)]);
+  // map_server's "unknown" grey
+  EXPECT_EQ(0, map->occ_state[MAP_INDEX(map, 2, 0)]);
+
+  // Negated, black is free
+  ASSERT_EQ(0, map_load_pgm(map, path.c_str(), 0.1, 1, 0.65, 0.196));
+  EXPECT_EQ(-1, map->occ_state[MAP_INDEX(map, 0, 1)]);
+  EXPECT_EQ(+1, map->occ_state[MAP_INDEX(map, 1, 0)]);
+  map_free(map);
+
+  // Not a binary PGM, or cut short
+  std::string bad = dir.path + "/bad.pgm";
+  FILE* file = fopen(bad.c_str(), "w");
+  fprintf(file, "P2\n3 2\n255\n0 0 0 0 0 0\n");
+  fclose(file);
+  map = map_alloc();
+  EXPECT_NE(0, map_load_pgm(map, bad.c_str(), 0.1, 0, 0.65, 0.196));
+  file = fopen(bad.c_str(), "wb");
+  fprintf(file, "P5\n3 2\n255\n");
+  fwrite(&pixels[0], 1, 4, file);
+  fclose(file);
+  EXPECT_NE(0, map_load_pgm(map, bad.c_str(), 0.1, 0, 0.65, 0.196));
+  EXPECT_NE(0, map_load_pgm(map, (dir.path + "/missing.pgm").c_str(), 0.1, 0, 0.65, 0.196));
+  map_free(map);
+}
+
+TEST(FloorSet, LazyLoading)
+{
+  TempDir dir;
+  ASSERT_FALSE(dir.path.empty());
+
+  AMCLFloorSet floors;
+  floors.SetCspace(1.0, MAP_CSPACE_EDT, 1, "");
+  EXPECT_TRUE(floors.AddFloor("ground", floor_info(write_room(dir.path, "ground", 60, 40))));
+  EXPECT_TRUE(floors.AddFloor("first", floor_info(write_room(dir.path, "first", 80, 50))));
+  EXPECT_TRUE(floors.HasFloor("ground"));
+  EXPECT_FALSE(floors.HasFloor("roof"));
+  EXPECT_EQ(2u, floors.GetFloorNames().size());
+
+  // Nothing is read until a floor is activated
+  EXPECT_FALSE(floors.IsLoaded("ground"));
+  EXPECT_EQ(0u, floors.GetMemoryUsed());
+  EXPECT_TRUE(floors.GetActiveMap() == NULL);
+  EXPECT_EQ("", floors.GetActiveName());
+
+  map_t* ground = floors.Activate("ground");
+  ASSERT_TRUE(ground != NULL);
+  EXPECT_EQ(ground, floors.GetActiveMap());
+  EXPECT_EQ("ground", floors.GetActiveName());
+  EXPECT_TRUE(floors.IsLoaded("ground"));
+  EXPECT_FALSE(floors.IsLoaded("first"));
+  EXPECT_GT(floors.GetMemoryUsed(), 0u);
+
+  // Placed like a map message with the same origin
+  EXPECT_EQ(60, ground->size_x);
+  EXPECT_EQ(40, ground->size_y);
+  EXPECT_DOUBLE_EQ(-1.0 + 30 * 0.05, ground->origin_x);
+  EXPECT_DOUBLE_EQ(-2.0 + 20 * 0.05, ground->origin_y);
+  EXPECT_DOUBLE_EQ(-1.0, MAP_WXGX(ground, 0));
+  EXPECT_DOUBLE_EQ(-2.0, MAP_WYGY(ground, 0));
+
+  // With its distance plane, and the free cells inside the walls (all
+  // but the pillar)
+  ASSERT_TRUE(ground->occ_dist != NULL);
+  EXPECT_DOUBLE_EQ(1.0, ground->max_occ_dist);
+  EXPECT_EQ(0, ground->occ_dist[MAP_INDEX(ground, 20, 26)]);
+  EXPECT_EQ(58u * 38u - 1u, floors.GetActiveFreeCells().size());
+
+  // Switching keeps the other floor loaded when there is no limit
+  map_t* first = floors.Activate("first");
+  ASSERT_TRUE(first != NULL);
+  EXPECT_EQ(80, first->size_x);
+  EXPECT_TRUE(floors.IsLoaded("ground"));
+  EXPECT_EQ(ground, floors.Activate("ground"));
+
+  // The active floor can't be redefined; the others can, and are unloaded
+  EXPECT_FALSE(floors.AddFloor("ground", floor_info(dir.path + "/first.pgm")));
+  EXPECT_TRUE(floors.AddFloor("first", floor_info(dir.path + "/ground.pgm")));
+  EXPECT_FALSE(floors.IsLoaded("first"));
+}
+
+TEST(FloorSet, Failures)
+{
+  TempDir dir;
+  ASSERT_FALSE(dir.path.empty());
+
+  AMCLFloorSet floors;
+  floors.SetCspace(1.0, MAP_CSPACE_BRUSHFIRE, 1, "");
+  floors.AddFloor("ground", floor_info(write_room(dir.path, "ground", 60, 40)));
+  floors.AddFloor("broken", floor_info(dir.path + "/missing.pgm"));
+
+  map_t* ground = floors.Activate("ground");
+  ASSERT_TRUE(ground != NULL);
+
+  // Unknown or unreadable floors leave the active one alone
+  EXPECT_TRUE(floors.Activate("roof") == NULL);
+  EXPECT_TRUE(floors.Activate("broken") == NULL);
+  EXPECT_EQ("ground", floors.GetActiveName());
+  EXPECT_EQ(ground, floors.GetActiveMap());
+  EXPECT_FALSE(floors.IsLoaded("broken"));
+}
+
+TEST(FloorSet, Eviction)
+{
+  TempDir dir;
+  ASSERT_FALSE(dir.path.empty());
+
+  AMCLFloorSet floors;
+  floors.SetCspace(1.0, MAP_CSPACE_EDT, 1, "");
+  floors.AddFloor("a", floor_info(write_room(dir.path, "a", 100, 100)));
+  floors.AddFloor("b", floor_info(write_room(dir.path, "b", 100, 100)));
+  floors.AddFloor("c", floor_info(write_room(dir.path, "c", 100, 100)));
+
+  ASSERT_TRUE(floors.Activate("a") != NULL);
+  size_t floor_bytes = floors.GetMemoryUsed();
+
+  // Room for two floors: the least recently used goes
+  floors.SetMemoryLimit(2 * floor_bytes + floor_bytes / 2);
+  ASSERT_TRUE(floors.Activate("b") != NULL);
+  ASSERT_TRUE(floors.Activate("c") != NULL);
+  EXPECT_FALSE(floors.IsLoaded("a"));
+  EXPECT_TRUE(floors.IsLoaded("b"));
+  EXPECT_TRUE(floors.IsLoaded("c"));
+
+  ASSERT_TRUE(floors.Activate("b") != NULL);
+  ASSERT_TRUE(floors.Activate("a") != NULL);
+  EXPECT_TRUE(floors.IsLoaded("a"));
+  EXPECT_TRUE(floors.IsLoaded("b"));
+  EXPECT_FALSE(floors.IsLoaded("c"));
+  EXPECT_LE(floors.GetMemoryUsed(), 2 * floor_bytes + floor_bytes / 2);
+
+  // A limit below a single floor still keeps the active one
+  floors.SetMemoryLimit(floor_bytes / 2);
+  EXPECT_TRUE(floors.IsLoaded("a"));
+  EXPECT_FALSE(floors.IsLoaded("b"));
+  EXPECT_EQ("a", floors.GetActiveName());
+  ASSERT_TRUE(floors.Activate("c") != NULL);
+  EXPECT_FALSE(floors.IsLoaded("a"));
+  EXPECT_EQ(floor_bytes, floors.GetMemoryUsed());
+}
+
+TEST(FloorSet, Cache)
+{
+  TempDir dir;
+  ASSERT_FALSE(dir.path.empty());
+  std::string ground_image = write_room(dir.path, "ground", 120, 90);
+
+  map_t* reference = map_alloc();
+  ASSERT_EQ(0, map_load_pgm(reference, ground_image.c_str(), 0.05, 0, 0.65, 0.196));
+  map_update_cspace_edt(reference, 1.0, 1);
+  size_t plane_size = reference->size_x * reference->size_y + MAP_DIST_PAD;
+
+  AMCLFloorSet floors;
+  floors.SetCspace(1.0, MAP_CSPACE_EDT, 1, dir.path + "/cache");
+  floors.SetMemoryLimit(1);
+  floors.AddFloor("ground", floor_info(ground_image));
+  floors.AddFloor("first", floor_info(write_room(dir.path, "first", 120, 90)));
+
+  // The planes are mapped from the cache, the first time as well as after
+  // the floor was evicted
+  for(int visit = 0; visit < 2; visit++)
+  {
+    map_t* ground = floors.Activate("ground");
+    ASSERT_TRUE(ground != NULL);
+    EXPECT_TRUE(ground->occ_dist_mapping != NULL);
+    EXPECT_EQ(0, memcmp(reference->occ_dist, ground->occ_dist, plane_size));
+    ASSERT_TRUE(floors.Activate("first") != NULL);
+    EXPECT_FALSE(floors.IsLoaded("ground"));
+  }
+
+  map_free(reference);
+}
+
+// New cspace settings apply to the floors loaded afterwards, and the
+// laser rebuilds a plane made with another distance or transform
+TEST(FloorSet, Reconfigure)
+{
+  TempDir dir;
+  ASSERT_FALSE(dir.path.empty());
+
+  AMCLFloorSet floors;
+  floors.SetCspace(1.0, MAP_CSPACE_EDT, 1, "");
+  floors.AddFloor("ground", floor_info(write_room(dir.path, "ground", 60, 40)));
+  floors.AddFloor("first", floor_info(write_room(dir.path, "first", 60, 40)));
+  ASSERT_TRUE(floors.Activate("first") != NULL);
+  map_t* ground = floors.Activate("ground");
+  ASSERT_TRUE(ground != NULL);
+  EXPECT_TRUE(floors.IsLoaded("first"));
+  EXPECT_EQ(MAP_CSPACE_EDT, ground->occ_dist_method);
+
+  // The same settings keep what is loaded
+  floors.SetCspace(1.0, MAP_CSPACE_EDT, 1, "");
+  EXPECT_TRUE(floors.IsLoaded("first"));
+
+  // A new distance drops the inactive floor, and reloads it with that
+  floors.SetCspace(1.5, MAP_CSPACE_EDT, 1, "");
+  EXPECT_FALSE(floors.IsLoaded("first"));
+  EXPECT_TRUE(floors.IsLoaded("ground"));
+  map_t* first = floors.Activate("first");
+  ASSERT_TRUE(first != NULL);
+  EXPECT_DOUBLE_EQ(1.5, first->max_occ_dist);
+
+  // So does a new transform
+  floors.SetCspace(1.5, MAP_CSPACE_BRUSHFIRE, 1, "");
+  EXPECT_FALSE(floors.IsLoaded("ground"));
+  ground = floors.Activate("ground");
+  ASSERT_TRUE(ground != NULL);
+  EXPECT_EQ(MAP_CSPACE_BRUSHFIRE, ground->occ_dist_method);
+  EXPECT_DOUBLE_EQ(1.5, ground->max_occ_dist);
+
+  // The laser keeps a plane built its way, and rebuilds one built with
+  // the other transform even at the same distance
+  map_t* reference = map_alloc();
+  ASSERT_EQ(0, map_load_pgm(reference, (dir.path + "/ground.pgm").c_str(), 0.05, 0,
+                            0.65, 0.196));
+  map_update_cspace_edt(reference, 1.5, 1);
+  size_t plane_size = reference->size_x * reference->size_y + MAP_DIST_PAD;
+  ASSERT_NE(0, memcmp(reference->occ_dist, ground->occ_dist, plane_size));
+
+  AMCLLaser brushfire_laser(30, ground);
+  uint8_t* plane = ground->occ_dist;
+  brushfire_laser.SetModelLikelihoodField(0.95, 0.05, 0.2, 1.5);
+  EXPECT_EQ(plane, ground->occ_dist);
+
+  AMCLLaser edt_laser(30, ground);
+  edt_laser.SetExactDistanceTransform(true);
+  edt_laser.SetModelLikelihoodField(0.95, 0.05, 0.2, 1.5);
+  EXPECT_EQ(MAP_CSPACE_EDT, ground->occ_dist_method);
+  EXPECT_EQ(0, memcmp(reference->occ_dist, ground->occ_dist, plane_size));
+  map_free(reference);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,212 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Checks that the global matcher finds the pose a scan was taken
+// from
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "amcl/map/map.h"
+#include "amcl/sensors/amcl_global_matcher.h"
+
+#include "amcl_test_util.h"
+
+using namespace amcl;
+
+// Walled area with rectangular obstacles at random, so that no two poses
+// see quite the same thing
+static map_t* random_rooms(int size_x, int size_y, int boxes, unsigned int seed)
+{
+  map_t* map = map_alloc();
+  map->scale = 0.05;
+  map->origin_x = 3.0;
+  map->origin_y = -1.0;
+  map_alloc_cells(map, size_x, size_y);
+
+  fill(map, 0, 0, size_x - 1, size_y - 1, -1);
+  fill(map, 0, 0, size_x - 1, 1, +1);
+  fill(map, 0, size_y - 2, size_x - 1, size_y - 1, +1);
+  fill(map, 0, 0, 1, size_y - 1, +1);
+  fill(map, size_x - 2, 0, size_x - 1, size_y - 1, +1);
+
+  srand(seed);
+  for(int k = 0; k < boxes; k++)
+  {
+    int x = rand() % size_x, y = rand() % size_y;
+    int w = 2 + rand() % 20, h = 2 + rand() % 20;
+    fill(map, x, y, x + w, y + h, +1);
+  }
+  return map;
+}
+
+// Endpoints in the robot frame of a scan taken at pose, hitting obstacles
+static std::vector<pf_vector_t> simulate_scan(map_t* map, pf_vector_t pose, int beams,
+                                              double max_range)
+{
+  std::vector<pf_vector_t> points;
+  for(int b = 0; b < beams; b++)
+  {
+    double bearing = -M_PI + b * 2 * M_PI / beams;
+    double r = map_calc_range(map, pose.v[0], pose.v[1], pose.v[2] + bearing, max_range);
+    if(r >= max_range)
+      continue;
+
+    // Beams that stop at unknown space return nothing
+    double wx = pose.v[0] + r * cos(pose.v[2] + bearing);
+    double wy = pose.v[1] + r * sin(pose.v[2] + bearing);
+    int i = MAP_GXWX(map, wx), j = MAP_GYWY(map, wy);
+    if(!MAP_VALID(map, i, j) || map->occ_state[MAP_INDEX(map, i, j)] != +1)
+      continue;
+
+    pf_vector_t p = pf_vector_zero();
+    p.v[0] = r * cos(bearing);
+    p.v[1] = r * sin(bearing);
+    points.push_back(p);
+  }
+  return points;
+}
+
+// A free pose at least a metre from any obstacle
+static pf_vector_t random_free_pose(map_t* map)
+{
+  int margin = (int)(1.0 / map->scale);
+  for(;;)
+  {
+    int i = rand() % map->size_x, j = rand() % map->size_y;
+    bool clear = true;
+    for(int dj = -margin; dj <= margin && clear; dj += 2)
+      for(int di = -margin; di <= margin && clear; di += 2)
+        clear = MAP_VALID(map, i + di, j + dj) &&
+                map->occ_state[MAP_INDEX(map, i + di, j + dj)] == -1;
+    if(!clear)
+      continue;
+    pf_vector_t pose = pf_vector_zero();
+    pose.v[0] = MAP_WXGX(map, i) + 0.3 * map->scale;
+    pose.v[1] = MAP_WYGY(map, j) - 0.2 * map->scale;
+    pose.v[2] = (rand() / (double)RAND_MAX - 0.5) * 2 * M_PI;
+    return pose;
+  }
+}
+
+static double angle_error(double a, double b)
+{
+  return fabs(atan2(sin(a - b), cos(a - b)));
+}
+
+TEST(GlobalMatcher, FindsScanPose)
+{
+  map_t* map = random_rooms(300, 240, 40, 1);
+  AMCLGlobalMatcher matcher;
+  matcher.SetMap(map, 0.1, 4, 2);
+  ASSERT_TRUE(matcher.HasMap());
+
+  srand(2);
+  for(int trial = 0; trial < 5; trial++)
+  {
+    pf_vector_t pose = random_free_pose(map);
+    std::vector<pf_vector_t> points = simulate_scan(map, pose, 360, 8.0);
+    ASSERT_GT(points.size(), 100u);
+
+    std::vector<amcl_match_t> matches;
+    int found = matcher.Match(points, 4, 0.3, &matches);
+    ASSERT_GE(found, 1);
+    ASSERT_EQ(found, (int)matches.size());
+
+    // Best first, and within a couple of cells and degrees of the truth
+    for(size_t i = 1; i < matches.size(); i++)
+      EXPECT_GE(matches[i-1].score, matches[i].score);
+    EXPECT_GT(matches[0].score, 0.8);
+    EXPECT_NEAR(pose.v[0], matches[0].pose.v[0], 2 * map->scale) << "trial " << trial;
+    EXPECT_NEAR(pose.v[1], matches[0].pose.v[1], 2 * map->scale) << "trial " << trial;
+    EXPECT_LT(angle_error(pose.v[2], matches[0].pose.v[2]), 0.05) << "trial " << trial;
+  }
+
+  map_free(map);
+}
+
+TEST(GlobalMatcher, SeparatedHypotheses)
+{
+  map_t* map = random_rooms(200, 200, 25, 3);
+  AMCLGlobalMatcher matcher;
+  matcher.SetMap(map, 0.1, 3, 1);
+  matcher.SetSeparation(1.0, 0.5);
+
+  srand(4);
+  pf_vector_t pose = random_free_pose(map);
+  std::vector<pf_vector_t> points = simulate_scan(map, pose, 180, 8.0);
+
+  std::vector<amcl_match_t> matches;
+  int found = matcher.Match(points, 6, 0.0, &matches);
+  ASSERT_EQ(6, found);
+  for(size_t i = 0; i < matches.size(); i++)
+    for(size_t j = i + 1; j < matches.size(); j++)
+    {
+      double d = hypot(matches[i].pose.v[0] - matches[j].pose.v[0],
+                       matches[i].pose.v[1] - matches[j].pose.v[1]);
+      double a = angle_error(matches[i].pose.v[2], matches[j].pose.v[2]);
+      EXPECT_TRUE(d >= 1.0 || a >= 0.5) << i << " and " << j;
+    }
+
+  // Nothing is good enough for an impossible score
+  EXPECT_EQ(0, matcher.Match(points, 6, 1.01, &matches));
+  EXPECT_TRUE(matches.empty());
+
+  // Nor with no points
+  EXPECT_EQ(0, matcher.Match(std::vector<pf_vector_t>(), 6, 0.0, &matches));
+
+  map_free(map);
+}
+
+TEST(GlobalMatcher, ThreadsAgree)
+{
+  map_t* map = random_rooms(240, 200, 30, 5);
+  AMCLGlobalMatcher serial, parallel;
+  serial.SetMap(map, 0.1, 4, 1);
+  parallel.SetMap(map, 0.1, 4, 4);
+
+  srand(6);
+  pf_vector_t pose = random_free_pose(map);
+  std::vector<pf_vector_t> points = simulate_scan(map, pose, 360, 8.0);
+
+  // The search is exact, so the best score does not depend on the order
+  // rotations finish in (the pose might, between equal scores)
+  std::vector<amcl_match_t> a, b;
+  ASSERT_GE(serial.Match(points, 1, 0.3, &a), 1);
+  ASSERT_GE(parallel.Match(points, 1, 0.3, &b), 1);
+  EXPECT_EQ(a[0].score, b[0].score);
+
+  map_free(map);
+}
+
+// A kidnapped robot: a scan from a random free pose, matched over the
+// whole map
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,116 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Checks the lock-free hand-off between the filter and publisher
+// threads
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <gtest/gtest.h>
+
+#include "amcl/sensors/amcl_handoff.h"
+
+#include "amcl_test_util.h"
+
+using namespace amcl;
+
+// A value that is torn if its fields disagree
+struct Stamped
+{
+  int seq;
+  int copies[63];
+};
+
+static void write_values(AMCLHandoff<Stamped>* handoff, int count)
+{
+  for(int seq = 1; seq <= count; seq++)
+  {
+    Stamped& value = handoff->GetBack();
+    value.seq = seq;
+    for(int i = 0; i < 63; i++)
+      value.copies[i] = seq;
+    handoff->Publish();
+  }
+}
+
+TEST(Handoff, Sequential)
+{
+  AMCLHandoff<int> handoff;
+  EXPECT_FALSE(handoff.Update());
+
+  handoff.GetBack() = 1;
+  handoff.Publish();
+  EXPECT_TRUE(handoff.Update());
+  EXPECT_EQ(1, handoff.GetFront());
+  EXPECT_FALSE(handoff.Update());
+  EXPECT_EQ(1, handoff.GetFront());
+
+  // Only the newest value is seen
+  for(int i = 2; i <= 5; i++)
+  {
+    handoff.GetBack() = i;
+    handoff.Publish();
+  }
+  EXPECT_TRUE(handoff.Update());
+  EXPECT_EQ(5, handoff.GetFront());
+  EXPECT_FALSE(handoff.Update());
+}
+
+TEST(Handoff, Concurrent)
+{
+  const int count = 200000;
+  AMCLHandoff<Stamped> handoff;
+  boost::thread writer(boost::bind(&write_values, &handoff, count));
+
+  // Values arrive whole and in order, and the last one always arrives
+  int last = 0, updates = 0, torn = 0;
+  double t0 = now();
+  while(last < count)
+  {
+    if(!handoff.Update())
+      continue;
+    const Stamped& value = handoff.GetFront();
+    EXPECT_GT(value.seq, last);
+    for(int i = 0; i < 63; i++)
+      if(value.copies[i] != value.seq)
+        torn++;
+    last = value.seq;
+    updates++;
+  }
+  double t1 = now();
+  writer.join();
+
+  EXPECT_EQ(0, torn);
+  EXPECT_EQ(count, last);
+  printf("%d values handed off in %.1f ms; the reader saw %d of them\n",
+         count, (t1 - t0) * 1e3, updates);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
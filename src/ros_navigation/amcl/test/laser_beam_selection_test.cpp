@@ -0,0 +1,280 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Checks the laser models' beam selection, and compares the
+// filter's accuracy in a corridor with selected and strided beams
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "amcl/map/map.h"
+#include "amcl/pf/pf.h"
+#include "amcl/sensors/amcl_laser.h"
+#include "amcl/sensors/amcl_odom.h"
+
+#include "amcl_test_util.h"
+
+using namespace amcl;
+
+// A 40 m corridor, 3 m wide, with a few door frames and pillars along it
+static map_t* corridor()
+{
+  map_t* map = map_alloc();
+  map->scale = 0.05;
+  map->origin_x = 20.0;
+  map->origin_y = 0.0;
+  map_alloc_cells(map, 820, 80);
+
+  fill(map, 0, 0, 819, 79, -1);
+  fill(map, 0, 0, 819, 9, +1);
+  fill(map, 0, 70, 819, 79, +1);
+  fill(map, 0, 0, 9, 79, +1);
+  fill(map, 810, 0, 819, 79, +1);
+
+  // Door frames: recesses in the walls; pillars: boxes by the walls
+  for(int x = 60; x < 800; x += 170)
+  {
+    fill(map, x, 6, x + 18, 9, -1);
+    fill(map, x + 70, 60, x + 75, 69, +1);
+  }
+  return map;
+}
+
+// A scan all the way around, from a laser at the robot's pose
+static void circle_scan(map_t* map, AMCLLaser* laser, pf_vector_t pose, int beams,
+                        double max_range, AMCLLaserData* data)
+{
+  data->sensor = laser;
+  data->range_count = beams;
+  data->range_max = max_range;
+  data->ranges = new double[beams][2];
+  for(int b = 0; b < beams; b++)
+  {
+    double bearing = -M_PI + b * 2 * M_PI / beams;
+    data->ranges[b][0] = map_calc_range(map, pose.v[0], pose.v[1], pose.v[2] + bearing,
+                                        max_range);
+    data->ranges[b][1] = bearing;
+  }
+}
+
+static pf_vector_t random_pose(void* data)
+{
+  return *(pf_vector_t*)data;
+}
+
+TEST(LaserBeamSelection, PicksValidBeams)
+{
+  map_t* map = corridor();
+  AMCLLaser laser(30, map);
+  laser.SetModelLikelihoodField(0.95, 0.05, 0.2, 2.0);
+  pf_vector_t origin = pf_vector_zero();
+  pf_vector_t pose = pf_vector_zero();
+  pose.v[0] = MAP_WXGX(map, 300);
+  pose.v[1] = MAP_WYGY(map, 40);
+  laser.SetLaserPose(origin);
+
+  pf_t* pf = pf_alloc(1, 1, 0.0, 0.0, random_pose, &pose);
+  pf_init_model(pf, random_pose, &pose);
+
+  // Short range, so some readings are max range
+  AMCLLaserData data;
+  circle_scan(map, &laser, pose, 720, 6.0, &data);
+
+  // Strided: every 24th reading, max range or not
+  laser.UpdateSensor(pf, &data);
+  std::vector<int> strided = laser.GetBeams();
+  ASSERT_EQ(30u, strided.size());
+  for(size_t k = 0; k < strided.size(); k++)
+    EXPECT_EQ((int)k * 24, strided[k]);
+
+  laser.SetBeamSelection(true);
+  laser.UpdateSensor(pf, &data);
+  std::vector<int> selected = laser.GetBeams();
+  EXPECT_EQ(30u, selected.size());
+  EXPECT_EQ(30, laser.GetBeamsUsed());
+  for(size_t k = 0; k < selected.size(); k++)
+  {
+    EXPECT_LT(data.ranges[selected[k]][0], data.range_max);
+    if(k > 0)
+    {
+      EXPECT_LT(selected[k-1], selected[k]);
+    }
+  }
+
+  // Fewer valid readings than beams: all of them
+  size_t valid = 0;
+  for(int i = 0; i < data.range_count; i++)
+  {
+    if(i % 40 != 0)
+      data.ranges[i][0] = data.range_max;
+    else if(data.ranges[i][0] < data.range_max)
+      valid++;
+  }
+  laser.UpdateSensor(pf, &data);
+  EXPECT_GT(valid, 0u);
+  EXPECT_EQ(valid, laser.GetBeams().size());
+
+  pf_free(pf);
+  map_free(map);
+}
+
+// In a corridor most readings hit the side walls, which say nothing about
+// the position along it; the selection should not let them crowd out
+// the door frames and pillars
+TEST(LaserBeamSelection, FavoursCrossSurfaces)
+{
+  map_t* map = corridor();
+  AMCLLaser laser(30, map);
+  laser.SetModelLikelihoodField(0.95, 0.05, 0.2, 2.0);
+  pf_vector_t origin = pf_vector_zero();
+  laser.SetLaserPose(origin);
+  pf_vector_t pose = pf_vector_zero();
+  pose.v[0] = MAP_WXGX(map, 400);
+  pose.v[1] = MAP_WYGY(map, 40);
+  pf_t* pf = pf_alloc(1, 1, 0.0, 0.0, random_pose, &pose);
+  pf_init_model(pf, random_pose, &pose);
+
+  AMCLLaserData data;
+  circle_scan(map, &laser, pose, 720, 12.0, &data);
+
+  // Readings that end on the side of a door frame or pillar (facing
+  // along the corridor) rather than on a wall running along it
+  std::vector<bool> cross(data.range_count, false);
+  for(int i = 0; i < data.range_count; i++)
+  {
+    double r = data.ranges[i][0];
+    if(r >= data.range_max)
+      continue;
+    double x = pose.v[0] + r * cos(data.ranges[i][1]);
+    double y = pose.v[1] + r * sin(data.ranges[i][1]);
+    int mi = MAP_GXWX(map, x), mj = MAP_GYWY(map, y);
+    bool left = MAP_VALID(map, mi - 1, mj) && map->occ_state[MAP_INDEX(map, mi - 1, mj)] == -1;
+    bool right = MAP_VALID(map, mi + 1, mj) && map->occ_state[MAP_INDEX(map, mi + 1, mj)] == -1;
+    cross[i] = left || right;
+  }
+
+  int counts[2];
+  for(int s = 0; s < 2; s++)
+  {
+    laser.SetBeamSelection(s == 1);
+    laser.UpdateSensor(pf, &data);
+    counts[s] = 0;
+    for(size_t k = 0; k < laser.GetBeams().size(); k++)
+      counts[s] += cross[laser.GetBeams()[k]] ? 1 : 0;
+  }
+  printf("Beams on cross surfaces: %d strided, %d selected (of 30)\n", counts[0], counts[1]);
+  EXPECT_GE(counts[1], 2 * counts[0]);
+  EXPECT_GE(counts[1], 6);
+
+  pf_free(pf);
+  map_free(map);
+}
+
+// Track a path down the corridor and back with strided and selected beams
+TEST(LaserBeamSelection, AccuracyVsBeams)
+{
+  map_t* map = corridor();
+  AMCLOdom odom;
+  odom.SetModel(ODOM_MODEL_DIFF, 0.2, 0.2, 0.2, 0.2);
+
+  std::vector<pf_vector_t> path;
+  for(int k = 0; k < 180; k++)
+  {
+    pf_vector_t p = pf_vector_zero();
+    int i = 40 + k * 4;
+    p.v[0] = MAP_WXGX(map, i);
+    p.v[1] = MAP_WYGY(map, 40 + (k % 20 < 10 ? k % 10 : 10 - k % 10) - 5);
+    p.v[2] = 0.1 * sin(k * 0.2);
+    path.push_back(p);
+  }
+
+  struct
+  {
+    int beams;
+    bool select;
+    double error;
+    double seconds;
+  } runs[] = {{60, false, 0, 0}, {30, false, 0, 0}, {30, true, 0, 0}};
+
+  for(int r = 0; r < 3; r++)
+  {
+    AMCLLaser laser(runs[r].beams, map);
+    laser.SetModelLikelihoodField(0.95, 0.05, 0.2, 2.0);
+    pf_vector_t origin = pf_vector_zero();
+    laser.SetLaserPose(origin);
+    laser.SetBeamSelection(runs[r].select);
+
+    double sum = 0.0;
+    int steps = 0;
+    for(int seed = 0; seed < 4; seed++)
+    {
+      pf_t* pf = pf_alloc(500, 500, 0.0, 0.0, NULL, NULL);
+      pf_set_seed(pf, 11 + seed);
+      pf_matrix_t cov = pf_matrix_zero();
+      cov.m[0][0] = cov.m[1][1] = 0.1 * 0.1;
+      cov.m[2][2] = 0.05 * 0.05;
+      pf_init(pf, path[0], cov);
+
+      for(size_t k = 1; k < path.size(); k++)
+      {
+        AMCLOdomData odata;
+        odata.sensor = &odom;
+        odata.pose = path[k];
+        odata.delta = pf_vector_sub(path[k], path[k-1]);
+        odom.UpdateAction(pf, &odata);
+
+        AMCLLaserData ldata;
+        circle_scan(map, &laser, path[k], 720, 12.0, &ldata);
+        double t0 = now();
+        laser.UpdateSensor(pf, &ldata);
+        runs[r].seconds += now() - t0;
+        pf_update_resample(pf);
+
+        pf_sample_set_t* set = pf->sets + pf->current_set;
+        sum += hypot(set->mean.v[0] - path[k].v[0], set->mean.v[1] - path[k].v[1]);
+        steps++;
+      }
+      pf_free(pf);
+    }
+    runs[r].error = sum / steps;
+    printf("%2d beams, %s: mean error %.4f m, sensor update %.3f ms\n", runs[r].beams,
+           runs[r].select ? "selected" : "strided ", runs[r].error,
+           runs[r].seconds * 1e3 / steps);
+  }
+
+  // Half the beams, selected, do about as well as all of them strided
+  EXPECT_LT(runs[2].error, 1.2 * runs[0].error);
+  EXPECT_LT(runs[2].error, runs[1].error);
+
+  map_free(map);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
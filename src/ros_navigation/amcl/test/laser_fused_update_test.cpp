@@ -0,0 +1,266 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Checks the fused update of several lasers against updating with
+// their scans one after the other
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "amcl/map/map.h"
+#include "amcl/pf/pf.h"
+#include "amcl/sensors/amcl_laser.h"
+
+#include "amcl_test_util.h"
+
+using namespace amcl;
+
+// A 20 x 15 m room with a few boxes in it
+static map_t* room()
+{
+  map_t* map = map_alloc();
+  map->scale = 0.05;
+  map->origin_x = 0.0;
+  map->origin_y = 0.0;
+  map_alloc_cells(map, 400, 300);
+
+  fill(map, 0, 0, 399, 299, -1);
+  fill(map, 0, 0, 399, 4, +1);
+  fill(map, 0, 295, 399, 299, +1);
+  fill(map, 0, 0, 4, 299, +1);
+  fill(map, 395, 0, 399, 299, +1);
+  fill(map, 80, 60, 110, 90, +1);
+  fill(map, 250, 180, 300, 200, +1);
+  fill(map, 200, 40, 205, 120, +1);
+  return map;
+}
+
+// Front, rear and side lasers
+static void mount(AMCLLaser* lasers[3])
+{
+  const double poses[3][3] = {{0.3, 0.0, 0.0}, {-0.3, 0.0, M_PI}, {0.0, 0.2, M_PI / 2}};
+  for(int l = 0; l < 3; l++)
+  {
+    pf_vector_t p = pf_vector_zero();
+    p.v[0] = poses[l][0];
+    p.v[1] = poses[l][1];
+    p.v[2] = poses[l][2];
+    lasers[l]->SetLaserPose(p);
+  }
+}
+
+static pf_t* spread(int count, pf_vector_t mean)
+{
+  pf_t* pf = pf_alloc(count, count, 0.001, 0.1, NULL, NULL);
+  pf_set_seed(pf, 5);
+  pf_matrix_t cov = pf_matrix_zero();
+  cov.m[0][0] = cov.m[1][1] = 0.5 * 0.5;
+  cov.m[2][2] = 0.3 * 0.3;
+  pf_init(pf, mean, cov);
+  return pf;
+}
+
+enum {MODEL_BEAM, MODEL_FIELD, MODEL_FIELD_SIMD, MODEL_FIELD_PROB, MODEL_BEAMSKIP};
+
+static void set_model(AMCLLaser* laser, int model)
+{
+  if(model == MODEL_BEAM)
+    laser->SetModelBeam(0.95, 0.1, 0.05, 0.05, 0.2, 0.1, 0.0);
+  else if(model == MODEL_FIELD_PROB || model == MODEL_BEAMSKIP)
+    laser->SetModelLikelihoodFieldProb(0.95, 0.05, 0.2, 2.0, model == MODEL_BEAMSKIP,
+                                       0.5, 0.3, 0.9);
+  else
+  {
+    laser->SetSimdKernel(model == MODEL_FIELD_SIMD);
+    laser->SetModelLikelihoodField(0.95, 0.05, 0.2, 2.0);
+  }
+}
+
+// The fused weights are the normalized product of the scans' weights,
+// whatever the model and thread count
+static void check_matches_sequential(int model, int threads)
+{
+  map_t* map = room();
+  pf_vector_t truth = pf_vector_zero();
+  truth.v[0] = 1.0;
+  truth.v[1] = -2.0;
+  truth.v[2] = 0.4;
+
+  AMCLLaser front(30, map), rear(30, map), side(30, map);
+  AMCLLaser* lasers[3] = {&front, &rear, &side};
+  mount(lasers);
+  for(int l = 0; l < 3; l++)
+  {
+    set_model(lasers[l], model);
+    lasers[l]->SetSensorThreads(threads);
+  }
+
+  AMCLLaserData data[3];
+  for(int l = 0; l < 3; l++)
+    scan_data(map, lasers[l], truth, 181, 8.0, &data[l]);
+
+  pf_t* sequential = spread(2000, truth);
+  pf_t* fused = spread(2000, truth);
+  if(model == MODEL_BEAMSKIP)
+  {
+    sequential->sets[sequential->current_set].converged = 1;
+    fused->sets[fused->current_set].converged = 1;
+  }
+
+  for(int l = 0; l < 3; l++)
+    EXPECT_TRUE(lasers[l]->UpdateSensor(sequential, &data[l]));
+  std::vector<int> beams_used;
+  for(int l = 0; l < 3; l++)
+    beams_used.push_back(lasers[l]->GetBeamsUsed());
+
+  std::vector<AMCLLaserData*> scans;
+  for(int l = 0; l < 3; l++)
+    scans.push_back(&data[l]);
+  EXPECT_TRUE(AMCLLaser::UpdateSensors(fused, scans));
+
+  pf_sample_set_t* a = sequential->sets + sequential->current_set;
+  pf_sample_set_t* b = fused->sets + fused->current_set;
+  ASSERT_EQ(a->sample_count, b->sample_count);
+  double max_weight = 0.0;
+  for(int i = 0; i < a->sample_count; i++)
+  {
+    EXPECT_DOUBLE_EQ(a->samples[i].pose.v[0], b->samples[i].pose.v[0]);
+    EXPECT_NEAR(a->samples[i].weight, b->samples[i].weight, 1e-9 * a->samples[i].weight + 1e-300);
+    max_weight = std::max(max_weight, b->samples[i].weight);
+  }
+  // The scans single out a few particles
+  EXPECT_GT(max_weight, 10.0 / a->sample_count);
+  for(int l = 0; l < 3; l++)
+    EXPECT_EQ(beams_used[l], lasers[l]->GetBeamsUsed());
+
+  pf_free(sequential);
+  pf_free(fused);
+  map_free(map);
+}
+
+TEST(LaserFusedUpdate, BeamModel)
+{
+  check_matches_sequential(MODEL_BEAM, 1);
+}
+
+TEST(LaserFusedUpdate, LikelihoodField)
+{
+  check_matches_sequential(MODEL_FIELD, 1);
+  check_matches_sequential(MODEL_FIELD, 3);
+}
+
+TEST(LaserFusedUpdate, LikelihoodFieldKernel)
+{
+  check_matches_sequential(MODEL_FIELD_SIMD, 1);
+  check_matches_sequential(MODEL_FIELD_SIMD, 3);
+}
+
+TEST(LaserFusedUpdate, LikelihoodFieldProb)
+{
+  check_matches_sequential(MODEL_FIELD_PROB, 3);
+}
+
+TEST(LaserFusedUpdate, BeamSkip)
+{
+  check_matches_sequential(MODEL_BEAMSKIP, 1);
+}
+
+// The recovery averages see each scan as they would updating with the
+// scans one by one, so recovery behaves the same with fusion on
+static void check_recovery_averages(int model)
+{
+  map_t* map = room();
+  AMCLLaser front(30, map), rear(30, map), side(30, map);
+  AMCLLaser* lasers[3] = {&front, &rear, &side};
+  mount(lasers);
+  for(int l = 0; l < 3; l++)
+    set_model(lasers[l], model);
+
+  // Start a little off, and drive on: the averages move a lot at first
+  pf_vector_t truth = pf_vector_zero();
+  truth.v[0] = 1.0;
+  truth.v[1] = -2.0;
+  pf_vector_t start = truth;
+  start.v[0] += 0.3;
+  pf_t* sequential = spread(1000, start);
+  pf_t* fused = spread(1000, start);
+
+  for(int k = 0; k < 10; k++)
+  {
+    AMCLLaserData data[3];
+    std::vector<AMCLLaserData*> scans;
+    for(int l = 0; l < 3; l++)
+    {
+      scan_data(map, lasers[l], truth, 181, 8.0, &data[l]);
+      scans.push_back(&data[l]);
+    }
+    for(int l = 0; l < 3; l++)
+      lasers[l]->UpdateSensor(sequential, &data[l]);
+    EXPECT_TRUE(AMCLLaser::UpdateSensors(fused, scans));
+
+    EXPECT_GT(fused->w_slow, 0.0);
+    EXPECT_NEAR(sequential->w_slow, fused->w_slow, 1e-9 * sequential->w_slow) << "step " << k;
+    EXPECT_NEAR(sequential->w_fast, fused->w_fast, 1e-9 * sequential->w_fast) << "step " << k;
+
+    pf_update_resample(sequential);
+    pf_update_resample(fused);
+    truth.v[0] += 0.05;
+  }
+
+  pf_free(sequential);
+  pf_free(fused);
+  map_free(map);
+}
+
+TEST(LaserFusedUpdate, RecoveryAverages)
+{
+  check_recovery_averages(MODEL_FIELD);
+  check_recovery_averages(MODEL_BEAM);
+  check_recovery_averages(MODEL_FIELD_PROB);
+}
+
+TEST(LaserFusedUpdate, NothingToScore)
+{
+  map_t* map = room();
+  pf_vector_t truth = pf_vector_zero();
+  AMCLLaser blind(1, map);
+  set_model(&blind, MODEL_FIELD);
+  AMCLLaserData none;
+  scan_data(map, &blind, truth, 181, 8.0, &none);
+  std::vector<AMCLLaserData*> blind_scans(1, &none);
+  pf_t* pf = spread(500, truth);
+  EXPECT_FALSE(AMCLLaser::UpdateSensors(pf, blind_scans));
+  EXPECT_EQ(0.0, pf->w_slow);
+  pf_free(pf);
+
+  map_free(map);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
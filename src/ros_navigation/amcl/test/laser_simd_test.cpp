@@ -0,0 +1,259 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Checks each code path of the likelihood field kernel against the
+// scalar likelihood field model
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "amcl/map/map.h"
+#include "amcl/pf/pf.h"
+#include "amcl/sensors/amcl_laser.h"
+#include "amcl/sensors/amcl_laser_simd.h"
+
+#include "amcl_test_util.h"
+
+using namespace amcl;
+
+static const double Z_HIT = 0.95, Z_RAND = 0.05, SIGMA_HIT = 0.2, MAX_OCC_DIST = 1.0;
+static const double RANGE_MAX = 10.0;
+
+// An 8 x 6 m room away from the origin, with a pillar and a wall stub;
+// most of it lies further than MAX_OCC_DIST from any obstacle
+static map_t* room()
+{
+  map_t* map = map_alloc();
+  map->scale = 0.05;
+  map->origin_x = 3.2;
+  map->origin_y = -1.7;
+  map_alloc_cells(map, 160, 120);
+
+  fill(map, 0, 0, 159, 119, -1);
+  fill(map, 0, 0, 159, 1, +1);
+  fill(map, 0, 118, 159, 119, +1);
+  fill(map, 0, 0, 1, 119, +1);
+  fill(map, 158, 0, 159, 119, +1);
+  fill(map, 40, 30, 45, 35, +1);
+  fill(map, 100, 60, 101, 119, +1);
+  return map;
+}
+
+static double uniform(double lo, double hi)
+{
+  return lo + (hi - lo) * drand48();
+}
+
+// Random poses over the map, near its edges and off it, so that the
+// endpoints land on obstacles, in open space and past the border
+static void random_poses(map_t* map, pf_sample_set_t* set)
+{
+  double x0 = MAP_WXGX(map, 0), x1 = MAP_WXGX(map, map->size_x - 1);
+  double y0 = MAP_WYGY(map, 0), y1 = MAP_WYGY(map, map->size_y - 1);
+  for(int j = 0; j < set->sample_count; j++)
+  {
+    pf_vector_t pose = pf_vector_zero();
+    if(j % 3 == 0)
+    {
+      pose.v[0] = uniform(x0, x1);
+      pose.v[1] = uniform(y0, y1);
+    }
+    else if(j % 3 == 1)
+    {
+      pose.v[0] = j % 2 ? uniform(x0 - 0.5, x0 + 0.5) : uniform(x1 - 0.5, x1 + 0.5);
+      pose.v[1] = uniform(y0 - 0.5, y1 + 0.5);
+    }
+    else
+    {
+      pose.v[0] = uniform(x0 - 0.5, x1 + 0.5);
+      pose.v[1] = j % 2 ? uniform(y0 - 0.5, y0 + 0.5) : uniform(y1 - 0.5, y1 + 0.5);
+    }
+    pose.v[2] = uniform(-M_PI, M_PI);
+    set->samples[j].pose = pose;
+    set->samples[j].weight = 1.0;
+  }
+}
+
+// Random ranges, with a few max range readings and a NaN for the model to
+// leave out
+static void random_scan(AMCLLaser* laser, int beams, AMCLLaserData* data)
+{
+  data->sensor = laser;
+  data->range_count = beams;
+  data->range_max = RANGE_MAX;
+  data->ranges = new double[beams][2];
+  for(int b = 0; b < beams; b++)
+  {
+    data->ranges[b][0] = b % 7 == 3 ? RANGE_MAX : uniform(0.0, RANGE_MAX);
+    data->ranges[b][1] = -M_PI + b * 2 * M_PI / beams;
+  }
+  data->ranges[beams / 2][0] = NAN;
+}
+
+typedef bool (*kernel_fn_t) (const laser_lf_map_t*, const laser_lf_beams_t*,
+                             laser_lf_poses_t*);
+
+static bool scalar_kernel(const laser_lf_map_t* map, const laser_lf_beams_t* beams,
+                          laser_lf_poses_t* poses)
+{
+  laser_lf_kernel_scalar(map, beams, poses);
+  return true;
+}
+
+// Score the poses with one code path of the kernel and with the scalar
+// model, and compare the normalized weights
+static void check_kernel(kernel_fn_t kernel, const char* name, int pose_count)
+{
+  srand48(17 + pose_count);
+  map_t* map = room();
+  AMCLLaser laser(61, map);
+  pf_vector_t mount = pf_vector_zero();
+  mount.v[0] = 0.25;
+  mount.v[1] = -0.1;
+  mount.v[2] = 0.3;
+  laser.SetLaserPose(mount);
+  laser.SetSimdKernel(false);
+  laser.SetModelLikelihoodField(Z_HIT, Z_RAND, SIGMA_HIT, MAX_OCC_DIST);
+
+  pf_t* pf = pf_alloc(pose_count, pose_count, 0.001, 0.1, NULL, NULL);
+  pf_init(pf, pf_vector_zero(), pf_matrix_zero());
+  pf_sample_set_t* set = pf->sets + pf->current_set;
+  ASSERT_EQ(pose_count, set->sample_count);
+  random_poses(map, set);
+
+  // The kernel's inputs, laid out as AMCLLaser lays them out
+  std::vector<float> table(MAP_DIST_MAX + 1);
+  for(int i = 0; i <= MAP_DIST_MAX; i++)
+  {
+    double z = i * map->occ_dist_step;
+    table[i] = Z_HIT * exp(-(z * z) / (2 * SIGMA_HIT * SIGMA_HIT));
+  }
+  laser_lf_map_t lf_map;
+  lf_map.size_x = map->size_x;
+  lf_map.size_y = map->size_y;
+  lf_map.origin_x = map->origin_x;
+  lf_map.origin_y = map->origin_y;
+  lf_map.scale = map->scale;
+  lf_map.dist = map->occ_dist;
+  lf_map.table = &table[0];
+  lf_map.z_rand_term = Z_RAND / RANGE_MAX;
+
+  AMCLLaserData data;
+  random_scan(&laser, 61, &data);
+  std::vector<double> beam_x, beam_y;
+  for(int b = 0; b < data.range_count; b++)
+  {
+    double range = data.ranges[b][0];
+    if(range >= RANGE_MAX || range != range)
+      continue;
+    beam_x.push_back(range * cos(data.ranges[b][1]));
+    beam_y.push_back(range * sin(data.ranges[b][1]));
+  }
+  laser_lf_beams_t beams;
+  beams.count = beam_x.size();
+  beams.x = &beam_x[0];
+  beams.y = &beam_y[0];
+
+  std::vector<double> x(pose_count), y(pose_count), c(pose_count), s(pose_count);
+  std::vector<double> p(pose_count, -1.0);
+  for(int j = 0; j < pose_count; j++)
+  {
+    pf_vector_t at = pf_vector_coord_add(mount, set->samples[j].pose);
+    x[j] = at.v[0];
+    y[j] = at.v[1];
+    c[j] = cos(at.v[2]);
+    s[j] = sin(at.v[2]);
+  }
+  laser_lf_poses_t poses;
+  poses.count = pose_count;
+  poses.x = &x[0];
+  poses.y = &y[0];
+  poses.cos_a = &c[0];
+  poses.sin_a = &s[0];
+  poses.p = &p[0];
+
+  if(!(*kernel)(&lf_map, &beams, &poses))
+  {
+    printf("%s is not supported on this CPU\n", name);
+    pf_free(pf);
+    map_free(map);
+    return;
+  }
+
+  ASSERT_TRUE(laser.UpdateSensor(pf, &data));
+  ASSERT_EQ((int) data.range_count, laser.GetBeamsUsed());
+
+  double total = 0.0;
+  for(int j = 0; j < pose_count; j++)
+    total += p[j];
+  double lowest = 1e300, highest = 0.0;
+  for(int j = 0; j < pose_count; j++)
+  {
+    // The table holds floats; every beam adds its rounding error
+    double weight = set->samples[j].weight;
+    EXPECT_NEAR(weight, p[j] / total, 1e-5 * weight) << name << ", pose " << j;
+    lowest = std::min(lowest, p[j]);
+    highest = std::max(highest, p[j]);
+  }
+  // The poses should span poorly and well matching endpoints
+  if(pose_count > 1)
+  {
+    EXPECT_LT(lowest, highest / 2) << name;
+  }
+
+  pf_free(pf);
+  map_free(map);
+}
+
+// Pose counts that leave 0 to 3 poses for the scalar tail of the vector
+// loops
+static const int POSE_COUNTS[] = {300, 301, 302, 303, 1};
+
+TEST(LaserSimd, Scalar)
+{
+  for(int k = 0; k < 5; k++)
+    check_kernel(scalar_kernel, "scalar", POSE_COUNTS[k]);
+}
+
+TEST(LaserSimd, Sse41)
+{
+  for(int k = 0; k < 5; k++)
+    check_kernel(laser_lf_kernel_sse41, "sse4.1", POSE_COUNTS[k]);
+}
+
+TEST(LaserSimd, Avx2)
+{
+  for(int k = 0; k < 5; k++)
+    check_kernel(laser_lf_kernel_avx2, "avx2", POSE_COUNTS[k]);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,297 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Checks that the laser models scored on one thread leave the
+// filter exactly as the serial models did, and on several threads within
+// rounding of it
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "amcl/map/map.h"
+#include "amcl/pf/pf.h"
+#include "amcl/sensors/amcl_laser.h"
+
+#include "amcl_test_util.h"
+
+using namespace amcl;
+
+static const int MAX_BEAMS = 30;
+static const double Z_HIT = 0.95, Z_SHORT = 0.1, Z_MAX = 0.05, Z_RAND = 0.05;
+static const double SIGMA_HIT = 0.2, LAMBDA_SHORT = 0.1, MAX_OCC_DIST = 2.0;
+
+// A 15 x 10 m room with two pillars
+static map_t* room()
+{
+  map_t* map = map_alloc();
+  map->scale = 0.05;
+  map->origin_x = 0.0;
+  map->origin_y = 0.0;
+  map_alloc_cells(map, 300, 200);
+
+  fill(map, 0, 0, 299, 199, -1);
+  fill(map, 0, 0, 299, 3, +1);
+  fill(map, 0, 196, 299, 199, +1);
+  fill(map, 0, 0, 3, 199, +1);
+  fill(map, 296, 0, 299, 199, +1);
+  fill(map, 60, 50, 80, 70, +1);
+  fill(map, 200, 120, 240, 130, +1);
+  return map;
+}
+
+// The serial models as they were before the particles were split into
+// chunks, with the parameters above
+static map_t* g_map;
+
+static double serial_beam_model(AMCLLaserData* data, pf_sample_set_t* set)
+{
+  AMCLLaser* self = (AMCLLaser*) data->sensor;
+  double total_weight = 0.0;
+  for(int j = 0; j < set->sample_count; j++)
+  {
+    pf_sample_t* sample = set->samples + j;
+    pf_vector_t pose = pf_vector_coord_add(self->GetLaserPose(), sample->pose);
+    double p = 1.0;
+    int step = (data->range_count - 1) / (MAX_BEAMS - 1);
+    for(int i = 0; i < data->range_count; i += step)
+    {
+      double obs_range = data->ranges[i][0];
+      double obs_bearing = data->ranges[i][1];
+      double map_range = map_calc_range(g_map, pose.v[0], pose.v[1],
+                                        pose.v[2] + obs_bearing, data->range_max);
+      double pz = 0.0;
+      double z = obs_range - map_range;
+      pz += Z_HIT * exp(-(z * z) / (2 * SIGMA_HIT * SIGMA_HIT));
+      if(z < 0)
+        pz += Z_SHORT * LAMBDA_SHORT * exp(-LAMBDA_SHORT*obs_range);
+      if(obs_range == data->range_max)
+        pz += Z_MAX * 1.0;
+      if(obs_range < data->range_max)
+        pz += Z_RAND * 1.0/data->range_max;
+      p += pz*pz*pz;
+    }
+    sample->weight *= p;
+    total_weight += sample->weight;
+  }
+  return total_weight;
+}
+
+static double serial_field_model(AMCLLaserData* data, pf_sample_set_t* set)
+{
+  AMCLLaser* self = (AMCLLaser*) data->sensor;
+  double total_weight = 0.0;
+  for(int j = 0; j < set->sample_count; j++)
+  {
+    pf_sample_t* sample = set->samples + j;
+    pf_vector_t pose = pf_vector_coord_add(self->GetLaserPose(), sample->pose);
+    double p = 1.0;
+    double z_hit_denom = 2 * SIGMA_HIT * SIGMA_HIT;
+    double z_rand_mult = 1.0/data->range_max;
+    int step = (data->range_count - 1) / (MAX_BEAMS - 1);
+    for(int i = 0; i < data->range_count; i += step)
+    {
+      double obs_range = data->ranges[i][0];
+      double obs_bearing = data->ranges[i][1];
+      if(obs_range >= data->range_max || obs_range != obs_range)
+        continue;
+      double x = pose.v[0] + obs_range * cos(pose.v[2] + obs_bearing);
+      double y = pose.v[1] + obs_range * sin(pose.v[2] + obs_bearing);
+      int mi = MAP_GXWX(g_map, x);
+      int mj = MAP_GYWY(g_map, y);
+      double z;
+      if(!MAP_VALID(g_map, mi, mj))
+        z = g_map->max_occ_dist;
+      else
+        z = MAP_OCC_DIST(g_map, MAP_INDEX(g_map, mi, mj));
+      double pz = 0.0;
+      pz += Z_HIT * exp(-(z * z) / z_hit_denom);
+      pz += Z_RAND * z_rand_mult;
+      p += pz*pz*pz;
+    }
+    sample->weight *= p;
+    total_weight += sample->weight;
+  }
+  return total_weight;
+}
+
+static double serial_field_prob_model(AMCLLaserData* data, pf_sample_set_t* set)
+{
+  AMCLLaser* self = (AMCLLaser*) data->sensor;
+  double total_weight = 0.0;
+  int step = ceil(data->range_count / static_cast<double>(MAX_BEAMS));
+  double z_hit_denom = 2 * SIGMA_HIT * SIGMA_HIT;
+  double z_rand_mult = 1.0/data->range_max;
+  double max_dist_prob = exp(-(g_map->max_occ_dist * g_map->max_occ_dist) / z_hit_denom);
+  for(int j = 0; j < set->sample_count; j++)
+  {
+    pf_sample_t* sample = set->samples + j;
+    pf_vector_t pose = pf_vector_coord_add(self->GetLaserPose(), sample->pose);
+    double log_p = 0;
+    for(int i = 0; i < data->range_count; i += step)
+    {
+      double obs_range = data->ranges[i][0];
+      double obs_bearing = data->ranges[i][1];
+      if(obs_range >= data->range_max || obs_range != obs_range)
+        continue;
+      double x = pose.v[0] + obs_range * cos(pose.v[2] + obs_bearing);
+      double y = pose.v[1] + obs_range * sin(pose.v[2] + obs_bearing);
+      int mi = MAP_GXWX(g_map, x);
+      int mj = MAP_GYWY(g_map, y);
+      double pz = 0.0;
+      if(!MAP_VALID(g_map, mi, mj))
+        pz += Z_HIT * max_dist_prob;
+      else
+      {
+        double z = MAP_OCC_DIST(g_map, MAP_INDEX(g_map, mi, mj));
+        pz += Z_HIT * exp(-(z * z) / z_hit_denom);
+      }
+      pz += Z_RAND * z_rand_mult;
+      log_p += log(pz);
+    }
+    sample->weight *= exp(log_p);
+    total_weight += sample->weight;
+  }
+  return total_weight;
+}
+
+enum {MODEL_BEAM, MODEL_FIELD, MODEL_FIELD_PROB};
+
+static pf_t* spread(pf_vector_t mean)
+{
+  pf_t* pf = pf_alloc(500, 3000, 0.001, 0.1, NULL, NULL);
+  pf_set_seed(pf, 11);
+  pf_matrix_t cov = pf_matrix_zero();
+  cov.m[0][0] = cov.m[1][1] = 0.4 * 0.4;
+  cov.m[2][2] = 0.3 * 0.3;
+  pf_init(pf, mean, cov);
+  return pf;
+}
+
+// Score and resample the same scans with the serial model and with the
+// laser on the given number of threads; with exact set, the two filters
+// must agree bit for bit
+static void check_against_serial(int model, int threads, bool exact)
+{
+  g_map = room();
+  AMCLLaser laser(MAX_BEAMS, g_map);
+  pf_vector_t laser_pose = pf_vector_zero();
+  laser_pose.v[0] = 0.2;
+  laser.SetLaserPose(laser_pose);
+  pf_sensor_model_fn_t serial;
+  if(model == MODEL_BEAM)
+  {
+    laser.SetModelBeam(Z_HIT, Z_SHORT, Z_MAX, Z_RAND, SIGMA_HIT, LAMBDA_SHORT, 0.0);
+    serial = (pf_sensor_model_fn_t) serial_beam_model;
+  }
+  else if(model == MODEL_FIELD)
+  {
+    laser.SetModelLikelihoodField(Z_HIT, Z_RAND, SIGMA_HIT, MAX_OCC_DIST);
+    serial = (pf_sensor_model_fn_t) serial_field_model;
+  }
+  else
+  {
+    laser.SetModelLikelihoodFieldProb(Z_HIT, Z_RAND, SIGMA_HIT, MAX_OCC_DIST,
+                                      false, 0.5, 0.3, 0.9);
+    serial = (pf_sensor_model_fn_t) serial_field_prob_model;
+  }
+  laser.SetSensorThreads(threads);
+
+  pf_vector_t truth = pf_vector_zero();
+  truth.v[0] = 2.0;
+  truth.v[1] = -1.0;
+  truth.v[2] = 0.3;
+  pf_t* a = spread(truth);
+  pf_t* b = spread(truth);
+
+  for(int k = 0; k < 4; k++)
+  {
+    AMCLLaserData data;
+    scan_data(g_map, &laser, truth, 181, 8.0, &data);
+    pf_update_sensor(a, serial, &data);
+    EXPECT_TRUE(laser.UpdateSensor(b, &data));
+
+    pf_sample_set_t* sa = a->sets + a->current_set;
+    pf_sample_set_t* sb = b->sets + b->current_set;
+    ASSERT_EQ(sa->sample_count, sb->sample_count);
+    for(int i = 0; i < sa->sample_count; i++)
+    {
+      if(exact)
+        ASSERT_EQ(sa->samples[i].weight, sb->samples[i].weight) << "sample " << i;
+      else
+        ASSERT_NEAR(sa->samples[i].weight, sb->samples[i].weight,
+                    1e-12 * sa->samples[i].weight);
+    }
+    if(exact)
+    {
+      EXPECT_EQ(a->w_slow, b->w_slow);
+      EXPECT_EQ(a->w_fast, b->w_fast);
+    }
+
+    pf_update_resample(a);
+    pf_update_resample(b);
+    sa = a->sets + a->current_set;
+    sb = b->sets + b->current_set;
+    ASSERT_EQ(sa->sample_count, sb->sample_count);
+    if(!exact)
+      break;
+    for(int i = 0; i < sa->sample_count; i++)
+      for(int d = 0; d < 3; d++)
+        ASSERT_EQ(sa->samples[i].pose.v[d], sb->samples[i].pose.v[d]) << "sample " << i;
+    truth.v[0] += 0.1;
+  }
+
+  pf_free(a);
+  pf_free(b);
+  map_free(g_map);
+}
+
+TEST(LaserThreads, BeamModelOneThreadIsSerial)
+{
+  check_against_serial(MODEL_BEAM, 1, true);
+}
+
+TEST(LaserThreads, LikelihoodFieldOneThreadIsSerial)
+{
+  check_against_serial(MODEL_FIELD, 1, true);
+}
+
+TEST(LaserThreads, LikelihoodFieldProbOneThreadIsSerial)
+{
+  check_against_serial(MODEL_FIELD_PROB, 1, true);
+}
+
+// On several threads only the order of the weight sum changes
+TEST(LaserThreads, SeveralThreads)
+{
+  check_against_serial(MODEL_BEAM, 4, false);
+  check_against_serial(MODEL_FIELD, 4, false);
+  check_against_serial(MODEL_FIELD_PROB, 3, false);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,135 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Checks the latency histograms and stage timers
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "amcl/sensors/amcl_latency.h"
+
+using namespace amcl;
+
+TEST(Latency, Percentiles)
+{
+  AMCLLatencyHistogram h;
+  EXPECT_EQ(0.0, h.GetPercentile(0.5));
+
+  // 1 ms to 1000 ms in 1 ms steps
+  for(int i = 1; i <= 1000; i++)
+    h.Add(i * 1e-3);
+  EXPECT_EQ(1000u, h.GetCount());
+  EXPECT_NEAR(0.5005, h.GetMean(), 1e-9);
+  EXPECT_EQ(1.0, h.GetMax());
+
+  // Within a bucket (2^(1/8), about 9%) above the exact value
+  const double p[] = {0.01, 0.5, 0.95, 0.99};
+  for(size_t i = 0; i < sizeof(p) / sizeof(p[0]); i++)
+  {
+    double exact = p[i];
+    EXPECT_GE(h.GetPercentile(p[i]), exact);
+    EXPECT_LE(h.GetPercentile(p[i]), exact * 1.0905);
+  }
+  EXPECT_EQ(1.0, h.GetPercentile(1.0));
+
+  // Tiny, huge and negative durations land in the end buckets
+  h.Clear();
+  h.Add(1e-8);
+  h.Add(-1.0);
+  EXPECT_LE(h.GetPercentile(1.0), 1e-6);
+  h.Add(1e3);
+  EXPECT_EQ(1e3, h.GetPercentile(1.0));
+  EXPECT_EQ(3u, h.GetCount());
+}
+
+TEST(Latency, WindowAndTotal)
+{
+  AMCLLatency latency;
+  int a = latency.AddStage("a");
+  int b = latency.AddStage("b");
+  EXPECT_EQ(0, a);
+  EXPECT_EQ(1, b);
+  EXPECT_EQ("b", latency.GetStageName(b));
+
+  latency.Record(a, 0.002);
+  latency.Record(a, 0.004);
+  latency.Record(b, 0.010);
+  latency.ClearWindow();
+  latency.Record(a, 0.001);
+
+  EXPECT_EQ(1u, latency.GetWindow(a).GetCount());
+  EXPECT_EQ(0u, latency.GetWindow(b).GetCount());
+  EXPECT_EQ(3u, latency.GetTotal(a).GetCount());
+  EXPECT_EQ(0.004, latency.GetTotal(a).GetMax());
+  EXPECT_EQ(1u, latency.GetTotal(b).GetCount());
+
+  std::string table = latency.Format(true);
+  EXPECT_NE(std::string::npos, table.find("p99"));
+  EXPECT_NE(std::string::npos, table.find("\nb "));
+}
+
+TEST(Latency, Timer)
+{
+  AMCLLatency latency;
+  int first = latency.AddStage("first");
+  int second = latency.AddStage("second");
+  int total = latency.AddStage("total");
+
+  {
+    AMCLLatencyTimer timer(&latency, total);
+    usleep(2000);
+    double t = timer.Lap(first);
+    EXPECT_GE(t, 0.002);
+    timer.Lap(second);
+  }
+
+  EXPECT_EQ(1u, latency.GetTotal(first).GetCount());
+  EXPECT_EQ(1u, latency.GetTotal(second).GetCount());
+  EXPECT_EQ(1u, latency.GetTotal(total).GetCount());
+  EXPECT_GE(latency.GetTotal(first).GetMax(), 0.002);
+  EXPECT_GE(latency.GetTotal(total).GetMax(),
+            latency.GetTotal(first).GetMax() + latency.GetTotal(second).GetMax());
+
+  // A negative stage records nothing on destruction
+  {
+    AMCLLatencyTimer timer(&latency, -1);
+  }
+  EXPECT_EQ(1u, latency.GetTotal(total).GetCount());
+
+  // Overhead of a lap
+  AMCLLatencyTimer timer(&latency, -1);
+  double t0 = AMCLLatency::Now();
+  for(int i = 0; i < 100000; i++)
+    timer.Lap(second);
+  double t1 = AMCLLatency::Now();
+  printf("%.1f ns per lap\n", (t1 - t0) * 1e9 / 100000);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
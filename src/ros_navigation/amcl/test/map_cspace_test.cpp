@@ -0,0 +1,304 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Compares the distance transforms behind the likelihood field, and
+// their window updates, and checks the on-disk cache for them
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "amcl/map/map.h"
+
+#include "amcl_test_util.h"
+
+// Map with obstacles scattered at the given density, plus a few walls
+static map_t* random_map(int size_x, int size_y, double density, unsigned int seed)
+{
+  map_t* map = map_alloc();
+  map->scale = 0.05;
+  map_alloc_cells(map, size_x, size_y);
+
+  srand(seed);
+  for(int i = 0; i < size_x * size_y; i++)
+  {
+    double r = rand() / (double)RAND_MAX;
+    map->occ_state[i] = (r < density) ? +1 : ((r < 2 * density) ? 0 : -1);
+  }
+  for(int i = 0; i < size_x; i++)
+    map->occ_state[MAP_INDEX(map, i, size_y / 3)] = +1;
+  for(int j = 0; j < size_y / 2; j++)
+    map->occ_state[MAP_INDEX(map, size_x / 2, j)] = +1;
+
+  return map;
+}
+
+// Brute-force reference, with the same truncation as the transforms
+static std::vector<uint8_t> brute_force(map_t* map, double max_occ_dist)
+{
+  int radius = (int)(max_occ_dist / map->scale);
+  std::vector<uint8_t> codes(map->size_x * map->size_y, MAP_DIST_MAX);
+
+  map_t ref = *map;
+  ref.max_occ_dist = max_occ_dist;
+  ref.occ_dist_step = max_occ_dist / MAP_DIST_MAX;
+
+  for(int j = 0; j < map->size_y; j++)
+    for(int i = 0; i < map->size_x; i++)
+    {
+      int best = -1;
+      for(int nj = j - radius; nj <= j + radius; nj++)
+        for(int ni = i - radius; ni <= i + radius; ni++)
+        {
+          if(!MAP_VALID(map, ni, nj) || MAP_OCC_STATE(map, MAP_INDEX(map, ni, nj)) != +1)
+            continue;
+          int d2 = (ni - i) * (ni - i) + (nj - j) * (nj - j);
+          if(best < 0 || d2 < best)
+            best = d2;
+        }
+      if(best >= 0 && best <= radius * radius)
+        codes[MAP_INDEX(map, i, j)] = MAP_DIST_CODE((&ref), sqrt((double)best) * map->scale);
+    }
+
+  return codes;
+}
+
+TEST(MapCspace, EdtMatchesBruteForce)
+{
+  const int sizes[][2] = {{1, 1}, {1, 37}, {41, 1}, {57, 43}, {120, 90}};
+  const double densities[] = {0.0, 0.002, 0.02, 0.2};
+  const double max_dists[] = {0.05, 0.5, 2.0};
+  const int thread_counts[] = {1, 3};
+
+  for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    for(size_t d = 0; d < sizeof(densities) / sizeof(densities[0]); d++)
+      for(size_t m = 0; m < sizeof(max_dists) / sizeof(max_dists[0]); m++)
+      {
+        map_t* map = random_map(sizes[s][0], sizes[s][1], densities[d], s * 100 + d);
+        std::vector<uint8_t> expected = brute_force(map, max_dists[m]);
+
+        for(size_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++)
+        {
+          map_update_cspace_edt(map, max_dists[m], thread_counts[t]);
+          ASSERT_TRUE(map->occ_dist != NULL);
+          for(int i = 0; i < map->size_x * map->size_y; i++)
+            ASSERT_EQ(expected[i], map->occ_dist[i])
+              << "cell " << i << " of " << map->size_x << "x" << map->size_y
+              << ", density " << densities[d] << ", max dist " << max_dists[m]
+              << ", " << thread_counts[t] << " threads";
+          // Off-map padding
+          for(int i = 0; i < MAP_DIST_PAD; i++)
+            ASSERT_EQ(MAP_DIST_MAX, map->occ_dist[map->size_x * map->size_y + i]);
+        }
+
+        map_free(map);
+      }
+}
+
+TEST(MapCspace, EdtAgreesWithBrushfire)
+{
+  map_t* map = random_map(300, 200, 0.01, 7);
+
+  map_update_cspace(map, 2.0);
+  std::vector<uint8_t> brushfire(map->occ_dist, map->occ_dist + map->size_x * map->size_y);
+
+  map_update_cspace_edt(map, 2.0, 2);
+
+  // The brushfire propagates the source of a neighbour, which can miss
+  // the true nearest obstacle: it never underestimates the distance, and
+  // on maps like this one it is off by less than a cell
+  int differ = 0;
+  for(int i = 0; i < map->size_x * map->size_y; i++)
+  {
+    ASSERT_LE(map->occ_dist[i], brushfire[i]) << "cell " << i;
+    EXPECT_LE((brushfire[i] - map->occ_dist[i]) * map->occ_dist_step, map->scale)
+      << "cell " << i;
+    if(map->occ_dist[i] != brushfire[i])
+      differ++;
+  }
+  printf("%d of %d cells differ from the brushfire\n", differ, map->size_x * map->size_y);
+
+  map_free(map);
+}
+
+TEST(MapCspace, WindowUpdate)
+{
+  const int windows[][4] = {{0, 0, 1, 1}, {10, 20, 40, 45}, {140, 90, 150, 100},
+                            {-5, -5, 200, 3}, {75, 0, 76, 100}};
+  const double max_dists[] = {0.05, 0.6};
+  const map_cspace_method_t methods[] = {MAP_CSPACE_EDT, MAP_CSPACE_BRUSHFIRE};
+
+  for(size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); w++)
+    for(size_t m = 0; m < sizeof(max_dists) / sizeof(max_dists[0]); m++)
+      for(size_t t = 0; t < sizeof(methods) / sizeof(methods[0]); t++)
+      {
+        map_t* map = random_map(150, 100, 0.01, w);
+        if(methods[t] == MAP_CSPACE_EDT)
+          map_update_cspace_edt(map, max_dists[m], 1);
+        else
+          map_update_cspace(map, max_dists[m]);
+
+        // New obstacles in the window and old ones cleared
+        srand(w + 10);
+        for(int j = std::max(0, windows[w][1]); j < std::min(map->size_y, windows[w][3]); j++)
+          for(int i = std::max(0, windows[w][0]); i < std::min(map->size_x, windows[w][2]); i++)
+          {
+            double r = rand() / (double)RAND_MAX;
+            map->occ_state[MAP_INDEX(map, i, j)] = (r < 0.05) ? +1 : -1;
+          }
+        EXPECT_EQ(0, map_update_cspace_window(map, windows[w][0], windows[w][1],
+                                              windows[w][2], windows[w][3], methods[t], 2));
+
+        // Same as building the plane for the new map with the same method
+        std::vector<uint8_t> updated(map->occ_dist,
+                                     map->occ_dist + map->size_x * map->size_y + MAP_DIST_PAD);
+        if(methods[t] == MAP_CSPACE_EDT)
+          map_update_cspace_edt(map, max_dists[m], 1);
+        else
+          map_update_cspace(map, max_dists[m]);
+        for(size_t i = 0; i < updated.size(); i++)
+          ASSERT_EQ(map->occ_dist[i], updated[i])
+            << "cell " << i << ", window " << w << ", max dist " << max_dists[m]
+            << ", method " << methods[t];
+
+        if(methods[t] == MAP_CSPACE_EDT)
+        {
+          std::vector<uint8_t> expected = brute_force(map, max_dists[m]);
+          for(int i = 0; i < map->size_x * map->size_y; i++)
+            ASSERT_EQ(expected[i], updated[i])
+              << "cell " << i << ", window " << w << ", max dist " << max_dists[m];
+        }
+
+        map_free(map);
+      }
+
+  // Nothing to update without a distance plane
+  map_t* map = random_map(20, 20, 0.01, 1);
+  EXPECT_EQ(-1, map_update_cspace_window(map, 0, 0, 5, 5, MAP_CSPACE_EDT, 1));
+  EXPECT_EQ(-1, map_update_cspace_window(map, 0, 0, 5, 5, MAP_CSPACE_BRUSHFIRE, 1));
+  map_free(map);
+}
+
+// Path of the only cache file in dir
+static std::string cache_file(const std::string& dir)
+{
+  std::string path;
+  DIR* d = opendir(dir.c_str());
+  struct dirent* e;
+  while((e = readdir(d)) != NULL)
+    if(e->d_name[0] != '.')
+      path = dir + "/" + e->d_name;
+  closedir(d);
+  return path;
+}
+
+TEST(MapCspace, Cache)
+{
+  TempDir temp;
+  ASSERT_FALSE(temp.path.empty());
+  std::string dir = temp.path;
+  std::string cache_dir = dir + "/cache";
+
+  map_t* reference = random_map(150, 100, 0.01, 3);
+  map_update_cspace_edt(reference, 1.0, 1);
+  size_t plane_size = reference->size_x * reference->size_y + MAP_DIST_PAD;
+
+  // Miss: computed and stored, then used from the mapped file
+  map_t* map = random_map(150, 100, 0.01, 3);
+  EXPECT_EQ(0, map_update_cspace_cached(map, 1.0, MAP_CSPACE_EDT, 1, cache_dir.c_str()));
+  EXPECT_TRUE(map->occ_dist_mapping != NULL);
+  EXPECT_EQ(0, memcmp(reference->occ_dist, map->occ_dist, plane_size));
+  map_free(map);
+
+  // Hit
+  map = random_map(150, 100, 0.01, 3);
+  EXPECT_EQ(1, map_update_cspace_cached(map, 1.0, MAP_CSPACE_EDT, 1, cache_dir.c_str()));
+  EXPECT_TRUE(map->occ_dist_mapping != NULL);
+  EXPECT_DOUBLE_EQ(1.0, map->max_occ_dist);
+  EXPECT_EQ(0, memcmp(reference->occ_dist, map->occ_dist, plane_size));
+  map_free(map);
+
+  // Other inputs use other files
+  map = random_map(150, 100, 0.01, 3);
+  EXPECT_EQ(0, map_update_cspace_cached(map, 1.5, MAP_CSPACE_EDT, 1, cache_dir.c_str()));
+  map_free(map);
+  map = random_map(150, 100, 0.01, 4);
+  EXPECT_EQ(0, map_update_cspace_cached(map, 1.0, MAP_CSPACE_EDT, 1, cache_dir.c_str()));
+  map_free(map);
+
+  // A corrupt file is detected and rebuilt
+  std::string one_dir = dir + "/one";
+  map = random_map(150, 100, 0.01, 3);
+  EXPECT_EQ(0, map_update_cspace_cached(map, 1.0, MAP_CSPACE_EDT, 1, one_dir.c_str()));
+  map_free(map);
+  std::string path = cache_file(one_dir);
+  FILE* file = fopen(path.c_str(), "r+b");
+  ASSERT_TRUE(file != NULL);
+  fseek(file, 96 + 1234, SEEK_SET);
+  fputc(0x5a, file);
+  fclose(file);
+
+  map = random_map(150, 100, 0.01, 3);
+  EXPECT_EQ(0, map_update_cspace_cached(map, 1.0, MAP_CSPACE_EDT, 1, one_dir.c_str()));
+  EXPECT_EQ(0, memcmp(reference->occ_dist, map->occ_dist, plane_size));
+  map_free(map);
+  map = random_map(150, 100, 0.01, 3);
+  EXPECT_EQ(1, map_update_cspace_cached(map, 1.0, MAP_CSPACE_EDT, 1, one_dir.c_str()));
+  map_free(map);
+
+  // Updating a mapped plane copies it, and leaves the file alone
+  map = random_map(150, 100, 0.01, 3);
+  EXPECT_EQ(1, map_update_cspace_cached(map, 1.0, MAP_CSPACE_EDT, 1, one_dir.c_str()));
+  map->occ_state[MAP_INDEX(map, 30, 30)] = +1;
+  EXPECT_EQ(0, map_update_cspace_window(map, 30, 30, 31, 31, MAP_CSPACE_EDT, 1));
+  EXPECT_TRUE(map->occ_dist_mapping == NULL);
+  EXPECT_EQ(0, map->occ_dist[MAP_INDEX(map, 30, 30)]);
+  map_free(map);
+  map = random_map(150, 100, 0.01, 3);
+  EXPECT_EQ(1, map_update_cspace_cached(map, 1.0, MAP_CSPACE_EDT, 1, one_dir.c_str()));
+  EXPECT_EQ(0, memcmp(reference->occ_dist, map->occ_dist, plane_size));
+  map_free(map);
+
+  // A truncated file as well
+  ASSERT_EQ(0, truncate(path.c_str(), 100));
+  map = random_map(150, 100, 0.01, 3);
+  EXPECT_EQ(0, map_update_cspace_cached(map, 1.0, MAP_CSPACE_EDT, 1, one_dir.c_str()));
+  EXPECT_EQ(0, memcmp(reference->occ_dist, map->occ_dist, plane_size));
+  map_free(map);
+
+  map_free(reference);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,219 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Checks the precomputed range tables against ray tracing, and
+// their on-disk cache
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "amcl/map/map.h"
+
+#include "amcl_test_util.h"
+
+// Mostly free map with scattered obstacles and unknown cells at the given
+// density, and walls
+static map_t* random_map(int size_x, int size_y, double density, unsigned int seed)
+{
+  map_t* map = map_alloc();
+  map->scale = 0.05;
+  map->origin_x = 1.0;
+  map->origin_y = -2.0;
+  map_alloc_cells(map, size_x, size_y);
+
+  srand(seed);
+  for(int i = 0; i < size_x * size_y; i++)
+  {
+    double r = rand() / (double)RAND_MAX;
+    map->occ_state[i] = (r < density) ? +1 : ((r < 2 * density) ? 0 : -1);
+  }
+  for(int i = 0; i < size_x; i++)
+  {
+    map->occ_state[MAP_INDEX(map, i, 0)] = +1;
+    map->occ_state[MAP_INDEX(map, i, size_y / 2)] = (i % 20 < 5) ? -1 : +1;
+  }
+
+  return map;
+}
+
+static void expect_matches_ray_tracing(map_t* map, map_range_table_t* table)
+{
+  double tolerance = table->range_step / 2 + 1e-9;
+  for(int j = 0; j < map->size_y; j += 3)
+    for(int i = 0; i < map->size_x; i += 2)
+    {
+      double ox = MAP_WXGX(map, i);
+      double oy = MAP_WYGY(map, j);
+      for(int k = 0; k < table->angle_count; k++)
+      {
+        double oa = k * 2 * M_PI / table->angle_count;
+        double expected = map_calc_range(map, ox, oy, oa, table->max_range);
+
+        // Also from nearby points and wrapped bearings that round to
+        // the same cell and bearing
+        ASSERT_NEAR(expected, map_range_table_lookup(table, map, ox, oy, oa), tolerance)
+          << "cell " << i << "," << j << ", bearing " << k;
+        ASSERT_NEAR(expected, map_range_table_lookup(table, map, ox + 0.2 * map->scale,
+                                                     oy - 0.2 * map->scale,
+                                                     oa - 4 * M_PI), tolerance)
+          << "cell " << i << "," << j << ", bearing " << k;
+      }
+    }
+}
+
+TEST(MapRangeTable, MatchesRayTracing)
+{
+  map_t* map = random_map(90, 70, 0.01, 1);
+
+  map_range_table_t* table = map_range_table_build(map, 3.0, 72, 2, 1);
+  ASSERT_TRUE(table != NULL);
+  expect_matches_ray_tracing(map, table);
+  map_range_table_free(table);
+
+  // Compressed
+  table = map_range_table_build(map, 3.0, 72, 1, 1);
+  ASSERT_TRUE(table != NULL);
+  expect_matches_ray_tracing(map, table);
+  map_range_table_free(table);
+
+  // Off the map
+  table = map_range_table_build(map, 3.0, 72, 2, 1);
+  EXPECT_EQ(0.0, map_range_table_lookup(table, map, MAP_WXGX(map, -1), MAP_WYGY(map, 5), 0.0));
+  EXPECT_EQ(0.0, map_range_table_lookup(table, map, MAP_WXGX(map, 5), MAP_WYGY(map, 70), 0.0));
+  map_range_table_free(table);
+
+  map_free(map);
+}
+
+TEST(MapRangeTable, ThreadsAgree)
+{
+  map_t* map = random_map(120, 97, 0.01, 2);
+
+  map_range_table_t* serial = map_range_table_build(map, 2.0, 36, 2, 1);
+  map_range_table_t* parallel = map_range_table_build(map, 2.0, 36, 2, 4);
+  ASSERT_TRUE(serial != NULL);
+  ASSERT_TRUE(parallel != NULL);
+  ASSERT_EQ(serial->size, parallel->size);
+  EXPECT_EQ(0, memcmp(serial->memory, parallel->memory, serial->size));
+
+  map_range_table_free(serial);
+  map_range_table_free(parallel);
+  map_free(map);
+}
+
+TEST(MapRangeTable, WindowUpdate)
+{
+  const int windows[][4] = {{0, 0, 1, 1}, {80, 60, 110, 75}, {170, 110, 200, 140},
+                            {-5, 40, 220, 43}, {100, 0, 102, 140}};
+  const int bytes[] = {2, 1};
+
+  for(size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); w++)
+    for(size_t b = 0; b < sizeof(bytes) / sizeof(bytes[0]); b++)
+    {
+      map_t* map = random_map(200, 140, 0.005, w);
+      map_range_table_t* table = map_range_table_build(map, 2.0, 36, bytes[b], 2);
+      ASSERT_TRUE(table != NULL);
+
+      // New obstacles and unknown cells in the window, and old ones cleared
+      srand(w + 10);
+      for(int j = std::max(0, windows[w][1]); j < std::min(map->size_y, windows[w][3]); j++)
+        for(int i = std::max(0, windows[w][0]); i < std::min(map->size_x, windows[w][2]); i++)
+        {
+          double r = rand() / (double)RAND_MAX;
+          map->occ_state[MAP_INDEX(map, i, j)] = (r < 0.1) ? +1 : ((r < 0.15) ? 0 : -1);
+        }
+      map_range_table_t* updated = map_range_table_update_window(
+        table, map, windows[w][0], windows[w][1], windows[w][2], windows[w][3], 2);
+      ASSERT_TRUE(updated != NULL);
+
+      // Same as building the table for the new map
+      map_range_table_t* rebuilt = map_range_table_build(map, 2.0, 36, bytes[b], 1);
+      ASSERT_TRUE(rebuilt != NULL);
+      ASSERT_EQ(rebuilt->size, updated->size) << "window " << w;
+      EXPECT_EQ(0, memcmp(rebuilt->memory, updated->memory, rebuilt->size))
+        << "window " << w << ", " << bytes[b] << " bytes per range";
+
+      map_range_table_free(rebuilt);
+      map_range_table_free(updated);
+      map_range_table_free(table);
+      map_free(map);
+    }
+
+  // Not for a map of another size
+  map_t* map = random_map(40, 30, 0.01, 1);
+  map_t* other = random_map(41, 30, 0.01, 1);
+  map_range_table_t* table = map_range_table_build(map, 1.0, 36, 2, 1);
+  ASSERT_TRUE(table != NULL);
+  EXPECT_TRUE(map_range_table_update_window(table, other, 0, 0, 5, 5, 1) == NULL);
+  map_range_table_free(table);
+  map_free(other);
+  map_free(map);
+}
+
+TEST(MapRangeTable, Cache)
+{
+  TempDir temp;
+  ASSERT_FALSE(temp.path.empty());
+  std::string dir = temp.path;
+
+  map_t* map = random_map(80, 60, 0.01, 3);
+  map_range_table_t* reference = map_range_table_build(map, 2.5, 90, 1, 1);
+
+  int hit = -1;
+  map_range_table_t* table = map_range_table_build_cached(map, 2.5, 90, 1, 1, dir.c_str(), &hit);
+  ASSERT_TRUE(table != NULL);
+  EXPECT_EQ(0, hit);
+  EXPECT_TRUE(table->mapping != NULL);
+  EXPECT_EQ(0, memcmp(reference->memory, table->memory, reference->size));
+  map_range_table_free(table);
+
+  table = map_range_table_build_cached(map, 2.5, 90, 1, 1, dir.c_str(), &hit);
+  ASSERT_TRUE(table != NULL);
+  EXPECT_EQ(1, hit);
+  EXPECT_EQ(0, memcmp(reference->memory, table->memory, reference->size));
+  expect_matches_ray_tracing(map, table);
+  map_range_table_free(table);
+
+  // Other settings use other files
+  table = map_range_table_build_cached(map, 2.5, 90, 2, 1, dir.c_str(), &hit);
+  EXPECT_EQ(0, hit);
+  map_range_table_free(table);
+
+  map_range_table_free(reference);
+  map_free(map);
+}
+
+// Beam model access pattern: a cloud of particles around one pose, each
+// looking along the same beams
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,207 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Checks the filter's random number generator and the batched
+// odometry motion models
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "amcl/pf/pf.h"
+#include "amcl/pf/pf_pdf.h"
+#include "amcl/pf/pf_random.h"
+#include "amcl/sensors/amcl_odom.h"
+
+using namespace amcl;
+
+static const odom_model_t g_models[] =
+  {ODOM_MODEL_DIFF, ODOM_MODEL_OMNI, ODOM_MODEL_DIFF_CORRECTED, ODOM_MODEL_OMNI_CORRECTED};
+
+static pf_vector_t random_pose(void*)
+{
+  return pf_vector_zero();
+}
+
+// Filter with every sample at the origin, and a seeded generator
+static pf_t* origin_filter(int samples, uint64_t seed)
+{
+  pf_t* pf = pf_alloc(samples, samples, 0.001, 0.1, random_pose, NULL);
+  pf_init_model(pf, random_pose, NULL);
+  pf_set_seed(pf, seed);
+  return pf;
+}
+
+static AMCLOdomData odom_data(double x, double y, double a)
+{
+  AMCLOdomData data;
+  data.sensor = NULL;
+  data.time = 0.0;
+  data.pose = pf_vector_zero();
+  data.pose.v[0] = x;
+  data.pose.v[1] = y;
+  data.pose.v[2] = a;
+  data.delta = data.pose;
+  return data;
+}
+
+TEST(OdomMotion, RandomIsReproducible)
+{
+  pf_random_t a, b, c;
+  pf_random_seed(&a, 7);
+  pf_random_seed(&b, 7);
+  pf_random_seed(&c, 8);
+
+  int same = 0;
+  for(int i = 0; i < 1000; i++)
+  {
+    uint64_t x = pf_random_next(&a);
+    ASSERT_EQ(x, pf_random_next(&b));
+    same += (x == pf_random_next(&c));
+  }
+  EXPECT_EQ(0, same);
+
+  // Seed zero is usable as well
+  pf_random_seed(&a, 0);
+  double sum = 0;
+  for(int i = 0; i < 100000; i++)
+  {
+    double u = pf_random_uniform(&a);
+    ASSERT_GE(u, 0.0);
+    ASSERT_LT(u, 1.0);
+    sum += u;
+  }
+  EXPECT_NEAR(0.5, sum / 100000, 0.005);
+}
+
+TEST(OdomMotion, GaussianFillIsStandardNormal)
+{
+  // Odd count, so the tail draw is covered
+  const int count = 1000001;
+  std::vector<double> x(count);
+  pf_random_t rng;
+  pf_random_seed(&rng, 3);
+  pf_random_gaussian_fill(&rng, &x[0], count);
+
+  double m1 = 0, m2 = 0, m4 = 0;
+  int beyond_2 = 0;
+  for(int i = 0; i < count; i++)
+  {
+    ASSERT_TRUE(isfinite(x[i]));
+    m1 += x[i];
+    m2 += x[i] * x[i];
+    m4 += x[i] * x[i] * x[i] * x[i];
+    beyond_2 += (fabs(x[i]) > 2.0);
+  }
+  EXPECT_NEAR(0.0, m1 / count, 0.005);
+  EXPECT_NEAR(1.0, m2 / count, 0.005);
+  EXPECT_NEAR(3.0, m4 / count, 0.05);
+  EXPECT_NEAR(0.0455, beyond_2 / (double)count, 0.001);
+
+  // Neighbouring draws (the two halves of a pair) are uncorrelated
+  double cross = 0;
+  for(int i = 0; i + 1 < count; i += 2)
+    cross += x[i] * x[i+1];
+  EXPECT_NEAR(0.0, cross / (count / 2), 0.005);
+}
+
+TEST(OdomMotion, UpdateIsReproducible)
+{
+  AMCLOdomData data = odom_data(0.3, 0.1, 0.2);
+
+  for(size_t m = 0; m < sizeof(g_models) / sizeof(g_models[0]); m++)
+  {
+    AMCLOdom odom;
+    odom.SetModel(g_models[m], 0.2, 0.2, 0.2, 0.2, 0.2);
+
+    pf_t* a = origin_filter(1000, 11);
+    pf_t* b = origin_filter(1000, 11);
+    pf_t* c = origin_filter(1000, 12);
+    odom.UpdateAction(a, &data);
+    odom.UpdateAction(b, &data);
+    odom.UpdateAction(c, &data);
+
+    int differ = 0;
+    for(int i = 0; i < 1000; i++)
+    {
+      pf_sample_t* sa = a->sets[a->current_set].samples + i;
+      pf_sample_t* sb = b->sets[b->current_set].samples + i;
+      pf_sample_t* sc = c->sets[c->current_set].samples + i;
+      for(int j = 0; j < 3; j++)
+      {
+        ASSERT_EQ(sa->pose.v[j], sb->pose.v[j]) << "model " << m << ", sample " << i;
+        differ += (sa->pose.v[j] != sc->pose.v[j]);
+      }
+    }
+    EXPECT_GT(differ, 2900) << "model " << m;
+
+    pf_free(a);
+    pf_free(b);
+    pf_free(c);
+  }
+}
+
+TEST(OdomMotion, NoiseFollowsModel)
+{
+  // Straight ahead by 1 m from the origin; with only alpha3 set, the
+  // noise is all along x, with standard deviation sqrt(alpha3) for the
+  // corrected models and alpha3 for the original ones
+  AMCLOdomData data = odom_data(1.0, 0.0, 0.0);
+  const int samples = 20000;
+
+  for(size_t m = 0; m < sizeof(g_models) / sizeof(g_models[0]); m++)
+  {
+    bool corrected = (g_models[m] == ODOM_MODEL_DIFF_CORRECTED ||
+                      g_models[m] == ODOM_MODEL_OMNI_CORRECTED);
+    AMCLOdom odom;
+    odom.SetModel(g_models[m], 0.0, 0.0, 0.04, 0.0, 0.0);
+    pf_t* pf = origin_filter(samples, 5);
+    odom.UpdateAction(pf, &data);
+
+    double sum = 0, sum2 = 0;
+    for(int i = 0; i < samples; i++)
+    {
+      pf_sample_t* s = pf->sets[pf->current_set].samples + i;
+      ASSERT_EQ(0.0, s->pose.v[1]);
+      ASSERT_EQ(0.0, s->pose.v[2]);
+      sum += s->pose.v[0];
+      sum2 += s->pose.v[0] * s->pose.v[0];
+    }
+    double mean = sum / samples;
+    double stddev = sqrt(sum2 / samples - mean * mean);
+    double expected = corrected ? 0.2 : 0.04;
+    EXPECT_NEAR(1.0, mean, 4 * expected / sqrt(samples)) << "model " << m;
+    EXPECT_NEAR(expected, stddev, 0.03 * expected) << "model " << m;
+
+    pf_free(pf);
+  }
+}
+
+// Scaling curve for a whole odometry update, against the three
+// pf_ran_gaussian() calls per sample the models made before
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,216 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Checks that the hash histogram bins and clusters samples exactly
+// like the kd tree
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "amcl/pf/pf.h"
+#include "amcl/pf/pf_kdtree.h"
+
+static double uniform(double lo, double hi)
+{
+  return lo + (hi - lo) * (rand() / (double)RAND_MAX);
+}
+
+// Poses around a few blobs of different spreads, some close enough to
+// merge, plus uniform clutter
+static std::vector<pf_vector_t> random_poses(int count, unsigned int seed)
+{
+  srand(seed);
+  std::vector<pf_vector_t> centers;
+  int blobs = 1 + rand() % 6;
+  for(int b = 0; b < blobs; b++)
+  {
+    pf_vector_t c = pf_vector_zero();
+    c.v[0] = uniform(-20, 20);
+    c.v[1] = uniform(-20, 20);
+    c.v[2] = uniform(-M_PI, M_PI);
+    centers.push_back(c);
+  }
+
+  std::vector<pf_vector_t> poses(count);
+  for(int i = 0; i < count; i++)
+  {
+    pf_vector_t p = pf_vector_zero();
+    if(i % 10 == 0)
+    {
+      p.v[0] = uniform(-25, 25);
+      p.v[1] = uniform(-25, 25);
+      p.v[2] = uniform(-M_PI, M_PI);
+    }
+    else
+    {
+      const pf_vector_t& c = centers[i % blobs];
+      double spread = 0.2 + (i % blobs);
+      p.v[0] = c.v[0] + uniform(-spread, spread);
+      p.v[1] = c.v[1] + uniform(-spread, spread);
+      p.v[2] = c.v[2] + uniform(-0.5, 0.5);
+    }
+    poses[i] = p;
+  }
+  return poses;
+}
+
+static void fill(pf_kdtree_t* tree, const std::vector<pf_vector_t>& poses)
+{
+  pf_kdtree_clear(tree);
+  for(size_t i = 0; i < poses.size(); i++)
+    pf_kdtree_insert(tree, poses[i], 1.0 / (1 + i % 7));
+}
+
+TEST(PfKdtree, HashMatchesTree)
+{
+  const int counts[] = {1, 2, 50, 1000, 5000};
+
+  for(size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+  {
+    pf_kdtree_t* tree = pf_kdtree_alloc(3 * counts[c]);
+    pf_kdtree_t* hash = pf_kdtree_alloc_type(counts[c], PF_KDTREE_HASH);
+
+    // Reuse both a few times, so clearing is covered as well
+    for(unsigned int seed = 0; seed < 20; seed++)
+    {
+      std::vector<pf_vector_t> poses = random_poses(counts[c], seed);
+      fill(tree, poses);
+      fill(hash, poses);
+      pf_kdtree_cluster(tree);
+      pf_kdtree_cluster(hash);
+
+      ASSERT_EQ(tree->leaf_count, hash->leaf_count);
+
+      // Same bins, same clusters up to their numbering
+      std::map<int, int> to_hash, to_tree;
+      for(size_t i = 0; i < poses.size(); i++)
+      {
+        ASSERT_EQ(pf_kdtree_get_prob(tree, poses[i]), pf_kdtree_get_prob(hash, poses[i]));
+        int a = pf_kdtree_get_cluster(tree, poses[i]);
+        int b = pf_kdtree_get_cluster(hash, poses[i]);
+        ASSERT_GE(b, 0);
+        ASSERT_LT(b, hash->leaf_count);
+        if(to_hash.count(a) == 0)
+          to_hash[a] = b;
+        if(to_tree.count(b) == 0)
+          to_tree[b] = a;
+        ASSERT_EQ(to_hash[a], b) << counts[c] << " poses, seed " << seed;
+        ASSERT_EQ(to_tree[b], a) << counts[c] << " poses, seed " << seed;
+      }
+
+      // Hash labels are dense
+      ASSERT_EQ((int)to_tree.size() - 1, to_tree.rbegin()->first);
+
+      // Empty bins
+      pf_vector_t far = pf_vector_zero();
+      far.v[0] = 1e3;
+      EXPECT_EQ(0.0, pf_kdtree_get_prob(hash, far));
+      EXPECT_EQ(-1, pf_kdtree_get_cluster(hash, far));
+    }
+
+    pf_kdtree_free(tree);
+    pf_kdtree_free(hash);
+  }
+}
+
+// Cluster statistics as a sorted list, so that numbering does not matter
+static std::vector<std::vector<double> > cluster_stats(pf_t* pf)
+{
+  std::vector<std::vector<double> > stats;
+  pf_sample_set_t* set = pf->sets + pf->current_set;
+  for(int i = 0; i < set->cluster_count; i++)
+  {
+    pf_cluster_t* cluster = set->clusters + i;
+    std::vector<double> s;
+    s.push_back(cluster->count);
+    s.push_back(cluster->weight);
+    for(int j = 0; j < 3; j++)
+      s.push_back(cluster->mean.v[j]);
+    for(int j = 0; j < 3; j++)
+      for(int k = 0; k < 3; k++)
+        s.push_back(cluster->cov.m[j][k]);
+    stats.push_back(s);
+  }
+  std::sort(stats.begin(), stats.end());
+  return stats;
+}
+
+static pf_vector_t random_pose(void*)
+{
+  pf_vector_t pose = pf_vector_zero();
+  pose.v[0] = uniform(-25, 25);
+  pose.v[1] = uniform(-25, 25);
+  pose.v[2] = uniform(-M_PI, M_PI);
+  return pose;
+}
+
+TEST(PfKdtree, FilterClustersMatch)
+{
+  pf_t* tree = pf_alloc_histogram(100, 5000, 0.001, 0.1, random_pose, NULL, PF_KDTREE_TREE);
+  pf_t* hash = pf_alloc_histogram(100, 5000, 0.001, 0.1, random_pose, NULL, PF_KDTREE_HASH);
+
+  for(unsigned int seed = 0; seed < 10; seed++)
+  {
+    srand(seed);
+    pf_init_model(tree, random_pose, NULL);
+    srand(seed);
+    pf_init_model(hash, random_pose, NULL);
+
+    std::vector<std::vector<double> > a = cluster_stats(tree);
+    std::vector<std::vector<double> > b = cluster_stats(hash);
+    ASSERT_EQ(a.size(), b.size());
+    for(size_t i = 0; i < a.size(); i++)
+      for(size_t j = 0; j < a[i].size(); j++)
+        EXPECT_DOUBLE_EQ(a[i][j], b[i][j]) << "seed " << seed << ", cluster " << i;
+
+    // Resampling draws the same random numbers, and has the same KLD bins
+    tree->w_slow = tree->w_fast = hash->w_slow = hash->w_fast = 1.0;
+    pf_set_seed(tree, seed);
+    pf_update_resample(tree);
+    pf_set_seed(hash, seed);
+    pf_update_resample(hash);
+    ASSERT_EQ(tree->sets[tree->current_set].sample_count,
+              hash->sets[hash->current_set].sample_count);
+    a = cluster_stats(tree);
+    b = cluster_stats(hash);
+    ASSERT_EQ(a.size(), b.size());
+    for(size_t i = 0; i < a.size(); i++)
+      for(size_t j = 0; j < a[i].size(); j++)
+        EXPECT_DOUBLE_EQ(a[i][j], b[i][j]) << "seed " << seed << ", cluster " << i;
+  }
+
+  pf_free(tree);
+  pf_free(hash);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,271 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Checks the resampling schemes of the particle filter and its time
+// budget
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "amcl/pf/pf.h"
+#include "amcl/pf/pf_kdtree.h"
+
+#include "amcl_test_util.h"
+
+static const pf_resample_model_t g_models[] =
+  {PF_RESAMPLE_MULTINOMIAL, PF_RESAMPLE_SYSTEMATIC, PF_RESAMPLE_ALIAS};
+static const char* g_model_names[] = {"multinomial", "systematic", "alias"};
+
+static pf_vector_t random_pose(void*)
+{
+  pf_vector_t pose = pf_vector_zero();
+  pose.v[0] = -1.0;
+  return pose;
+}
+
+// Filter whose current set holds the given weights.  Sample i sits in
+// kd-tree cell i % cells along x, and its index is encoded in y (within a
+// single cell), so that the parent of a resampled pose can be read back.
+static pf_t* weighted_filter(const std::vector<double>& weights, int max_samples,
+                             int cells)
+{
+  pf_t* pf = pf_alloc(1, max_samples, 0.001, 0.1, random_pose, NULL);
+  pf->w_slow = pf->w_fast = 1.0;
+
+  pf_sample_set_t* set = pf->sets + pf->current_set;
+  set->sample_count = weights.size();
+  double total = 0;
+  for(size_t i = 0; i < weights.size(); i++)
+    total += weights[i];
+  for(size_t i = 0; i < weights.size(); i++)
+  {
+    set->samples[i].pose = pf_vector_zero();
+    set->samples[i].pose.v[0] = (double)(i % cells);
+    set->samples[i].pose.v[1] = 1e-5 * i;
+    set->samples[i].weight = weights[i] / total;
+  }
+  return pf;
+}
+
+// Parent of every sample in the current set
+static std::vector<int> parents(pf_t* pf)
+{
+  pf_sample_set_t* set = pf->sets + pf->current_set;
+  std::vector<int> result(set->sample_count);
+  for(int i = 0; i < set->sample_count; i++)
+    result[i] = (int)floor(set->samples[i].pose.v[1] * 1e5 + 0.5);
+  return result;
+}
+
+TEST(PfResample, MultinomialMatchesLinearSearch)
+{
+  std::vector<double> weights(500);
+  srand(1);
+  for(size_t i = 0; i < weights.size(); i++)
+    weights[i] = (i % 7 == 0) ? 0.0 : rand() / (double)RAND_MAX;
+
+  pf_t* pf = weighted_filter(weights, 2000, weights.size());
+  pf_sample_set_t* set = pf->sets + pf->current_set;
+  std::vector<double> c(set->sample_count + 1, 0.0);
+  for(int i = 0; i < set->sample_count; i++)
+    c[i+1] = c[i] + set->samples[i].weight;
+
+  pf_set_seed(pf, 42);
+  pf_update_resample(pf);
+  std::vector<int> actual = parents(pf);
+
+  // The search the filter used before, fed the same random numbers
+  pf_random_t rng;
+  pf_random_seed(&rng, 42);
+  for(size_t k = 0; k < actual.size(); k++)
+  {
+    ASSERT_FALSE(pf_random_uniform(&rng) < 0.0);
+    double r = pf_random_uniform(&rng);
+    int i;
+    for(i = 0; i < set->sample_count; i++)
+      if((c[i] <= r) && (r < c[i+1]))
+        break;
+    ASSERT_EQ(i, actual[k]) << "sample " << k;
+  }
+
+  pf_free(pf);
+}
+
+TEST(PfResample, DrawsFollowWeights)
+{
+  // Samples on two kd-tree cells, so the KLD limit stops the draws after
+  // a tenth of max_samples, and every scheme has to be unbiased on that
+  // prefix
+  std::vector<double> weights(64);
+  for(size_t i = 0; i < weights.size(); i++)
+    weights[i] = (i % 5 == 0) ? 0.0 : 1.0 + (i % 3);
+  double total = 0;
+  for(size_t i = 0; i < weights.size(); i++)
+    total += weights[i];
+
+  for(size_t m = 0; m < sizeof(g_models) / sizeof(g_models[0]); m++)
+  {
+    std::vector<int> counts(weights.size(), 0);
+    int draws = 0;
+    for(int trial = 0; trial < 2000; trial++)
+    {
+      pf_t* pf = weighted_filter(weights, 5000, 2);
+      pf_set_resample_model(pf, g_models[m]);
+      // pf_alloc() seeds from the clock
+      pf_set_seed(pf, trial);
+      pf_update_resample(pf);
+      std::vector<int> p = parents(pf);
+      ASSERT_LT(p.size(), 1000u) << g_model_names[m];
+      for(size_t i = 0; i < p.size(); i++)
+      {
+        ASSERT_GE(p[i], 0);
+        ASSERT_LT(p[i], (int)weights.size());
+        counts[p[i]]++;
+      }
+      draws += p.size();
+      pf_free(pf);
+    }
+
+    for(size_t i = 0; i < weights.size(); i++)
+    {
+      double expected = draws * weights[i] / total;
+      if(weights[i] == 0)
+        EXPECT_EQ(0, counts[i]) << g_model_names[m] << ", sample " << i;
+      else
+        EXPECT_NEAR(expected, counts[i], 5 * sqrt(expected))
+          << g_model_names[m] << ", sample " << i;
+    }
+  }
+}
+
+TEST(PfResample, KldLimitsSampleCount)
+{
+  std::vector<double> weights(1000, 1.0);
+
+  for(size_t m = 0; m < sizeof(g_models) / sizeof(g_models[0]); m++)
+  {
+    // Spread out: every sample in its own cell, and the set fills up
+    pf_t* pf = weighted_filter(weights, 1000, weights.size());
+    pf_set_resample_model(pf, g_models[m]);
+    pf_update_resample(pf);
+    int spread = pf->sets[pf->current_set].sample_count;
+    pf_free(pf);
+
+    // Concentrated on two cells: the limit is about 530 samples
+    pf = weighted_filter(weights, 1000, 2);
+    pf_set_resample_model(pf, g_models[m]);
+    pf_update_resample(pf);
+    int concentrated = pf->sets[pf->current_set].sample_count;
+    pf_free(pf);
+
+    EXPECT_EQ(1000, spread) << g_model_names[m];
+    EXPECT_GT(concentrated, 500) << g_model_names[m];
+    EXPECT_LT(concentrated, 560) << g_model_names[m];
+  }
+}
+
+// Sensor model that takes about 2 us per sample
+static double slow_sensor(void*, pf_sample_set_t* set)
+{
+  double end = now() + 2e-6 * set->sample_count;
+  while(now() < end)
+    ;
+  for(int i = 0; i < set->sample_count; i++)
+    set->samples[i].weight = 1.0;
+  return set->sample_count;
+}
+
+TEST(PfResample, TimeBudgetLimitsSampleCount)
+{
+  std::vector<double> weights(1000, 1.0);
+
+  // No budget: the KLD limit alone
+  pf_t* pf = weighted_filter(weights, 1000, weights.size());
+  pf->sensor_cost = pf->resample_cost = 1e-6;
+  pf_update_resample(pf);
+  EXPECT_EQ(1000, pf->sets[pf->current_set].sample_count);
+  EXPECT_EQ(0, pf->budget_limited);
+  pf_free(pf);
+
+  // Spread out, the KLD limit wants every sample but the budget pays for
+  // 200
+  pf = weighted_filter(weights, 1000, weights.size());
+  pf_set_time_budget(pf, 400e-6);
+  pf->sensor_cost = pf->resample_cost = 1e-6;
+  pf_update_resample(pf);
+  EXPECT_EQ(200, pf->budget_samples);
+  EXPECT_EQ(200, pf->sets[pf->current_set].sample_count);
+  EXPECT_EQ(1, pf->budget_limited);
+  EXPECT_GT(pf->kld_samples, 200);
+  EXPECT_GT(pf->resample_cost, 0.0);
+  pf_free(pf);
+
+  // Concentrated, the KLD limit binds first
+  pf = weighted_filter(weights, 1000, 2);
+  pf_set_time_budget(pf, 1.6e-3);
+  pf->sensor_cost = pf->resample_cost = 1e-6;
+  pf_update_resample(pf);
+  EXPECT_EQ(800, pf->budget_samples);
+  EXPECT_LT(pf->sets[pf->current_set].sample_count, 560);
+  EXPECT_EQ(0, pf->budget_limited);
+  pf_free(pf);
+
+  // Never below min_samples
+  pf = weighted_filter(weights, 1000, weights.size());
+  pf->min_samples = 50;
+  pf_set_time_budget(pf, 1e-6);
+  pf->sensor_cost = pf->resample_cost = 1e-6;
+  pf_update_resample(pf);
+  EXPECT_EQ(50, pf->sets[pf->current_set].sample_count);
+  pf_free(pf);
+}
+
+TEST(PfResample, MeasuresSensorCost)
+{
+  std::vector<double> weights(1000, 1.0);
+  pf_t* pf = weighted_filter(weights, 1000, weights.size());
+  pf_set_time_budget(pf, 1e-3);
+
+  // About 2 us per sample in the sensor model, so the budget pays for
+  // fewer than 500 samples
+  for(int i = 0; i < 5; i++)
+  {
+    pf_update_sensor(pf, slow_sensor, NULL);
+    pf_update_resample(pf);
+  }
+  EXPECT_GE(pf->sensor_cost, 2e-6);
+  EXPECT_LT(pf->sensor_cost, 1e-4);
+  EXPECT_LT(pf->sets[pf->current_set].sample_count, 500);
+  EXPECT_EQ(1, pf->budget_limited);
+  pf_free(pf);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,303 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000  Brian Gerkey et al.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+///////////////////////////////////////////////////////////////////////////
+//
+// Desc: Checks that the pose refiner pulls a perturbed pose back onto the
+// map, and compares the filter's accuracy with and without it over a
+// range of particle counts
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "amcl/map/map.h"
+#include "amcl/pf/pf.h"
+#include "amcl/sensors/amcl_laser.h"
+#include "amcl/sensors/amcl_odom.h"
+#include "amcl/sensors/amcl_pose_refiner.h"
+
+#include "amcl_test_util.h"
+
+using namespace amcl;
+
+// Walled area with rectangular obstacles at random
+static map_t* random_rooms(int size_x, int size_y, int boxes, unsigned int seed)
+{
+  map_t* map = map_alloc();
+  map->scale = 0.05;
+  map->origin_x = 1.0;
+  map->origin_y = -2.0;
+  map_alloc_cells(map, size_x, size_y);
+
+  fill(map, 0, 0, size_x - 1, size_y - 1, -1);
+  fill(map, 0, 0, size_x - 1, 1, +1);
+  fill(map, 0, size_y - 2, size_x - 1, size_y - 1, +1);
+  fill(map, 0, 0, 1, size_y - 1, +1);
+  fill(map, size_x - 2, 0, size_x - 1, size_y - 1, +1);
+
+  srand(seed);
+  for(int k = 0; k < boxes; k++)
+  {
+    int x = rand() % size_x, y = rand() % size_y;
+    int w = 2 + rand() % 20, h = 2 + rand() % 20;
+    fill(map, x, y, x + w, y + h, +1);
+  }
+  return map;
+}
+
+static bool clear_at(map_t* map, double x, double y, double margin)
+{
+  int i = MAP_GXWX(map, x), j = MAP_GYWY(map, y);
+  return MAP_VALID(map, i, j) && MAP_OCC_DIST(map, MAP_INDEX(map, i, j)) >= margin;
+}
+
+// A pose with no obstacle within margin.  It is at the centre of a cell,
+// where map_calc_range() traces from.
+static pf_vector_t random_clear_pose(map_t* map, double margin)
+{
+  for(;;)
+  {
+    pf_vector_t pose = pf_vector_zero();
+    pose.v[0] = MAP_WXGX(map, rand() % map->size_x);
+    pose.v[1] = MAP_WYGY(map, rand() % map->size_y);
+    pose.v[2] = (rand() / (double)RAND_MAX - 0.5) * 2 * M_PI;
+    if(clear_at(map, pose.v[0], pose.v[1], margin))
+      return pose;
+  }
+}
+
+// Ranges of a scan taken at pose, and the endpoints of the ones that hit
+// something, in the robot frame
+static void simulate_scan(map_t* map, pf_vector_t pose, int beams, double max_range,
+                          std::vector<double>* ranges, std::vector<pf_vector_t>* points)
+{
+  ranges->clear();
+  points->clear();
+  for(int b = 0; b < beams; b++)
+  {
+    double bearing = -M_PI + b * 2 * M_PI / beams;
+    double r = map_calc_range(map, pose.v[0], pose.v[1], pose.v[2] + bearing, max_range);
+    ranges->push_back(r);
+    if(r >= max_range)
+      continue;
+    pf_vector_t p = pf_vector_zero();
+    p.v[0] = r * cos(bearing);
+    p.v[1] = r * sin(bearing);
+    points->push_back(p);
+  }
+}
+
+static double angle_error(double a, double b)
+{
+  return fabs(atan2(sin(a - b), cos(a - b)));
+}
+
+static pf_vector_t perturb(pf_vector_t pose, double dx, double dy, double da)
+{
+  pose.v[0] += dx;
+  pose.v[1] += dy;
+  pose.v[2] += da;
+  return pose;
+}
+
+TEST(PoseRefiner, ConvergesToScanPose)
+{
+  map_t* map = random_rooms(300, 240, 40, 1);
+  map_update_cspace(map, 1.0);
+  AMCLPoseRefiner refiner;
+  refiner.SetMap(map);
+
+  srand(2);
+  for(int trial = 0; trial < 10; trial++)
+  {
+    pf_vector_t truth = random_clear_pose(map, 0.3);
+    std::vector<double> ranges;
+    std::vector<pf_vector_t> points;
+    simulate_scan(map, truth, 360, 8.0, &ranges, &points);
+
+    // A pose as far off as a coarse filter's would be
+    double dx = ((trial % 3) - 1) * 0.08, dy = ((trial % 2) ? 0.06 : -0.05);
+    double da = ((trial % 4) - 1.5) * 0.03;
+    pf_vector_t pose = perturb(truth, dx, dy, da);
+    ASSERT_TRUE(refiner.Refine(points, &pose)) << "trial " << trial;
+    EXPECT_LT(refiner.GetFinalError(), refiner.GetInitialError());
+    EXPECT_LE(refiner.GetIterations(), 10);
+    EXPECT_NEAR(truth.v[0], pose.v[0], 0.02) << "trial " << trial;
+    EXPECT_NEAR(truth.v[1], pose.v[1], 0.02) << "trial " << trial;
+    EXPECT_LT(angle_error(truth.v[2], pose.v[2]), 0.01) << "trial " << trial;
+  }
+
+  map_free(map);
+}
+
+TEST(PoseRefiner, RefusesBadCorrections)
+{
+  map_t* map = random_rooms(200, 200, 25, 3);
+  AMCLPoseRefiner refiner;
+  refiner.SetMap(map);
+
+  srand(4);
+  std::vector<double> ranges;
+  std::vector<pf_vector_t> points;
+
+  // No distance plane yet
+  map_update_cspace(map, 1.0);
+  pf_vector_t truth = random_clear_pose(map, 0.3);
+  map_free_occ_dist(map);
+  simulate_scan(map, truth, 180, 8.0, &ranges, &points);
+  pf_vector_t pose = perturb(truth, 0.1, 0.0, 0.0);
+  EXPECT_FALSE(refiner.Refine(points, &pose));
+  map_update_cspace(map, 1.0);
+
+  // A correction larger than allowed leaves the pose alone
+  refiner.SetMaxCorrection(0.02, 0.3);
+  pf_vector_t before = pose;
+  EXPECT_FALSE(refiner.Refine(points, &pose));
+  EXPECT_EQ(before.v[0], pose.v[0]);
+  EXPECT_EQ(before.v[1], pose.v[1]);
+  EXPECT_EQ(before.v[2], pose.v[2]);
+  refiner.SetMaxCorrection(0.5, 0.3);
+  EXPECT_TRUE(refiner.Refine(points, &pose));
+
+  // Too few points to say anything
+  std::vector<pf_vector_t> few(points.begin(), points.begin() + 5);
+  pose = perturb(truth, 0.1, 0.0, 0.0);
+  EXPECT_FALSE(refiner.Refine(few, &pose));
+  EXPECT_FALSE(refiner.Refine(std::vector<pf_vector_t>(), &pose));
+
+  map_free(map);
+}
+
+// Track a random walk through the map with the likelihood field model at
+// several particle counts, and compare the error of the best cluster's
+// mean with and without refinement
+TEST(PoseRefiner, AccuracyVsParticles)
+{
+  map_t* map = random_rooms(400, 300, 60, 5);
+  AMCLLaser laser(60, map);
+  laser.SetModelLikelihoodField(0.95, 0.05, 0.2, 2.0);
+  pf_vector_t laser_pose = pf_vector_zero();
+  laser.SetLaserPose(laser_pose);
+  AMCLOdom odom;
+  odom.SetModel(ODOM_MODEL_DIFF, 0.2, 0.2, 0.2, 0.2);
+  AMCLPoseRefiner refiner;
+  refiner.SetMap(map);
+
+  // Path: steps of about 0.2 m between cell centres, turning away from
+  // obstacles
+  srand(6);
+  std::vector<pf_vector_t> path;
+  path.push_back(random_clear_pose(map, 0.6));
+  while(path.size() < 150)
+  {
+    pf_vector_t next = path.back();
+    next.v[2] += (rand() / (double)RAND_MAX - 0.5) * 0.3;
+    next.v[0] = MAP_WXGX(map, MAP_GXWX(map, next.v[0] + 0.2 * cos(next.v[2])));
+    next.v[1] = MAP_WYGY(map, MAP_GYWY(map, next.v[1] + 0.2 * sin(next.v[2])));
+    if(clear_at(map, next.v[0], next.v[1], 0.4))
+      path.push_back(next);
+    else
+      path.back().v[2] += M_PI / 3;
+  }
+
+  const int counts[] = {100, 300, 1000, 3000};
+  double refined_error[4], filter_error[4];
+  for(int c = 0; c < 4; c++)
+  {
+    pf_t* pf = pf_alloc(counts[c], counts[c], 0.0, 0.0, NULL, NULL);
+    pf_set_seed(pf, 7);
+    pf_matrix_t cov = pf_matrix_zero();
+    cov.m[0][0] = cov.m[1][1] = 0.1 * 0.1;
+    cov.m[2][2] = 0.05 * 0.05;
+    pf_init(pf, path[0], cov);
+
+    double filter_sum = 0.0, refined_sum = 0.0, refine_time = 0.0;
+    int steps = 0;
+    for(size_t k = 1; k < path.size(); k++)
+    {
+      AMCLOdomData odata;
+      odata.sensor = &odom;
+      odata.pose = path[k];
+      odata.delta = pf_vector_sub(path[k], path[k-1]);
+      odom.UpdateAction(pf, &odata);
+
+      std::vector<double> ranges;
+      std::vector<pf_vector_t> points;
+      simulate_scan(map, path[k], 360, 10.0, &ranges, &points);
+      AMCLLaserData ldata;
+      ldata.sensor = &laser;
+      ldata.range_count = ranges.size();
+      ldata.range_max = 10.0;
+      ldata.ranges = new double[ldata.range_count][2];
+      for(int i = 0; i < ldata.range_count; i++)
+      {
+        ldata.ranges[i][0] = ranges[i];
+        ldata.ranges[i][1] = -M_PI + i * 2 * M_PI / ldata.range_count;
+      }
+      laser.UpdateSensor(pf, &ldata);
+      pf_update_resample(pf);
+
+      double best = -1;
+      pf_vector_t mean = pf_vector_zero();
+      for(int i = 0; i < pf->sets[pf->current_set].cluster_count; i++)
+      {
+        double weight;
+        pf_vector_t m;
+        pf_matrix_t m_cov;
+        if(pf_get_cluster_stats(pf, i, &weight, &m, &m_cov) && weight > best)
+        {
+          best = weight;
+          mean = m;
+        }
+      }
+      filter_sum += hypot(mean.v[0] - path[k].v[0], mean.v[1] - path[k].v[1]);
+
+      double t0 = now();
+      refiner.Refine(points, &mean);
+      refine_time += now() - t0;
+      refined_sum += hypot(mean.v[0] - path[k].v[0], mean.v[1] - path[k].v[1]);
+      steps++;
+    }
+    filter_error[c] = filter_sum / steps;
+    refined_error[c] = refined_sum / steps;
+    printf("%5d particles: mean error %.4f m, refined %.4f m (%.3f ms per refinement)\n",
+           counts[c], filter_error[c], refined_error[c], refine_time * 1e3 / steps);
+    pf_free(pf);
+  }
+
+  // Refined poses from a few hundred particles beat the filter's own
+  // estimate with ten times as many
+  EXPECT_LT(refined_error[1], filter_error[3]);
+  for(int c = 0; c < 4; c++)
+    EXPECT_LT(refined_error[c], filter_error[c]);
+
+  map_free(map);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -38,6 +38,7 @@
 #ifndef COSTMAP_2D_COSTMAP_2D_H_
 #define COSTMAP_2D_COSTMAP_2D_H_
 
+#include <algorithm>
 #include <vector>
 #include <queue>
 #include <geometry_msgs/Point.h>
@@ -170,7 +171,16 @@ public:
    */
   inline unsigned int getIndex(unsigned int mx, unsigned int my) const
   {
-    return my * size_x_ + mx;
+    if (!toroidal_)
+      return my * size_x_ + mx;
+
+    // in a ring buffer the map starts at cell offset_x_, offset_y_ of the storage
+    unsigned int x = mx + offset_x_, y = my + offset_y_;
+    if (x >= size_x_)
+      x -= size_x_;
+    if (y >= size_y_)
+      y -= size_y_;
+    return y * size_x_ + x;
   }
 
   /**
@@ -183,12 +193,19 @@ public:
   {
     my = index / size_x_;
     mx = index - (my * size_x_);
+    if (toroidal_)
+    {
+      mx = mx >= offset_x_ ? mx - offset_x_ : mx + size_x_ - offset_x_;
+      my = my >= offset_y_ ? my - offset_y_ : my + size_y_ - offset_y_;
+    }
   }
 
   /**
    * @brief  Will return a pointer to the underlying unsigned char array used as the costmap
    * @return A pointer to the underlying unsigned char array storing cost values
    * charMap -1~100
+   * @note   In a ring buffer (see setToroidal()) the cells are not in row
+   * order from the origin: find them with getIndex().
    */
   unsigned char* getCharMap() const;
 
@@ -234,6 +251,19 @@ public:
    */
   double getResolution() const;
 
+  /**
+   * @brief  Store the map as a ring buffer, so that updateOrigin() moves no
+   * data and only clears the cells that come into view. getIndex(),
+   * indexToCells(), getCost(), setCost() and the raytracing take care of
+   * the wrapping, code that walks getCharMap() on its own has to as well.
+   */
+  void setToroidal(bool toroidal);
+
+  bool isToroidal() const
+  {
+    return toroidal_;
+  }
+
   void setDefaultValue(unsigned char c)
   {
     default_value_ = c;
@@ -331,6 +361,45 @@ protected:
       }
     }
 
+  /**
+   * @brief  One past the last index of the row of costmap_ an index is in.
+   * Walking along a row of a ring buffer, the index goes back by size_x_ there.
+   */
+  inline unsigned int rowEnd(unsigned int index) const
+  {
+    return index - index % size_x_ + size_x_;
+  }
+
+  /**
+   * @brief  Move the contents of a map in row order by the cells the origin
+   * moves, as updateOrigin() does, without a copy of the map
+   * @param  map The map to shift, of size_x_ by size_y_ cells
+   * @param  cell_ox The number of cells the origin moves along x
+   * @param  cell_oy The number of cells the origin moves along y
+   * @param  value The value to give the cells that come into view
+   * @note   The shift has to be smaller than the map
+   */
+  template<typename data_type>
+    void shiftMapRegion(data_type* map, int cell_ox, int cell_oy, data_type value)
+    {
+      int size_x = size_x_, size_y = size_y_;
+      unsigned int region_size_x = size_x - abs(cell_ox);
+      int first_y = std::max(0, -cell_oy), last_y = std::min(size_y, size_y - cell_oy);
+      int dest_x = std::max(0, -cell_ox), source_x = std::max(0, cell_ox);
+
+      // a row is read before it is overwritten, when the rows are walked in the direction the origin moves
+      for (int k = 0; k < last_y - first_y; ++k)
+      {
+        int y = cell_oy >= 0 ? first_y + k : last_y - 1 - k;
+        memmove(map + y * size_x + dest_x, map + (y + cell_oy) * size_x + source_x,
+                region_size_x * sizeof(data_type));
+        std::fill(map + y * size_x, map + y * size_x + dest_x, value);
+        std::fill(map + y * size_x + dest_x + region_size_x, map + (y + 1) * size_x, value);
+      }
+      std::fill(map, map + first_y * size_x, value);
+      std::fill(map + last_y * size_x, map + size_y * size_x, value);
+    }
+
   /**
    * @brief  Deletes the costmap, static_map, and markers data structures
    */
@@ -376,6 +445,18 @@ protected:
       double dist = hypot(dx, dy);
       double scale = (dist == 0.0) ? 1.0 : std::min(1.0, max_length / dist);
 
+      // in a ring buffer a step can cross the seam of the storage, so the cells are stepped instead of the offset
+      if (toroidal_)
+      {
+        if (abs_dx >= abs_dy)
+          bresenham2DCells(at, abs_dx, abs_dy, abs_dx / 2, sign(dx), 0, 0, sign(dy), x0, y0,
+                           (unsigned int)(scale * abs_dx));
+        else
+          bresenham2DCells(at, abs_dy, abs_dx, abs_dy / 2, 0, sign(dy), sign(dx), 0, x0, y0,
+                           (unsigned int)(scale * abs_dy));
+        return;
+      }
+
       // if x is dominant
       if (abs_dx >= abs_dy)
       {
@@ -412,6 +493,31 @@ private:
       at(offset);
     }
 
+  /**
+   * @brief  bresenham2D() over map coordinates, for ring buffers
+   */
+  template<class ActionType>
+    inline void bresenham2DCells(ActionType at, unsigned int abs_da, unsigned int abs_db, int error_b, int step_ax,
+                                 int step_ay, int step_bx, int step_by, unsigned int x, unsigned int y,
+                                 unsigned int max_length)
+    {
+      unsigned int end = std::min(max_length, abs_da);
+      for (unsigned int i = 0; i < end; ++i)
+      {
+        at(getIndex(x, y));
+        x += step_ax;
+        y += step_ay;
+        error_b += abs_db;
+        if ((unsigned int)error_b >= abs_da)
+        {
+          x += step_bx;
+          y += step_by;
+          error_b -= abs_da;
+        }
+      }
+      at(getIndex(x, y));
+    }
+
   inline int sign(int x)
   {
     return x > 0 ? 1.0 : -1.0;
@@ -426,6 +532,8 @@ protected:
   double origin_y_;
   unsigned char* costmap_;
   unsigned char default_value_;
+  bool toroidal_;  ///< Whether costmap_ is a ring buffer, see setToroidal()
+  unsigned int offset_x_, offset_y_;  ///< The cell of costmap_ that holds map cell 0, 0 in a ring buffer
 
   class MarkCell
   {
@@ -39,6 +39,7 @@
 #define COSTMAP_2D_COSTMAP_2D_PUBLISHER_H_
 #include <ros/ros.h>
 #include <costmap_2d/costmap_2d.h>
+#include <costmap_2d/dirty_tiles.h>
 #include <nav_msgs/OccupancyGrid.h>
 #include <map_msgs/OccupancyGridUpdate.h>
 #include <tf/transform_datatypes.h>
@@ -72,6 +73,15 @@ public:
     yn_ = std::max(yn, yn_);
   }
 
+  /** @brief Include the given tiles in the changed area, to be sent as one update per box of them. */
+  void updateBounds(const DirtyTiles& dirty)
+  {
+    if (dirty_.hasSameGrid(dirty))
+      dirty_.merge(dirty);
+    else
+      dirty_ = dirty;
+  }
+
   /**
    * @brief  Publishes the visualization data over ROS
    */
@@ -90,6 +100,9 @@ private:
   /** @brief Prepare grid_ message for publication. */
   void prepareGrid();
 
+  /** @brief Publish the cells x0..xn-1, y0..yn-1 as an update, with the costmap locked. */
+  void publishUpdate(unsigned int x0, unsigned int xn, unsigned int y0, unsigned int yn);
+
   /** @brief Publish the latest full costmap to the new subscriber. */
   void onNewSubscription(const ros::SingleSubscriberPublisher& pub);
 
@@ -97,6 +110,7 @@ private:
   Costmap2D* costmap_;
   std::string global_frame_;
   unsigned int x0_, xn_, y0_, yn_;  //x0 y0 mapcell size width*hight
+  DirtyTiles dirty_;
   double saved_origin_x_, saved_origin_y_;
   bool active_;
   bool always_send_full_costmap_;
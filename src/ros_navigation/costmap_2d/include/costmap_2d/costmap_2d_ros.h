@@ -132,6 +132,16 @@ public:
       return layered_costmap_->getCostmap();
     }
 
+  /**
+   * @brief Return the costmap as the last completed update left it, without
+   * waiting for the one in progress. NULL before the first update.
+   *
+   * Same as calling getLayeredCostmap()->getSnapshot(). */
+  CostmapSnapshotPtr getSnapshot()
+    {
+      return layered_costmap_->getSnapshot();
+    }
+
   /**
    * @brief  Returns the global frame of the costmap
    * @return The global frame of the costmap
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2013, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef COSTMAP_2D_COSTMAP_SNAPSHOT_H_
+#define COSTMAP_2D_COSTMAP_SNAPSHOT_H_
+
+#include <costmap_2d/costmap_2d.h>
+#include <costmap_2d/dirty_tiles.h>
+#include <boost/shared_ptr.hpp>
+#include <vector>
+
+namespace costmap_2d
+{
+
+/**
+ * @class CostmapSnapshot
+ * @brief An immutable copy of a costmap as one update left it
+ *
+ * The cells are kept in square tiles that are shared with the snapshot
+ * before whenever they did not change, so taking a snapshot after an
+ * update costs about as much as copying the updated window. Snapshots
+ * are handed out as CostmapSnapshotPtr and may be read from any thread.
+ */
+class CostmapSnapshot
+{
+public:
+  static const unsigned int TILE_SIZE = 64;
+
+  /**
+   * @brief  Copy a costmap in which only the window x0..xn, y0..yn changed since previous was taken
+   * @param costmap The costmap to copy, locked by the caller
+   * @param previous An earlier snapshot of the same costmap, or NULL. Unless it has the same size
+   * and origin as costmap, all of costmap is copied.
+   * @param version The version number of the snapshot
+   * @param dirty If not NULL, only the dirty tiles of the window changed
+   */
+  CostmapSnapshot(const Costmap2D& costmap, const CostmapSnapshot* previous, unsigned int x0, unsigned int xn,
+                  unsigned int y0, unsigned int yn, unsigned long version, const DirtyTiles* dirty = NULL);
+
+  /** @brief Goes up with every snapshot that differs from the one before. */
+  unsigned long getVersion() const
+  {
+    return version_;
+  }
+
+  /** @brief The window of cells that changed since the snapshot before. */
+  void getBounds(unsigned int* x0, unsigned int* xn, unsigned int* y0, unsigned int* yn) const
+  {
+    *x0 = x0_;
+    *xn = xn_;
+    *y0 = y0_;
+    *yn = yn_;
+  }
+
+  /** @brief How many tiles were copied from the costmap rather than shared with the snapshot before. */
+  unsigned int getCopiedTiles() const
+  {
+    return copied_tiles_;
+  }
+
+  unsigned int getSizeInCellsX() const
+  {
+    return size_x_;
+  }
+
+  unsigned int getSizeInCellsY() const
+  {
+    return size_y_;
+  }
+
+  double getResolution() const
+  {
+    return resolution_;
+  }
+
+  double getOriginX() const
+  {
+    return origin_x_;
+  }
+
+  double getOriginY() const
+  {
+    return origin_y_;
+  }
+
+  unsigned char getCost(unsigned int mx, unsigned int my) const
+  {
+    const std::vector<unsigned char>& tile = *tiles_[(my / TILE_SIZE) * tiles_x_ + mx / TILE_SIZE];
+    return tile[(my % TILE_SIZE) * TILE_SIZE + mx % TILE_SIZE];
+  }
+
+  /** @brief Same as Costmap2D::worldToMap(). */
+  bool worldToMap(double wx, double wy, unsigned int& mx, unsigned int& my) const;
+
+  /** @brief Whether both cover the same cells of the world. */
+  bool hasSameGeometry(const CostmapSnapshot& other) const;
+
+  /**
+   * @brief  Make costmap, which must not be toroidal, a copy of this snapshot
+   * @param have A snapshot costmap is known to be a copy of, or NULL. Only the tiles
+   * that differ between it and this snapshot are copied then.
+   */
+  void copyTo(Costmap2D& costmap, const CostmapSnapshot* have = NULL) const;
+
+private:
+  typedef boost::shared_ptr<const std::vector<unsigned char> > Tile;
+
+  Tile copyTile(const Costmap2D& costmap, unsigned int tx, unsigned int ty) const;
+  void pasteTile(Costmap2D& costmap, unsigned int tile) const;
+
+  unsigned long version_;
+  unsigned int size_x_, size_y_;
+  double resolution_, origin_x_, origin_y_;
+  unsigned int x0_, xn_, y0_, yn_;
+  unsigned int tiles_x_, tiles_y_, copied_tiles_;
+  std::vector<Tile> tiles_;  ///< TILE_SIZE x TILE_SIZE cells each, in rows, padded past the edge of the map
+};
+
+typedef boost::shared_ptr<const CostmapSnapshot> CostmapSnapshotPtr;
+
+}  // namespace costmap_2d
+
+#endif  // COSTMAP_2D_COSTMAP_SNAPSHOT_H_
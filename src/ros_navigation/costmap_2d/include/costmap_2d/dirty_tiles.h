@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2013, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef COSTMAP_2D_DIRTY_TILES_H_
+#define COSTMAP_2D_DIRTY_TILES_H_
+
+#include <vector>
+
+namespace costmap_2d
+{
+
+/**
+ * @class DirtyTiles
+ * @brief Which tiles of a fixed grid over a costmap changed in an update
+ *
+ * Several small changes far apart mark only the tiles around each of
+ * them, where a single bounding box would have to cover everything in
+ * between.
+ */
+class DirtyTiles
+{
+public:
+  DirtyTiles();
+
+  /** @brief Cover a map of size_x x size_y cells with tiles of tile_size x tile_size cells, none dirty. */
+  void resize(unsigned int size_x, unsigned int size_y, unsigned int tile_size);
+
+  void clear();
+
+  void markAll();
+
+  /** @brief Mark the tiles holding any of the cells min_i..max_i-1, min_j..max_j-1 that are on the map. */
+  void mark(int min_i, int min_j, int max_i, int max_j);
+
+  /** @brief Also mark every tile that has a cell within cells cells of a dirty one. */
+  void grow(unsigned int cells);
+
+  /** @brief Whether other covers a map of the same size with the same tiles. */
+  bool hasSameGrid(const DirtyTiles& other) const
+  {
+    return size_x_ == other.size_x_ && size_y_ == other.size_y_ && tile_size_ == other.tile_size_;
+  }
+
+  /** @brief Also mark the tiles dirty in other, unless it is on another grid. */
+  void merge(const DirtyTiles& other);
+
+  /** @brief Whether any of the cells min_i..max_i-1, min_j..max_j-1 is in a dirty tile. */
+  bool isDirty(int min_i, int min_j, int max_i, int max_j) const;
+
+  bool empty() const;
+
+  /** @brief The number of cells in dirty tiles. */
+  unsigned int getDirtyCells() const;
+
+  unsigned int getTileSize() const
+  {
+    return tile_size_;
+  }
+
+  /**
+   * @brief  The smallest box of cells min_i..max_i-1, min_j..max_j-1 holding all the dirty tiles
+   * @return False if there are none
+   */
+  bool getBounds(int& min_i, int& min_j, int& max_i, int& max_j) const;
+
+  /**
+   * @brief  Cover the dirty tiles with boxes of cells, appended to boxes as min_i, min_j, max_i, max_j
+   *
+   * Dirty tiles next to each other in a row share a box, and so do rows
+   * of such runs that line up.
+   */
+  void getBoxes(std::vector<int>& boxes) const;
+
+private:
+  bool isDirtyTile(unsigned int tx, unsigned int ty) const
+  {
+    return tiles_[ty * tiles_x_ + tx] != 0;
+  }
+
+  unsigned int size_x_, size_y_, tile_size_;
+  unsigned int tiles_x_, tiles_y_;
+  std::vector<unsigned char> tiles_;
+};
+
+}  // namespace costmap_2d
+
+#endif  // COSTMAP_2D_DIRTY_TILES_H_
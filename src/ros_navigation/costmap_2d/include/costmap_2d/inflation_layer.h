@@ -44,6 +44,9 @@
 #include <costmap_2d/InflationPluginConfig.h>
 #include <dynamic_reconfigure/server.h>
 #include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
+#include <stdint.h>
+#include <vector>
 
 namespace costmap_2d
 {
@@ -72,6 +75,161 @@ public:
   unsigned int src_x_, src_y_;
 };
 
+/**
+ * @class SeenSet
+ * @brief One bit per cell of the costmap, marking the cells inflation has visited
+ *
+ * Each word of 32 bits carries the generation it was written in, so
+ * clear() forgets every mark without touching memory.
+ */
+class SeenSet
+{
+public:
+  SeenSet() : size_(0), generation_(1) {}
+
+  void resize(unsigned int size)
+  {
+    words_.assign((size + 31) / 32, Word());
+    size_ = size;
+    generation_ = 1;
+  }
+
+  unsigned int size() const
+  {
+    return size_;
+  }
+
+  void clear()
+  {
+    if (++generation_ == 0)
+    {
+      // stamps from the last wrap around could match again
+      words_.assign(words_.size(), Word());
+      generation_ = 1;
+    }
+  }
+
+  bool test(unsigned int index) const
+  {
+    const Word& word = words_[index >> 5];
+    return word.generation == generation_ && (word.bits & (1u << (index & 31)));
+  }
+
+  /** @brief Mark a cell, returning false if it was marked already */
+  bool insert(unsigned int index)
+  {
+    Word& word = words_[index >> 5];
+    uint32_t bit = 1u << (index & 31);
+    if (word.generation != generation_)
+    {
+      word.generation = generation_;
+      word.bits = bit;
+      return true;
+    }
+    if (word.bits & bit)
+      return false;
+    word.bits |= bit;
+    return true;
+  }
+
+private:
+  struct Word
+  {
+    Word() : generation(0), bits(0) {}
+    uint32_t generation;
+    uint32_t bits;
+  };
+  std::vector<Word> words_;
+  unsigned int size_;
+  uint32_t generation_;
+};
+
+/**
+ * @brief The wavefront of one inflation pass. Tiles that are inflated at
+ * the same time each get their own.
+ */
+struct InflationWorkspace
+{
+  std::vector<std::vector<CellData> > bins;  ///< cells to visit, by rank of their distance
+  SeenSet seen;
+};
+
+/**
+ * @class BrushfireField
+ * @brief The nearest lethal cell of every cell within some radius of one,
+ * kept up to date as lethal cells come and go.
+ *
+ * A dynamic brushfire after Lau et al., "Improved Updating of Euclidean
+ * Distance Maps and Voronoi Diagrams", IROS 2010: removing an obstacle
+ * raises the cells that took it as their source, adding one lowers the
+ * cells it is nearer to, so an update only visits the cells whose source
+ * changed.
+ */
+class BrushfireField
+{
+public:
+  /** @brief Sources are stored as offsets of one byte each */
+  static const unsigned int MAX_RADIUS = 127;
+
+  BrushfireField();
+
+  /** @brief Forget all obstacles and match a map of size_x by size_y cells */
+  void reset(unsigned int size_x, unsigned int size_y, unsigned int radius);
+
+  bool isObstacle(unsigned int index) const
+  {
+    return cells_[index].flags & OBSTACLE;
+  }
+
+  void setObstacle(unsigned int index);
+  void removeObstacle(unsigned int index);
+
+  /**
+   * @brief Spread the obstacles set and removed since the last call
+   * @return The number of cells visited
+   */
+  unsigned int update();
+
+  /**
+   * @brief The offset of the nearest obstacle within the radius of a cell
+   * @return False if there is none
+   */
+  bool getSource(unsigned int index, int& dx, int& dy) const
+  {
+    const Cell& cell = cells_[index];
+    dx = cell.dx;
+    dy = cell.dy;
+    return cell.flags & HAS_SOURCE;
+  }
+
+private:
+  enum
+  {
+    HAS_SOURCE = 1,
+    OBSTACLE = 2,
+    RAISE = 4
+  };
+
+  struct Cell
+  {
+    Cell() : dx(0), dy(0), flags(0) {}
+    int8_t dx, dy;  ///< from the cell to its source
+    uint8_t flags;
+  };
+
+  void push(unsigned int index, unsigned int distance_sq);
+  void raise(unsigned int index, unsigned int x, unsigned int y);
+  void lower(unsigned int index, unsigned int x, unsigned int y);
+
+  std::vector<Cell> cells_;
+  unsigned int size_x_, size_y_;
+  unsigned int radius_sq_;
+
+  // cells to visit, by squared distance to their source
+  std::vector<std::vector<unsigned int> > open_;
+  unsigned int open_min_, open_count_;
+};
+
 class InflationLayer : public Layer
 {
 public:
@@ -87,7 +245,30 @@ public:
   virtual void onInitialize();
   virtual void updateBounds(double robot_x, double robot_y, double robot_yaw, double* min_x, double* min_y,
                             double* max_x, double* max_y);
+  /** @brief Grows what the layers below changed by the inflation radius, as updateBounds() grows their bounds. */
+  virtual void updateDirtyTiles(double robot_x, double robot_y, double robot_yaw, costmap_2d::DirtyTiles& dirty);
+  /** @brief With incremental inflation, hands the lethal changes of all the boxes to the brushfire at once. */
+  virtual void beginUpdate(costmap_2d::Costmap2D& master_grid, const std::vector<int>& boxes);
   virtual void updateCosts(costmap_2d::Costmap2D& master_grid, int min_i, int min_j, int max_i, int max_j);
+
+  /** @brief Each tile is inflated from the obstacles within the inflation radius of it. */
+  virtual bool isTileSafe()
+  {
+    return true;
+  }
+  virtual unsigned int getTileMargin()
+  {
+    return useBrushfire() ? 0 : 2 * cell_inflation_radius_;
+  }
+  virtual unsigned int getTileHalo()
+  {
+    return useBrushfire() ? 0 : cell_inflation_radius_;
+  }
+  virtual void beginTiles(costmap_2d::Costmap2D& master_grid, int min_i, int min_j, int max_i, int max_j);
+  virtual void endTiles();
+  virtual void updateTileCosts(costmap_2d::Costmap2D& master_grid, int min_i, int min_j, int max_i, int max_j,
+                               int tile_min_i, int tile_min_j, int tile_max_i, int tile_max_j);
+
   virtual bool isDiscretized()
   {
     return true;
@@ -158,32 +339,89 @@ private:
     return cached_costs_[dx][dy];
   }
 
+  /**
+   * @brief  Lookup the rank of pre-computed distances, see cached_bins_
+   */
+  inline unsigned int binLookup(int mx, int my, int src_x, int src_y)
+  {
+    unsigned int dx = abs(mx - src_x);
+    unsigned int dy = abs(my - src_y);
+    return cached_bins_[dx][dy];
+  }
+
   void computeCaches();
   void deleteKernels();
   void inflate_area(int min_i, int min_j, int max_i, int max_j, unsigned char* master_grid);
 
+  /**
+   * @brief  Spread the lethal obstacles found in seeds over the cells in
+   * bounds, writing costs only to the cells in write. Boxes are given as
+   * min_i, min_j, max_i, max_j.
+   */
+  void inflate(InflationWorkspace& workspace, costmap_2d::Costmap2D& master_grid, const int seeds[4],
+               const int bounds[4], const int write[4]);
+
+  /**
+   * @brief Whether costs come from brushfire_ rather than a wavefront. A
+   * rolling window moves under the field, so it always takes the wavefront.
+   */
+  bool useBrushfire() const
+  {
+    return incremental_ && !layered_costmap_->isRolling() && cell_inflation_radius_ <= BrushfireField::MAX_RADIUS;
+  }
+
+  /**
+   * @brief  Hand the lethal cells that came or went in the boxes (min_i,
+   * min_j, max_i, max_j of each in turn) to brushfire_, and let it spread them
+   */
+  void updateBrushfire(costmap_2d::Costmap2D& master_grid, const std::vector<int>& boxes);
+
+  /** @brief  updateBrushfire() over the window, unless beginUpdate() already covered it */
+  void updateBrushfire(costmap_2d::Costmap2D& master_grid, int min_i, int min_j, int max_i, int max_j);
+
+  /** @brief  Write the costs of the box from the sources in brushfire_ */
+  void writeBrushfireCosts(costmap_2d::Costmap2D& master_grid, int min_i, int min_j, int max_i, int max_j);
+
+  /** @brief Take a workspace no other thread is using, and give it back. */
+  InflationWorkspace* acquireWorkspace();
+  void releaseWorkspace(InflationWorkspace* workspace);
+
   unsigned int cellDistance(double world_dist)
   {
     return layered_costmap_->getCostmap()->cellDistance(world_dist);
   }
 
-  inline void enqueue(unsigned int index, unsigned int mx, unsigned int my,
-                      unsigned int src_x, unsigned int src_y);
+  inline void enqueue(InflationWorkspace& workspace, unsigned int current_bin, unsigned int index,
+                      unsigned int mx, unsigned int my, unsigned int src_x, unsigned int src_y);
 
   double inflation_radius_, inscribed_radius_, weight_;
   bool inflate_unknown_;
   unsigned int cell_inflation_radius_;
   unsigned int cached_cell_inflation_radius_;
-  std::map<double, std::vector<CellData> > inflation_cells_;
 
   double resolution_;
 
-  bool* seen_;
-  int seen_size_;
+  bool incremental_;
+  BrushfireField brushfire_;
+  bool brushfire_valid_;  ///< False when brushfire_ has to be rebuilt from the whole map
+  bool brushfire_current_;  ///< brushfire_ already holds the lethal changes of every box of this update
+
+  // Wavefronts are kept here between updates, so that their memory is reused
+  std::vector<boost::shared_ptr<InflationWorkspace> > workspaces_;
+  std::vector<InflationWorkspace*> free_workspaces_;
+  boost::mutex workspace_access_;
 
   unsigned char** cached_costs_;
   double** cached_distances_;
+  /**
+   * Rank of each cached distance among those within the inflation radius,
+   * bin_count_ for those beyond it. Equal distances share a rank, so the
+   * bins are visited in the same order a map keyed by distance would be.
+   */
+  unsigned int** cached_bins_;
+  unsigned int bin_count_;
   double last_min_x_, last_min_y_, last_max_x_, last_max_y_;
+  costmap_2d::DirtyTiles last_dirty_;  ///< what the layers below changed in the last update, in dirty tile mode
 
   dynamic_reconfigure::Server<costmap_2d::InflationPluginConfig> *dsrv_;
   void reconfigureCB(costmap_2d::InflationPluginConfig &config, uint32_t level);
@@ -38,6 +38,7 @@
 #define COSTMAP_2D_LAYER_H_
 
 #include <costmap_2d/costmap_2d.h>
+#include <costmap_2d/dirty_tiles.h>
 #include <costmap_2d/layered_costmap.h>
 #include <string>
 #include <tf/tf.h>
@@ -65,6 +66,17 @@ public:
   virtual void updateBounds(double robot_x, double robot_y, double robot_yaw, double* min_x, double* min_y,
                             double* max_x, double* max_y) {}
 
+  /**
+   * @brief In place of updateBounds() when the LayeredCostmap tracks dirty
+   *        tiles: mark the tiles this layer will change in dirty, which
+   *        holds what the layers before it marked.
+   *
+   * The default marks the bounds updateBounds() reports when started from
+   * an empty box. Layers whose updateBounds() grows the bounds they are
+   * given, rather than adding their own, must override this.
+   */
+  virtual void updateDirtyTiles(double robot_x, double robot_y, double robot_yaw, DirtyTiles& dirty);
+
   /**
    * @brief Actually update the underlying costmap, only within the bounds
    *        calculated during UpdateBounds().
@@ -72,6 +84,63 @@ public:
    */
   virtual void updateCosts(Costmap2D& master_grid, int min_i, int min_j, int max_i, int max_j) {}
 
+  /**
+   * @brief Whether the LayeredCostmap may run this layer's update as
+   *        tiles on several threads at once, see updateTileCosts().
+   */
+  virtual bool isTileSafe()
+  {
+    return false;
+  }
+
+  /**
+   * @brief How many cells outside the update window updateCosts() may
+   *        change. The tiles handed out cover the window grown by this much.
+   */
+  virtual unsigned int getTileMargin()
+  {
+    return 0;
+  }
+
+  /**
+   * @brief How many cells around its tile updateTileCosts() reads from the
+   *        master grid. Tiles closer to each other than this are never
+   *        updated at the same time.
+   */
+  virtual unsigned int getTileHalo()
+  {
+    return 0;
+  }
+
+  /**
+   * @brief Called once per update, after the layers before this one have
+   *        updated every box of it and before this layer updates any.
+   *        boxes holds min_i, min_j, max_i, max_j of each box in turn.
+   */
+  virtual void beginUpdate(Costmap2D& master_grid, const std::vector<int>& boxes) {}
+
+  /**
+   * @brief Called once on the updating thread before the tiles of a
+   *        window are handed to updateTileCosts(), and endTiles() after
+   *        all of them are done.
+   */
+  virtual void beginTiles(Costmap2D& master_grid, int min_i, int min_j, int max_i, int max_j) {}
+  virtual void endTiles() {}
+
+  /**
+   * @brief Update the cells of one tile of the window min_i..max_j.
+   *
+   * Must leave the cells of the tile exactly as updateCosts() over the
+   * whole window would, and must not write outside the tile. Several
+   * tiles are updated at the same time from different threads. The
+   * default suits layers that set every cell on its own.
+   */
+  virtual void updateTileCosts(Costmap2D& master_grid, int min_i, int min_j, int max_i, int max_j,
+                               int tile_min_i, int tile_min_j, int tile_max_i, int tile_max_j)
+  {
+    updateCosts(master_grid, tile_min_i, tile_min_j, tile_max_i, tile_max_j);
+  }
+
   /** @brief Stop publishers. */
   virtual void deactivate() {}
 
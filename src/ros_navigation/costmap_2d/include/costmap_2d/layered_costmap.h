@@ -41,6 +41,11 @@
 #include <costmap_2d/cost_values.h>
 #include <costmap_2d/layer.h>
 #include <costmap_2d/costmap_2d.h>
+#include <costmap_2d/costmap_snapshot.h>
+#include <costmap_2d/dirty_tiles.h>
+#include <costmap_2d/worker_pool.h>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 #include <vector>
 #include <string>
 
@@ -73,6 +78,62 @@ public:
     return global_frame_;
   }
 
+  /**
+   * @brief  Update the layers that are tile safe in tiles of tile_size x tile_size
+   * cells, on thread_count threads. With one thread every layer updates the
+   * whole window in a single updateCosts() call.
+   */
+  void setUpdateThreads(unsigned int thread_count, unsigned int tile_size);
+
+  unsigned int getUpdateThreads()
+  {
+    return pool_ ? pool_->getThreadCount() : 1;
+  }
+
+  /**
+   * @brief  The threads that update the layers in tiles, NULL with just one.
+   * Layers may run jobs of their own on it from updateBounds().
+   */
+  WorkerPool* getWorkerPool()
+  {
+    return pool_.get();
+  }
+
+  /**
+   * @brief  How long the layers' updateCosts() took in the last updateMap(),
+   * both as elapsed time and as time spent summed over all threads. Their
+   * ratio is the speedup from updating in tiles.
+   */
+  void getCostsUpdateTime(double& elapsed, double& work)
+  {
+    elapsed = costs_elapsed_;
+    work = costs_work_;
+  }
+
+  /**
+   * @brief  Track what the layers change in tiles of tile_size x tile_size
+   * cells, through Layer::updateDirtyTiles(), and update only those tiles
+   * rather than one box around all the changes. 0 goes back to the box.
+   */
+  void setDirtyTileSize(unsigned int tile_size);
+
+  bool isTrackingDirtyTiles()
+  {
+    return dirty_tile_size_ > 0;
+  }
+
+  /** @brief The tiles the last updateMap() updated, when tracking dirty tiles. */
+  const DirtyTiles& getDirtyTiles()
+  {
+    return dirty_;
+  }
+
+  /** @brief How many cells the last updateMap() reset and handed to the layers. */
+  unsigned int getUpdatedCells()
+  {
+    return updated_cells_;
+  }
+
   void resizeMap(unsigned int size_x, unsigned int size_y, double resolution, double origin_x, double origin_y,
                  bool size_locked = false);
 
@@ -130,6 +191,21 @@ public:
       return initialized_;
   }
 
+  /**
+   * @brief  The costmap as the last updateMap() left it, or NULL before the first one.
+   * Never waits for an update in progress.
+   */
+  CostmapSnapshotPtr getSnapshot();
+
+  /**
+   * @brief  Make the next snapshot copy all of the costmap, for when it was
+   * changed outside updateMap(). Call with the costmap locked.
+   */
+  void invalidateSnapshot()
+  {
+    snapshot_stale_ = true;
+  }
+
   /** @brief Updates the stored footprint, updates the circumscribed
    * and inscribed radii, and calls onFootprintChanged() in all
    * layers. */
@@ -153,6 +229,16 @@ public:
   double getInscribedRadius() { return inscribed_radius_; }
 
 private:
+  /** @brief Run one layer over the window x0..yn in tiles on the worker pool */
+  void updateCostsInTiles(Layer* layer, int x0, int y0, int xn, int yn);
+  /** @brief Fill windows_ with the box around the bounds the layers report */
+  void collectBounds(double robot_x, double robot_y, double robot_yaw);
+  /** @brief Fill windows_ with boxes covering the tiles the layers mark dirty */
+  void collectDirtyTiles(double robot_x, double robot_y, double robot_yaw);
+  void updateTile(Layer* layer, int x0, int y0, int xn, int yn, unsigned int tile);
+  /** @brief Publish a snapshot of the costmap, of which the window x0..xn, y0..yn was updated */
+  void takeSnapshot(unsigned int x0, unsigned int xn, unsigned int y0, unsigned int yn);
+
   Costmap2D costmap_;
   std::string global_frame_;
 
@@ -169,6 +255,22 @@ private:
   bool size_locked_;
   double circumscribed_radius_, inscribed_radius_;
   std::vector<geometry_msgs::Point> footprint_;
+
+  boost::scoped_ptr<WorkerPool> pool_;
+  unsigned int tile_size_;
+  std::vector<int> tiles_;  ///< min_i, min_j, max_i, max_j of each tile handed out
+  boost::mutex work_mutex_;
+  double costs_elapsed_, costs_work_;
+
+  unsigned int dirty_tile_size_;  ///< 0 when updating one box around the bounds
+  DirtyTiles dirty_;
+  std::vector<int> windows_;  ///< min_i, min_j, max_i, max_j of each box updateMap() updates
+  unsigned int updated_cells_;
+
+  CostmapSnapshotPtr snapshot_;
+  boost::mutex snapshot_mutex_;  ///< only guards handing out snapshot_, the costmap lock guards the rest
+  unsigned long snapshot_version_;
+  bool snapshot_stale_;
 };
 
 }  // namespace costmap_2d
@@ -73,6 +73,14 @@ public:
                             double* max_x, double* max_y);
   virtual void updateCosts(costmap_2d::Costmap2D& master_grid, int min_i, int min_j, int max_i, int max_j);
 
+  virtual bool isTileSafe()
+  {
+    return true;
+  }
+  virtual void beginTiles(costmap_2d::Costmap2D& master_grid, int min_i, int min_j, int max_i, int max_j);
+  virtual void updateTileCosts(costmap_2d::Costmap2D& master_grid, int min_i, int min_j, int max_i, int max_j,
+                               int tile_min_i, int tile_min_j, int tile_max_i, int tile_max_j);
+
   virtual void activate();
   virtual void deactivate();
   virtual void reset();
@@ -144,6 +152,43 @@ protected:
   void updateRaytraceBounds(double ox, double oy, double wx, double wy, double range, double* min_x, double* min_y,
                             double* max_x, double* max_y);
 
+  /** @brief A line raytraceFreespace() clears, to the end cell x, y */
+  struct ClearingRay
+  {
+    unsigned int index, x, y, sector;
+  };
+
+  /** @brief Clears the cells first..last of a line, counting the sensor cell as 0 */
+  class ClearCells
+  {
+  public:
+    ClearCells(unsigned char* costmap, unsigned int first, unsigned int last) :
+        costmap_(costmap), first_(first), last_(last), cell_(0)
+    {
+    }
+    inline void operator()(unsigned int offset)
+    {
+      if (cell_ >= first_ && cell_ <= last_)
+        costmap_[offset] = FREE_SPACE;
+      ++cell_;
+    }
+  private:
+    unsigned char* costmap_;
+    unsigned int first_, last_, cell_;
+  };
+
+  /**
+   * @brief Clear along the rays of the sector 2 * task + parity, from the
+   *        sensor cell x0, y0, leaving the cells before first_cell
+   */
+  void traceClearingRays(unsigned int x0, unsigned int y0, unsigned int cell_raytrace_range, unsigned int first_cell,
+                         unsigned int parity, unsigned int task);
+
+  std::vector<ClearingRay> clearing_rays_;  ///< one per end cell
+  std::vector<unsigned int> clearing_ray_table_;  ///< end cells hashed to 1 + their ray, 0 for none
+  std::vector<unsigned int> clearing_ray_order_;  ///< the rays sector by sector
+  std::vector<unsigned int> clearing_sectors_;  ///< where each sector starts in clearing_ray_order_, and the end
+
   std::vector<geometry_msgs::Point> transformed_footprint_;
   bool footprint_clearing_enabled_;
   void updateFootprint(double robot_x, double robot_y, double robot_yaw, double* min_x, double* min_y, 
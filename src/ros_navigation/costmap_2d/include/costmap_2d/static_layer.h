@@ -64,6 +64,12 @@ public:
                             double* max_x, double* max_y);
   virtual void updateCosts(costmap_2d::Costmap2D& master_grid, int min_i, int min_j, int max_i, int max_j);
 
+  /** @brief In a rolling window every call looks up the map transform, so the tiles could disagree. */
+  virtual bool isTileSafe()
+  {
+    return !layered_costmap_->isRolling();
+  }
+
   virtual void matchSize();
 
 private:
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2013, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef COSTMAP_2D_WORKER_POOL_H_
+#define COSTMAP_2D_WORKER_POOL_H_
+
+#include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace costmap_2d
+{
+
+/**
+ * @class WorkerPool
+ * @brief A fixed set of threads that run the tasks of one job at a time
+ *
+ * run() hands out the task indices [0, task_count) to the workers and to
+ * the calling thread, and returns once every task has finished.
+ */
+class WorkerPool
+{
+public:
+  /**
+   * @brief  Start the pool
+   * @param thread_count The number of threads that run tasks, counting the one that calls run()
+   */
+  explicit WorkerPool(unsigned int thread_count);
+
+  ~WorkerPool();
+
+  unsigned int getThreadCount() const
+  {
+    return thread_count_;
+  }
+
+  /**
+   * @brief  Call fn(i) for every i in [0, task_count) and block until all calls returned
+   */
+  void run(unsigned int task_count, const boost::function<void(unsigned int)>& fn);
+
+private:
+  void workerLoop();
+
+  /** @brief Run tasks of the current job until all have been handed out */
+  void drainTasks();
+
+  unsigned int thread_count_;
+  boost::thread_group workers_;
+
+  boost::mutex mutex_;
+  boost::condition_variable job_cond_;
+  boost::condition_variable done_cond_;
+
+  // The current job, guarded by mutex_
+  const boost::function<void(unsigned int)>* job_fn_;
+  unsigned int job_task_count_;
+  unsigned int job_next_task_;
+  unsigned int job_pending_;
+  unsigned long job_generation_;
+  bool shutdown_;
+};
+
+}  // namespace costmap_2d
+
+#endif  // COSTMAP_2D_WORKER_POOL_H_
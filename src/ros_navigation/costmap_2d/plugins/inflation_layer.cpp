@@ -51,16 +51,164 @@ using costmap_2d::NO_INFORMATION;
 namespace costmap_2d
 {
 
+const unsigned int BrushfireField::MAX_RADIUS;
+
+BrushfireField::BrushfireField()
+  : size_x_(0)
+  , size_y_(0)
+  , radius_sq_(0)
+  , open_min_(0)
+  , open_count_(0)
+{
+}
+
+void BrushfireField::reset(unsigned int size_x, unsigned int size_y, unsigned int radius)
+{
+  radius = std::min(radius, MAX_RADIUS);
+  cells_.assign(size_x * size_y, Cell());
+  size_x_ = size_x;
+  size_y_ = size_y;
+  radius_sq_ = radius * radius;
+  open_.assign(radius_sq_ + 1, std::vector<unsigned int>());
+  open_min_ = 0;
+  open_count_ = 0;
+}
+
+void BrushfireField::setObstacle(unsigned int index)
+{
+  Cell& cell = cells_[index];
+  cell.dx = 0;
+  cell.dy = 0;
+  // a pending raise still has to clear the cells around
+  cell.flags = (cell.flags & RAISE) | HAS_SOURCE | OBSTACLE;
+  push(index, 0);
+}
+
+void BrushfireField::removeObstacle(unsigned int index)
+{
+  Cell& cell = cells_[index];
+  cell.dx = 0;
+  cell.dy = 0;
+  cell.flags = RAISE;
+  push(index, 0);
+}
+
+inline void BrushfireField::push(unsigned int index, unsigned int distance_sq)
+{
+  open_[distance_sq].push_back(index);
+  open_min_ = std::min(open_min_, distance_sq);
+  ++open_count_;
+}
+
+unsigned int BrushfireField::update()
+{
+  unsigned int visited = 0;
+  while (open_count_ > 0)
+  {
+    while (open_[open_min_].empty())
+      ++open_min_;
+    std::vector<unsigned int>& bin = open_[open_min_];
+    unsigned int index = bin.back();
+    bin.pop_back();
+    --open_count_;
+    ++visited;
+
+    unsigned int x = index % size_x_, y = index / size_x_;
+    if (cells_[index].flags & RAISE)
+      raise(index, x, y);
+
+    const Cell& cell = cells_[index];
+    if ((cell.flags & HAS_SOURCE) && (cells_[index + cell.dx + int(size_x_) * cell.dy].flags & OBSTACLE))
+      lower(index, x, y);
+  }
+  open_min_ = 0;
+  return visited;
+}
+
+/**
+ * @brief  Clear the neighbors whose source is gone and queue them to clear
+ * theirs in turn; queue the others to lower the cleared cells again.
+ */
+void BrushfireField::raise(unsigned int index, unsigned int x, unsigned int y)
+{
+  unsigned int min_x = x > 0 ? x - 1 : x, max_x = x + 1 < size_x_ ? x + 1 : x;
+  unsigned int min_y = y > 0 ? y - 1 : y, max_y = y + 1 < size_y_ ? y + 1 : y;
+  for (unsigned int ny = min_y; ny <= max_y; ++ny)
+  {
+    for (unsigned int nx = min_x; nx <= max_x; ++nx)
+    {
+      unsigned int n = ny * size_x_ + nx;
+      Cell& cell = cells_[n];
+      if (n == index || !(cell.flags & HAS_SOURCE) || (cell.flags & RAISE))
+        continue;
+
+      unsigned int distance_sq = cell.dx * cell.dx + cell.dy * cell.dy;
+      if (!(cells_[n + cell.dx + int(size_x_) * cell.dy].flags & OBSTACLE))
+        cell.flags = (cell.flags & ~HAS_SOURCE) | RAISE;
+      push(n, distance_sq);
+    }
+  }
+  cells_[index].flags &= ~RAISE;
+}
+
+/**
+ * @brief  Offer the source of a cell to its neighbors, and queue those it
+ * is nearer to than their own.
+ */
+void BrushfireField::lower(unsigned int index, unsigned int x, unsigned int y)
+{
+  const Cell& cell = cells_[index];
+  int src_x = int(x) + cell.dx, src_y = int(y) + cell.dy;
+
+  unsigned int min_x = x > 0 ? x - 1 : x, max_x = x + 1 < size_x_ ? x + 1 : x;
+  unsigned int min_y = y > 0 ? y - 1 : y, max_y = y + 1 < size_y_ ? y + 1 : y;
+  for (unsigned int ny = min_y; ny <= max_y; ++ny)
+  {
+    for (unsigned int nx = min_x; nx <= max_x; ++nx)
+    {
+      unsigned int n = ny * size_x_ + nx;
+      Cell& neighbor = cells_[n];
+      if (n == index || (neighbor.flags & RAISE))
+        continue;
+
+      int dx = src_x - int(nx), dy = src_y - int(ny);
+      unsigned int distance_sq = dx * dx + dy * dy;
+      if (distance_sq > radius_sq_)
+        continue;
+
+      if (neighbor.flags & HAS_SOURCE)
+      {
+        unsigned int old_sq = neighbor.dx * neighbor.dx + neighbor.dy * neighbor.dy;
+        if (distance_sq > old_sq)
+          continue;
+        // on a tie, only take over from a source that is gone
+        if (distance_sq == old_sq &&
+            (cells_[n + neighbor.dx + int(size_x_) * neighbor.dy].flags & OBSTACLE))
+          continue;
+      }
+
+      neighbor.dx = dx;
+      neighbor.dy = dy;
+      neighbor.flags |= HAS_SOURCE;
+      push(n, distance_sq);
+    }
+  }
+}
+
 InflationLayer::InflationLayer()
   : inflation_radius_(0)
   , weight_(0)
   , inflate_unknown_(false)
   , cell_inflation_radius_(0)
   , cached_cell_inflation_radius_(0)
+  , incremental_(false)
+  , brushfire_valid_(false)
+  , brushfire_current_(false)
   , dsrv_(NULL)
-  , seen_(NULL)
   , cached_costs_(NULL)
   , cached_distances_(NULL)
+  , cached_bins_(NULL)
+  , bin_count_(0)
   , last_min_x_(-std::numeric_limits<float>::max())
   , last_min_y_(-std::numeric_limits<float>::max())
   , last_max_x_(std::numeric_limits<float>::max())
@@ -77,10 +225,8 @@ void InflationLayer::onInitialize()
     boost::unique_lock < boost::recursive_mutex > lock(*inflation_access_);
     ros::NodeHandle nh("~/" + name_), g_nh;
     current_ = true;
-    if (seen_)
-      delete[] seen_;
-    seen_ = NULL;
-    seen_size_ = 0;
+    workspaces_.clear();
+    free_workspaces_.clear();
     need_reinflation_ = false;
 
     // inlfation layer 的动态参数调节
@@ -111,6 +257,15 @@ void InflationLayer::reconfigureCB(costmap_2d::InflationPluginConfig &config, ui
     inflate_unknown_ = config.inflate_unknown;
     need_reinflation_ = true;
   }
+
+  if (incremental_ != config.incremental) {
+    boost::unique_lock < boost::recursive_mutex > lock(*inflation_access_);
+    incremental_ = config.incremental;
+    brushfire_valid_ = false;
+    need_reinflation_ = true;
+    if (incremental_ && layered_costmap_->isRolling())
+      ROS_WARN("Incremental inflation needs a static costmap, the rolling window is inflated whole every update");
+  }
 }
 
 void InflationLayer::matchSize()
@@ -120,17 +275,17 @@ void InflationLayer::matchSize()
   resolution_ = costmap->getResolution();
   cell_inflation_radius_ = cellDistance(inflation_radius_);
   computeCaches();
+  brushfire_valid_ = false;
 
   unsigned int size_x = costmap->getSizeInCellsX(), size_y = costmap->getSizeInCellsY();
-  if (seen_)
-    delete[] seen_;
-  seen_size_ = size_x * size_y;
-  seen_ = new bool[seen_size_];
+  for (unsigned int i = 0; i < workspaces_.size(); ++i)
+    workspaces_[i]->seen.resize(size_x * size_y);
 }
 
 void InflationLayer::updateBounds(double robot_x, double robot_y, double robot_yaw, double* min_x,
                                            double* min_y, double* max_x, double* max_y)
 {
+  brushfire_current_ = false;
   if (need_reinflation_)
   {
     last_min_x_ = *min_x;
@@ -163,6 +318,25 @@ void InflationLayer::updateBounds(double robot_x, double robot_y, double robot_y
   }
 }
 
+void InflationLayer::updateDirtyTiles(double robot_x, double robot_y, double robot_yaw,
+                                      costmap_2d::DirtyTiles& dirty)
+{
+  brushfire_current_ = false;
+  if (need_reinflation_)
+  {
+    last_dirty_ = dirty;
+    dirty.markAll();
+    need_reinflation_ = false;
+    return;
+  }
+
+  // like the bounds, also cover what changed in the last update
+  costmap_2d::DirtyTiles changed = dirty;
+  dirty.merge(last_dirty_);
+  last_dirty_ = changed;
+  dirty.grow(cell_inflation_radius_);
+}
+
 void InflationLayer::onFootprintChanged()
 {
   inscribed_radius_ = layered_costmap_->getInscribedRadius();
@@ -175,31 +349,32 @@ void InflationLayer::onFootprintChanged()
             layered_costmap_->getFootprint().size(), inscribed_radius_, inflation_radius_);
 }
 
-void InflationLayer::updateCosts(costmap_2d::Costmap2D& master_grid, int min_i, int min_j, int max_i, int max_j)
+void InflationLayer::beginUpdate(costmap_2d::Costmap2D& master_grid, const std::vector<int>& boxes)
 {
   boost::unique_lock < boost::recursive_mutex > lock(*inflation_access_);
-  if (!enabled_ || (cell_inflation_radius_ == 0))
+  if (!enabled_ || cell_inflation_radius_ == 0 || !useBrushfire())
     return;
 
-  // make sure the inflation list is empty at the beginning of the cycle (should always be true)
-  ROS_ASSERT_MSG(inflation_cells_.empty(), "The inflation list must be empty at the beginning of inflation");
+  // a box written before the lethal cells of a later one reach the field
+  // would miss the costs they spread into it
+  updateBrushfire(master_grid, boxes);
+  brushfire_current_ = true;
+}
 
-  unsigned char* master_array = master_grid.getCharMap();
-  unsigned int size_x = master_grid.getSizeInCellsX(), size_y = master_grid.getSizeInCellsY();
+void InflationLayer::updateCosts(costmap_2d::Costmap2D& master_grid, int min_i, int min_j, int max_i, int max_j)
+{
+  boost::unique_lock < boost::recursive_mutex > lock(*inflation_access_);
+  if (!enabled_ || (cell_inflation_radius_ == 0))
+    return;
 
-  if (seen_ == NULL) {
-    ROS_WARN("InflationLayer::updateCosts(): seen_ array is NULL");
-    seen_size_ = size_x * size_y;
-    seen_ = new bool[seen_size_];
-  }
-  else if (seen_size_ != size_x * size_y)
+  if (useBrushfire())
   {
-    ROS_WARN("InflationLayer::updateCosts(): seen_ array size is wrong");
-    delete[] seen_;
-    seen_size_ = size_x * size_y;
-    seen_ = new bool[seen_size_];
+    updateBrushfire(master_grid, min_i, min_j, max_i, max_j);
+    writeBrushfireCosts(master_grid, min_i, min_j, max_i, max_j);
+    return;
   }
-  memset(seen_, false, size_x * size_y * sizeof(bool));
+
+  unsigned int size_x = master_grid.getSizeInCellsX(), size_y = master_grid.getSizeInCellsY();
 
   // We need to include in the inflation cells outside the bounding
   // box min_i...max_j, by the amount cell_inflation_radius_.  Cells
@@ -215,14 +390,81 @@ void InflationLayer::updateCosts(costmap_2d::Costmap2D& master_grid, int min_i,
   max_i = std::min(int(size_x), max_i);
   max_j = std::min(int(size_y), max_j);
 
-  // Inflation list; we append cells to visit in a list associated with its distance to the nearest obstacle
-  // We use a map<distance, list> to emulate the priority queue used before, with a notable performance boost
+  const int seeds[4] = {min_i, min_j, max_i, max_j};
+  const int whole_map[4] = {0, 0, int(size_x), int(size_y)};
+  InflationWorkspace* workspace = acquireWorkspace();
+  inflate(*workspace, master_grid, seeds, whole_map, whole_map);
+  releaseWorkspace(workspace);
+}
+
+void InflationLayer::beginTiles(costmap_2d::Costmap2D& master_grid, int min_i, int min_j, int max_i, int max_j)
+{
+  // held until endTiles(), the tiles themselves don't lock
+  inflation_access_->lock();
+
+  // the sources are settled here, the tiles only look them up
+  if (enabled_ && cell_inflation_radius_ != 0 && useBrushfire())
+    updateBrushfire(master_grid, min_i, min_j, max_i, max_j);
+}
+
+void InflationLayer::endTiles()
+{
+  inflation_access_->unlock();
+}
+
+void InflationLayer::updateTileCosts(costmap_2d::Costmap2D& master_grid, int min_i, int min_j, int max_i, int max_j,
+                                     int tile_min_i, int tile_min_j, int tile_max_i, int tile_max_j)
+{
+  if (!enabled_ || (cell_inflation_radius_ == 0))
+    return;
+
+  if (useBrushfire())
+  {
+    writeBrushfireCosts(master_grid, tile_min_i, tile_min_j, tile_max_i, tile_max_j);
+    return;
+  }
+
+  int size_x = master_grid.getSizeInCellsX(), size_y = master_grid.getSizeInCellsY();
+  int radius = cell_inflation_radius_;
+
+  // The wavefront that settles a cell of the tile starts at obstacles
+  // within the inflation radius of it, and runs over cells no farther out,
+  // so it is reproduced by inflating the tile grown by the radius.
+  const int bounds[4] = {std::max(0, tile_min_i - radius), std::max(0, tile_min_j - radius),
+                         std::min(size_x, tile_max_i + radius), std::min(size_y, tile_max_j + radius)};
+
+  // of those obstacles, use the ones updateCosts() would start from
+  const int seeds[4] = {std::max(bounds[0], min_i - radius), std::max(bounds[1], min_j - radius),
+                        std::min(bounds[2], max_i + radius), std::min(bounds[3], max_j + radius)};
+  if (seeds[0] >= seeds[2] || seeds[1] >= seeds[3])
+    return;
+
+  const int tile[4] = {tile_min_i, tile_min_j, tile_max_i, tile_max_j};
+  InflationWorkspace* workspace = acquireWorkspace();
+  inflate(*workspace, master_grid, seeds, bounds, tile);
+  releaseWorkspace(workspace);
+}
+
+void InflationLayer::inflate(InflationWorkspace& workspace, costmap_2d::Costmap2D& master_grid, const int seeds[4],
+                             const int bounds[4], const int write[4])
+{
+  unsigned char* master_array = master_grid.getCharMap();
+  unsigned int size_x = master_grid.getSizeInCellsX(), size_y = master_grid.getSizeInCellsY();
+
+  if (workspace.seen.size() != size_x * size_y)
+    workspace.seen.resize(size_x * size_y);
+  workspace.seen.clear();
+  if (workspace.bins.size() < bin_count_)
+    workspace.bins.resize(bin_count_);
+
+  // Inflation list; we append cells to visit in a list associated with the rank of its distance to the nearest
+  // obstacle. The ranks are precomputed, so the bins emulate the priority queue used before without any sorting
 
   // Start with lethal obstacles: by definition distance is 0.0
-  std::vector<CellData>& obs_bin = inflation_cells_[0.0];
-  for (int j = min_j; j < max_j; j++)
+  std::vector<CellData>& obs_bin = workspace.bins[0];
+  for (int j = seeds[1]; j < seeds[3]; j++)
   {
-    for (int i = min_i; i < max_i; i++)
+    for (int i = seeds[0]; i < seeds[2]; i++)
     {
       int index = master_grid.getIndex(i, j);
       unsigned char cost = master_array[index];
@@ -235,76 +477,192 @@ void InflationLayer::updateCosts(costmap_2d::Costmap2D& master_grid, int min_i,
 
   // Process cells by increasing distance; new cells are appended to the corresponding distance bin, so they
   // can overtake previously inserted but farther away cells
-  std::map<double, std::vector<CellData> >::iterator bin;
-  for (bin = inflation_cells_.begin(); bin != inflation_cells_.end(); ++bin)
+  for (unsigned int bin = 0; bin < bin_count_; ++bin)
   {
-    for (int i = 0; i < bin->second.size(); ++i)
+    std::vector<CellData>& cells = workspace.bins[bin];
+    for (unsigned int i = 0; i < cells.size(); ++i)
     {
-      // process all cells at distance dist_bin.first
-      const CellData& cell = bin->second[i];
+      // process all cells at distance rank bin; read the cell before enqueueing, which may grow the bin
+      const CellData& cell = cells[i];
 
       unsigned int index = cell.index_;
 
       // ignore if already visited
-      if (seen_[index])
+      if (!workspace.seen.insert(index))
       {
         continue;
       }
 
-      seen_[index] = true;
-
       unsigned int mx = cell.x_;
       unsigned int my = cell.y_;
       unsigned int sx = cell.src_x_;
       unsigned int sy = cell.src_y_;
 
       // assign the cost associated with the distance from an obstacle to the cell
-      unsigned char cost = costLookup(mx, my, sx, sy);
-      unsigned char old_cost = master_array[index];
-      if (old_cost == NO_INFORMATION && (inflate_unknown_ ? (cost > FREE_SPACE) : (cost >= INSCRIBED_INFLATED_OBSTACLE)))
-        master_array[index] = cost;
-      else
-        master_array[index] = std::max(old_cost, cost);
+      if (int(mx) >= write[0] && int(my) >= write[1] && int(mx) < write[2] && int(my) < write[3])
+      {
+        unsigned char cost = costLookup(mx, my, sx, sy);
+        unsigned char old_cost = master_array[index];
+        if (old_cost == NO_INFORMATION && (inflate_unknown_ ? (cost > FREE_SPACE) : (cost >= INSCRIBED_INFLATED_OBSTACLE)))
+          master_array[index] = cost;
+        else
+          master_array[index] = std::max(old_cost, cost);
+      }
 
       // attempt to put the neighbors of the current cell onto the inflation list
-      if (mx > 0)
-        enqueue(index - 1, mx - 1, my, sx, sy);
-      if (my > 0)
-        enqueue(index - size_x, mx, my - 1, sx, sy);
-      if (mx < size_x - 1)
-        enqueue(index + 1, mx + 1, my, sx, sy);
-      if (my < size_y - 1)
-        enqueue(index + size_x, mx, my + 1, sx, sy);
+      if (int(mx) > bounds[0])
+        enqueue(workspace, bin, index - 1, mx - 1, my, sx, sy);
+      if (int(my) > bounds[1])
+        enqueue(workspace, bin, index - size_x, mx, my - 1, sx, sy);
+      if (int(mx) < bounds[2] - 1)
+        enqueue(workspace, bin, index + 1, mx + 1, my, sx, sy);
+      if (int(my) < bounds[3] - 1)
+        enqueue(workspace, bin, index + size_x, mx, my + 1, sx, sy);
     }
+    cells.clear();
   }
-
-  inflation_cells_.clear();
 }
 
 /**
  * @brief  Given an index of a cell in the costmap, place it into a list pending for obstacle inflation
- * @param  grid The costmap
+ * @param  workspace The wavefront to add the cell to
+ * @param  current_bin The bin being processed
  * @param  index The index of the cell
  * @param  mx The x coordinate of the cell (can be computed from the index, but saves time to store it)
  * @param  my The y coordinate of the cell (can be computed from the index, but saves time to store it)
  * @param  src_x The x index of the obstacle point inflation started at
  * @param  src_y The y index of the obstacle point inflation started at
  */
-inline void InflationLayer::enqueue(unsigned int index, unsigned int mx, unsigned int my,
-                                    unsigned int src_x, unsigned int src_y)
+inline void InflationLayer::enqueue(InflationWorkspace& workspace, unsigned int current_bin, unsigned int index,
+                                    unsigned int mx, unsigned int my, unsigned int src_x, unsigned int src_y)
 {
-  if (!seen_[index])
+  if (!workspace.seen.test(index))
   {
     // we compute our distance table one cell further than the inflation radius dictates so we can make the check below
-    double distance = distanceLookup(mx, my, src_x, src_y);
+    unsigned int bin = binLookup(mx, my, src_x, src_y);
 
     // we only want to put the cell in the list if it is within the inflation radius of the obstacle point
-    if (distance > cell_inflation_radius_)
+    if (bin >= bin_count_)
+      return;
+
+    // a bin that was already processed is never looked at again
+    if (bin < current_bin)
       return;
 
     // push the cell data onto the inflation list and mark
-    inflation_cells_[distance].push_back(CellData(index, mx, my, src_x, src_y));
+    workspace.bins[bin].push_back(CellData(index, mx, my, src_x, src_y));
+  }
+}
+
+void InflationLayer::updateBrushfire(costmap_2d::Costmap2D& master_grid, int min_i, int min_j, int max_i, int max_j)
+{
+  if (brushfire_current_ && brushfire_valid_)
+    return;
+
+  std::vector<int> window(4);
+  window[0] = min_i;
+  window[1] = min_j;
+  window[2] = max_i;
+  window[3] = max_j;
+  updateBrushfire(master_grid, window);
+}
+
+void InflationLayer::updateBrushfire(costmap_2d::Costmap2D& master_grid, const std::vector<int>& boxes)
+{
+  unsigned char* master_array = master_grid.getCharMap();
+  unsigned int size_x = master_grid.getSizeInCellsX(), size_y = master_grid.getSizeInCellsY();
+
+  std::vector<int> whole_map;
+  const std::vector<int>* scan = &boxes;
+  if (!brushfire_valid_)
+  {
+    // outside the boxes the master grid still holds the lethal cells of
+    // earlier updates, which the new field has to know about as well
+    brushfire_.reset(size_x, size_y, cell_inflation_radius_);
+    brushfire_valid_ = true;
+    whole_map.push_back(0);
+    whole_map.push_back(0);
+    whole_map.push_back(size_x);
+    whole_map.push_back(size_y);
+    scan = &whole_map;
+  }
+
+  // Lethal cells can only have changed inside the boxes of the update: the
+  // other layers write nowhere else
+  unsigned int changed = 0;
+  for (unsigned int b = 0; b + 3 < scan->size(); b += 4)
+  {
+    int min_i = std::max(0, (*scan)[b]);
+    int min_j = std::max(0, (*scan)[b + 1]);
+    int max_i = std::min(int(size_x), (*scan)[b + 2]);
+    int max_j = std::min(int(size_y), (*scan)[b + 3]);
+    for (int j = min_j; j < max_j; j++)
+    {
+      unsigned int index = master_grid.getIndex(min_i, j);
+      for (int i = min_i; i < max_i; i++, index++)
+      {
+        bool lethal = master_array[index] == LETHAL_OBSTACLE;
+        if (lethal == brushfire_.isObstacle(index))
+          continue;
+        if (lethal)
+          brushfire_.setObstacle(index);
+        else
+          brushfire_.removeObstacle(index);
+        ++changed;
+      }
+    }
+  }
+
+  unsigned int visited = brushfire_.update();
+  ROS_DEBUG("InflationLayer: %u lethal cells changed, %u cells visited", changed, visited);
+}
+
+void InflationLayer::writeBrushfireCosts(costmap_2d::Costmap2D& master_grid, int min_i, int min_j, int max_i,
+                                         int max_j)
+{
+  unsigned char* master_array = master_grid.getCharMap();
+  min_i = std::max(0, min_i);
+  min_j = std::max(0, min_j);
+  max_i = std::min(int(master_grid.getSizeInCellsX()), max_i);
+  max_j = std::min(int(master_grid.getSizeInCellsY()), max_j);
+
+  for (int j = min_j; j < max_j; j++)
+  {
+    unsigned int index = master_grid.getIndex(min_i, j);
+    for (int i = min_i; i < max_i; i++, index++)
+    {
+      int dx, dy;
+      if (!brushfire_.getSource(index, dx, dy))
+        continue;
+
+      // the same rule the wavefront applies
+      unsigned char cost = cached_costs_[abs(dx)][abs(dy)];
+      unsigned char old_cost = master_array[index];
+      if (old_cost == NO_INFORMATION && (inflate_unknown_ ? (cost > FREE_SPACE) : (cost >= INSCRIBED_INFLATED_OBSTACLE)))
+        master_array[index] = cost;
+      else
+        master_array[index] = std::max(old_cost, cost);
+    }
+  }
+}
+
+InflationWorkspace* InflationLayer::acquireWorkspace()
+{
+  boost::mutex::scoped_lock lock(workspace_access_);
+  if (free_workspaces_.empty())
+  {
+    workspaces_.push_back(boost::shared_ptr<InflationWorkspace>(new InflationWorkspace()));
+    return workspaces_.back().get();
   }
+  InflationWorkspace* workspace = free_workspaces_.back();
+  free_workspaces_.pop_back();
+  return workspace;
+}
+
+void InflationLayer::releaseWorkspace(InflationWorkspace* workspace)
+{
+  boost::mutex::scoped_lock lock(workspace_access_);
+  free_workspaces_.push_back(workspace);
 }
 
 void InflationLayer::computeCaches()
@@ -319,18 +677,37 @@ void InflationLayer::computeCaches()
 
     cached_costs_ = new unsigned char*[cell_inflation_radius_ + 2];
     cached_distances_ = new double*[cell_inflation_radius_ + 2];
+    cached_bins_ = new unsigned int*[cell_inflation_radius_ + 2];
 
+    std::vector<double> distances;
     for (unsigned int i = 0; i <= cell_inflation_radius_ + 1; ++i)
     {
       cached_costs_[i] = new unsigned char[cell_inflation_radius_ + 2];
       cached_distances_[i] = new double[cell_inflation_radius_ + 2];
+      cached_bins_[i] = new unsigned int[cell_inflation_radius_ + 2];
       for (unsigned int j = 0; j <= cell_inflation_radius_ + 1; ++j)
       {
         cached_distances_[i][j] = hypot(i, j);
+        if (cached_distances_[i][j] <= cell_inflation_radius_)
+          distances.push_back(cached_distances_[i][j]);
+      }
+    }
+
+    // the bins of the inflation wavefront, nearest first
+    std::sort(distances.begin(), distances.end());
+    distances.erase(std::unique(distances.begin(), distances.end()), distances.end());
+    bin_count_ = distances.size();
+    for (unsigned int i = 0; i <= cell_inflation_radius_ + 1; ++i)
+    {
+      for (unsigned int j = 0; j <= cell_inflation_radius_ + 1; ++j)
+      {
+        cached_bins_[i][j] = std::lower_bound(distances.begin(), distances.end(), cached_distances_[i][j]) -
+                             distances.begin();
       }
     }
 
     cached_cell_inflation_radius_ = cell_inflation_radius_;
+    brushfire_valid_ = false;
   }
 
   for (unsigned int i = 0; i <= cell_inflation_radius_ + 1; ++i)
@@ -356,6 +733,17 @@ void InflationLayer::deleteKernels()
     cached_distances_ = NULL;
   }
 
+  if (cached_bins_ != NULL)
+  {
+    for (unsigned int i = 0; i <= cached_cell_inflation_radius_ + 1; ++i)
+    {
+      if (cached_bins_[i])
+        delete[] cached_bins_[i];
+    }
+    delete[] cached_bins_;
+    cached_bins_ = NULL;
+  }
+
   if (cached_costs_ != NULL)
   {
     for (unsigned int i = 0; i <= cached_cell_inflation_radius_ + 1; ++i)
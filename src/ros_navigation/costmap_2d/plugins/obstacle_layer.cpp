@@ -38,6 +38,10 @@
 #include <costmap_2d/obstacle_layer.h>
 #include <costmap_2d/costmap_math.h>
 #include <pluginlib/class_list_macros.h>
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <climits>
+#include <cmath>
 
 PLUGINLIB_EXPORT_CLASS(costmap_2d::ObstacleLayer, costmap_2d::Layer)
 
@@ -56,6 +60,11 @@ void ObstacleLayer::onInitialize()
   ros::NodeHandle nh("~/" + name_), g_nh;
   rolling_window_ = layered_costmap_->isRolling();
 
+  // a rolling window kept as a ring buffer only clears the cells that come into view when it moves
+  bool ring_buffer;
+  nh.param("ring_buffer", ring_buffer, false);
+  setToroidal(rolling_window_ && ring_buffer);
+
   bool track_unknown_space;
   nh.param("track_unknown_space", track_unknown_space, layered_costmap_->isTrackingUnknown());
   if (track_unknown_space)
@@ -432,22 +441,36 @@ void ObstacleLayer::updateFootprint(double robot_x, double robot_y, double robot
 
 //怎么更新map的cost的
 void ObstacleLayer::updateCosts(costmap_2d::Costmap2D& master_grid, int min_i, int min_j, int max_i, int max_j)
+{
+  beginTiles(master_grid, min_i, min_j, max_i, max_j);
+  updateTileCosts(master_grid, min_i, min_j, max_i, max_j, min_i, min_j, max_i, max_j);
+}
+
+void ObstacleLayer::beginTiles(costmap_2d::Costmap2D& master_grid, int min_i, int min_j, int max_i, int max_j)
 {
   if (!enabled_)
     return;
 
+  // this writes our own grid, so it is done once and not per tile
   if (footprint_clearing_enabled_)
   {
     setConvexPolygonCost(transformed_footprint_, costmap_2d::FREE_SPACE);
   }
+}
+
+void ObstacleLayer::updateTileCosts(costmap_2d::Costmap2D& master_grid, int min_i, int min_j, int max_i, int max_j,
+                                    int tile_min_i, int tile_min_j, int tile_max_i, int tile_max_j)
+{
+  if (!enabled_)
+    return;
 
   switch (combination_method_)
   {
     case 0:  // Overwrite
-      updateWithOverwrite(master_grid, min_i, min_j, max_i, max_j);
+      updateWithOverwrite(master_grid, tile_min_i, tile_min_j, tile_max_i, tile_max_j);
       break;
     case 1:  // Maximum
-      updateWithMax(master_grid, min_i, min_j, max_i, max_j);
+      updateWithMax(master_grid, tile_min_i, tile_min_j, tile_max_i, tile_max_j);
       break;
     default:  // Nothing
       break;
@@ -508,7 +531,7 @@ void ObstacleLayer::raytraceFreespace(const Observation& clearing_observation, d
 {
   double ox = clearing_observation.origin_.x;
   double oy = clearing_observation.origin_.y;
-  pcl::PointCloud < pcl::PointXYZ > cloud = *(clearing_observation.cloud_);
+  const pcl::PointCloud < pcl::PointXYZ >& cloud = *(clearing_observation.cloud_);
 
   // get the map coordinates of the origin of the sensor
   unsigned int x0, y0;
@@ -528,6 +551,16 @@ void ObstacleLayer::raytraceFreespace(const Observation& clearing_observation, d
 
   touch(ox, oy, min_x, min_y, max_x, max_y);
 
+  // All the points that end in one cell trace the same line, and a dense
+  // cloud puts thousands of them in a few cells. So the end cells are
+  // hashed, and only one ray is traced to each.
+  unsigned int table_bits = 1;
+  while ((1u << table_bits) < 2 * cloud.points.size())
+    ++table_bits;
+  unsigned int table_mask = (1u << table_bits) - 1;
+  clearing_ray_table_.assign(table_mask + 1, 0);
+  clearing_rays_.clear();
+
   // for each point in the cloud, we want to trace a line from the origin and clear obstacles along it
   for (unsigned int i = 0; i < cloud.points.size(); ++i)
   {
@@ -574,12 +607,81 @@ void ObstacleLayer::raytraceFreespace(const Observation& clearing_observation, d
     if (!worldToMap(wx, wy, x1, y1))
       continue;
 
-    unsigned int cell_raytrace_range = cellDistance(clearing_observation.raytrace_range_);
+    // every point still widens the bounds, as if it had its own ray
+    updateRaytraceBounds(ox, oy, wx, wy, clearing_observation.raytrace_range_, min_x, min_y, max_x, max_y);
+
+    unsigned int index = getIndex(x1, y1);
+    unsigned int slot = (index * 2654435761u) >> (32 - table_bits);
+    while (clearing_ray_table_[slot] != 0 && clearing_rays_[clearing_ray_table_[slot] - 1].index != index)
+      slot = (slot + 1) & table_mask;
+
+    if (clearing_ray_table_[slot] == 0)
+    {
+      ClearingRay ray = {index, x1, y1, 0};
+      clearing_rays_.push_back(ray);
+      clearing_ray_table_[slot] = clearing_rays_.size();
+    }
+  }
+
+  unsigned int cell_raytrace_range = cellDistance(clearing_observation.raytrace_range_);
+  WorkerPool* pool = layered_costmap_->getWorkerPool();
+  if (pool == NULL || clearing_rays_.size() < 64)
+  {
     MarkCell marker(costmap_, FREE_SPACE);
-    // and finally... we can execute our trace to clear obstacles along that line
-    raytraceLine(marker, x0, y0, x1, y1, cell_raytrace_range);
+    for (unsigned int i = 0; i < clearing_rays_.size(); ++i)
+    {
+      // and finally... we can execute our trace to clear obstacles along that line
+      raytraceLine(marker, x0, y0, clearing_rays_[i].x, clearing_rays_[i].y, cell_raytrace_range);
+    }
+    return;
+  }
 
-    updateRaytraceBounds(ox, oy, wx, wy, clearing_observation.raytrace_range_, min_x, min_y, max_x, max_y);
+  // With several update threads the rays are split into an even number of
+  // angular sectors around the sensor cell, and sorted sector by sector
+  unsigned int sectors = 4 * pool->getThreadCount();
+  clearing_sectors_.assign(sectors + 1, 0);
+  for (unsigned int i = 0; i < clearing_rays_.size(); ++i)
+  {
+    ClearingRay& ray = clearing_rays_[i];
+    double angle = atan2(double(ray.y) - y0, double(ray.x) - x0);
+    ray.sector = std::min(sectors - 1, (unsigned int)((angle + M_PI) / (2 * M_PI) * sectors));
+    ++clearing_sectors_[ray.sector + 1];
+  }
+  for (unsigned int sector = 0; sector < sectors; ++sector)
+    clearing_sectors_[sector + 1] += clearing_sectors_[sector];
+
+  clearing_ray_order_.resize(clearing_rays_.size());
+  std::vector<unsigned int> next(clearing_sectors_.begin(), clearing_sectors_.end() - 1);
+  for (unsigned int i = 0; i < clearing_rays_.size(); ++i)
+    clearing_ray_order_[next[clearing_rays_[i].sector]++] = i;
+
+  // The cells of a line stay within half a cell of the straight one, so two
+  // rays at least a sector apart only meet within 0.5 / sin(pi / sectors)
+  // cells of the sensor. The cells that close are cleared here; past them
+  // the even sectors, then the odd ones, are traced at the same time, and
+  // no two of them write the same cell.
+  unsigned int shared_cells = (unsigned int)(0.5 / sin(M_PI / sectors)) + 1;
+  // (a line the length of this reaches past shared_cells steps whatever its slope)
+  unsigned int near_length = std::min(cell_raytrace_range, 2 * (shared_cells + 2));
+  for (unsigned int i = 0; i < clearing_rays_.size(); ++i)
+  {
+    ClearCells near_cells(costmap_, 0, shared_cells);
+    raytraceLine(near_cells, x0, y0, clearing_rays_[i].x, clearing_rays_[i].y, near_length);
+  }
+  for (unsigned int parity = 0; parity < 2; ++parity)
+    pool->run(sectors / 2, boost::bind(&ObstacleLayer::traceClearingRays, this, x0, y0, cell_raytrace_range,
+                                       shared_cells + 1, parity, _1));
+}
+
+void ObstacleLayer::traceClearingRays(unsigned int x0, unsigned int y0, unsigned int cell_raytrace_range,
+                                      unsigned int first_cell, unsigned int parity, unsigned int task)
+{
+  unsigned int sector = 2 * task + parity;
+  for (unsigned int i = clearing_sectors_[sector]; i < clearing_sectors_[sector + 1]; ++i)
+  {
+    const ClearingRay& ray = clearing_rays_[clearing_ray_order_[i]];
+    ClearCells far_cells(costmap_, first_cell, UINT_MAX);
+    raytraceLine(far_cells, x0, y0, ray.x, ray.y, cell_raytrace_range);
   }
 }
 
@@ -57,6 +57,13 @@ void VoxelLayer::onInitialize()
   ObstacleLayer::onInitialize();
   ros::NodeHandle private_nh("~/" + name_);
 
+  // the voxel grid raytraces over its columns in row order
+  if (isToroidal())
+  {
+    ROS_WARN("The voxel layer %s cannot be a ring buffer, it moves its data in place instead", name_.c_str());
+    setToroidal(false);
+  }
+
   private_nh.param("publish_voxel_map", publish_voxel_, false);
   if (publish_voxel_)
     voxel_pub_ = private_nh.advertise < costmap_2d::VoxelGrid > ("voxel_grid", 1);
@@ -399,44 +406,26 @@ void VoxelLayer::updateOrigin(double new_origin_x, double new_origin_y)
   int size_x = size_x_;
   int size_y = size_y_;
 
-  // we need to compute the overlap of the new and existing windows
-  int lower_left_x, lower_left_y, upper_right_x, upper_right_y;
-  lower_left_x = std::min(std::max(cell_ox, 0), size_x);
-  lower_left_y = std::min(std::max(cell_oy, 0), size_y);
-  upper_right_x = std::min(std::max(cell_ox + size_x, 0), size_x);
-  upper_right_y = std::min(std::max(cell_oy + size_y, 0), size_y);
-
-  unsigned int cell_size_x = upper_right_x - lower_left_x;
-  unsigned int cell_size_y = upper_right_y - lower_left_y;
-
-  // we need a map to store the obstacles in the window temporarily
-  unsigned char* local_map = new unsigned char[cell_size_x * cell_size_y];
-  unsigned int* local_voxel_map = new unsigned int[cell_size_x * cell_size_y];
-  unsigned int* voxel_map = voxel_grid_.getData();
-
-  // copy the local window in the costmap to the local map
-  copyMapRegion(costmap_, lower_left_x, lower_left_y, size_x_, local_map, 0, 0, cell_size_x, cell_size_x, cell_size_y);
-  copyMapRegion(voxel_map, lower_left_x, lower_left_y, size_x_, local_voxel_map, 0, 0, cell_size_x, cell_size_x,
-                cell_size_y);
+  if (cell_ox == 0 && cell_oy == 0)
+    return;
 
-  // we'll reset our maps to unknown space if appropriate
-  resetMaps();
+  // nothing of the old window is left in the new one
+  if (abs(cell_ox) >= size_x || abs(cell_oy) >= size_y)
+  {
+    resetMaps();
+    origin_x_ = new_grid_ox;
+    origin_y_ = new_grid_oy;
+    return;
+  }
 
   // update the origin with the appropriate world coordinates
   origin_x_ = new_grid_ox;
   origin_y_ = new_grid_oy;
 
-  // compute the starting cell location for copying data back in
-  int start_x = lower_left_x - cell_ox;
-  int start_y = lower_left_y - cell_oy;
-
-  // now we want to copy the overlapping information back into the map, but in its new location
-  copyMapRegion(local_map, 0, 0, cell_size_x, costmap_, start_x, start_y, size_x_, cell_size_x, cell_size_y);
-  copyMapRegion(local_voxel_map, 0, 0, cell_size_x, voxel_map, start_x, start_y, size_x_, cell_size_x, cell_size_y);
-
-  // make sure to clean up
-  delete[] local_map;
-  delete[] local_voxel_map;
+  // move the overlapping information to its new location in place, the cells that come into view become
+  // unknown as after resetMaps()
+  shiftMapRegion(costmap_, cell_ox, cell_oy, default_value_);
+  shiftMapRegion(voxel_grid_.getData(), cell_ox, cell_oy, ~((uint32_t)0) >> 16);
 }
 
 }  // namespace costmap_2d
@@ -45,7 +45,7 @@ namespace costmap_2d
 Costmap2D::Costmap2D(unsigned int cells_size_x, unsigned int cells_size_y, double resolution,
                      double origin_x, double origin_y, unsigned char default_value) :
     size_x_(cells_size_x), size_y_(cells_size_y), resolution_(resolution), origin_x_(origin_x),
-    origin_y_(origin_y), costmap_(NULL), default_value_(default_value)
+    origin_y_(origin_y), costmap_(NULL), default_value_(default_value), toroidal_(false), offset_x_(0), offset_y_(0)
 {
   access_ = new mutex_t();
 
@@ -77,6 +77,8 @@ void Costmap2D::resizeMap(unsigned int size_x, unsigned int size_y, double resol
   resolution_ = resolution;
   origin_x_ = origin_x;
   origin_y_ = origin_y;
+  offset_x_ = 0;
+  offset_y_ = 0;
 
   initMaps(size_x, size_y);
 
@@ -94,10 +96,44 @@ void Costmap2D::resetMap(unsigned int x0, unsigned int y0, unsigned int xn, unsi
 {
   boost::unique_lock<mutex_t> lock(*(access_));
   unsigned int len = xn - x0;
+  if (toroidal_)
+  {
+    for (unsigned int y = y0; y < yn; y++)
+    {
+      // a row of the map runs into the start of its row of storage at most once
+      unsigned int start = getIndex(x0, y), row_end = rowEnd(start);
+      unsigned int first = std::min(len, row_end - start);
+      memset(costmap_ + start, default_value_, first * sizeof(unsigned char));
+      memset(costmap_ + row_end - size_x_, default_value_, (len - first) * sizeof(unsigned char));
+    }
+    return;
+  }
+
   for (unsigned int y = y0 * size_x_ + x0; y < yn * size_x_ + x0; y += size_x_)
     memset(costmap_ + y, default_value_, len * sizeof(unsigned char));
 }
 
+void Costmap2D::setToroidal(bool toroidal)
+{
+  boost::unique_lock<mutex_t> lock(*access_);
+  if (toroidal == toroidal_)
+    return;
+
+  // put the cells back in row order
+  if (offset_x_ != 0 || offset_y_ != 0)
+  {
+    unsigned char* linear = new unsigned char[size_x_ * size_y_];
+    for (unsigned int y = 0; y < size_y_; y++)
+      for (unsigned int x = 0; x < size_x_; x++)
+        linear[y * size_x_ + x] = costmap_[getIndex(x, y)];
+    delete[] costmap_;
+    costmap_ = linear;
+  }
+  offset_x_ = 0;
+  offset_y_ = 0;
+  toroidal_ = toroidal;
+}
+
 bool Costmap2D::copyCostmapWindow(const Costmap2D& map, double win_origin_x, double win_origin_y, double win_size_x,
                                   double win_size_y)
 {
@@ -125,12 +161,22 @@ bool Costmap2D::copyCostmapWindow(const Costmap2D& map, double win_origin_x, dou
   resolution_ = map.resolution_;
   origin_x_ = win_origin_x;
   origin_y_ = win_origin_y;
+  toroidal_ = false;
+  offset_x_ = 0;
+  offset_y_ = 0;
 
   // initialize our various maps and reset markers for inflation
   initMaps(size_x_, size_y_);
 
   // copy the window of the static map and the costmap that we're taking
-  copyMapRegion(map.costmap_, lower_left_x, lower_left_y, map.size_x_, costmap_, 0, 0, size_x_, size_x_, size_y_);
+  if (map.toroidal_)
+  {
+    for (unsigned int y = 0; y < size_y_; y++)
+      for (unsigned int x = 0; x < size_x_; x++)
+        costmap_[y * size_x_ + x] = map.getCost(lower_left_x + x, lower_left_y + y);
+  }
+  else
+    copyMapRegion(map.costmap_, lower_left_x, lower_left_y, map.size_x_, costmap_, 0, 0, size_x_, size_x_, size_y_);
   return true;
 }
 
@@ -148,6 +194,9 @@ Costmap2D& Costmap2D::operator=(const Costmap2D& map)
   resolution_ = map.resolution_;
   origin_x_ = map.origin_x_;
   origin_y_ = map.origin_y_;
+  toroidal_ = map.toroidal_;
+  offset_x_ = map.offset_x_;
+  offset_y_ = map.offset_y_;
 
   // initialize our various maps
   initMaps(size_x_, size_y_);
@@ -159,7 +208,7 @@ Costmap2D& Costmap2D::operator=(const Costmap2D& map)
 }
 
 Costmap2D::Costmap2D(const Costmap2D& map) :
-    costmap_(NULL)
+    costmap_(NULL), toroidal_(false), offset_x_(0), offset_y_(0)
 {
   access_ = new mutex_t();
   *this = map;
@@ -167,7 +216,8 @@ Costmap2D::Costmap2D(const Costmap2D& map) :
 
 // just initialize everything to NULL by default
 Costmap2D::Costmap2D() :
-    size_x_(0), size_y_(0), resolution_(0.0), origin_x_(0.0), origin_y_(0.0), costmap_(NULL)
+    size_x_(0), size_y_(0), resolution_(0.0), origin_x_(0.0), origin_y_(0.0), costmap_(NULL), toroidal_(false),
+    offset_x_(0), offset_y_(0)
 {
   access_ = new mutex_t();
 }
@@ -274,38 +324,39 @@ void Costmap2D::updateOrigin(double new_origin_x, double new_origin_y)
   int size_x = size_x_;
   int size_y = size_y_;
 
-  // we need to compute the overlap of the new and existing windows
-  int lower_left_x, lower_left_y, upper_right_x, upper_right_y;
-  lower_left_x = min(max(cell_ox, 0), size_x);
-  lower_left_y = min(max(cell_oy, 0), size_y);
-  upper_right_x = min(max(cell_ox + size_x, 0), size_x);
-  upper_right_y = min(max(cell_oy + size_y, 0), size_y);
-
-  unsigned int cell_size_x = upper_right_x - lower_left_x;
-  unsigned int cell_size_y = upper_right_y - lower_left_y;
-
-  // we need a map to store the obstacles in the window temporarily
-  unsigned char* local_map = new unsigned char[cell_size_x * cell_size_y];
-
-  // copy the local window in the costmap to the local map
-  copyMapRegion(costmap_, lower_left_x, lower_left_y, size_x_, local_map, 0, 0, cell_size_x, cell_size_x, cell_size_y);
+  if (cell_ox == 0 && cell_oy == 0)
+    return;
 
-  // now we'll set the costmap to be completely unknown if we track unknown space
-  resetMaps();
+  // nothing of the old window is left in the new one
+  if (abs(cell_ox) >= size_x || abs(cell_oy) >= size_y)
+  {
+    resetMaps();
+    origin_x_ = new_grid_ox;
+    origin_y_ = new_grid_oy;
+    return;
+  }
 
-  // update the origin with the appropriate world coordinates
   origin_x_ = new_grid_ox;
   origin_y_ = new_grid_oy;
 
-  // compute the starting cell location for copying data back in
-  int start_x = lower_left_x - cell_ox;
-  int start_y = lower_left_y - cell_oy;
-
-  // now we want to copy the overlapping information back into the map, but in its new location
-  copyMapRegion(local_map, 0, 0, cell_size_x, costmap_, start_x, start_y, size_x_, cell_size_x, cell_size_y);
+  if (!toroidal_)
+  {
+    // move the overlapping information to its new location in place
+    shiftMapRegion(costmap_, cell_ox, cell_oy, default_value_);
+    return;
+  }
 
-  // make sure to clean up
-  delete[] local_map;
+  // the ring buffer turns under the map, and the cells that wrap around are the ones that came into view
+  offset_x_ = (offset_x_ + size_x + cell_ox) % size_x;
+  offset_y_ = (offset_y_ + size_y + cell_oy) % size_y;
+  if (cell_ox > 0)
+    resetMap(size_x - cell_ox, 0, size_x, size_y);
+  else if (cell_ox < 0)
+    resetMap(0, 0, -cell_ox, size_y);
+  if (cell_oy > 0)
+    resetMap(0, size_y - cell_oy, size_x, size_y);
+  else if (cell_oy < 0)
+    resetMap(0, 0, size_x, -cell_oy);
 }
 
 bool Costmap2D::setConvexPolygonCost(const std::vector<geometry_msgs::Point>& polygon, unsigned char cost_value)
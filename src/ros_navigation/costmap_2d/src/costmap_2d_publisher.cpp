@@ -137,34 +137,47 @@ void Costmap2DPublisher::publishCostmap()
     prepareGrid();
     costmap_pub_.publish(grid_);
   }
-  else if (x0_ < xn_)
+  else if (x0_ < xn_ || !dirty_.empty())
   {
     boost::unique_lock<Costmap2D::mutex_t> lock(*(costmap_->getMutex()));
     // Publish Just an Update
-    map_msgs::OccupancyGridUpdate update;
-    update.header.stamp = ros::Time::now();
-    update.header.frame_id = global_frame_;
-    update.x = x0_;
-    update.y = y0_;
-    update.width = xn_ - x0_;
-    update.height = yn_ - y0_;
-    update.data.resize(update.width * update.height);
-
-    unsigned int i = 0;
-    for (unsigned int y = y0_; y < yn_; y++)
-    {
-      for (unsigned int x = x0_; x < xn_; x++)
-      {
-        unsigned char cost = costmap_->getCost(x, y);
-        update.data[i++] = cost_translation_table_[ cost ];
-      }
-    }
-    costmap_update_pub_.publish(update);
+    if (x0_ < xn_)
+      publishUpdate(x0_, xn_, y0_, yn_);
+
+    // or one for each box of dirty tiles
+    std::vector<int> boxes;
+    dirty_.getBoxes(boxes);
+    for (unsigned int i = 0; i < boxes.size(); i += 4)
+      publishUpdate(boxes[i], boxes[i + 2], boxes[i + 1], boxes[i + 3]);
   }
 
+  dirty_.clear();
   xn_ = yn_ = 0;
   x0_ = costmap_->getSizeInCellsX();
   y0_ = costmap_->getSizeInCellsY();
 }
 
+void Costmap2DPublisher::publishUpdate(unsigned int x0, unsigned int xn, unsigned int y0, unsigned int yn)
+{
+  map_msgs::OccupancyGridUpdate update;
+  update.header.stamp = ros::Time::now();
+  update.header.frame_id = global_frame_;
+  update.x = x0;
+  update.y = y0;
+  update.width = xn - x0;
+  update.height = yn - y0;
+  update.data.resize(update.width * update.height);
+
+  unsigned int i = 0;
+  for (unsigned int y = y0; y < yn; y++)
+  {
+    for (unsigned int x = x0; x < xn; x++)
+    {
+      unsigned char cost = costmap_->getCost(x, y);
+      update.data[i++] = cost_translation_table_[ cost ];
+    }
+  }
+  costmap_update_pub_.publish(update);
+}
+
 }  // end namespace costmap_2d
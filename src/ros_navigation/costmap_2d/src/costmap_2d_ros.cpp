@@ -128,6 +128,19 @@ Costmap2DROS::Costmap2DROS(std::string name, tf::TransformListener& tf) :
 
   layered_costmap_ = new LayeredCostmap(global_frame_, rolling_window, track_unknown_space);
 
+  // layers that allow it are updated in tiles of tile_size cells on this many threads
+  int update_threads, tile_size;
+  private_nh.param("update_threads", update_threads, 1);
+  private_nh.param("tile_size", tile_size, 128);
+  layered_costmap_->setUpdateThreads(std::max(1, update_threads), std::max(1, tile_size));
+
+  // with dirty_tiles, only the tiles of dirty_tile_size cells the layers changed are updated
+  bool dirty_tiles;
+  int dirty_tile_size;
+  private_nh.param("dirty_tiles", dirty_tiles, false);
+  private_nh.param("dirty_tile_size", dirty_tile_size, 64);
+  layered_costmap_->setDirtyTileSize(dirty_tiles ? std::max(1, dirty_tile_size) : 0);
+
 
   if (!private_nh.hasParam("plugins"))
   {
@@ -432,11 +445,37 @@ void Costmap2DROS::mapUpdateLoop(double frequency)
     end_t = end.tv_sec + double(end.tv_usec) / 1e6;
     t_diff = end_t - start_t;
     ROS_DEBUG("Map update time: %.9f", t_diff);
-    if (publish_cycle.toSec() > 0 && layered_costmap_->isInitialized())
+    if (layered_costmap_->getUpdateThreads() > 1)
+    {
+      double costs_elapsed, costs_work;
+      layered_costmap_->getCostsUpdateTime(costs_elapsed, costs_work);
+      if (costs_elapsed > 0)
+        ROS_DEBUG("Layer costs took %.6f s of work in %.6f s on %u threads, a speedup of %.2f", costs_work,
+                  costs_elapsed, layered_costmap_->getUpdateThreads(), costs_work / costs_elapsed);
+    }
+    if (layered_costmap_->isTrackingDirtyTiles())
     {
       unsigned int x0, y0, xn, yn;
       layered_costmap_->getBounds(&x0, &xn, &y0, &yn);
-      publisher_->updateBounds(x0, xn, y0, yn);
+      ROS_DEBUG("Map update touched %u cells, their bounding box has %u", layered_costmap_->getUpdatedCells(),
+                layered_costmap_->getUpdatedCells() > 0 ? (xn - x0) * (yn - y0) : 0);
+    }
+    else
+    {
+      ROS_DEBUG("Map update touched %u cells", layered_costmap_->getUpdatedCells());
+    }
+    if (publish_cycle.toSec() > 0 && layered_costmap_->isInitialized())
+    {
+      if (layered_costmap_->isTrackingDirtyTiles())
+      {
+        publisher_->updateBounds(layered_costmap_->getDirtyTiles());
+      }
+      else
+      {
+        unsigned int x0, y0, xn, yn;
+        layered_costmap_->getBounds(&x0, &xn, &y0, &yn);
+        publisher_->updateBounds(x0, xn, y0, yn);
+      }
 
       ros::Time now = ros::Time::now();
       if (last_publish_ + publish_cycle < now)
@@ -537,6 +576,7 @@ void Costmap2DROS::resetLayers()
 {
   Costmap2D* top = layered_costmap_->getCostmap();
   top->resetMap(0, 0, top->getSizeInCellsX(), top->getSizeInCellsY());
+  layered_costmap_->invalidateSnapshot();
   std::vector < boost::shared_ptr<Layer> > *plugins = layered_costmap_->getPlugins();
   for (vector<boost::shared_ptr<Layer> >::iterator plugin = plugins->begin(); plugin != plugins->end();
       ++plugin)
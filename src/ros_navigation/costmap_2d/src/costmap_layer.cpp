@@ -54,17 +54,18 @@ void CostmapLayer::updateWithMax(costmap_2d::Costmap2D& master_grid, int min_i,
   for (int j = min_j; j < max_j; j++)
   {
     unsigned int it = j * span + min_i;
-    for (int i = min_i; i < max_i; i++)
+    unsigned int lit = getIndex(min_i, j), row_end = rowEnd(lit);
+    for (int i = min_i; i < max_i; i++, it++)
     {
-      if (costmap_[it] == NO_INFORMATION){
-        it++;
+      unsigned char cost = costmap_[lit];
+      if (++lit == row_end)
+        lit -= size_x_;
+      if (cost == NO_INFORMATION)
         continue;
-      }
 
       unsigned char old_cost = master_array[it];
-      if (old_cost == NO_INFORMATION || old_cost < costmap_[it])
-        master_array[it] = costmap_[it];
-      it++;
+      if (old_cost == NO_INFORMATION || old_cost < cost)
+        master_array[it] = cost;
     }
   }
 }
@@ -80,10 +81,12 @@ void CostmapLayer::updateWithTrueOverwrite(costmap_2d::Costmap2D& master_grid, i
   for (int j = min_j; j < max_j; j++)
   {
     unsigned int it = span*j+min_i;
-    for (int i = min_i; i < max_i; i++)
+    unsigned int lit = getIndex(min_i, j), row_end = rowEnd(lit);
+    for (int i = min_i; i < max_i; i++, it++)
     {
-      master[it] = costmap_[it];
-      it++;
+      master[it] = costmap_[lit];
+      if (++lit == row_end)
+        lit -= size_x_;
     }
   }
 }
@@ -98,11 +101,13 @@ void CostmapLayer::updateWithOverwrite(costmap_2d::Costmap2D& master_grid, int m
   for (int j = min_j; j < max_j; j++)
   {
     unsigned int it = span*j+min_i;
-    for (int i = min_i; i < max_i; i++)
+    unsigned int lit = getIndex(min_i, j), row_end = rowEnd(lit);
+    for (int i = min_i; i < max_i; i++, it++)
     {
-      if (costmap_[it] != NO_INFORMATION)
-        master[it] = costmap_[it];
-      it++;
+      if (costmap_[lit] != NO_INFORMATION)
+        master[it] = costmap_[lit];
+      if (++lit == row_end)
+        lit -= size_x_;
     }
   }
 }
@@ -117,25 +122,26 @@ void CostmapLayer::updateWithAddition(costmap_2d::Costmap2D& master_grid, int mi
   for (int j = min_j; j < max_j; j++)
   {
     unsigned int it = j * span + min_i;
-    for (int i = min_i; i < max_i; i++)
+    unsigned int lit = getIndex(min_i, j), row_end = rowEnd(lit);
+    for (int i = min_i; i < max_i; i++, it++)
     {
-      if (costmap_[it] == NO_INFORMATION){
-        it++;
+      unsigned char cost = costmap_[lit];
+      if (++lit == row_end)
+        lit -= size_x_;
+      if (cost == NO_INFORMATION)
         continue;
-      }
 
       unsigned char old_cost = master_array[it];
       if (old_cost == NO_INFORMATION)
-        master_array[it] = costmap_[it];
+        master_array[it] = cost;
       else
       {
-        int sum = old_cost + costmap_[it];
+        int sum = old_cost + cost;
         if (sum >= costmap_2d::INSCRIBED_INFLATED_OBSTACLE)
             master_array[it] = costmap_2d::INSCRIBED_INFLATED_OBSTACLE - 1;
         else
             master_array[it] = sum;
       }
-      it++;
     }
   }
 }
@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2013, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <costmap_2d/costmap_snapshot.h>
+#include <algorithm>
+
+namespace costmap_2d
+{
+
+const unsigned int CostmapSnapshot::TILE_SIZE;
+
+CostmapSnapshot::CostmapSnapshot(const Costmap2D& costmap, const CostmapSnapshot* previous, unsigned int x0,
+                                 unsigned int xn, unsigned int y0, unsigned int yn, unsigned long version,
+                                 const DirtyTiles* dirty) :
+    version_(version),
+    size_x_(costmap.getSizeInCellsX()),
+    size_y_(costmap.getSizeInCellsY()),
+    resolution_(costmap.getResolution()),
+    origin_x_(costmap.getOriginX()),
+    origin_y_(costmap.getOriginY()),
+    x0_(x0),
+    xn_(xn),
+    y0_(y0),
+    yn_(yn),
+    tiles_x_((size_x_ + TILE_SIZE - 1) / TILE_SIZE),
+    tiles_y_((size_y_ + TILE_SIZE - 1) / TILE_SIZE),
+    copied_tiles_(0)
+{
+  bool share = previous != NULL && hasSameGeometry(*previous);
+  if (!share)
+  {
+    x0_ = y0_ = 0;
+    xn_ = size_x_;
+    yn_ = size_y_;
+  }
+
+  tiles_.resize(tiles_x_ * tiles_y_);
+  for (unsigned int ty = 0; ty < tiles_y_; ++ty)
+  {
+    for (unsigned int tx = 0; tx < tiles_x_; ++tx)
+    {
+      unsigned int tile = ty * tiles_x_ + tx;
+      bool in_window = tx * TILE_SIZE < xn_ && (tx + 1) * TILE_SIZE > x0_ &&
+                       ty * TILE_SIZE < yn_ && (ty + 1) * TILE_SIZE > y0_;
+      if (in_window && share && dirty != NULL)
+        in_window = dirty->isDirty(tx * TILE_SIZE, ty * TILE_SIZE, (tx + 1) * TILE_SIZE, (ty + 1) * TILE_SIZE);
+      if (share && !in_window)
+      {
+        tiles_[tile] = previous->tiles_[tile];
+        continue;
+      }
+
+      tiles_[tile] = copyTile(costmap, tx, ty);
+      // layers often write back the costs a cell already had
+      if (share && *tiles_[tile] == *previous->tiles_[tile])
+        tiles_[tile] = previous->tiles_[tile];
+      else
+        ++copied_tiles_;
+    }
+  }
+}
+
+bool CostmapSnapshot::worldToMap(double wx, double wy, unsigned int& mx, unsigned int& my) const
+{
+  if (wx < origin_x_ || wy < origin_y_)
+    return false;
+
+  mx = (int)((wx - origin_x_) / resolution_);
+  my = (int)((wy - origin_y_) / resolution_);
+
+  return mx < size_x_ && my < size_y_;
+}
+
+bool CostmapSnapshot::hasSameGeometry(const CostmapSnapshot& other) const
+{
+  return size_x_ == other.size_x_ && size_y_ == other.size_y_ && resolution_ == other.resolution_ &&
+         origin_x_ == other.origin_x_ && origin_y_ == other.origin_y_;
+}
+
+void CostmapSnapshot::copyTo(Costmap2D& costmap, const CostmapSnapshot* have) const
+{
+  if (costmap.getSizeInCellsX() != size_x_ || costmap.getSizeInCellsY() != size_y_ ||
+      costmap.getResolution() != resolution_ || costmap.getOriginX() != origin_x_ ||
+      costmap.getOriginY() != origin_y_)
+  {
+    costmap.resizeMap(size_x_, size_y_, resolution_, origin_x_, origin_y_);
+    have = NULL;
+  }
+  if (have != NULL && !hasSameGeometry(*have))
+    have = NULL;
+
+  for (unsigned int tile = 0; tile < tiles_.size(); ++tile)
+  {
+    if (have == NULL || have->tiles_[tile] != tiles_[tile])
+      pasteTile(costmap, tile);
+  }
+}
+
+CostmapSnapshot::Tile CostmapSnapshot::copyTile(const Costmap2D& costmap, unsigned int tx, unsigned int ty) const
+{
+  boost::shared_ptr<std::vector<unsigned char> > tile(new std::vector<unsigned char>(TILE_SIZE * TILE_SIZE, 0));
+  unsigned int x0 = tx * TILE_SIZE, xn = std::min(x0 + TILE_SIZE, size_x_);
+  unsigned int y0 = ty * TILE_SIZE, yn = std::min(y0 + TILE_SIZE, size_y_);
+  const unsigned char* map = costmap.getCharMap();
+
+  for (unsigned int my = y0; my < yn; ++my)
+  {
+    unsigned char* row = &(*tile)[(my - y0) * TILE_SIZE];
+    if (costmap.isToroidal())
+    {
+      for (unsigned int mx = x0; mx < xn; ++mx)
+        row[mx - x0] = costmap.getCost(mx, my);
+    }
+    else
+    {
+      const unsigned char* src = map + costmap.getIndex(x0, my);
+      std::copy(src, src + (xn - x0), row);
+    }
+  }
+  return tile;
+}
+
+void CostmapSnapshot::pasteTile(Costmap2D& costmap, unsigned int tile) const
+{
+  unsigned int x0 = (tile % tiles_x_) * TILE_SIZE, xn = std::min(x0 + TILE_SIZE, size_x_);
+  unsigned int y0 = (tile / tiles_x_) * TILE_SIZE, yn = std::min(y0 + TILE_SIZE, size_y_);
+  unsigned char* map = costmap.getCharMap();
+  const std::vector<unsigned char>& cells = *tiles_[tile];
+
+  for (unsigned int my = y0; my < yn; ++my)
+  {
+    const unsigned char* row = &cells[(my - y0) * TILE_SIZE];
+    std::copy(row, row + (xn - x0), map + costmap.getIndex(x0, my));
+  }
+}
+
+}  // namespace costmap_2d
@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2013, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <costmap_2d/dirty_tiles.h>
+#include <algorithm>
+
+namespace costmap_2d
+{
+
+DirtyTiles::DirtyTiles() :
+    size_x_(0),
+    size_y_(0),
+    tile_size_(1),
+    tiles_x_(0),
+    tiles_y_(0)
+{
+}
+
+void DirtyTiles::resize(unsigned int size_x, unsigned int size_y, unsigned int tile_size)
+{
+  size_x_ = size_x;
+  size_y_ = size_y;
+  tile_size_ = std::max(1u, tile_size);
+  tiles_x_ = (size_x_ + tile_size_ - 1) / tile_size_;
+  tiles_y_ = (size_y_ + tile_size_ - 1) / tile_size_;
+  tiles_.assign(tiles_x_ * tiles_y_, 0);
+}
+
+void DirtyTiles::clear()
+{
+  std::fill(tiles_.begin(), tiles_.end(), 0);
+}
+
+void DirtyTiles::markAll()
+{
+  std::fill(tiles_.begin(), tiles_.end(), 1);
+}
+
+void DirtyTiles::mark(int min_i, int min_j, int max_i, int max_j)
+{
+  min_i = std::max(0, min_i);
+  min_j = std::max(0, min_j);
+  max_i = std::min(int(size_x_), max_i);
+  max_j = std::min(int(size_y_), max_j);
+  if (min_i >= max_i || min_j >= max_j)
+    return;
+
+  for (unsigned int ty = min_j / tile_size_; ty <= (max_j - 1) / tile_size_; ++ty)
+  {
+    for (unsigned int tx = min_i / tile_size_; tx <= (max_i - 1) / tile_size_; ++tx)
+      tiles_[ty * tiles_x_ + tx] = 1;
+  }
+}
+
+void DirtyTiles::grow(unsigned int cells)
+{
+  int reach = (cells + tile_size_ - 1) / tile_size_;
+  if (reach == 0 || empty())
+    return;
+
+  // the square around each dirty tile, as a pass along the rows and one along the columns
+  std::vector<unsigned char> rows(tiles_.size(), 0);
+  for (int ty = 0; ty < int(tiles_y_); ++ty)
+  {
+    for (int tx = 0; tx < int(tiles_x_); ++tx)
+    {
+      if (!isDirtyTile(tx, ty))
+        continue;
+      int end = std::min(int(tiles_x_) - 1, tx + reach);
+      for (int x = std::max(0, tx - reach); x <= end; ++x)
+        rows[ty * tiles_x_ + x] = 1;
+    }
+  }
+  for (int ty = 0; ty < int(tiles_y_); ++ty)
+  {
+    for (int tx = 0; tx < int(tiles_x_); ++tx)
+    {
+      if (!rows[ty * tiles_x_ + tx])
+        continue;
+      int end = std::min(int(tiles_y_) - 1, ty + reach);
+      for (int y = std::max(0, ty - reach); y <= end; ++y)
+        tiles_[y * tiles_x_ + tx] = 1;
+    }
+  }
+}
+
+void DirtyTiles::merge(const DirtyTiles& other)
+{
+  if (!hasSameGrid(other))
+    return;
+  for (unsigned int i = 0; i < tiles_.size(); ++i)
+    tiles_[i] |= other.tiles_[i];
+}
+
+bool DirtyTiles::isDirty(int min_i, int min_j, int max_i, int max_j) const
+{
+  min_i = std::max(0, min_i);
+  min_j = std::max(0, min_j);
+  max_i = std::min(int(size_x_), max_i);
+  max_j = std::min(int(size_y_), max_j);
+  if (min_i >= max_i || min_j >= max_j)
+    return false;
+
+  for (unsigned int ty = min_j / tile_size_; ty <= (max_j - 1) / tile_size_; ++ty)
+  {
+    for (unsigned int tx = min_i / tile_size_; tx <= (max_i - 1) / tile_size_; ++tx)
+    {
+      if (isDirtyTile(tx, ty))
+        return true;
+    }
+  }
+  return false;
+}
+
+bool DirtyTiles::empty() const
+{
+  return std::find(tiles_.begin(), tiles_.end(), 1) == tiles_.end();
+}
+
+unsigned int DirtyTiles::getDirtyCells() const
+{
+  unsigned int cells = 0;
+  for (unsigned int ty = 0; ty < tiles_y_; ++ty)
+  {
+    for (unsigned int tx = 0; tx < tiles_x_; ++tx)
+    {
+      if (isDirtyTile(tx, ty))
+        cells += (std::min(size_x_, (tx + 1) * tile_size_) - tx * tile_size_) *
+                 (std::min(size_y_, (ty + 1) * tile_size_) - ty * tile_size_);
+    }
+  }
+  return cells;
+}
+
+bool DirtyTiles::getBounds(int& min_i, int& min_j, int& max_i, int& max_j) const
+{
+  int tx0 = tiles_x_, ty0 = tiles_y_, txn = -1, tyn = -1;
+  for (int ty = 0; ty < int(tiles_y_); ++ty)
+  {
+    for (int tx = 0; tx < int(tiles_x_); ++tx)
+    {
+      if (!isDirtyTile(tx, ty))
+        continue;
+      tx0 = std::min(tx0, tx);
+      ty0 = std::min(ty0, ty);
+      txn = std::max(txn, tx);
+      tyn = std::max(tyn, ty);
+    }
+  }
+  if (txn < 0)
+    return false;
+
+  min_i = tx0 * tile_size_;
+  min_j = ty0 * tile_size_;
+  max_i = std::min(size_x_, (txn + 1) * tile_size_);
+  max_j = std::min(size_y_, (tyn + 1) * tile_size_);
+  return true;
+}
+
+void DirtyTiles::getBoxes(std::vector<int>& boxes) const
+{
+  // boxes that reached down to the row before, by their first and last tile column
+  std::vector<unsigned int> open, open_runs, next, next_runs;
+  for (unsigned int ty = 0; ty < tiles_y_; ++ty)
+  {
+    int max_j = std::min(size_y_, (ty + 1) * tile_size_);
+    next.clear();
+    next_runs.clear();
+    for (unsigned int tx = 0; tx < tiles_x_; ++tx)
+    {
+      if (!isDirtyTile(tx, ty))
+        continue;
+      unsigned int start = tx;
+      while (tx + 1 < tiles_x_ && isDirtyTile(tx + 1, ty))
+        ++tx;
+
+      unsigned int box = boxes.size();
+      for (unsigned int k = 0; k < open.size(); ++k)
+      {
+        if (open_runs[2 * k] == start && open_runs[2 * k + 1] == tx)
+          box = open[k];
+      }
+      if (box == boxes.size())
+      {
+        boxes.push_back(start * tile_size_);
+        boxes.push_back(ty * tile_size_);
+        boxes.push_back(std::min(size_x_, (tx + 1) * tile_size_));
+        boxes.push_back(max_j);
+      }
+      else
+      {
+        boxes[box + 3] = max_j;
+      }
+      next.push_back(box);
+      next_runs.push_back(start);
+      next_runs.push_back(tx);
+    }
+    open.swap(next);
+    open_runs.swap(next_runs);
+  }
+}
+
+}  // namespace costmap_2d
@@ -49,6 +49,20 @@ void Layer::initialize(LayeredCostmap* parent, std::string name, tf::TransformLi
   onInitialize();
 }
 
+void Layer::updateDirtyTiles(double robot_x, double robot_y, double robot_yaw, DirtyTiles& dirty)
+{
+  double min_x = 1e30, min_y = 1e30, max_x = -1e30, max_y = -1e30;
+  updateBounds(robot_x, robot_y, robot_yaw, &min_x, &min_y, &max_x, &max_y);
+  if (min_x > max_x || min_y > max_y)
+    return;
+
+  int min_i, min_j, max_i, max_j;
+  Costmap2D* master = layered_costmap_->getCostmap();
+  master->worldToMapEnforceBounds(min_x, min_y, min_i, min_j);
+  master->worldToMapEnforceBounds(max_x, max_y, max_i, max_j);
+  dirty.mark(min_i, min_j, max_i + 1, max_j + 1);
+}
+
 const std::vector<geometry_msgs::Point>& Layer::getFootprint() const
 {
   return layered_costmap_->getFootprint();
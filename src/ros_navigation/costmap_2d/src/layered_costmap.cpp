@@ -37,9 +37,12 @@
  *********************************************************************/
 #include <costmap_2d/layered_costmap.h>
 #include <costmap_2d/footprint.h>
+#include <ros/time.h>
+#include <boost/bind.hpp>
 #include <cstdio>
 #include <string>
 #include <algorithm>
+#include <limits>
 #include <vector>
 
 using std::vector;
@@ -63,7 +66,14 @@ LayeredCostmap::LayeredCostmap(std::string global_frame, bool rolling_window, bo
     initialized_(false),
     size_locked_(false),
     circumscribed_radius_(1.0),
-    inscribed_radius_(0.1)
+    inscribed_radius_(0.1),
+    tile_size_(128),
+    costs_elapsed_(0.0),
+    costs_work_(0.0),
+    dirty_tile_size_(0),
+    updated_cells_(0),
+    snapshot_version_(0),
+    snapshot_stale_(false)
 {
   if (track_unknown)
     costmap_.setDefaultValue(255);
@@ -80,6 +90,22 @@ LayeredCostmap::~LayeredCostmap()
   }
 }
 
+void LayeredCostmap::setUpdateThreads(unsigned int thread_count, unsigned int tile_size)
+{
+  boost::unique_lock<Costmap2D::mutex_t> lock(*(costmap_.getMutex()));
+  tile_size_ = std::max(1u, tile_size);
+  if (thread_count > 1)
+    pool_.reset(new WorkerPool(thread_count));
+  else
+    pool_.reset();
+}
+
+void LayeredCostmap::setDirtyTileSize(unsigned int tile_size)
+{
+  boost::unique_lock<Costmap2D::mutex_t> lock(*(costmap_.getMutex()));
+  dirty_tile_size_ = tile_size;
+}
+
 // resize map
 void LayeredCostmap::resizeMap(unsigned int size_x, unsigned int size_y, double resolution, double origin_x,
                                double origin_y, bool size_locked)
@@ -87,6 +113,7 @@ void LayeredCostmap::resizeMap(unsigned int size_x, unsigned int size_y, double
   boost::unique_lock<Costmap2D::mutex_t> lock(*(costmap_.getMutex()));
   size_locked_ = size_locked;
   costmap_.resizeMap(size_x, size_y, resolution, origin_x, origin_y);
+  snapshot_stale_ = true;
 
   //对于每一层costmap都要 match size
   for (vector<boost::shared_ptr<Layer> >::iterator plugin = plugins_.begin(); plugin != plugins_.end();
@@ -112,8 +139,75 @@ void LayeredCostmap::updateMap(double robot_x, double robot_y, double robot_yaw)
   }
 
   if (plugins_.size() == 0)
+  {
+    takeSnapshot(0, 0, 0, 0);
     return;
+  }
+
+  windows_.clear();
+  if (dirty_tile_size_ > 0)
+    collectDirtyTiles(robot_x, robot_y, robot_yaw);
+  else
+    collectBounds(robot_x, robot_y, robot_yaw);
+
+  updated_cells_ = 0;
+  if (windows_.empty())
+  {
+    // a rolling window may still have moved
+    takeSnapshot(0, 0, 0, 0);
+    return;
+  }
+
+  int x0, xn, y0, yn;
+  x0 = y0 = std::numeric_limits<int>::max();
+  xn = yn = 0;
+  for (unsigned int w = 0; w < windows_.size(); w += 4)
+  {
+    const int* box = &windows_[w];
+    costmap_.resetMap(box[0], box[1], box[2], box[3]);
+    updated_cells_ += (box[2] - box[0]) * (box[3] - box[1]);
+    x0 = std::min(x0, box[0]);
+    y0 = std::min(y0, box[1]);
+    xn = std::max(xn, box[2]);
+    yn = std::max(yn, box[3]);
+  }
+
+  ros::WallTime start = ros::WallTime::now();
+  costs_work_ = 0.0;
+  for (vector<boost::shared_ptr<Layer> >::iterator plugin = plugins_.begin(); plugin != plugins_.end();
+       ++plugin)
+  {
+    // each layer sees the output of the ones before it, so the tiles of one
+    // layer are all finished before the next layer starts
+    (*plugin)->beginUpdate(costmap_, windows_);
+    for (unsigned int w = 0; w < windows_.size(); w += 4)
+    {
+      const int* box = &windows_[w];
+      if (pool_ && (*plugin)->isTileSafe())
+      {
+        updateCostsInTiles(plugin->get(), box[0], box[1], box[2], box[3]);
+      }
+      else
+      {
+        ros::WallTime layer_start = ros::WallTime::now();
+        (*plugin)->updateCosts(costmap_, box[0], box[1], box[2], box[3]);
+        costs_work_ += (ros::WallTime::now() - layer_start).toSec();
+      }
+    }
+  }
+  costs_elapsed_ = (ros::WallTime::now() - start).toSec();
+
+  bx0_ = x0;
+  bxn_ = xn;
+  by0_ = y0;
+  byn_ = yn;
+
+  initialized_ = true;
+  takeSnapshot(x0, xn, y0, yn);
+}
 
+void LayeredCostmap::collectBounds(double robot_x, double robot_y, double robot_yaw)
+{
   minx_ = miny_ = 1e30;
   maxx_ = maxy_ = -1e30;
 
@@ -150,19 +244,103 @@ void LayeredCostmap::updateMap(double robot_x, double robot_y, double robot_yaw)
   if (xn < x0 || yn < y0)
     return;
 
-  costmap_.resetMap(x0, y0, xn, yn);
+  windows_.push_back(x0);
+  windows_.push_back(y0);
+  windows_.push_back(xn);
+  windows_.push_back(yn);
+}
+
+void LayeredCostmap::collectDirtyTiles(double robot_x, double robot_y, double robot_yaw)
+{
+  dirty_.resize(costmap_.getSizeInCellsX(), costmap_.getSizeInCellsY(), dirty_tile_size_);
   for (vector<boost::shared_ptr<Layer> >::iterator plugin = plugins_.begin(); plugin != plugins_.end();
        ++plugin)
   {
-    (*plugin)->updateCosts(costmap_, x0, y0, xn, yn);
+    (*plugin)->updateDirtyTiles(robot_x, robot_y, robot_yaw, dirty_);
   }
 
-  bx0_ = x0;
-  bxn_ = xn;
-  by0_ = y0;
-  byn_ = yn;
+  int x0, xn, y0, yn;
+  if (!dirty_.getBounds(x0, y0, xn, yn))
+    return;
+  costmap_.mapToWorld(x0, y0, minx_, miny_);
+  costmap_.mapToWorld(xn - 1, yn - 1, maxx_, maxy_);
 
-  initialized_ = true;
+  dirty_.getBoxes(windows_);
+  ROS_DEBUG("Updating %u boxes of dirty tiles within x: [%d, %d] y: [%d, %d]", (unsigned int)windows_.size() / 4,
+            x0, xn, y0, yn);
+}
+
+void LayeredCostmap::takeSnapshot(unsigned int x0, unsigned int xn, unsigned int y0, unsigned int yn)
+{
+  // only this thread replaces snapshot_, so it can be read without snapshot_mutex_
+  const CostmapSnapshot* previous = snapshot_stale_ ? NULL : snapshot_.get();
+  CostmapSnapshotPtr snapshot(new CostmapSnapshot(costmap_, previous, x0, xn, y0, yn, snapshot_version_ + 1,
+                                                  dirty_tile_size_ > 0 ? &dirty_ : NULL));
+  snapshot_stale_ = false;
+
+  // keep the version when nothing changed, so that readers can skip their work
+  if (previous != NULL && snapshot->getCopiedTiles() == 0)
+    return;
+
+  ++snapshot_version_;
+  boost::mutex::scoped_lock lock(snapshot_mutex_);
+  snapshot_ = snapshot;
+}
+
+CostmapSnapshotPtr LayeredCostmap::getSnapshot()
+{
+  boost::mutex::scoped_lock lock(snapshot_mutex_);
+  return snapshot_;
+}
+
+void LayeredCostmap::updateCostsInTiles(Layer* layer, int x0, int y0, int xn, int yn)
+{
+  layer->beginTiles(costmap_, x0, y0, xn, yn);
+
+  // the layer may write up to its margin outside the window
+  int margin = layer->getTileMargin();
+  int min_i = std::max(0, x0 - margin);
+  int min_j = std::max(0, y0 - margin);
+  int max_i = std::min(int(costmap_.getSizeInCellsX()), xn + margin);
+  int max_j = std::min(int(costmap_.getSizeInCellsY()), yn + margin);
+
+  // Tiles sit on a fixed grid over the map, cut down to the area. A layer
+  // that reads around its tiles gets tiles at least as wide as that halo,
+  // and they are run in four passes so that no two neighbours are updated
+  // at the same time.
+  unsigned int halo = layer->getTileHalo();
+  int tile = std::max(tile_size_, halo);
+  int passes = halo > 0 ? 4 : 1;
+  for (int pass = 0; pass < passes; ++pass)
+  {
+    tiles_.clear();
+    for (int j = min_j / tile * tile; j < max_j; j += tile)
+    {
+      for (int i = min_i / tile * tile; i < max_i; i += tile)
+      {
+        if (passes > 1 && ((i / tile) % 2 + 2 * ((j / tile) % 2)) != pass)
+          continue;
+        tiles_.push_back(std::max(i, min_i));
+        tiles_.push_back(std::max(j, min_j));
+        tiles_.push_back(std::min(i + tile, max_i));
+        tiles_.push_back(std::min(j + tile, max_j));
+      }
+    }
+    pool_->run(tiles_.size() / 4, boost::bind(&LayeredCostmap::updateTile, this, layer, x0, y0, xn, yn, _1));
+  }
+
+  layer->endTiles();
+}
+
+void LayeredCostmap::updateTile(Layer* layer, int x0, int y0, int xn, int yn, unsigned int tile)
+{
+  ros::WallTime start = ros::WallTime::now();
+  const int* box = &tiles_[4 * tile];
+  layer->updateTileCosts(costmap_, x0, y0, xn, yn, box[0], box[1], box[2], box[3]);
+  double spent = (ros::WallTime::now() - start).toSec();
+
+  boost::mutex::scoped_lock lock(work_mutex_);
+  costs_work_ += spent;
 }
 
 bool LayeredCostmap::isCurrent()
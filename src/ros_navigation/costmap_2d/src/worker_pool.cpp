@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2013, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <costmap_2d/worker_pool.h>
+#include <boost/bind.hpp>
+#include <algorithm>
+
+namespace costmap_2d
+{
+
+WorkerPool::WorkerPool(unsigned int thread_count) :
+    thread_count_(std::max(1u, thread_count)),
+    job_fn_(NULL),
+    job_task_count_(0),
+    job_next_task_(0),
+    job_pending_(0),
+    job_generation_(0),
+    shutdown_(false)
+{
+  // the thread calling run() takes tasks as well
+  for (unsigned int i = 1; i < thread_count_; ++i)
+    workers_.create_thread(boost::bind(&WorkerPool::workerLoop, this));
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    shutdown_ = true;
+  }
+  job_cond_.notify_all();
+  workers_.join_all();
+}
+
+void WorkerPool::run(unsigned int task_count, const boost::function<void(unsigned int)>& fn)
+{
+  if (task_count == 0)
+    return;
+
+  // not worth waking anyone up
+  if (task_count == 1 || thread_count_ == 1)
+  {
+    for (unsigned int i = 0; i < task_count; ++i)
+      fn(i);
+    return;
+  }
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    job_fn_ = &fn;
+    job_task_count_ = task_count;
+    job_next_task_ = 0;
+    job_pending_ = task_count;
+    ++job_generation_;
+  }
+  job_cond_.notify_all();
+
+  drainTasks();
+
+  boost::mutex::scoped_lock lock(mutex_);
+  while (job_pending_ > 0)
+    done_cond_.wait(lock);
+  job_fn_ = NULL;
+}
+
+void WorkerPool::drainTasks()
+{
+  for (;;)
+  {
+    unsigned int task;
+    const boost::function<void(unsigned int)>* fn;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      if (job_fn_ == NULL || job_next_task_ >= job_task_count_)
+        return;
+      task = job_next_task_++;
+      fn = job_fn_;
+    }
+
+    (*fn)(task);
+
+    boost::mutex::scoped_lock lock(mutex_);
+    if (--job_pending_ == 0)
+      done_cond_.notify_all();
+  }
+}
+
+void WorkerPool::workerLoop()
+{
+  unsigned long seen_generation = 0;
+  for (;;)
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      while (!shutdown_ && job_generation_ == seen_generation)
+        job_cond_.wait(lock);
+      if (shutdown_)
+        return;
+      seen_generation = job_generation_;
+    }
+    drainTasks();
+  }
+}
+
+}  // namespace costmap_2d
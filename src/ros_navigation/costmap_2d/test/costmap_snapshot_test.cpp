@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2013, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Checks that snapshots hold the costmap as it was when they were taken,
+// share the tiles that did not change, and copy back out exactly
+
+#include <gtest/gtest.h>
+#include <costmap_2d/costmap_snapshot.h>
+#include <costmap_2d/cost_values.h>
+#include <cstdlib>
+#include <vector>
+
+using namespace costmap_2d;
+
+static std::vector<unsigned char> cells(const Costmap2D& costmap)
+{
+  std::vector<unsigned char> result;
+  for (unsigned int y = 0; y < costmap.getSizeInCellsY(); y++)
+    for (unsigned int x = 0; x < costmap.getSizeInCellsX(); x++)
+      result.push_back(costmap.getCost(x, y));
+  return result;
+}
+
+static std::vector<unsigned char> cells(const CostmapSnapshot& snapshot)
+{
+  std::vector<unsigned char> result;
+  for (unsigned int y = 0; y < snapshot.getSizeInCellsY(); y++)
+    for (unsigned int x = 0; x < snapshot.getSizeInCellsX(); x++)
+      result.push_back(snapshot.getCost(x, y));
+  return result;
+}
+
+TEST(CostmapSnapshot, sharesUnchangedTiles)
+{
+  const unsigned int size_x = 150, size_y = 130;  // 3 x 3 tiles, cut at the edges
+  Costmap2D costmap(size_x, size_y, 0.1, -2.0, 1.0, FREE_SPACE);
+  srand(5);
+  for (unsigned int i = 0; i < 500; i++)
+    costmap.setCost(rand() % size_x, rand() % size_y, LETHAL_OBSTACLE);
+
+  CostmapSnapshotPtr first(new CostmapSnapshot(costmap, NULL, 0, 0, 0, 0, 1));
+  EXPECT_EQ(9u, first->getCopiedTiles());
+  EXPECT_EQ(cells(costmap), cells(*first));
+
+  // a window in the middle tile only
+  std::vector<unsigned char> before = cells(costmap);
+  for (unsigned int y = 70; y < 80; y++)
+    for (unsigned int x = 65; x < 100; x++)
+      costmap.setCost(x, y, INSCRIBED_INFLATED_OBSTACLE);
+  CostmapSnapshotPtr second(new CostmapSnapshot(costmap, first.get(), 65, 100, 70, 80, 2));
+  EXPECT_EQ(1u, second->getCopiedTiles());
+  EXPECT_EQ(2u, second->getVersion());
+  EXPECT_EQ(cells(costmap), cells(*second));
+  EXPECT_EQ(before, cells(*first));
+
+  // writing back the same costs copies nothing
+  CostmapSnapshotPtr third(new CostmapSnapshot(costmap, second.get(), 0, size_x, 0, size_y, 3));
+  EXPECT_EQ(0u, third->getCopiedTiles());
+
+  unsigned int mx, my;
+  ASSERT_TRUE(second->worldToMap(-2.0 + 0.1 * 66.5, 1.0 + 0.1 * 71.5, mx, my));
+  EXPECT_EQ(66u, mx);
+  EXPECT_EQ(71u, my);
+  EXPECT_FALSE(second->worldToMap(-2.5, 2.0, mx, my));
+}
+
+TEST(CostmapSnapshot, copiesOutWhatChanged)
+{
+  const unsigned int size_x = 100, size_y = 90;
+  Costmap2D costmap(size_x, size_y, 0.05, 0.0, 0.0, NO_INFORMATION);
+  Costmap2D copy;
+
+  srand(7);
+  CostmapSnapshotPtr have;
+  for (unsigned int version = 1; version <= 30; version++)
+  {
+    unsigned int x0 = rand() % size_x, y0 = rand() % size_y;
+    unsigned int xn = x0 + 1 + rand() % (size_x - x0), yn = y0 + 1 + rand() % (size_y - y0);
+    for (unsigned int y = y0; y < yn; y++)
+      for (unsigned int x = x0; x < xn; x++)
+        costmap.setCost(x, y, rand() % 256);
+
+    // now and then the map moves, which copies all of it
+    if (version % 10 == 0)
+      costmap.resizeMap(size_x, size_y, 0.05, version * 0.5, 0.0);
+
+    CostmapSnapshotPtr snapshot(new CostmapSnapshot(costmap, have.get(), x0, xn, y0, yn, version));
+    snapshot->copyTo(copy, have.get());
+    EXPECT_EQ(cells(costmap), cells(copy));
+    EXPECT_EQ(costmap.getOriginX(), copy.getOriginX());
+    have = snapshot;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
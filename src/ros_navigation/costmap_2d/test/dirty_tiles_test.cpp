@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2013, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Checks the tiles marked dirty and the boxes that cover them
+
+#include <gtest/gtest.h>
+#include <costmap_2d/dirty_tiles.h>
+#include <vector>
+
+using namespace costmap_2d;
+
+TEST(DirtyTiles, marksOnlyTheTilesTouched)
+{
+  DirtyTiles dirty;
+  dirty.resize(100, 70, 16);  // 7 x 5 tiles, cut at the edges
+  EXPECT_TRUE(dirty.empty());
+
+  // two changes in opposite corners, and one off the map
+  dirty.mark(2, 3, 5, 6);
+  dirty.mark(96, 65, 120, 80);
+  dirty.mark(-10, 30, 0, 40);
+  EXPECT_FALSE(dirty.empty());
+  EXPECT_EQ(16u * 16 + 4 * 6, dirty.getDirtyCells());
+  EXPECT_TRUE(dirty.isDirty(15, 15, 17, 17));
+  EXPECT_FALSE(dirty.isDirty(16, 16, 96, 64));
+
+  int min_i, min_j, max_i, max_j;
+  ASSERT_TRUE(dirty.getBounds(min_i, min_j, max_i, max_j));
+  EXPECT_EQ(0, min_i);
+  EXPECT_EQ(0, min_j);
+  EXPECT_EQ(100, max_i);
+  EXPECT_EQ(70, max_j);
+
+  std::vector<int> boxes;
+  dirty.getBoxes(boxes);
+  ASSERT_EQ(8u, boxes.size());
+  EXPECT_EQ(0, boxes[0]);
+  EXPECT_EQ(16, boxes[2]);
+  EXPECT_EQ(96, boxes[4]);
+  EXPECT_EQ(64, boxes[5]);
+  EXPECT_EQ(100, boxes[6]);
+  EXPECT_EQ(70, boxes[7]);
+
+  dirty.clear();
+  EXPECT_TRUE(dirty.empty());
+  EXPECT_FALSE(dirty.getBounds(min_i, min_j, max_i, max_j));
+}
+
+TEST(DirtyTiles, growsAndMerges)
+{
+  DirtyTiles dirty, other;
+  dirty.resize(100, 100, 10);
+  other.resize(100, 100, 10);
+
+  // the cells within 12 cells of a tile are up to two tiles away
+  dirty.mark(45, 45, 46, 46);
+  dirty.grow(12);
+  EXPECT_EQ(50u * 50, dirty.getDirtyCells());
+
+  // rows of the same run share one box
+  std::vector<int> boxes;
+  dirty.getBoxes(boxes);
+  ASSERT_EQ(4u, boxes.size());
+  EXPECT_EQ(20, boxes[0]);
+  EXPECT_EQ(20, boxes[1]);
+  EXPECT_EQ(70, boxes[2]);
+  EXPECT_EQ(70, boxes[3]);
+
+  other.mark(0, 0, 1, 1);
+  dirty.merge(other);
+  EXPECT_EQ(50u * 50 + 100, dirty.getDirtyCells());
+
+  // tiles on another grid are left out
+  DirtyTiles coarse;
+  coarse.resize(100, 100, 20);
+  coarse.markAll();
+  dirty.merge(coarse);
+  EXPECT_FALSE(dirty.hasSameGrid(coarse));
+  EXPECT_EQ(50u * 50 + 100, dirty.getDirtyCells());
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -271,6 +271,238 @@ TEST(costmap, testInflationOrderCorrectness){
   validatePointInflation(5, 5, layers.getCostmap(), ilayer, inflation_radius);
 }
 
+/**
+ * Test that updating in tiles on several threads gives the same costs
+ * as updating the whole window at once
+ */
+TEST(costmap, testTiledUpdateMatchesSerial){
+  tf::TransformListener tf;
+  LayeredCostmap serial("frame", false, false);
+  LayeredCostmap tiled("frame", false, false);
+  serial.resizeMap(100, 100, 1, 0, 0);
+  tiled.resizeMap(100, 100, 1, 0, 0);
+  // tiles smaller than the inflation radius, so the halo matters
+  tiled.setUpdateThreads(3, 4);
+
+  std::vector<Point> polygon = setRadii(serial, 2.1, 2.3, 6.1);
+  setRadii(tiled, 2.1, 2.3, 6.1);
+
+  ObstacleLayer* serial_olayer = addObstacleLayer(serial, tf);
+  addInflationLayer(serial, tf);
+  serial.setFootprint(polygon);
+  ObstacleLayer* tiled_olayer = addObstacleLayer(tiled, tf);
+  addInflationLayer(tiled, tf);
+  tiled.setFootprint(polygon);
+
+  srand(1);
+  for (int round = 0; round < 3; round++)
+  {
+    for (int i = 0; i < 40; i++)
+    {
+      double x = rand() % 100, y = rand() % 100;
+      addObservation(serial_olayer, x, y, MAX_Z, x, y);
+      addObservation(tiled_olayer, x, y, MAX_Z, x, y);
+    }
+    serial.updateMap(0, 0, 0);
+    tiled.updateMap(0, 0, 0);
+
+    Costmap2D* a = serial.getCostmap();
+    Costmap2D* b = tiled.getCostmap();
+    for (unsigned int j = 0; j < 100; j++)
+      for (unsigned int i = 0; i < 100; i++)
+        ASSERT_EQ(a->getCost(i, j), b->getCost(i, j));
+  }
+}
+
+// Copies the lethal cells of a grid the test edits, inside the bounds it is given,
+// or in dirty tile mode inside the tiles of the cells it is told to mark
+class GridLayer : public Layer
+{
+public:
+  GridLayer(unsigned int size_x, unsigned int size_y) : size_x_(size_x), lethal_(size_x * size_y, false) {}
+
+  void toggle(unsigned int x, unsigned int y)
+  {
+    lethal_[y * size_x_ + x] = !lethal_[y * size_x_ + x];
+  }
+
+  bool isLethal(unsigned int x, unsigned int y) const
+  {
+    return lethal_[y * size_x_ + x];
+  }
+
+  void mark(unsigned int x, unsigned int y)
+  {
+    marked_.push_back(x);
+    marked_.push_back(y);
+  }
+
+  void setBounds(double min_x, double min_y, double max_x, double max_y)
+  {
+    min_x_ = min_x;
+    min_y_ = min_y;
+    max_x_ = max_x;
+    max_y_ = max_y;
+  }
+
+  virtual void updateBounds(double robot_x, double robot_y, double robot_yaw, double* min_x, double* min_y,
+                            double* max_x, double* max_y)
+  {
+    *min_x = std::min(*min_x, min_x_);
+    *min_y = std::min(*min_y, min_y_);
+    *max_x = std::max(*max_x, max_x_);
+    *max_y = std::max(*max_y, max_y_);
+  }
+
+  virtual void updateDirtyTiles(double robot_x, double robot_y, double robot_yaw, DirtyTiles& dirty)
+  {
+    if (marked_.empty())
+      Layer::updateDirtyTiles(robot_x, robot_y, robot_yaw, dirty);
+    for (unsigned int k = 0; k < marked_.size(); k += 2)
+      dirty.mark(marked_[k], marked_[k + 1], marked_[k] + 1, marked_[k + 1] + 1);
+    marked_.clear();
+  }
+
+  virtual void updateCosts(Costmap2D& master_grid, int min_i, int min_j, int max_i, int max_j)
+  {
+    for (int j = min_j; j < max_j; j++)
+      for (int i = min_i; i < max_i; i++)
+        master_grid.setCost(i, j, isLethal(i, j) ? LETHAL_OBSTACLE : FREE_SPACE);
+  }
+
+private:
+  unsigned int size_x_;
+  std::vector<bool> lethal_;
+  std::vector<int> marked_;
+  double min_x_, min_y_, max_x_, max_y_;
+};
+
+/**
+ * Test that incremental inflation keeps every cell at the cost of its
+ * nearest obstacle while obstacles come and go
+ */
+TEST(costmap, testIncrementalInflation){
+  tf::TransformListener tf;
+  LayeredCostmap layers("frame", false, false);
+  layers.resizeMap(60, 60, 1, 0, 0);
+  std::vector<Point> polygon = setRadii(layers, 2.1, 2.3, 6.1);
+
+  GridLayer* grid = new GridLayer(60, 60);
+  grid->initialize(&layers, "grid", &tf);
+  layers.addPlugin(boost::shared_ptr<Layer>(grid));
+
+  ros::NodeHandle nh;
+  nh.setParam("/inflation_tests/inflation/incremental", true);
+  InflationLayer* ilayer = addInflationLayer(layers, tf);
+  nh.setParam("/inflation_tests/inflation/incremental", false);
+  layers.setFootprint(polygon);
+
+  srand(2);
+  grid->setBounds(0, 0, 60, 60);
+  for (int round = 0; round < 20; round++)
+  {
+    // a burst of changes in a 10 x 10 box
+    int x0 = rand() % 50, y0 = rand() % 50;
+    for (int k = 0; k < 30; k++)
+      grid->toggle(x0 + rand() % 10, y0 + rand() % 10);
+    if (round > 0)
+      grid->setBounds(x0, y0, x0 + 10, y0 + 10);
+    layers.updateMap(0, 0, 0);
+
+    // cells within 7 cells of an obstacle are inflated (the radius rounded up)
+    Costmap2D* costmap = layers.getCostmap();
+    for (int j = 0; j < 60; j++)
+    {
+      for (int i = 0; i < 60; i++)
+      {
+        double nearest = 8;
+        for (int y = std::max(0, j - 7); y <= std::min(59, j + 7); y++)
+          for (int x = std::max(0, i - 7); x <= std::min(59, i + 7); x++)
+            if (grid->isLethal(x, y))
+              nearest = std::min(nearest, hypot(x - i, y - j));
+        unsigned char expected = nearest <= 7 ? ilayer->computeCost(nearest) : FREE_SPACE;
+        ASSERT_EQ(expected, costmap->getCost(i, j));
+      }
+    }
+  }
+}
+
+/**
+ * Test that incremental inflation over dirty tiles that make several boxes
+ * matches a full inflation, also where an obstacle in one box inflates
+ * cells of a box updated before it
+ */
+TEST(costmap, testIncrementalInflationOverBoxes){
+  tf::TransformListener tf;
+  ros::NodeHandle nh;
+  for (unsigned int threads = 1; threads <= 3; threads += 2)
+  {
+    LayeredCostmap layers("frame", false, false);
+    layers.resizeMap(60, 60, 1, 0, 0);
+    layers.setDirtyTileSize(10);
+    layers.setUpdateThreads(threads, 4);
+    std::vector<Point> polygon = setRadii(layers, 2.1, 2.3, 6.1);
+
+    GridLayer* grid = new GridLayer(60, 60);
+    grid->initialize(&layers, "grid", &tf);
+    layers.addPlugin(boost::shared_ptr<Layer>(grid));
+    nh.setParam("/inflation_tests/inflation/incremental", true);
+    addInflationLayer(layers, tf);
+    nh.setParam("/inflation_tests/inflation/incremental", false);
+    layers.setFootprint(polygon);
+
+    grid->setBounds(0, 0, 60, 60);
+    grid->toggle(5, 5);
+    grid->toggle(45, 15);
+    for (int round = 0; round < 6; round++)
+    {
+      // Changes at (15, 15) and next to (33, 30), grown by the inflation
+      // radius, cover the boxes [0, 30) x [0, 20), [0, 50) x [20, 30) and
+      // [20, 50) x [30, 40); the second one holds cells right next to the
+      // change in the third.
+      if (round > 0)
+      {
+        unsigned int x = round % 2 ? 33 : 35;
+        grid->toggle(15, 15);
+        grid->toggle(x, 30);
+        grid->mark(15, 15);
+        grid->mark(x, 30);
+      }
+      layers.updateMap(0, 0, 0);
+
+      // the first two updates cover the whole map
+      if (round > 1)
+      {
+        std::vector<int> boxes;
+        layers.getDirtyTiles().getBoxes(boxes);
+        ASSERT_EQ(12u, boxes.size());
+      }
+
+      LayeredCostmap full("frame", false, false);
+      full.resizeMap(60, 60, 1, 0, 0);
+      setRadii(full, 2.1, 2.3, 6.1);
+      GridLayer* full_grid = new GridLayer(60, 60);
+      for (unsigned int j = 0; j < 60; j++)
+        for (unsigned int i = 0; i < 60; i++)
+          if (grid->isLethal(i, j))
+            full_grid->toggle(i, j);
+      full_grid->setBounds(0, 0, 60, 60);
+      full_grid->initialize(&full, "grid", &tf);
+      full.addPlugin(boost::shared_ptr<Layer>(full_grid));
+      addInflationLayer(full, tf);
+      full.setFootprint(polygon);
+      full.updateMap(0, 0, 0);
+
+      Costmap2D* a = layers.getCostmap();
+      Costmap2D* b = full.getCostmap();
+      for (unsigned int j = 0; j < 60; j++)
+        for (unsigned int i = 0; i < 60; i++)
+          ASSERT_EQ(b->getCost(i, j), a->getCost(i, j)) << "cell " << i << ", " << j << " in round " << round
+                                                         << " on " << threads << " threads";
+    }
+  }
+}
+
 /**
  * Test inflation for both static and dynamic obstacles
  */
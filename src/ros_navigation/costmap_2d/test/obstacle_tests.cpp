@@ -245,6 +245,132 @@ TEST(costmap, testMultipleAdditions){
 }
 
 
+// Exposes the clearing of ObstacleLayer, next to the one ray per point it
+// used to trace
+class ClearingLayer : public ObstacleLayer
+{
+public:
+  void clear(const Observation& observation, double* min_x, double* min_y, double* max_x, double* max_y)
+  {
+    raytraceFreespace(observation, min_x, min_y, max_x, max_y);
+  }
+
+  void clearPointByPoint(const Observation& observation, double* min_x, double* min_y, double* max_x,
+                         double* max_y)
+  {
+    double ox = observation.origin_.x;
+    double oy = observation.origin_.y;
+    const pcl::PointCloud<pcl::PointXYZ>& cloud = *(observation.cloud_);
+    unsigned int x0, y0;
+    if (!worldToMap(ox, oy, x0, y0))
+      return;
+
+    double map_end_x = origin_x_ + size_x_ * resolution_;
+    double map_end_y = origin_y_ + size_y_ * resolution_;
+    touch(ox, oy, min_x, min_y, max_x, max_y);
+    for (unsigned int i = 0; i < cloud.points.size(); ++i)
+    {
+      double wx = cloud.points[i].x;
+      double wy = cloud.points[i].y;
+      double a = wx - ox;
+      double b = wy - oy;
+      if (wx < origin_x_)
+      {
+        double t = (origin_x_ - ox) / a;
+        wx = origin_x_;
+        wy = oy + b * t;
+      }
+      if (wy < origin_y_)
+      {
+        double t = (origin_y_ - oy) / b;
+        wx = ox + a * t;
+        wy = origin_y_;
+      }
+      if (wx > map_end_x)
+      {
+        double t = (map_end_x - ox) / a;
+        wx = map_end_x - .001;
+        wy = oy + b * t;
+      }
+      if (wy > map_end_y)
+      {
+        double t = (map_end_y - oy) / b;
+        wx = ox + a * t;
+        wy = map_end_y - .001;
+      }
+
+      unsigned int x1, y1;
+      if (!worldToMap(wx, wy, x1, y1))
+        continue;
+
+      MarkCell marker(costmap_, FREE_SPACE);
+      raytraceLine(marker, x0, y0, x1, y1, cellDistance(observation.raytrace_range_));
+      updateRaytraceBounds(ox, oy, wx, wy, observation.raytrace_range_, min_x, min_y, max_x, max_y);
+    }
+  }
+};
+
+/**
+ * Test that clearing one ray per end cell, on one thread or several, clears
+ * the same cells and reports the same bounds as one ray per point, with
+ * points off the map and beyond the raytrace range among them
+ */
+TEST(costmap, testClearingMatchesRayPerPoint){
+  tf::TransformListener tf;
+
+  // points all over a 14 x 14 m square around the 10 x 10 m map
+  srand(3);
+  pcl::PointCloud<pcl::PointXYZ> cloud;
+  cloud.points.resize(5000);
+  for (unsigned int i = 0; i < cloud.points.size(); ++i)
+  {
+    cloud.points[i].x = -2.0 + 14.0 * rand() / RAND_MAX;
+    cloud.points[i].y = -2.0 + 14.0 * rand() / RAND_MAX;
+    cloud.points[i].z = 0.5;
+  }
+  geometry_msgs::Point origin;
+  origin.x = 4.03;
+  origin.y = 5.51;
+  origin.z = MAX_Z;
+  Observation observation(origin, cloud, 100.0, 3.0);
+
+  for (unsigned int threads = 1; threads <= 4; threads += 3)
+  {
+    LayeredCostmap layers("frame", false, false);
+    layers.resizeMap(100, 100, 0.1, 0, 0);
+    layers.setUpdateThreads(threads, 16);
+
+    boost::shared_ptr<ClearingLayer> rays(new ClearingLayer());
+    boost::shared_ptr<ClearingLayer> points(new ClearingLayer());
+    rays->initialize(&layers, "obstacles", &tf);
+    points->initialize(&layers, "obstacles", &tf);
+    rays->matchSize();
+    points->matchSize();
+    for (unsigned int j = 0; j < 100; j++)
+    {
+      for (unsigned int i = 0; i < 100; i++)
+      {
+        rays->setCost(i, j, LETHAL_OBSTACLE);
+        points->setCost(i, j, LETHAL_OBSTACLE);
+      }
+    }
+
+    double a[4] = {1e30, 1e30, -1e30, -1e30};
+    double b[4] = {1e30, 1e30, -1e30, -1e30};
+    rays->clear(observation, &a[0], &a[1], &a[2], &a[3]);
+    points->clearPointByPoint(observation, &b[0], &b[1], &b[2], &b[3]);
+
+    EXPECT_GT(countValues(*points, FREE_SPACE), 1000u);
+    for (unsigned int j = 0; j < 100; j++)
+      for (unsigned int i = 0; i < 100; i++)
+        ASSERT_EQ(points->getCost(i, j), rays->getCost(i, j)) << "cell " << i << ", " << j << " on " << threads
+                                                               << " threads";
+    for (unsigned int k = 0; k < 4; k++)
+      EXPECT_EQ(b[k], a[k]) << "bound " << k << " on " << threads << " threads";
+  }
+}
+
+
 int main(int argc, char** argv){
   ros::init(argc, argv, "obstacle_tests");
   testing::InitGoogleTest(&argc, argv);
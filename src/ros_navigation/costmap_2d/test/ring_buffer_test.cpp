@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2013, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Checks a costmap kept as a ring buffer against one kept in row order, and
+// both against moving the cells by hand
+
+#include <gtest/gtest.h>
+#include <costmap_2d/costmap_2d.h>
+#include <costmap_2d/cost_values.h>
+#include <cstdlib>
+#include <vector>
+
+using namespace costmap_2d;
+
+// Exposes the raytracing
+class TracingCostmap : public Costmap2D
+{
+public:
+  TracingCostmap(unsigned int size_x, unsigned int size_y) : Costmap2D(size_x, size_y, 0.5, 0.0, 0.0, NO_INFORMATION) {}
+
+  void clearLine(unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, unsigned int max_length)
+  {
+    MarkCell marker(costmap_, FREE_SPACE);
+    raytraceLine(marker, x0, y0, x1, y1, max_length);
+  }
+};
+
+static std::vector<unsigned char> cells(const Costmap2D& costmap)
+{
+  std::vector<unsigned char> result;
+  for (unsigned int y = 0; y < costmap.getSizeInCellsY(); y++)
+    for (unsigned int x = 0; x < costmap.getSizeInCellsX(); x++)
+      result.push_back(costmap.getCost(x, y));
+  return result;
+}
+
+TEST(RingBuffer, matchesRowOrder)
+{
+  const int size_x = 37, size_y = 23;
+  TracingCostmap linear(size_x, size_y), ring(size_x, size_y);
+  ring.setToroidal(true);
+  ASSERT_TRUE(ring.isToroidal());
+
+  srand(3);
+  for (int step = 0; step < 300; step++)
+  {
+    // mostly small moves, now and then one past the map
+    int move_x = rand() % 7 - 3, move_y = rand() % 7 - 3;
+    if (step % 50 == 49)
+      move_x = size_x + 2;
+    std::vector<unsigned char> before = cells(linear);
+    double origin_x = linear.getOriginX() + move_x * 0.5;
+    double origin_y = linear.getOriginY() + move_y * 0.5;
+    linear.updateOrigin(origin_x, origin_y);
+    ring.updateOrigin(origin_x, origin_y);
+    EXPECT_DOUBLE_EQ(linear.getOriginX(), ring.getOriginX());
+    EXPECT_DOUBLE_EQ(linear.getOriginY(), ring.getOriginY());
+
+    // cells keep their place in the world, and the new ones are unknown
+    std::vector<unsigned char> after = cells(linear);
+    for (int y = 0; y < size_y; y++)
+    {
+      for (int x = 0; x < size_x; x++)
+      {
+        int old_x = x + move_x, old_y = y + move_y;
+        bool kept = old_x >= 0 && old_x < size_x && old_y >= 0 && old_y < size_y;
+        ASSERT_EQ(kept ? before[old_y * size_x + old_x] : NO_INFORMATION, after[y * size_x + x]);
+      }
+    }
+
+    // mark, clear and raytrace the same cells in both
+    for (int k = 0; k < 20; k++)
+    {
+      unsigned int x = rand() % size_x, y = rand() % size_y;
+      unsigned char cost = rand() % 256;
+      linear.setCost(x, y, cost);
+      ring.setCost(x, y, cost);
+    }
+    unsigned int x0 = rand() % size_x, y0 = rand() % size_y, x1 = rand() % size_x, y1 = rand() % size_y;
+    linear.clearLine(x0, y0, x1, y1, 15);
+    ring.clearLine(x0, y0, x1, y1, 15);
+    unsigned int xn = x0 + rand() % (size_x - x0 + 1), yn = y0 + rand() % (size_y - y0 + 1);
+    if (step % 3 == 0)
+    {
+      linear.resetMap(x0, y0, xn, yn);
+      ring.resetMap(x0, y0, xn, yn);
+    }
+
+    ASSERT_EQ(cells(linear), cells(ring));
+  }
+
+  // indices go both ways
+  for (unsigned int y = 0; y < size_y; y++)
+  {
+    for (unsigned int x = 0; x < size_x; x++)
+    {
+      unsigned int mx, my;
+      ring.indexToCells(ring.getIndex(x, y), mx, my);
+      EXPECT_EQ(x, mx);
+      EXPECT_EQ(y, my);
+    }
+  }
+
+  // and the cells are put back in row order
+  std::vector<unsigned char> expected = cells(ring);
+  ring.setToroidal(false);
+  EXPECT_EQ(expected, std::vector<unsigned char>(ring.getCharMap(), ring.getCharMap() + size_x * size_y));
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
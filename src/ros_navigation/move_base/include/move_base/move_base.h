@@ -245,6 +245,7 @@ namespace move_base {
       ros::Subscriber goal_sub_;        //订阅话题
       ros::ServiceServer make_plan_srv_, clear_costmaps_srv_; //定义两个服务
       bool shutdown_costmaps_, clearing_rotation_allowed_, recovery_behavior_enabled_;
+      bool lock_planner_costmap_;
       double oscillation_timeout_, oscillation_distance_; //震荡
 
 
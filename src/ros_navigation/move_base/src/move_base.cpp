@@ -85,6 +85,8 @@ namespace move_base {
     private_nh.param("planner_patience", planner_patience_, 5.0);
     private_nh.param("controller_patience", controller_patience_, 15.0);
     private_nh.param("max_planning_retries", max_planning_retries_, -1);  // disabled by default
+    // planners that plan on a costmap snapshot, like navfn, don't need the costmap held still
+    private_nh.param("lock_planner_costmap", lock_planner_costmap_, true);
 
     private_nh.param("oscillation_timeout", oscillation_timeout_, 0.0);
     private_nh.param("oscillation_distance", oscillation_distance_, 0.5);
@@ -529,8 +531,11 @@ namespace move_base {
 
     ROS_WARN("MoveBase::makePlan");
 
-    // lock costMap
-    boost::unique_lock<costmap_2d::Costmap2D::mutex_t> lock(*(planner_costmap_ros_->getCostmap()->getMutex())); 
+    // lock costMap, unless the planner only reads snapshots of it
+    boost::unique_lock<costmap_2d::Costmap2D::mutex_t> lock(*(planner_costmap_ros_->getCostmap()->getMutex()),
+                                                            boost::defer_lock);
+    if(lock_planner_costmap_)
+      lock.lock();
 
     //make sure to set the plan to be empty initially
     plan.clear();
@@ -40,6 +40,8 @@
 #include <ros/ros.h>
 #include <navfn/navfn.h> // Dijstar A*star class
 #include <costmap_2d/costmap_2d.h> //依赖的costmap
+#include <costmap_2d/costmap_2d_ros.h>
+#include <costmap_2d/costmap_snapshot.h>
 #include <geometry_msgs/PoseStamped.h>
 #include <geometry_msgs/Point.h>
 #include <nav_msgs/Path.h>
@@ -165,6 +167,7 @@ namespace navfn {
        * @brief Store a copy of the current costmap in \a costmap.  Called by makePlan.
        */
       costmap_2d::Costmap2D* costmap_;
+      costmap_2d::Costmap2DROS* costmap_ros_;  ///< NULL when planning straight on a costmap
       boost::shared_ptr<NavFn> planner_;
       ros::Publisher plan_pub_;
       pcl_ros::Publisher<PotarrPoint> potarr_pub_;
@@ -180,6 +183,17 @@ namespace navfn {
 
       void mapToWorld(double mx, double my, double& wx, double& wy);
       void clearRobotCell(const tf::Stamped<tf::Pose>& global_pose, unsigned int mx, unsigned int my);
+
+      /**
+       * @brief Bring the copy of the costmap planned on up to the latest snapshot of
+       * costmap_ros_, copying only the tiles that changed since the last one.
+       */
+      void updateCostmap();
+
+      costmap_2d::Costmap2D snapshot_costmap_;
+      costmap_2d::CostmapSnapshotPtr snapshot_;  ///< the snapshot snapshot_costmap_ is a copy of
+      bool robot_cell_cleared_;
+      unsigned int robot_cell_x_, robot_cell_y_;
       double planner_window_x_, planner_window_y_, default_tolerance_;
       std::string tf_prefix_;
       boost::mutex mutex_;
@@ -47,16 +47,19 @@ PLUGINLIB_EXPORT_CLASS(navfn::NavfnROS, nav_core::BaseGlobalPlanner)
 
 namespace navfn {
   NavfnROS::NavfnROS() 
-    : costmap_(NULL),  planner_(), initialized_(false), allow_unknown_(true) {}
+    : costmap_(NULL), costmap_ros_(NULL), planner_(), initialized_(false), allow_unknown_(true),
+      robot_cell_cleared_(false), robot_cell_x_(0), robot_cell_y_(0) {}
 
   NavfnROS::NavfnROS(std::string name, costmap_2d::Costmap2DROS* costmap_ros)
-    : costmap_(NULL),  planner_(), initialized_(false), allow_unknown_(true) {
+    : costmap_(NULL), costmap_ros_(NULL), planner_(), initialized_(false), allow_unknown_(true),
+      robot_cell_cleared_(false), robot_cell_x_(0), robot_cell_y_(0) {
       //initialize the planner
       initialize(name, costmap_ros);
   }
 
   NavfnROS::NavfnROS(std::string name, costmap_2d::Costmap2D* costmap, std::string global_frame)
-    : costmap_(NULL),  planner_(), initialized_(false), allow_unknown_(true) {
+    : costmap_(NULL), costmap_ros_(NULL), planner_(), initialized_(false), allow_unknown_(true),
+      robot_cell_cleared_(false), robot_cell_x_(0), robot_cell_y_(0) {
       //initialize the planner
       initialize(name, costmap, global_frame);
   }
@@ -95,7 +98,12 @@ namespace navfn {
   }
 
   void NavfnROS::initialize(std::string name, costmap_2d::Costmap2DROS* costmap_ros){
-    initialize(name, costmap_ros->getCostmap(), costmap_ros->getGlobalFrameID());
+    if(!initialized_){
+      //plan on copies of the costmap's snapshots, so that its updates never wait for a plan
+      costmap_ros_ = costmap_ros;
+      updateCostmap();
+    }
+    initialize(name, &snapshot_costmap_, costmap_ros->getGlobalFrameID());
   }
 
 
@@ -155,6 +163,8 @@ namespace navfn {
       return false;
     }
 
+    updateCostmap();
+
     //make sure to resize the underlying array that Navfn uses
     planner_->setNavArr(costmap_->getSizeInCellsX(), costmap_->getSizeInCellsY());
     planner_->setCostmap(costmap_->getCharMap(), true, allow_unknown_);
@@ -185,6 +195,36 @@ namespace navfn {
 
     //set the associated costs in the cost map to be free
     costmap_->setCost(mx, my, costmap_2d::FREE_SPACE);
+    robot_cell_cleared_ = true;
+    robot_cell_x_ = mx;
+    robot_cell_y_ = my;
+  }
+
+  void NavfnROS::updateCostmap(){
+    if(costmap_ros_ == NULL)
+      return;
+
+    costmap_2d::CostmapSnapshotPtr snapshot = costmap_ros_->getSnapshot();
+    if(!snapshot){
+      //the costmap has not been updated yet, copy it as it is
+      costmap_2d::Costmap2D* costmap = costmap_ros_->getCostmap();
+      boost::unique_lock<costmap_2d::Costmap2D::mutex_t> lock(*(costmap->getMutex()));
+      snapshot_costmap_ = *costmap;
+      snapshot_.reset();
+      robot_cell_cleared_ = false;
+      return;
+    }
+
+    //undo clearRobotCell(), so that the copy matches snapshot_ again
+    if(robot_cell_cleared_ && snapshot_)
+      snapshot_costmap_.setCost(robot_cell_x_, robot_cell_y_, snapshot_->getCost(robot_cell_x_, robot_cell_y_));
+    robot_cell_cleared_ = false;
+
+    if(snapshot_ && snapshot->getVersion() == snapshot_->getVersion())
+      return;
+
+    snapshot->copyTo(snapshot_costmap_, snapshot_.get());
+    snapshot_ = snapshot;
   }
 
   bool NavfnROS::makePlanService(nav_msgs::GetPlan::Request& req, nav_msgs::GetPlan::Response& resp){
@@ -236,6 +276,8 @@ namespace navfn {
       return false;
     }
     
+    updateCostmap();
+
     //start
     double wx = start.pose.position.x;
     double wy = start.pose.position.y;